@@ -0,0 +1,250 @@
+use std::hint::black_box;
+
+use criterion::{criterion_group, criterion_main, BatchSize, BenchmarkId, Criterion, Throughput};
+
+use lison::document::Document;
+use lison::hit::HitTester;
+use lison::image::*;
+use lison::lod::{render_lod, DEFAULT_DETAIL};
+use lison::render::render;
+use lison::scan::parse_image_parallel;
+use lison::strip::{strip_image, StrippedImage};
+
+const SIZE: f64 = 1000.0;
+const SCALES: [usize; 3] = [1, 10, 100];
+const THUMBNAIL: f64 = 128.0;
+
+fn point(x: f64, y: f64) -> Point {
+    Point { x, y }
+}
+
+fn color(i: usize) -> Color {
+    let t = (i % 17) as f64 / 16.0;
+    Color { red: t, green: 1.0 - t, blue: 0.5, alpha: 0.75 }
+}
+
+fn monochrome(i: usize) -> Pattern {
+    Pattern::Monochrome(MonochromePattern { color: color(i) })
+}
+
+fn empty_image() -> Image {
+    Image {
+        width: SIZE,
+        height: SIZE,
+        unit_per_inch: 72.0,
+        editor: Some(String::from("bench")),
+        pens: vec![Pen { pattern: monochrome(0), width: 2.0, cap: LineCap::Round, join: LineJoin::Round }],
+        brushes: vec![Brush { pattern: monochrome(1) }],
+        shapes: Vec::new()
+    }
+}
+
+// A closed polygon of `sides` lines inscribed in the circle (cx, cy, r).
+fn polygon(cx: f64, cy: f64, r: f64, sides: usize) -> CurveData {
+    let angle = |i: usize| i as f64 / sides as f64 * std::f64::consts::TAU;
+
+    CurveData::from_segments(point(cx + r, cy), (1..sides)
+        .map(|i| Segment::Line(LineSegment { point_2: point(cx + r * angle(i).cos(), cy + r * angle(i).sin()) })))
+}
+
+fn position(i: usize, count: usize) -> (f64, f64) {
+    let columns = (count as f64).sqrt().ceil() as usize;
+    let cell = SIZE / columns as f64;
+    ((i % columns) as f64 * cell + cell / 2.0, (i / columns) as f64 * cell + cell / 2.0)
+}
+
+// n regions, each with m concentric subpaths.
+fn regions(n: usize, m: usize) -> Image {
+    let mut image = empty_image();
+
+    image.shapes = (0..n)
+        .map(|i| {
+            let (x, y) = position(i, n);
+            let r = SIZE / (n as f64).sqrt() / 2.0;
+
+            Shape::Region(RegionShape {
+                pen: Some(0),
+                brush: Some(0),
+                data: (0..m).map(|j| polygon(x, y, r * (m - j) as f64 / m as f64, 12)).collect()
+            })
+        })
+        .collect();
+
+    image
+}
+
+// Groups nested depth levels deep, each annotated like an editor export.
+fn nested_groups(depth: usize, leaves: usize) -> Image {
+    let mut image = empty_image();
+
+    let mut shape = Shape::Group(GroupShape {
+        content: (0..leaves)
+            .map(|i| {
+                let (x, y) = position(i, leaves);
+                Shape::Curve(CurveShape { pen: 0, data: polygon(x, y, 5.0, 6) })
+            })
+            .collect(),
+        edit_annot: serde_json::Value::Null
+    });
+
+    for level in 0..depth {
+        shape = Shape::Group(GroupShape {
+            content: vec![shape],
+            edit_annot: serde_json::json!({ "name": format!("layer {}", level), "locked": false })
+        });
+    }
+
+    image.shapes = vec![shape];
+    image
+}
+
+// n regions, each filled with its own gradient brush.
+fn gradients(n: usize) -> Image {
+    let mut image = empty_image();
+
+    image.brushes = (0..n)
+        .map(|i| {
+            let (x, y) = position(i, n);
+            let pattern = if i % 2 == 0 {
+                Pattern::LinearGradient(LinearGradientPattern {
+                    point_1: point(x - 10.0, y),
+                    color_1: color(i),
+                    point_2: point(x + 10.0, y),
+                    color_2: color(i + 5)
+                })
+            } else {
+                Pattern::RadialGradient(RadialGradientPattern {
+                    center_1: point(x, y),
+                    radius_1: 0.0,
+                    color_1: color(i),
+                    center_2: point(x, y),
+                    radius_2: 10.0,
+                    color_2: color(i + 5)
+                })
+            };
+
+            Brush { pattern }
+        })
+        .collect();
+
+    image.shapes = (0..n)
+        .map(|i| {
+            let (x, y) = position(i, n);
+            Shape::Region(RegionShape { pen: None, brush: Some(i), data: vec![polygon(x, y, 10.0, 8)] })
+        })
+        .collect();
+
+    image
+}
+
+// One curve made of a long chain of quadratic segments.
+fn quadratic_chain(length: usize) -> Image {
+    let mut image = empty_image();
+
+    let rows = (length as f64).sqrt().ceil();
+    let step = SIZE / rows;
+
+    let segments = (0..length)
+        .map(|i| {
+            let x = (i as f64 % rows) * step;
+            let y = (i as f64 / rows).floor() * step;
+            Segment::QuadraticBezier(QuadraticBezierSegment {
+                point_2: point(x + step / 2.0, y + step),
+                point_3: point(x + step, y)
+            })
+        });
+
+    image.shapes = vec![Shape::Curve(CurveShape { pen: 0, data: CurveData::from_segments(point(0.0, 0.0), segments) })];
+    image
+}
+
+fn create_surface(image: &Image) -> cairo::ImageSurface {
+    let width = image.width.round() as i32;
+    let height = image.height.round() as i32;
+    cairo::ImageSurface::create(cairo::Format::ARgb32, width, height).unwrap()
+}
+
+fn bench_document(c: &mut Criterion, name: &str, generate: impl Fn(usize) -> Image) {
+    let mut group = c.benchmark_group(format!("documents/{}", name));
+    let threads = std::thread::available_parallelism().map_or(1, |threads| threads.get());
+
+    for scale in SCALES {
+        let image = generate(scale);
+        let bytes = serde_json::to_vec(&image).unwrap();
+
+        group.throughput(Throughput::Bytes(bytes.len() as u64));
+
+        group.bench_with_input(BenchmarkId::new("parse", scale), &bytes, |b, bytes| {
+            b.iter(|| serde_json::from_slice::<Image>(black_box(bytes)).unwrap())
+        });
+
+        group.bench_with_input(BenchmarkId::new("parse-parallel", scale), &bytes, |b, bytes| {
+            b.iter(|| parse_image_parallel(black_box(bytes), threads).unwrap())
+        });
+
+        group.bench_with_input(BenchmarkId::new("parse-document", scale), &bytes, |b, bytes| {
+            b.iter(|| serde_json::from_slice::<Document>(black_box(bytes)).unwrap())
+        });
+
+        let surface = create_surface(&image);
+        let context = cairo::Context::new(&surface).unwrap();
+
+        group.bench_with_input(BenchmarkId::new("render", scale), &image, |b, image| {
+            b.iter(|| render(&context, black_box(image), 72.0, 1.0).unwrap())
+        });
+
+        drop(context);
+
+        let thumbnail = cairo::ImageSurface::create(cairo::Format::ARgb32, THUMBNAIL as i32, THUMBNAIL as i32).unwrap();
+        let context = cairo::Context::new(&thumbnail).unwrap();
+        let ppi = 72.0 * THUMBNAIL / SIZE;
+
+        group.bench_with_input(BenchmarkId::new("thumbnail", scale), &image, |b, image| {
+            b.iter(|| render(&context, black_box(image), ppi, 1.0).unwrap())
+        });
+
+        group.bench_with_input(BenchmarkId::new("thumbnail-lod", scale), &image, |b, image| {
+            b.iter(|| render_lod(&context, black_box(image), ppi, 1.0, DEFAULT_DETAIL).unwrap())
+        });
+
+        drop(context);
+
+        group.bench_with_input(BenchmarkId::new("png", scale), &surface, |b, surface| {
+            b.iter(|| {
+                let mut png = Vec::new();
+                surface.write_to_png(&mut png).unwrap();
+                png
+            })
+        });
+
+        let tester = HitTester::new(&image);
+
+        group.bench_with_input(BenchmarkId::new("hit-test", scale), &tester, |b, tester| {
+            b.iter(|| tester.hit_test(black_box(Point { x: SIZE / 2.0, y: SIZE / 2.0 }), 1.0).map(<[usize]>::len))
+        });
+
+        group.bench_with_input(BenchmarkId::new("strip", scale), &image, |b, image| {
+            b.iter_batched(|| image.clone(), |mut image| {
+                strip_image(&mut image);
+                image
+            }, BatchSize::LargeInput)
+        });
+
+        group.bench_with_input(BenchmarkId::new("strip-serialize", scale), &image, |b, image| {
+            b.iter(|| serde_json::to_vec(&StrippedImage(black_box(image), None)).unwrap())
+        });
+    }
+
+    group.finish();
+}
+
+fn bench_documents(c: &mut Criterion) {
+    bench_document(c, "regions", |scale| regions(100 * scale, 4));
+    // Each group level costs two levels of serde_json's recursion limit.
+    bench_document(c, "nested-groups", |scale| nested_groups(50, 100 * scale));
+    bench_document(c, "gradients", |scale| gradients(100 * scale));
+    bench_document(c, "quadratic-chain", |scale| quadratic_chain(1000 * scale));
+}
+
+criterion_group!(benches, bench_documents);
+criterion_main!(benches);
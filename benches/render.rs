@@ -0,0 +1,183 @@
+use std::fs;
+use std::hint::black_box;
+
+use criterion::{criterion_group, criterion_main, BenchmarkId, Criterion, Throughput};
+
+use lison::image::*;
+use lison::plan::RenderPlan;
+use lison::render::render;
+
+const SAMPLES: [&str; 3] = ["curve", "pattern", "region"];
+const COPIES: [usize; 2] = [100, 1000];
+const PPI: f64 = 96.0;
+const SCALE: f64 = 4.0;
+
+fn load_sample(name: &str, copies: usize) -> Image {
+    let path = format!("{}/samples/{}.lison", env!("CARGO_MANIFEST_DIR"), name);
+    let image_str = fs::read_to_string(&path).unwrap();
+    let mut image: Image = serde_json::from_str(&image_str).unwrap();
+
+    let shapes = image.shapes.clone();
+    image.shapes = (0..copies).flat_map(|_| shapes.iter().cloned()).collect();
+    image
+}
+
+fn create_context(image: &Image) -> (cairo::ImageSurface, cairo::Context) {
+    let width = (image.width * PPI / image.unit_per_inch * SCALE).round() as i32;
+    let height = (image.height * PPI / image.unit_per_inch * SCALE).round() as i32;
+    let surface = cairo::ImageSurface::create(cairo::Format::ARgb32, width, height).unwrap();
+    let context = cairo::Context::new(&surface).unwrap();
+    (surface, context)
+}
+
+// The renderer as it was before the scale moved to the CTM: every
+// coordinate is multiplied on the way to Cairo and patterns are built per
+// shape. It is kept here only as the baseline for the comparison.
+mod per_coordinate {
+    use lison::image::*;
+    use cairo::{Context, Result};
+
+    pub fn render(context: &Context, image: &Image, ppi: f64, scale: f64) -> Result<()> {
+        let factor = ppi / image.unit_per_inch * scale;
+
+        context.set_operator(cairo::Operator::Over);
+        context.set_fill_rule(cairo::FillRule::EvenOdd);
+        context.new_path();
+
+        for shape in image.shapes.iter() {
+            render_shape(context, shape, image, factor)?;
+        }
+
+        Ok(())
+    }
+
+    fn render_shape(context: &Context, shape: &Shape, image: &Image, f: f64) -> Result<()> {
+        match shape {
+            Shape::Group(group) => {
+                for child in group.content.iter() {
+                    render_shape(context, child, image, f)?;
+                }
+                Ok(())
+            },
+            Shape::Curve(curve) => {
+                plot(context, &curve.data, f, false)?;
+                set_pen(context, &image.pens[curve.pen], f)?;
+                context.stroke()
+            },
+            Shape::Region(region) => {
+                for data in region.data.iter() {
+                    context.new_sub_path();
+                    plot(context, data, f, true)?;
+                }
+
+                if let Some(brush) = region.brush {
+                    set_pattern(context, &image.brushes[brush].pattern, f)?;
+                    context.fill_preserve()?;
+                }
+
+                if let Some(pen) = region.pen {
+                    set_pen(context, &image.pens[pen], f)?;
+                    context.stroke()
+                } else {
+                    context.new_path();
+                    Ok(())
+                }
+            }
+        }
+    }
+
+    fn set_pattern(context: &Context, pattern: &Pattern, f: f64) -> Result<()> {
+        match pattern {
+            Pattern::Monochrome(pat) => {
+                context.set_source_rgba(pat.color.red, pat.color.green, pat.color.blue, pat.color.alpha);
+                Ok(())
+            },
+            Pattern::LinearGradient(pat) => {
+                let grad = cairo::LinearGradient::new(
+                    pat.point_1.x * f, pat.point_1.y * f, pat.point_2.x * f, pat.point_2.y * f
+                );
+                grad.add_color_stop_rgba(0.0, pat.color_1.red, pat.color_1.green, pat.color_1.blue, pat.color_1.alpha);
+                grad.add_color_stop_rgba(1.0, pat.color_2.red, pat.color_2.green, pat.color_2.blue, pat.color_2.alpha);
+                context.set_source(grad)
+            },
+            Pattern::RadialGradient(pat) => {
+                let grad = cairo::RadialGradient::new(
+                    pat.center_1.x * f, pat.center_1.y * f, pat.radius_1 * f,
+                    pat.center_2.x * f, pat.center_2.y * f, pat.radius_2 * f
+                );
+                grad.add_color_stop_rgba(0.0, pat.color_1.red, pat.color_1.green, pat.color_1.blue, pat.color_1.alpha);
+                grad.add_color_stop_rgba(1.0, pat.color_2.red, pat.color_2.green, pat.color_2.blue, pat.color_2.alpha);
+                context.set_source(grad)
+            }
+        }
+    }
+
+    fn set_pen(context: &Context, pen: &Pen, f: f64) -> Result<()> {
+        set_pattern(context, &pen.pattern, f)?;
+        context.set_line_width(pen.width * f);
+        Ok(())
+    }
+
+    fn plot(context: &Context, data: &CurveData, f: f64, closed: bool) -> Result<()> {
+        let start = data.start();
+        context.move_to(start.x * f, start.y * f);
+
+        for seg in data.segments() {
+            match seg {
+                Segment::Line(line) => context.line_to(line.point_2.x * f, line.point_2.y * f),
+                Segment::QuadraticBezier(bezier) => {
+                    let (x1, y1) = context.current_point()?;
+                    let (x2, y2) = (bezier.point_2.x * f, bezier.point_2.y * f);
+                    let (x3, y3) = (bezier.point_3.x * f, bezier.point_3.y * f);
+                    context.curve_to(
+                        1.0 / 3.0 * x1 + 2.0 / 3.0 * x2, 1.0 / 3.0 * y1 + 2.0 / 3.0 * y2,
+                        1.0 / 3.0 * x3 + 2.0 / 3.0 * x2, 1.0 / 3.0 * y3 + 2.0 / 3.0 * y2,
+                        x3, y3
+                    );
+                },
+                Segment::CubicBezier(bezier) => context.curve_to(
+                    bezier.point_2.x * f, bezier.point_2.y * f,
+                    bezier.point_3.x * f, bezier.point_3.y * f,
+                    bezier.point_4.x * f, bezier.point_4.y * f
+                )
+            }
+        }
+
+        if closed {
+            context.close_path();
+        }
+
+        Ok(())
+    }
+}
+
+fn bench_scaling(c: &mut Criterion) {
+    for name in SAMPLES {
+        let mut group = c.benchmark_group(format!("scaling/{}", name));
+
+        for copies in COPIES {
+            let image = load_sample(name, copies);
+            let plan = RenderPlan::new(&image).unwrap();
+            let (_surface, context) = create_context(&image);
+
+            group.throughput(Throughput::Elements(image.shapes.len() as u64));
+
+            group.bench_with_input(BenchmarkId::new("per-coordinate", copies), &image, |b, image| {
+                b.iter(|| per_coordinate::render(&context, black_box(image), PPI, SCALE).unwrap())
+            });
+
+            group.bench_with_input(BenchmarkId::new("ctm", copies), &image, |b, image| {
+                b.iter(|| render(&context, black_box(image), PPI, SCALE).unwrap())
+            });
+
+            group.bench_with_input(BenchmarkId::new("plan", copies), &plan, |b, plan| {
+                b.iter(|| black_box(plan).replay(&context, PPI, SCALE).unwrap())
+            });
+        }
+
+        group.finish();
+    }
+}
+
+criterion_group!(benches, bench_scaling);
+criterion_main!(benches);
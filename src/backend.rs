@@ -0,0 +1,129 @@
+use std::slice;
+
+use crate::image::*;
+use crate::render::*;
+
+use cairo::Context;
+
+// What render_to needs from a drawing target. Coordinates are in image
+// units; begin gives the factor taking them to output pixels. Indices have
+// not been checked against the resource lists.
+pub trait Backend {
+    type Error;
+
+    fn begin(&mut self, image: &Image, factor: f64) -> Result<(), Self::Error>;
+    fn fill(&mut self, data: &[CurveData], brush: usize) -> Result<(), Self::Error>;
+    fn stroke(&mut self, data: &[CurveData], closed: bool, pen: usize) -> Result<(), Self::Error>;
+    fn end(&mut self) -> Result<(), Self::Error>;
+}
+
+pub fn render_to<B: Backend>(backend: &mut B, image: &Image, ppi: f64, scale: f64) -> Result<(), B::Error> {
+    let scaler = Scaler::new(image.unit_per_inch, ppi, scale);
+    backend.begin(image, scaler.factor())?;
+
+    for shape in image.leaves() {
+        match shape {
+            Shape::Group(_) => {},
+            Shape::Curve(curve) => {
+                backend.stroke(slice::from_ref(&curve.data), false, curve.pen)?;
+            },
+            Shape::Region(region) => {
+                if let Some(brush) = region.brush {
+                    backend.fill(&region.data, brush)?;
+                }
+
+                if let Some(pen) = region.pen {
+                    backend.stroke(&region.data, true, pen)?;
+                }
+            }
+        }
+    }
+
+    backend.end()
+}
+
+pub struct CairoBackend<'a> {
+    context: &'a Context,
+    resources: Option<Resources>
+}
+
+impl CairoBackend<'_> {
+    pub fn new(context: &Context) -> CairoBackend<'_> {
+        CairoBackend { context, resources: None }
+    }
+
+    fn plot(&self, data: &[CurveData], closed: bool) {
+        for (i, data) in data.iter().enumerate() {
+            if i != 0 {
+                self.context.new_sub_path();
+            }
+
+            plot_curve_data(self.context, data, closed);
+        }
+    }
+}
+
+impl Backend for CairoBackend<'_> {
+    type Error = cairo::Error;
+
+    fn begin(&mut self, image: &Image, factor: f64) -> cairo::Result<()> {
+        self.resources = Some(Resources::new(image));
+        Scaler::from_factor(factor).begin(self.context)
+    }
+
+    fn fill(&mut self, data: &[CurveData], brush: usize) -> cairo::Result<()> {
+        let Some(resources) = &self.resources else {
+            return Ok(());
+        };
+
+        self.plot(data, true);
+        resources.set_brush(self.context, brush)?;
+        self.context.fill()
+    }
+
+    fn stroke(&mut self, data: &[CurveData], closed: bool, pen: usize) -> cairo::Result<()> {
+        let Some(resources) = &self.resources else {
+            return Ok(());
+        };
+
+        self.plot(data, closed);
+        resources.set_pen(self.context, pen)?;
+        self.context.stroke()
+    }
+
+    fn end(&mut self) -> cairo::Result<()> {
+        self.resources = None;
+        self.context.restore()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn render_sample(name: &str, draw: impl FnOnce(&Context, &Image)) -> Vec<u8> {
+        let path = format!("{}/samples/{}.lison", env!("CARGO_MANIFEST_DIR"), name);
+        let image = crate::load::load_image(path).unwrap();
+
+        let mut surface = cairo::ImageSurface::create(cairo::Format::ARgb32, 200, 200).unwrap();
+        {
+            let context = Context::new(&surface).unwrap();
+            draw(&context, &image);
+        }
+        surface.flush();
+
+        let data = surface.data().unwrap();
+        data.to_vec()
+    }
+
+    #[test]
+    fn test_cairo_backend() {
+        for name in ["curve", "pattern", "region"] {
+            let expected = render_sample(name, |context, image| render(context, image, 144.0, 1.0).unwrap());
+            let actual = render_sample(name, |context, image| {
+                render_to(&mut CairoBackend::new(context), image, 144.0, 1.0).unwrap()
+            });
+            assert_eq!(expected, actual);
+        }
+    }
+}
@@ -0,0 +1,119 @@
+
+use std::env;
+use std::fs;
+use std::io::{BufWriter, Write};
+
+use lison::binary::*;
+use lison::load::*;
+
+struct PackConfig {
+    input: String,
+    output: String,
+    precision: Precision,
+    unpack: bool
+}
+
+enum Config {
+    Help,
+    Pack(PackConfig)
+}
+
+fn parse_args(mut args: &[String]) -> Result<Config, String> {
+    let mut output = String::new();
+    let mut precision = Precision::Double;
+    let mut unpack = false;
+
+    while !args.is_empty() {
+        let arg = &args[0];
+
+        match arg.as_str() {
+            "-h" | "--help" => {
+                return Ok(Config::Help);
+            },
+            "-o" => {
+                if args.len() == 1 {
+                    return Err(String::from("missing operand after '-o'."));
+                }
+
+                output = args[1].clone();
+                args = &args[2..];
+            },
+            "-f" => {
+                precision = Precision::Single;
+                args = &args[1..];
+            },
+            "-u" => {
+                unpack = true;
+                args = &args[1..];
+            },
+            option if option.starts_with("-") => {
+                return Err(format!("unknown option '{}'.", option));
+            },
+            _ => {
+                break;
+            }
+        }
+    }
+
+    if args.is_empty() {
+        return Err(String::from("missing operand."));
+    } else if args.len() > 1 {
+        return Err(String::from("too many operands."));
+    }
+
+    let input = args[0].clone();
+
+    if output.is_empty() {
+        output = if !unpack {
+            format!("{}.lisb", &input)
+        } else if let Some(stem) = input.strip_suffix(".lisb") {
+            String::from(stem)
+        } else {
+            format!("{}.lison", &input)
+        };
+    }
+
+    Ok(Config::Pack(PackConfig { input, output, precision, unpack }))
+}
+
+const HELP_MESSAGE: &str = r#"usage: lison-pack [-h] [-f] [-u] [-o output] input
+options:
+  -h        : print help message.
+  -f        : store coordinates as 32-bit floats.
+  -u        : convert a binary file back to JSON.
+  -o <file> : output file name."#;
+
+fn main() -> Result<(), String> {
+    let args: Vec<String> = env::args().collect();
+    let conf = parse_args(&args[1..])?;
+
+    match conf {
+        Config::Help => {
+            eprintln!("{}", HELP_MESSAGE);
+        },
+        Config::Pack(conf) => {
+            let image = load_image(&conf.input)
+                .map_err(|err| match err {
+                    LoadError::Io(_) => format!("failed to read '{}'.", &conf.input),
+                    LoadError::Parse(_) | LoadError::Binary(_) => format!("failed to parse '{}'.", &conf.input),
+                    LoadError::Invalid(err) => format!("invalid '{}': {}", &conf.input, err)
+                })?;
+
+            let output_file = fs::File::create(&conf.output)
+                .or_else(|_| Err(format!("failed to create '{}'.", &conf.output)))?;
+
+            let mut writer = BufWriter::new(output_file);
+
+            let result = if conf.unpack {
+                serde_json::to_writer(&mut writer, &image).map_err(|err| err.into())
+            } else {
+                write_image(&mut writer, &image, conf.precision)
+            };
+
+            result.and_then(|_| writer.flush())
+                .or_else(|_| Err(format!("failed to write to '{}'.", &conf.output)))?;
+        }
+    }
+
+    Ok(())
+}
@@ -0,0 +1,215 @@
+use std::env;
+use std::fs;
+use std::io::{self, BufWriter};
+use std::thread;
+
+use lison::index::*;
+use lison::load::*;
+use lison::png::*;
+use lison::pyramid::*;
+
+struct PyramidConfig {
+    input: String,
+    output: String,
+    resolution: f64,
+    scale: f64,
+    threads: Option<usize>,
+    levels: Option<usize>,
+    tar: bool,
+    png: PngOptions
+}
+
+enum Config {
+    Help,
+    Build(PyramidConfig)
+}
+
+fn parse_args(mut args: &[String]) -> Result<Config, String> {
+    let mut output = String::new();
+    let mut resolution = 96.0;
+    let mut scale = 1.0;
+    let mut threads = None;
+    let mut levels = None;
+    let mut tar = false;
+    let mut png = PngOptions::default();
+
+    while !args.is_empty() {
+        let arg = &args[0];
+
+        match arg.as_str() {
+            "-h" | "--help" => {
+                return Ok(Config::Help);
+            },
+            "-o" => {
+                if args.len() == 1 {
+                    return Err(String::from("missing operand after '-o'."));
+                }
+
+                output = args[1].clone();
+                args = &args[2..];
+            },
+            "-r" => {
+                if args.len() == 1 {
+                    return Err(String::from("missing operand after '-r'."));
+                }
+
+                resolution = args[1]
+                    .parse()
+                    .or_else(|_| Err(String::from("invalid resolution value.")))?;
+                args = &args[2..];
+            },
+            "-s" => {
+                if args.len() == 1 {
+                    return Err(String::from("missing operand after '-s'."));
+                }
+
+                scale = args[1]
+                    .parse()
+                    .or_else(|_| Err(String::from("invalid scale value.")))?;
+                args = &args[2..];
+            },
+            "-j" => {
+                if args.len() == 1 {
+                    return Err(String::from("missing operand after '-j'."));
+                }
+
+                threads = Some(args[1]
+                    .parse()
+                    .ok()
+                    .filter(|&threads| threads > 0)
+                    .ok_or_else(|| String::from("invalid thread count."))?);
+                args = &args[2..];
+            },
+            "-z" => {
+                if args.len() == 1 {
+                    return Err(String::from("missing operand after '-z'."));
+                }
+
+                levels = Some(args[1]
+                    .parse()
+                    .ok()
+                    .filter(|&levels| levels > 0)
+                    .ok_or_else(|| String::from("invalid level count."))?);
+                args = &args[2..];
+            },
+            "--tar" => {
+                tar = true;
+                args = &args[1..];
+            },
+            "--level" => {
+                if args.len() == 1 {
+                    return Err(String::from("missing operand after '--level'."));
+                }
+
+                png.level = args[1]
+                    .parse()
+                    .ok()
+                    .filter(|&level| level <= 9)
+                    .ok_or_else(|| String::from("invalid compression level."))?;
+                args = &args[2..];
+            },
+            option if option.starts_with("-") => {
+                return Err(format!("unknown option '{}'.", option));
+            },
+            _ => {
+                break;
+            }
+        }
+    }
+
+    if args.is_empty() {
+        return Err(String::from("missing operand."));
+    } else if args.len() > 1 {
+        return Err(String::from("too many operands."));
+    }
+
+    if output == "-" && !tar {
+        return Err(String::from("'-o -' can only be used with '--tar'."));
+    }
+
+    let input = args[0].clone();
+
+    if output.is_empty() {
+        output = if tar { format!("{}-tiles.tar", input) } else { format!("{}-tiles", input) };
+    }
+
+    // Every tile is encoded on its own thread already.
+    png.threads = 1;
+
+    Ok(Config::Build(PyramidConfig { input, output, resolution, scale, threads, levels, tar, png }))
+}
+
+const HELP_MESSAGE: &str = r#"usage: lison-pyramid [-h] [-o output] [-r resolution] [-s scale] [-j threads] [-z levels] [--tar] [--level num] input
+options:
+  -h            : print help message.
+  -o <path>     : output directory, or archive with '--tar' ('-' for stdout).
+  -r <num>      : resolution of the deepest level in ppi.
+  -s <num>      : scale ratio of the deepest level.
+  -j <num>      : render on this many threads.
+  -z <num>      : keep only this many of the deepest levels.
+  --tar         : write a single tar archive instead of a directory.
+  --level <num> : png compression level from 0 to 9, 6 by default.
+tiles are 256 pixels square and written to '<level>/<column>_<row>.png',
+where level 0 fits in one tile and each level doubles the size of the one
+before. tiles with nothing drawn on them are not written."#;
+
+fn main() -> Result<(), String> {
+    let args: Vec<String> = env::args().collect();
+    let conf = parse_args(&args[1..])?;
+
+    match conf {
+        Config::Help => {
+            eprintln!("{}", HELP_MESSAGE);
+        },
+        Config::Build(conf) => {
+            let image = load_valid_image(&conf.input)
+                .map_err(|err| match err {
+                    LoadError::Io(_) => format!("failed to read '{}'.", &conf.input),
+                    LoadError::Parse(_) | LoadError::Binary(_) => format!("failed to parse '{}'.", &conf.input),
+                    LoadError::Invalid(err) => format!("invalid '{}': {}", &conf.input, err)
+                })?;
+
+            let mut levels = pyramid_levels(&image, conf.resolution, conf.scale, TILE_SIZE)
+                .ok_or_else(|| String::from("invalid image size."))?;
+
+            if let Some(count) = conf.levels {
+                levels.drain(..levels.len().saturating_sub(count));
+            }
+
+            let threads = conf.threads
+                .or_else(|| thread::available_parallelism().ok().map(|threads| threads.get()))
+                .unwrap_or(1);
+
+            let destination = match conf.output.as_str() {
+                "-" => String::from("stdout"),
+                output => format!("'{}'", output)
+            };
+
+            let index = SpatialIndex::new(&image);
+            let build = |sink: &mut dyn TileSink| build_pyramid(&image, &index, &levels, conf.resolution, TILE_SIZE, threads, &conf.png, sink)
+                .or_else(|err| Err(match err {
+                    PyramidError::Tile(_) => String::from("rendering operation failed."),
+                    PyramidError::Io(_) => format!("failed to write to {}.", destination)
+                }));
+
+            if !conf.tar {
+                build(&mut DirectorySink::new(&conf.output))?;
+            } else if conf.output == "-" {
+                let mut sink = TarSink::new(BufWriter::new(io::stdout().lock()));
+                build(&mut sink)?;
+                sink.finish()
+                    .or_else(|_| Err(String::from("failed to write to stdout.")))?;
+            } else {
+                let output_file = fs::File::create(&conf.output)
+                    .or_else(|_| Err(format!("failed to create '{}'.", &conf.output)))?;
+
+                let mut sink = TarSink::new(BufWriter::new(output_file));
+                build(&mut sink)?;
+                sink.finish()
+                    .or_else(|_| Err(format!("failed to write to '{}'.", &conf.output)))?;
+            }
+        }
+    }
+
+    Ok(())
+}
@@ -0,0 +1,305 @@
+use std::collections::HashMap;
+use std::env;
+use std::fs;
+use std::io::{self, BufRead, Write};
+#[cfg(unix)]
+use std::os::unix::fs::FileTypeExt;
+#[cfg(unix)]
+use std::os::unix::net::{UnixListener, UnixStream};
+use std::path::{Path, PathBuf};
+use std::sync::{mpsc, Arc, Mutex, OnceLock};
+use std::thread;
+use std::time::SystemTime;
+
+use lison::service::*;
+
+struct ServerConfig {
+    threads: Option<usize>,
+    documents: usize,
+    socket: Option<String>
+}
+
+enum Config {
+    Help,
+    Serve(ServerConfig)
+}
+
+const DEFAULT_DOCUMENTS: usize = 64;
+const QUEUED_PER_THREAD: usize = 4;
+
+fn parse_args(mut args: &[String]) -> Result<Config, String> {
+    let mut threads = None;
+    let mut documents = DEFAULT_DOCUMENTS;
+    let mut socket = None;
+
+    while !args.is_empty() {
+        let arg = &args[0];
+
+        match arg.as_str() {
+            "-h" | "--help" => {
+                return Ok(Config::Help);
+            },
+            "-j" => {
+                if args.len() == 1 {
+                    return Err(String::from("missing operand after '-j'."));
+                }
+
+                threads = Some(args[1]
+                    .parse()
+                    .ok()
+                    .filter(|&threads| threads > 0)
+                    .ok_or_else(|| String::from("invalid thread count."))?);
+                args = &args[2..];
+            },
+            "-n" => {
+                if args.len() == 1 {
+                    return Err(String::from("missing operand after '-n'."));
+                }
+
+                documents = args[1]
+                    .parse()
+                    .or_else(|_| Err(String::from("invalid document count.")))?;
+                args = &args[2..];
+            },
+            "--socket" => {
+                if args.len() == 1 {
+                    return Err(String::from("missing operand after '--socket'."));
+                }
+
+                socket = Some(args[1].clone());
+                args = &args[2..];
+            },
+            option if option.starts_with("-") => {
+                return Err(format!("unknown option '{}'.", option));
+            },
+            operand => {
+                return Err(format!("unexpected operand '{}'.", operand));
+            }
+        }
+    }
+
+    Ok(Config::Serve(ServerConfig { threads, documents, socket }))
+}
+
+const HELP_MESSAGE: &str = r#"usage: lison-server [-h] [-j threads] [-n documents] [--socket path]
+options:
+  -h              : print help message.
+  -j <num>        : render on this many threads.
+  -n <num>        : keep this many parsed documents, 64 by default.
+  --socket <path> : serve a Unix socket instead of stdin and stdout.
+each request is a line of JSON, at most 65536 bytes long, such as
+  {"id": 1, "path": "a.lison", "ppi": 96, "scale": 1, "viewport": [0, 0, 256, 256]}
+where the viewport is x, y, width and height in output pixels. each reply is
+a line 'ok <id> <length>' followed by that many bytes of PNG, or a line
+'error <id> <message>'. replies may come in any order."#;
+
+type Output = Arc<Mutex<dyn Write + Send>>;
+
+struct Task {
+    line: String,
+    output: Output
+}
+
+// Waiters share the outcome of one load, errors included.
+type Loaded = Result<Arc<Prepared>, Arc<ServiceError>>;
+
+struct Load {
+    modified: SystemTime,
+    length: u64,
+    result: Arc<OnceLock<Loaded>>
+}
+
+struct Server {
+    cache: Mutex<DocumentCache>,
+    loading: Mutex<HashMap<PathBuf, Load>>
+}
+
+impl Server {
+    // Files are parsed outside the cache lock. Requests missing the cache
+    // while a file is being parsed wait for that parse rather than start
+    // their own, so a slow parse holds up only the requests for its file.
+    fn prepare(&self, path: &Path) -> Loaded {
+        let (modified, length) = file_stamp(path).map_err(Arc::new)?;
+
+        // The cache is looked up under the loading lock, and a finished load
+        // is cached before it stops being in flight, so every request either
+        // finds the document or joins its load.
+        let flight = {
+            let mut loading = self.loading.lock().unwrap();
+
+            if let Some(prepared) = self.cache.lock().unwrap().get(path, modified, length) {
+                return Ok(prepared);
+            }
+
+            match loading.get(path) {
+                Some(load) if load.modified == modified && load.length == length => load.result.clone(),
+                _ => {
+                    let result = Arc::new(OnceLock::new());
+                    loading.insert(path.to_path_buf(), Load { modified, length, result: result.clone() });
+                    result
+                }
+            }
+        };
+
+        flight.get_or_init(|| {
+            let result = Prepared::load(path).map(Arc::new).map_err(Arc::new);
+
+            if let Ok(prepared) = &result {
+                self.cache.lock().unwrap().insert(path.to_path_buf(), modified, length, prepared.clone());
+            }
+
+            let mut loading = self.loading.lock().unwrap();
+
+            if loading.get(path).is_some_and(|load| Arc::ptr_eq(&load.result, &flight)) {
+                loading.remove(path);
+            }
+
+            result
+        }).clone()
+    }
+
+    fn handle(&self, line: &str) -> (u64, Result<Vec<u8>, Arc<ServiceError>>) {
+        match Request::parse(line) {
+            Ok(request) => (request.id, self.prepare(&request.path)
+                .and_then(|prepared| prepared.render_png(&request).map_err(Arc::new))),
+            Err(err) => (0, Err(Arc::new(err)))
+        }
+    }
+}
+
+fn reply(output: &Output, id: u64, result: Result<Vec<u8>, Arc<ServiceError>>) -> io::Result<()> {
+    let mut output = output.lock().unwrap();
+
+    match result {
+        Ok(png) => {
+            writeln!(output, "ok {} {}", id, png.len())?;
+            output.write_all(&png)?;
+        },
+        Err(err) => {
+            let message = err.to_string().replace('\n', " ");
+            writeln!(output, "error {} {}", id, message)?;
+        }
+    }
+
+    output.flush()
+}
+
+fn work(server: &Server, tasks: &Mutex<mpsc::Receiver<Task>>) {
+    loop {
+        let Ok(task) = tasks.lock().unwrap().recv() else {
+            break;
+        };
+
+        let (id, result) = server.handle(&task.line);
+
+        // A client that went away takes its replies with it.
+        let _ = reply(&task.output, id, result);
+    }
+}
+
+fn read_requests(mut input: impl BufRead, output: Output, tasks: &mpsc::SyncSender<Task>) {
+    while let Ok(Some(line)) = read_request(&mut input) {
+        let line = match line {
+            Ok(line) => line,
+            Err(err) => {
+                let _ = reply(&output, 0, Err(Arc::new(err)));
+                continue;
+            }
+        };
+
+        if line.trim().is_empty() {
+            continue;
+        }
+
+        if tasks.send(Task { line, output: output.clone() }).is_err() {
+            break;
+        }
+    }
+}
+
+// A socket file nobody accepts on is left over from a run that did not
+// shut down, and would make bind fail.
+#[cfg(unix)]
+fn remove_stale_socket(path: &str) {
+    let is_socket = fs::symlink_metadata(path).is_ok_and(|metadata| metadata.file_type().is_socket());
+
+    if is_socket && UnixStream::connect(path).is_err() {
+        let _ = fs::remove_file(path);
+    }
+}
+
+#[cfg(unix)]
+fn listen(path: &str, tasks: mpsc::SyncSender<Task>) -> Result<(), String> {
+    remove_stale_socket(path);
+
+    let listener = UnixListener::bind(path)
+        .or_else(|_| Err(format!("failed to listen on '{}'.", path)))?;
+
+    for stream in listener.incoming() {
+        let Ok(stream) = stream else {
+            continue;
+        };
+
+        let Ok(writer) = stream.try_clone() else {
+            continue;
+        };
+
+        let output: Output = Arc::new(Mutex::new(io::BufWriter::new(writer)));
+        let tasks = tasks.clone();
+
+        thread::spawn(move || read_requests(io::BufReader::new(stream), output, &tasks));
+    }
+
+    Ok(())
+}
+
+#[cfg(not(unix))]
+fn listen(_path: &str, _tasks: mpsc::SyncSender<Task>) -> Result<(), String> {
+    Err(String::from("'--socket' needs Unix domain sockets."))
+}
+
+fn serve(conf: &ServerConfig) -> Result<(), String> {
+    let threads = conf.threads
+        .or_else(|| thread::available_parallelism().ok().map(|threads| threads.get()))
+        .unwrap_or(1);
+
+    let server = Server { cache: Mutex::new(DocumentCache::new(conf.documents)), loading: Mutex::new(HashMap::new()) };
+    // Readers block once every worker has a few requests waiting, so a
+    // client cannot queue work faster than it is done.
+    let (sender, receiver) = mpsc::sync_channel(threads * QUEUED_PER_THREAD);
+    let receiver = Mutex::new(receiver);
+
+    thread::scope(|scope| {
+        for _ in 0..threads {
+            scope.spawn(|| work(&server, &receiver));
+        }
+
+        match &conf.socket {
+            Some(path) => listen(path, sender),
+            None => {
+                let output: Output = Arc::new(Mutex::new(io::stdout()));
+                read_requests(io::stdin().lock(), output, &sender);
+
+                // Closing the queue lets the workers finish what is left.
+                drop(sender);
+                Ok(())
+            }
+        }
+    })
+}
+
+fn main() -> Result<(), String> {
+    let args: Vec<String> = env::args().collect();
+    let conf = parse_args(&args[1..])?;
+
+    match conf {
+        Config::Help => {
+            eprintln!("{}", HELP_MESSAGE);
+        },
+        Config::Serve(conf) => {
+            serve(&conf)?;
+        }
+    }
+
+    Ok(())
+}
@@ -1,12 +1,16 @@
 
 use std::env;
 use std::fs;
+use std::io::{BufWriter, Write};
 
-use lison::image::*;
+use lison::format::*;
+use lison::load::*;
+use lison::strip::*;
 
 struct StripConfig {
     input: String,
-    output: String
+    output: String,
+    precision: Option<u32>
 }
 
 enum Config {
@@ -14,54 +18,67 @@ enum Config {
     Strip(StripConfig)
 }
 
-fn parse_args(args: &[String]) -> Result<Config, String> {
-    if args.iter().any(|arg| arg == "-h" || arg == "--help") {
-        return Ok(Config::Help);
-    }
-
-    if args.len() == 1 {
-        let input = args[0].clone();
-        let output = format!("stripped-{}", input);
-        Ok(Config::Strip(StripConfig { input, output }))
-    } else if args.len() == 3 && args[0] == "-o" {
-        let input = args[2].clone();
-        let output = args[1].clone();
-        Ok(Config::Strip(StripConfig { input, output }))
-    } else {
-        Err(String::from("invalid arguments."))
-    }
-}
-
-const HELP_MESSAGE: &str = r#"usage: lison-strip [-h] [-o output] input
-options:
-  -h        : print help message.
-  -o <file> : output file name."#;
-
-fn flatten_shape(shapes: &mut Vec<Shape>, shape: &Shape) {
-    match shape {
-        Shape::Group(group) => {
-            for child in group.content.iter() {
-                flatten_shape(shapes, child);
+fn parse_args(mut args: &[String]) -> Result<Config, String> {
+    let mut output = String::new();
+    let mut precision = None;
+
+    while !args.is_empty() {
+        let arg = &args[0];
+
+        match arg.as_str() {
+            "-h" | "--help" => {
+                return Ok(Config::Help);
+            },
+            "-o" => {
+                if args.len() == 1 {
+                    return Err(String::from("missing operand after '-o'."));
+                }
+
+                output = args[1].clone();
+                args = &args[2..];
+            },
+            "-p" => {
+                if args.len() == 1 {
+                    return Err(String::from("missing operand after '-p'."));
+                }
+
+                precision = Some(args[1]
+                    .parse()
+                    .ok()
+                    .filter(|&precision| precision <= MAX_PRECISION)
+                    .ok_or_else(|| String::from("invalid precision value."))?);
+                args = &args[2..];
+            },
+            option if option.starts_with("-") => {
+                return Err(format!("unknown option '{}'.", option));
+            },
+            _ => {
+                break;
             }
-        },
-        _ => {
-            shapes.push(shape.clone());
         }
     }
-}
 
-fn strip_image(image: &mut Image) {
-    image.editor = None;
+    if args.is_empty() {
+        return Err(String::from("missing operand."));
+    } else if args.len() > 1 {
+        return Err(String::from("too many operands."));
+    }
 
-    let mut shapes: Vec<Shape> = Vec::new();
+    let input = args[0].clone();
 
-    for shape in image.shapes.iter() {
-        flatten_shape(&mut shapes, shape);
+    if output.is_empty() {
+        output = format!("stripped-{}", input);
     }
 
-    image.shapes = shapes;
+    Ok(Config::Strip(StripConfig { input, output, precision }))
 }
 
+const HELP_MESSAGE: &str = r#"usage: lison-strip [-h] [-o output] [-p precision] input
+options:
+  -h        : print help message.
+  -o <file> : output file name.
+  -p <num>  : round coordinates to this many decimals."#;
+
 fn main() -> Result<(), String> {
     let args: Vec<String> = env::args().collect();
     let conf = parse_args(&args[1..])?;
@@ -71,18 +88,21 @@ fn main() -> Result<(), String> {
             eprintln!("{}", HELP_MESSAGE);
         },
         Config::Strip(conf) => {
-            let image_str = fs::read_to_string(&conf.input)
-                .or_else(|_| Err(format!("failed to read '{}'.", &conf.input)))?;
-
-            let mut image: Image = serde_json::from_str(&image_str)
-                .or_else(|_| Err(format!("failed to parse '{}'.", &conf.input)))?;
+            let image = load_image(&conf.input)
+                .map_err(|err| match err {
+                    LoadError::Io(_) => format!("failed to read '{}'.", &conf.input),
+                    LoadError::Parse(_) | LoadError::Binary(_) => format!("failed to parse '{}'.", &conf.input),
+                    LoadError::Invalid(err) => format!("invalid '{}': {}", &conf.input, err)
+                })?;
 
-            strip_image(&mut image);
+            let output_file = fs::File::create(&conf.output)
+                .or_else(|_| Err(format!("failed to create '{}'.", &conf.output)))?;
 
-            let stripped_image_str = serde_json::to_string(&image)
-                .or_else(|_| Err(String::from("failed to strip the image.")))?;
+            let mut writer = BufWriter::new(output_file);
 
-            fs::write(&conf.output, &stripped_image_str)
+            to_writer(&mut writer, &StrippedImage(&image, conf.precision), conf.precision)
+                .map_err(|err| err.into())
+                .and_then(|_| writer.flush())
                 .or_else(|_| Err(format!("failed to write to '{}'.", &conf.output)))?;
         }
     }
@@ -1,17 +1,86 @@
 
 use std::env;
 use std::fs;
+use std::io::{self, Write};
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::{Arc, Mutex};
+use std::thread;
 
-use lison::image::*;
+use lison::backend::*;
+use lison::cache::*;
+#[cfg(feature = "gpu")]
+use lison::gpu::*;
+use lison::image::Image;
+use lison::load::*;
+use lison::lod::*;
+use lison::pdf::*;
+use lison::png::*;
+use lison::profile::*;
+use lison::raster::*;
 use lison::render::*;
+use lison::stream::*;
+use lison::svg::*;
+use lison::tile::*;
+use lison::validate::ValidImage;
 
-struct ConvertConfig {
-    input: String,
+struct Job {
+    input: usize,
     output: String,
     resolution: f64,
     scale: f64
 }
 
+#[derive(Clone, Copy, PartialEq)]
+enum BackendKind {
+    Cairo,
+    Raster,
+    #[cfg(feature = "gpu")]
+    Gpu
+}
+
+#[derive(Clone, Copy, PartialEq)]
+enum OutputFormat {
+    Png,
+    Rgba,
+    Ppm,
+    Svg,
+    Pdf
+}
+
+impl OutputFormat {
+    fn extension(self) -> &'static str {
+        match self {
+            OutputFormat::Png => "png",
+            OutputFormat::Rgba => "rgba",
+            OutputFormat::Ppm => "ppm",
+            OutputFormat::Svg => "svg",
+            OutputFormat::Pdf => "pdf"
+        }
+    }
+
+    // Vector formats are written from the image, with no surface between.
+    fn is_vector(self) -> bool {
+        self == OutputFormat::Svg || self == OutputFormat::Pdf
+    }
+}
+
+struct OutputOptions {
+    format: OutputFormat,
+    png: PngOptions
+}
+
+struct ConvertConfig {
+    inputs: Vec<String>,
+    jobs: Vec<Job>,
+    stream: bool,
+    threads: Option<usize>,
+    cache: Option<usize>,
+    profile: bool,
+    backend: BackendKind,
+    lod: bool,
+    output: OutputOptions
+}
+
 enum Config {
     Help,
     Convert(ConvertConfig)
@@ -19,8 +88,16 @@ enum Config {
 
 fn parse_args(mut args: &[String]) -> Result<Config, String> {
     let mut output = String::new();
-    let mut resolution = 96.0;
-    let mut scale = 1.0;
+    let mut resolutions = Vec::new();
+    let mut scales = Vec::new();
+    let mut stream = false;
+    let mut threads = None;
+    let mut cache = None;
+    let mut profile = false;
+    let mut lod = false;
+    let mut backend = BackendKind::Cairo;
+    let mut format = OutputFormat::Png;
+    let mut png = PngOptions::default();
 
     while !args.is_empty() {
         let arg = &args[0];
@@ -42,9 +119,9 @@ fn parse_args(mut args: &[String]) -> Result<Config, String> {
                     return Err(String::from("missing operand after '-r'."));
                 }
 
-                resolution = args[1]
+                resolutions.push(args[1]
                     .parse()
-                    .or_else(|_| Err(String::from("invalid resolution value.")))?;
+                    .or_else(|_| Err(String::from("invalid resolution value.")))?);
                 args = &args[2..];
             },
             "-s" => {
@@ -52,9 +129,105 @@ fn parse_args(mut args: &[String]) -> Result<Config, String> {
                     return Err(String::from("missing operand after '-s'."));
                 }
 
-                scale = args[1]
+                scales.push(args[1]
+                    .parse()
+                    .or_else(|_| Err(String::from("invalid scale value.")))?);
+                args = &args[2..];
+            },
+            "-j" => {
+                if args.len() == 1 {
+                    return Err(String::from("missing operand after '-j'."));
+                }
+
+                threads = Some(args[1]
+                    .parse()
+                    .ok()
+                    .filter(|&threads| threads > 0)
+                    .ok_or_else(|| String::from("invalid thread count."))?);
+                args = &args[2..];
+            },
+            "-c" => {
+                if args.len() == 1 {
+                    return Err(String::from("missing operand after '-c'."));
+                }
+
+                let megabytes: usize = args[1]
+                    .parse()
+                    .or_else(|_| Err(String::from("invalid cache size.")))?;
+                cache = Some(megabytes
+                    .checked_mul(1 << 20)
+                    .ok_or_else(|| String::from("invalid cache size."))?);
+                args = &args[2..];
+            },
+            "--stream" => {
+                stream = true;
+                args = &args[1..];
+            },
+            "--backend" => {
+                if args.len() == 1 {
+                    return Err(String::from("missing operand after '--backend'."));
+                }
+
+                backend = match args[1].as_str() {
+                    "cairo" => BackendKind::Cairo,
+                    "raster" => BackendKind::Raster,
+                    #[cfg(feature = "gpu")]
+                    "gpu" => BackendKind::Gpu,
+                    #[cfg(not(feature = "gpu"))]
+                    "gpu" => return Err(String::from("the gpu backend is not built in; rebuild with '--features gpu'.")),
+                    name => return Err(format!("unknown backend '{}'.", name))
+                };
+                args = &args[2..];
+            },
+            "--profile" => {
+                profile = true;
+                args = &args[1..];
+            },
+            "--lod" => {
+                lod = true;
+                args = &args[1..];
+            },
+            "--format" => {
+                if args.len() == 1 {
+                    return Err(String::from("missing operand after '--format'."));
+                }
+
+                format = match args[1].as_str() {
+                    "png" => OutputFormat::Png,
+                    "rgba" => OutputFormat::Rgba,
+                    "ppm" => OutputFormat::Ppm,
+                    "svg" => OutputFormat::Svg,
+                    "pdf" => OutputFormat::Pdf,
+                    name => return Err(format!("unknown format '{}'.", name))
+                };
+                args = &args[2..];
+            },
+            "--level" => {
+                if args.len() == 1 {
+                    return Err(String::from("missing operand after '--level'."));
+                }
+
+                png.level = args[1]
                     .parse()
-                    .or_else(|_| Err(String::from("invalid scale value.")))?;
+                    .ok()
+                    .filter(|&level| level <= 9)
+                    .ok_or_else(|| String::from("invalid compression level."))?;
+                args = &args[2..];
+            },
+            "--filter" => {
+                if args.len() == 1 {
+                    return Err(String::from("missing operand after '--filter'."));
+                }
+
+                png.filter = match args[1].as_str() {
+                    "none" => Filter::None,
+                    "sub" => Filter::Sub,
+                    "up" => Filter::Up,
+                    "average" => Filter::Average,
+                    "paeth" => Filter::Paeth,
+                    "adaptive" => Filter::Adaptive,
+                    name => return Err(format!("unknown filter '{}'.", name))
+                };
                 args = &args[2..];
             },
             option if option.starts_with("-") => {
@@ -68,25 +241,442 @@ fn parse_args(mut args: &[String]) -> Result<Config, String> {
 
     if args.is_empty() {
         return Err(String::from("missing operand."));
-    } else if args.len() > 1 {
-        return Err(String::from("too many operands."));
     }
 
-    let input = args[0].clone();
+    // A single -r or -s applies to every pair; otherwise they pair up in
+    // the order given.
+    let count = resolutions.len().max(scales.len()).max(1);
 
-    if output.is_empty() {
-        output = format!("{}.png", &input);
+    for values in [&resolutions, &scales] {
+        if values.len() > 1 && values.len() != count {
+            return Err(String::from("'-r' and '-s' must be given the same number of times."));
+        }
+    }
+
+    let resolution = |i: usize| *resolutions.get(i).or(resolutions.first()).unwrap_or(&96.0);
+    let scale = |i: usize| *scales.get(i).or(scales.first()).unwrap_or(&1.0);
+
+    let inputs: Vec<String> = args.to_vec();
+    let batch = inputs.len() > 1 || count > 1;
+
+    if batch && !output.is_empty() {
+        return Err(String::from("'-o' cannot be used with several outputs."));
+    }
+
+    if stream && batch {
+        return Err(String::from("'--stream' cannot be used with several outputs."));
+    }
+
+    if stream && threads.is_some_and(|threads| threads > 1) {
+        return Err(String::from("'--stream' cannot be used with '-j'."));
+    }
+
+    if profile && (batch || stream || threads.is_some_and(|threads| threads > 1) || cache.is_some()) {
+        return Err(String::from("'--profile' cannot be used with several outputs, '--stream', '-j' or '-c'."));
+    }
+
+    if backend == BackendKind::Raster && (stream || profile || cache.is_some() || (!batch && threads.is_some_and(|threads| threads > 1))) {
+        return Err(String::from("'--backend raster' cannot be used with '--stream', '--profile', '-c' or tiling."));
+    }
+
+    #[cfg(feature = "gpu")]
+    if backend == BackendKind::Gpu && (stream || profile || cache.is_some() || threads.is_some()) {
+        return Err(String::from("'--backend gpu' cannot be used with '--stream', '--profile', '-c' or '-j'."));
+    }
+
+    if cache.is_some() && (stream || (!batch && threads.is_some_and(|threads| threads > 1))) {
+        return Err(String::from("'-c' cannot be used with '--stream' or tiling."));
+    }
+
+    if lod && (backend != BackendKind::Cairo || stream || profile || cache.is_some() || (!batch && threads.is_some_and(|threads| threads > 1))) {
+        return Err(String::from("'--lod' cannot be used with '--backend', '--stream', '--profile', '-c' or tiling."));
+    }
+
+    if format.is_vector() && (backend != BackendKind::Cairo || stream || profile || cache.is_some() || lod || (!batch && threads.is_some_and(|threads| threads > 1))) {
+        return Err(String::from("'--format svg' and '--format pdf' cannot be used with '--backend', '--stream', '--profile', '-c', '--lod' or tiling."));
+    }
+
+    let mut jobs = Vec::new();
+
+    for (input, name) in inputs.iter().enumerate() {
+        for i in 0..count {
+            let output = if !output.is_empty() {
+                output.clone()
+            } else if count == 1 {
+                format!("{}.{}", name, format.extension())
+            } else {
+                format!("{}-{}-{}.{}", name, resolution(i), scale(i), format.extension())
+            };
+
+            jobs.push(Job { input, output, resolution: resolution(i), scale: scale(i) });
+        }
     }
 
-    Ok(Config::Convert(ConvertConfig { input, output, resolution, scale }))
+    let output = OutputOptions { format, png };
+
+    Ok(Config::Convert(ConvertConfig { inputs, jobs, stream, threads, cache, profile, backend, lod, output }))
 }
 
-const HELP_MESSAGE: &str = r#"usage: lison-to-png [-h] [-o output] [-r resolution] [-s scale] input
+const HELP_MESSAGE: &str = r#"usage: lison-to-png [-h] [-o output] [-r resolution]... [-s scale]... [-j threads] [-c cache] [--stream] [--profile]
+                   [--backend name] [--lod] [--format name] [--level num] [--filter name] input...
 options:
-  -h        : print help message.
-  -o <file> : output file name.
-  -r <num>  : resolution in ppi.
-  -s <num>  : scale ratio."#;
+  -h               : print help message.
+  -o <file>        : output file name, or '-' for stdout.
+  -r <num>         : resolution in ppi.
+  -s <num>         : scale ratio.
+  -j <num>         : render on this many threads.
+  -c <num>         : cache rasters of repeated groups, up to this many MiB.
+  --stream         : render shapes while reading the input.
+  --profile        : report where the time went to stderr.
+  --backend <name> : 'cairo' (default), 'raster' to render without Cairo,
+                     or 'gpu' when built with the gpu feature.
+  --lod            : leave out sub-pixel detail, for fast thumbnails.
+  --format <name>  : 'png' (default), 'rgba' for raw RGBA bytes, 'ppm', 'svg'
+                     or 'pdf', whose page size ignores '-r'.
+  --level <num>    : png compression level from 0 to 9, 6 by default.
+  --filter <name>  : png row filter, 'none', 'sub', 'up', 'average', 'paeth'
+                     or 'adaptive' (default).
+when several inputs or -r/-s pairs are given, each input is read once. with
+one -r/-s pair each input is written to '<input>.<format>', with several
+each pair is written to '<input>-<resolution>-<scale>.<format>'."#;
+
+const TILE_SIZE: i32 = 512;
+
+fn surface_size(width: f64, height: f64, unit_per_inch: f64, job: &Job) -> Result<(i32, i32), String> {
+    let width = (width * job.resolution / unit_per_inch * job.scale).round();
+    let height = (height * job.resolution / unit_per_inch * job.scale).round();
+
+    if width <= 0.0 || width > i32::MAX.into() || height <= 0.0 || height > i32::MAX.into() {
+        return Err(String::from("bad image dimension."));
+    }
+
+    Ok((width as i32, height as i32))
+}
+
+fn create_surface(width: f64, height: f64, unit_per_inch: f64, job: &Job) -> Result<cairo::ImageSurface, String> {
+    let (width, height) = surface_size(width, height, unit_per_inch, job)?;
+
+    cairo::ImageSurface::create(cairo::Format::ARgb32, width, height)
+        .or_else(|_| Err(String::from("surface creation failed.")))
+}
+
+fn read_image(input: &str) -> Result<ValidImage, String> {
+    load_valid_image(input)
+        .map_err(|err| match err {
+            LoadError::Io(_) => format!("failed to read '{}'.", input),
+            LoadError::Parse(_) | LoadError::Binary(_) => format!("failed to parse '{}'.", input),
+            LoadError::Invalid(err) => format!("invalid '{}': {}", input, err)
+        })
+}
+
+// The raster is kept between jobs, so strokes drawn again at the same scale
+// come from its cache.
+fn draw_raster(surface: &mut cairo::ImageSurface, image: &Image, job: &Job, raster: &mut Option<Raster>) -> Result<(), String> {
+    let (width, height) = (surface.width() as usize, surface.height() as usize);
+    let raster = raster.get_or_insert_with(|| Raster::new(width, height));
+    raster.resize(width, height);
+
+    render_to(raster, image, job.resolution, job.scale)
+        .or_else(|_| Err(String::from("rendering operation failed.")))?;
+
+    let stride = surface.stride() as usize;
+    let mut data = surface.data()
+        .or_else(|_| Err(String::from("rendering operation failed.")))?;
+
+    raster.write_argb32(&mut data, stride);
+
+    Ok(())
+}
+
+fn draw(surface: &mut cairo::ImageSurface, image: &ValidImage, job: &Job, backend: BackendKind, lod: bool, cache: Option<&mut GroupCache>, raster: &mut Option<Raster>) -> Result<(), String> {
+    if backend == BackendKind::Raster {
+        return draw_raster(surface, image, job, raster);
+    }
+
+    let context = cairo::Context::new(surface)
+        .or_else(|_| Err(String::from("context creation failed.")))?;
+
+    if lod {
+        return render_lod(&context, image, job.resolution, job.scale, DEFAULT_DETAIL)
+            .map(|_| ())
+            .or_else(|_| Err(String::from("rendering operation failed.")));
+    }
+
+    let result = match cache {
+        Some(cache) => render_with_cache(&context, image, &Resources::new(image), cache, job.resolution, job.scale),
+        None => render_valid(&context, image, job.resolution, job.scale)
+    };
+
+    result.or_else(|_| Err(String::from("rendering operation failed.")))
+}
+
+fn convert(input: &str, job: &Job, threads: usize, cache: Option<usize>, backend: BackendKind, lod: bool) -> Result<cairo::ImageSurface, String> {
+    let image = read_image(input)?;
+
+    if threads > 1 {
+        let (width, height) = surface_size(image.width, image.height, image.unit_per_inch, job)?;
+
+        return render_tiled(&image, width, height, job.resolution, job.scale, TILE_SIZE, threads)
+            .or_else(|_| Err(String::from("rendering operation failed.")));
+    }
+
+    let mut surface = create_surface(image.width, image.height, image.unit_per_inch, job)?;
+    draw(&mut surface, &image, job, backend, lod, cache.map(GroupCache::new).as_mut(), &mut None)?;
+
+    Ok(surface)
+}
+
+fn convert_stream(input: &str, job: &Job) -> Result<cairo::ImageSurface, String> {
+    let input_file = fs::File::open(input)
+        .or_else(|_| Err(format!("failed to read '{}'.", input)))?;
+
+    let mut surface = None;
+
+    render_from_reader(io::BufReader::new(input_file), job.resolution, job.scale, |header| {
+        let target = create_surface(header.width, header.height, header.unit_per_inch, job)?;
+
+        let context = cairo::Context::new(&target)
+            .or_else(|_| Err(String::from("context creation failed.")))?;
+
+        surface = Some(target);
+        Ok(context)
+    }).map_err(|err| match err {
+        StreamError::Parse(_) => format!("failed to parse '{}'.", input),
+        StreamError::Render(_) => String::from("rendering operation failed."),
+        StreamError::Target(message) => message
+    })?;
+
+    surface.ok_or_else(|| String::from("rendering operation failed."))
+}
+
+const PROFILE_TOP: usize = 10;
+
+fn convert_profiled(input: &str, job: &Job, output: &OutputOptions) -> Result<(), String> {
+    let mut profiler = Profiler::new(PROFILE_TOP);
+
+    let image = profiler.time(Phase::Parse, || read_image(input))?;
+    let surface = create_surface(image.width, image.height, image.unit_per_inch, job)?;
+
+    {
+        let context = cairo::Context::new(&surface)
+            .or_else(|_| Err(String::from("context creation failed.")))?;
+
+        render_with_hook(&context, &image, job.resolution, job.scale, &mut profiler)
+            .or_else(|_| Err(String::from("rendering operation failed.")))?;
+    }
+
+    profiler.time(Phase::Encode, || write_output(&surface, &job.output, output))?;
+    eprint!("{}", profiler);
+
+    Ok(())
+}
+
+fn encode(writer: &mut impl Write, surface: &cairo::ImageSurface, options: &OutputOptions) -> io::Result<()> {
+    let (width, height, stride) = (surface.width() as usize, surface.height() as usize, surface.stride() as usize);
+    let mut result = Ok(());
+
+    surface.with_data(|data| {
+        result = match options.format {
+            OutputFormat::Png => write_png(writer, width, height, data, stride, &options.png),
+            OutputFormat::Rgba => write_rgba(writer, width, height, data, stride),
+            OutputFormat::Ppm => write_ppm(writer, width, height, data, stride),
+            OutputFormat::Svg | OutputFormat::Pdf => unreachable!()
+        };
+    }).map_err(io::Error::other)?;
+
+    result?;
+    writer.flush()
+}
+
+fn write_output(surface: &cairo::ImageSurface, output: &str, options: &OutputOptions) -> Result<(), String> {
+    if output == "-" {
+        let mut writer = io::BufWriter::new(io::stdout().lock());
+
+        return encode(&mut writer, surface, options)
+            .or_else(|_| Err(String::from("failed to write to stdout.")));
+    }
+
+    let output_file = fs::File::create(output)
+        .or_else(|_| Err(format!("failed to create '{}'.", output)))?;
+
+    encode(&mut io::BufWriter::new(output_file), surface, options)
+        .or_else(|_| Err(format!("failed to write to '{}'.", output)))
+}
+
+fn encode_vector(writer: &mut impl Write, image: &Image, job: &Job, format: OutputFormat) -> io::Result<()> {
+    match format {
+        OutputFormat::Svg => write_svg(writer, image, job.resolution, job.scale)?,
+        OutputFormat::Pdf => write_pdf(writer, image, job.scale)?,
+        _ => unreachable!()
+    }
+
+    writer.flush()
+}
+
+fn write_vector(image: &Image, job: &Job, format: OutputFormat) -> Result<(), String> {
+    if job.output == "-" {
+        let mut writer = io::BufWriter::new(io::stdout().lock());
+
+        return encode_vector(&mut writer, image, job, format)
+            .or_else(|_| Err(String::from("failed to write to stdout.")));
+    }
+
+    let output_file = fs::File::create(&job.output)
+        .or_else(|_| Err(format!("failed to create '{}'.", job.output)))?;
+
+    encode_vector(&mut io::BufWriter::new(output_file), image, job, format)
+        .or_else(|_| Err(format!("failed to write to '{}'.", job.output)))
+}
+
+// An input is parsed by the first job that needs it and dropped after its
+// last job, so only the inputs in flight stay in memory.
+struct Source {
+    image: Mutex<Option<Result<Arc<ValidImage>, String>>>,
+    remaining: AtomicUsize
+}
+
+impl Source {
+    fn acquire(&self, input: &str) -> Result<Arc<ValidImage>, String> {
+        let mut image = self.image.lock().unwrap();
+
+        image.get_or_insert_with(|| read_image(input).map(Arc::new)).clone()
+    }
+
+    fn release(&self) {
+        if self.remaining.fetch_sub(1, Ordering::AcqRel) == 1 {
+            *self.image.lock().unwrap() = None;
+        }
+    }
+}
+
+// Each worker keeps the surface of its previous job, so a run of equally
+// sized outputs allocates one surface per worker.
+fn reuse_surface(cached: &mut Option<cairo::ImageSurface>, image: &Image, job: &Job) -> Result<cairo::ImageSurface, String> {
+    let (width, height) = surface_size(image.width, image.height, image.unit_per_inch, job)?;
+
+    if let Some(surface) = cached.take().filter(|surface| surface.width() == width && surface.height() == height) {
+        let context = cairo::Context::new(&surface)
+            .or_else(|_| Err(String::from("context creation failed.")))?;
+
+        context.set_operator(cairo::Operator::Clear);
+        context.paint()
+            .or_else(|_| Err(String::from("rendering operation failed.")))?;
+
+        return Ok(surface);
+    }
+
+    cairo::ImageSurface::create(cairo::Format::ARgb32, width, height)
+        .or_else(|_| Err(String::from("surface creation failed.")))
+}
+
+fn convert_batch(conf: &ConvertConfig, threads: usize) -> Result<(), String> {
+    let sources: Vec<Source> = (0..conf.inputs.len())
+        .map(|input| Source {
+            image: Mutex::new(None),
+            remaining: AtomicUsize::new(conf.jobs.iter().filter(|job| job.input == input).count())
+        })
+        .collect();
+
+    let next = AtomicUsize::new(0);
+    let errors = Mutex::new(Vec::new());
+
+    thread::scope(|scope| {
+        for _ in 0..threads.min(conf.jobs.len()) {
+            scope.spawn(|| {
+                let mut cached = None;
+                let mut cache = conf.cache.map(GroupCache::new);
+                let mut raster = None;
+
+                loop {
+                    let number = next.fetch_add(1, Ordering::Relaxed);
+
+                    let Some(job) = conf.jobs.get(number) else {
+                        break;
+                    };
+
+                    let source = &sources[job.input];
+
+                    let result = source.acquire(&conf.inputs[job.input]).and_then(|image| {
+                        if conf.output.format.is_vector() {
+                            return write_vector(&image, job, conf.output.format);
+                        }
+
+                        let mut surface = reuse_surface(&mut cached, &image, job)?;
+                        draw(&mut surface, &image, job, conf.backend, conf.lod, cache.as_mut(), &mut raster)?;
+                        write_output(&surface, &job.output, &conf.output)?;
+                        cached = Some(surface);
+                        Ok(())
+                    });
+
+                    source.release();
+
+                    if let Err(message) = result {
+                        let mut errors = errors.lock().unwrap();
+
+                        if !errors.contains(&message) {
+                            errors.push(message);
+                        }
+                    }
+                }
+            });
+        }
+    });
+
+    let errors = errors.into_inner().unwrap();
+
+    match errors.len() {
+        0 => Ok(()),
+        _ => Err(errors.join("\n"))
+    }
+}
+
+// Each input is uploaded once and rendered at every size asked of it.
+#[cfg(feature = "gpu")]
+fn convert_gpu(conf: &ConvertConfig) -> Result<(), String> {
+    let gpu = Gpu::new()
+        .or_else(|_| Err(String::from("gpu initialization failed.")))?;
+
+    let mut errors = Vec::new();
+
+    for (input, name) in conf.inputs.iter().enumerate() {
+        let result = read_image(name).and_then(|image| {
+            let jobs: Vec<&Job> = conf.jobs.iter().filter(|job| job.input == input).collect();
+            let factor = |job: &Job| job.resolution / image.unit_per_inch * job.scale;
+            let largest = jobs.iter().map(|job| factor(job)).fold(0.0, f64::max);
+
+            let document = GpuDocument::new(&gpu, &image, DEFAULT_TOLERANCE / largest)
+                .or_else(|_| Err(String::from("rendering operation failed.")))?;
+
+            for job in jobs {
+                let mut surface = create_surface(image.width, image.height, image.unit_per_inch, job)?;
+                let (width, height, stride) = (surface.width() as u32, surface.height() as u32, surface.stride() as usize);
+
+                {
+                    let mut data = surface.data()
+                        .or_else(|_| Err(String::from("rendering operation failed.")))?;
+
+                    document.render_argb32(&gpu, factor(job), width, height, &mut data, stride)
+                        .or_else(|_| Err(String::from("rendering operation failed.")))?;
+                }
+
+                write_output(&surface, &job.output, &conf.output)?;
+            }
+
+            Ok(())
+        });
+
+        if let Err(message) = result {
+            if !errors.contains(&message) {
+                errors.push(message);
+            }
+        }
+    }
+
+    match errors.len() {
+        0 => Ok(()),
+        _ => Err(errors.join("\n"))
+    }
+}
 
 fn main() -> Result<(), String> {
     let args: Vec<String> = env::args().collect();
@@ -96,37 +686,44 @@ fn main() -> Result<(), String> {
         Config::Help => {
             eprintln!("{}", HELP_MESSAGE);
         },
-        Config::Convert(conf) => {
-            let image_str = fs::read_to_string(&conf.input)
-                .or_else(|_| Err(format!("failed to read '{}'.", &conf.input)))?;
-
-            let image: Image = serde_json::from_str(&image_str)
-                .or_else(|_| Err(format!("failed to parse '{}'.", &conf.input)))?;
+        Config::Convert(mut conf) => {
+            #[cfg(feature = "gpu")]
+            if conf.backend == BackendKind::Gpu {
+                return convert_gpu(&conf);
+            }
 
-            let width = (image.width * conf.resolution / image.unit_per_inch * conf.scale).round();
-            let height = (image.height * conf.resolution / image.unit_per_inch * conf.scale).round();
+            if conf.jobs.len() > 1 {
+                let threads = conf.threads
+                    .or_else(|| thread::available_parallelism().ok().map(|threads| threads.get()))
+                    .unwrap_or(1);
 
-            if width <= 0.0 || width > i32::MAX.into() || height <= 0.0 || height > i32::MAX.into() {
-                return Err(String::from("bad image dimension."));
+                // The jobs already keep every thread busy, so each output
+                // is encoded on its own worker.
+                return convert_batch(&conf, threads);
             }
 
-            let width = width as i32;
-            let height = height as i32;
+            conf.output.png.threads = conf.threads
+                .or_else(|| thread::available_parallelism().ok().map(|threads| threads.get()))
+                .unwrap_or(1);
 
-            let surface = cairo::ImageSurface::create(cairo::Format::ARgb32, width, height)
-                .or_else(|_| Err(String::from("surface creation failed.")))?;
+            let job = &conf.jobs[0];
+            let input = &conf.inputs[job.input];
 
-            let context = cairo::Context::new(&surface)
-                .or_else(|_| Err(String::from("context creation failed.")))?;
+            if conf.output.format.is_vector() {
+                return write_vector(&*read_image(input)?, job, conf.output.format);
+            }
 
-            render(&context, &image, conf.resolution, conf.scale)
-                .or_else(|_| Err(String::from("rendering operation failed.")))?;
+            if conf.profile {
+                return convert_profiled(input, job, &conf.output);
+            }
 
-            let mut output_file = fs::File::create(&conf.output)
-                .or_else(|_| Err(format!("failed to create '{}'.", &conf.output)))?;
+            let surface = if conf.stream {
+                convert_stream(input, job)?
+            } else {
+                convert(input, job, conf.threads.unwrap_or(1), conf.cache, conf.backend, conf.lod)?
+            };
 
-            surface.write_to_png(&mut output_file)
-                .or_else(|_| Err(format!("failed to write to '{}'.", &conf.output)))?;
+            write_output(&surface, &job.output, &conf.output)?;
         }
     }
 
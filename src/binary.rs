@@ -0,0 +1,658 @@
+use std::fmt;
+use std::io::{self, Write};
+
+use crate::image::*;
+use crate::scan::RECURSION_LIMIT;
+
+// Layout (all numbers little-endian):
+//
+//   "LISB" version:u8 precision:u8 reserved:u16
+//   width:f64 height:f64 unit-per-inch:f64 editor:string
+//   pens:u32 pen*  brushes:u32 brush*  shapes:u32 shape*
+//
+//   string  = len:u32 utf8[len]            (len 0xffffffff: absent)
+//   pattern = 0 color | 1 point color point color
+//           | 2 point f64 color point f64 color
+//   pen     = pattern width:f64 cap:u8 join:u8
+//   brush   = pattern
+//   shape   = 0 edit-annot:string count:u32 shape*
+//           | 1 pen:u32 curve
+//           | 2 flags:u8 [pen:u32] [brush:u32] count:u32 curve*
+//   curve   = count:u32 verb[count] coord[2 * points]
+//
+// Pattern points and colors are f64. Curve coordinates are packed as f32
+// or f64 depending on the precision byte, and a curve stores its start
+// point followed by the points of every verb ('L', 'Q' or 'C').
+
+pub const MAGIC: &[u8; 4] = b"LISB";
+
+const VERSION: u8 = 1;
+const ABSENT: u32 = u32::MAX;
+
+const PATTERN_MONOCHROME: u8 = 0;
+const PATTERN_LINEAR_GRADIENT: u8 = 1;
+const PATTERN_RADIAL_GRADIENT: u8 = 2;
+
+const SHAPE_GROUP: u8 = 0;
+const SHAPE_CURVE: u8 = 1;
+const SHAPE_REGION: u8 = 2;
+
+const REGION_PEN: u8 = 1;
+const REGION_BRUSH: u8 = 2;
+
+const VERB_LINE: u8 = b'L';
+const VERB_QUADRATIC_BEZIER: u8 = b'Q';
+const VERB_CUBIC_BEZIER: u8 = b'C';
+
+pub use crate::image::Precision;
+
+impl Precision {
+    fn coord_size(self) -> usize {
+        match self {
+            Precision::Single => 4,
+            Precision::Double => 8
+        }
+    }
+}
+
+#[derive(Debug)]
+pub enum BinaryError {
+    InvalidMagic,
+    UnsupportedVersion(u8),
+    UnexpectedEnd,
+    InvalidValue(&'static str),
+    InvalidAnnotation(serde_json::Error)
+}
+
+impl fmt::Display for BinaryError {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        match self {
+            BinaryError::InvalidMagic => write!(f, "not a binary LISON file"),
+            BinaryError::UnsupportedVersion(version) => write!(f, "unsupported version {}", version),
+            BinaryError::UnexpectedEnd => write!(f, "unexpected end of data"),
+            BinaryError::InvalidValue(what) => write!(f, "invalid {}", what),
+            BinaryError::InvalidAnnotation(err) => write!(f, "invalid edit annotation: {}", err)
+        }
+    }
+}
+
+impl std::error::Error for BinaryError {}
+
+pub fn is_binary(bytes: &[u8]) -> bool {
+    bytes.starts_with(MAGIC)
+}
+
+pub fn encode_image(image: &Image, precision: Precision) -> Vec<u8> {
+    let mut bytes = Vec::new();
+    write_image(&mut bytes, image, precision).expect("writing to a Vec never fails");
+    bytes
+}
+
+pub fn write_image<W: Write>(writer: &mut W, image: &Image, precision: Precision) -> io::Result<()> {
+    let mut encoder = Encoder { writer, precision, buffer: Vec::new() };
+    encoder.image(image)
+}
+
+pub fn decode_image(bytes: &[u8]) -> Result<Image, BinaryError> {
+    let mut decoder = Decoder { bytes, pos: 0, precision: Precision::Double };
+    decoder.image()
+}
+
+struct Encoder<'a, W: Write> {
+    writer: &'a mut W,
+    precision: Precision,
+    buffer: Vec<u8>
+}
+
+impl<'a, W: Write> Encoder<'a, W> {
+    fn u8(&mut self, value: u8) -> io::Result<()> {
+        self.writer.write_all(&[value])
+    }
+
+    fn u32(&mut self, value: u32) -> io::Result<()> {
+        self.writer.write_all(&value.to_le_bytes())
+    }
+
+    fn len(&mut self, value: usize) -> io::Result<()> {
+        match u32::try_from(value) {
+            Ok(value) if value != ABSENT => self.u32(value),
+            _ => Err(io::Error::new(io::ErrorKind::InvalidInput, "too many elements"))
+        }
+    }
+
+    fn f64(&mut self, value: f64) -> io::Result<()> {
+        self.writer.write_all(&value.to_le_bytes())
+    }
+
+    fn string(&mut self, value: Option<&str>) -> io::Result<()> {
+        match value {
+            None => self.u32(ABSENT),
+            Some(value) => {
+                self.len(value.len())?;
+                self.writer.write_all(value.as_bytes())
+            }
+        }
+    }
+
+    fn point(&mut self, point: &Point) -> io::Result<()> {
+        self.f64(point.x)?;
+        self.f64(point.y)
+    }
+
+    fn color(&mut self, color: &Color) -> io::Result<()> {
+        self.f64(color.red)?;
+        self.f64(color.green)?;
+        self.f64(color.blue)?;
+        self.f64(color.alpha)
+    }
+
+    fn image(&mut self, image: &Image) -> io::Result<()> {
+        self.writer.write_all(MAGIC)?;
+        self.u8(VERSION)?;
+        self.u8(self.precision.coord_size() as u8)?;
+        self.writer.write_all(&[0, 0])?;
+        self.f64(image.width)?;
+        self.f64(image.height)?;
+        self.f64(image.unit_per_inch)?;
+        self.string(image.editor.as_deref())?;
+
+        self.len(image.pens.len())?;
+        for pen in image.pens.iter() {
+            self.pattern(&pen.pattern)?;
+            self.f64(pen.width)?;
+            self.u8(match pen.cap {
+                LineCap::Butt => 0,
+                LineCap::Round => 1,
+                LineCap::Square => 2
+            })?;
+            self.u8(match pen.join {
+                LineJoin::Miter => 0,
+                LineJoin::Round => 1,
+                LineJoin::Bevel => 2
+            })?;
+        }
+
+        self.len(image.brushes.len())?;
+        for brush in image.brushes.iter() {
+            self.pattern(&brush.pattern)?;
+        }
+
+        self.shapes(&image.shapes)
+    }
+
+    fn pattern(&mut self, pattern: &Pattern) -> io::Result<()> {
+        match pattern {
+            Pattern::Monochrome(pat) => {
+                self.u8(PATTERN_MONOCHROME)?;
+                self.color(&pat.color)
+            },
+            Pattern::LinearGradient(pat) => {
+                self.u8(PATTERN_LINEAR_GRADIENT)?;
+                self.point(&pat.point_1)?;
+                self.color(&pat.color_1)?;
+                self.point(&pat.point_2)?;
+                self.color(&pat.color_2)
+            },
+            Pattern::RadialGradient(pat) => {
+                self.u8(PATTERN_RADIAL_GRADIENT)?;
+                self.point(&pat.center_1)?;
+                self.f64(pat.radius_1)?;
+                self.color(&pat.color_1)?;
+                self.point(&pat.center_2)?;
+                self.f64(pat.radius_2)?;
+                self.color(&pat.color_2)
+            }
+        }
+    }
+
+    fn shapes(&mut self, shapes: &[Shape]) -> io::Result<()> {
+        self.len(shapes.len())?;
+
+        for shape in shapes.iter() {
+            match shape {
+                Shape::Group(group) => {
+                    self.u8(SHAPE_GROUP)?;
+
+                    if group.edit_annot.is_null() {
+                        self.string(None)?;
+                    } else {
+                        let annot = serde_json::to_string(&group.edit_annot)?;
+                        self.string(Some(&annot))?;
+                    }
+
+                    self.shapes(&group.content)?;
+                },
+                Shape::Curve(curve) => {
+                    self.u8(SHAPE_CURVE)?;
+                    self.len(curve.pen)?;
+                    self.curve_data(&curve.data)?;
+                },
+                Shape::Region(region) => {
+                    self.u8(SHAPE_REGION)?;
+
+                    let mut flags = 0;
+                    if region.pen.is_some() { flags |= REGION_PEN; }
+                    if region.brush.is_some() { flags |= REGION_BRUSH; }
+                    self.u8(flags)?;
+
+                    if let Some(pen) = region.pen { self.len(pen)?; }
+                    if let Some(brush) = region.brush { self.len(brush)?; }
+
+                    self.len(region.data.len())?;
+                    for data in region.data.iter() {
+                        self.curve_data(data)?;
+                    }
+                }
+            }
+        }
+
+        Ok(())
+    }
+
+    fn curve_data(&mut self, data: &CurveData) -> io::Result<()> {
+        let precision = self.precision;
+        let buffer = &mut self.buffer;
+        buffer.clear();
+
+        let mut push = |point: &Point| match precision {
+            Precision::Single => {
+                buffer.extend_from_slice(&(point.x as f32).to_le_bytes());
+                buffer.extend_from_slice(&(point.y as f32).to_le_bytes());
+            },
+            Precision::Double => {
+                buffer.extend_from_slice(&point.x.to_le_bytes());
+                buffer.extend_from_slice(&point.y.to_le_bytes());
+            }
+        };
+
+        // The container lays out a subpath the way CurveData holds it.
+        for point in data.points() {
+            push(&point);
+        }
+
+        let verbs: Vec<u8> = data.verbs().iter()
+            .map(|verb| match verb {
+                Verb::Line => VERB_LINE,
+                Verb::QuadraticBezier => VERB_QUADRATIC_BEZIER,
+                Verb::CubicBezier => VERB_CUBIC_BEZIER
+            })
+            .collect();
+
+        self.len(verbs.len())?;
+        self.writer.write_all(&verbs)?;
+        self.writer.write_all(&self.buffer)
+    }
+}
+
+struct Decoder<'a> {
+    bytes: &'a [u8],
+    pos: usize,
+    precision: Precision
+}
+
+impl<'a> Decoder<'a> {
+    fn take(&mut self, len: usize) -> Result<&'a [u8], BinaryError> {
+        let end = self.pos.checked_add(len).ok_or(BinaryError::UnexpectedEnd)?;
+        let bytes = self.bytes.get(self.pos..end).ok_or(BinaryError::UnexpectedEnd)?;
+        self.pos = end;
+        Ok(bytes)
+    }
+
+    fn array<const N: usize>(&mut self) -> Result<[u8; N], BinaryError> {
+        let mut array = [0; N];
+        array.copy_from_slice(self.take(N)?);
+        Ok(array)
+    }
+
+    fn u8(&mut self) -> Result<u8, BinaryError> {
+        Ok(self.take(1)?[0])
+    }
+
+    fn u32(&mut self) -> Result<u32, BinaryError> {
+        Ok(u32::from_le_bytes(self.array()?))
+    }
+
+    // Counts are checked against the remaining input so that a corrupt
+    // count cannot trigger a huge allocation.
+    fn count(&mut self, min_size: usize) -> Result<usize, BinaryError> {
+        let count = self.u32()? as usize;
+
+        if count.saturating_mul(min_size) > self.bytes.len() - self.pos {
+            Err(BinaryError::UnexpectedEnd)
+        } else {
+            Ok(count)
+        }
+    }
+
+    fn f64(&mut self) -> Result<f64, BinaryError> {
+        Ok(f64::from_le_bytes(self.array()?))
+    }
+
+    fn string(&mut self) -> Result<Option<&'a str>, BinaryError> {
+        let len = self.u32()?;
+
+        if len == ABSENT {
+            return Ok(None);
+        }
+
+        let bytes = self.take(len as usize)?;
+        std::str::from_utf8(bytes)
+            .map(Some)
+            .map_err(|_| BinaryError::InvalidValue("string"))
+    }
+
+    fn point(&mut self) -> Result<Point, BinaryError> {
+        let x = self.f64()?;
+        let y = self.f64()?;
+        Ok(Point { x, y })
+    }
+
+    fn color(&mut self) -> Result<Color, BinaryError> {
+        let red = self.f64()?;
+        let green = self.f64()?;
+        let blue = self.f64()?;
+        let alpha = self.f64()?;
+        Ok(Color { red, green, blue, alpha })
+    }
+
+    fn image(&mut self) -> Result<Image, BinaryError> {
+        if self.take(4).map_err(|_| BinaryError::InvalidMagic)? != MAGIC {
+            return Err(BinaryError::InvalidMagic);
+        }
+
+        let version = self.u8()?;
+        if version != VERSION {
+            return Err(BinaryError::UnsupportedVersion(version));
+        }
+
+        self.precision = match self.u8()? {
+            4 => Precision::Single,
+            8 => Precision::Double,
+            _ => return Err(BinaryError::InvalidValue("precision"))
+        };
+        self.take(2)?;
+
+        let width = self.f64()?;
+        let height = self.f64()?;
+        let unit_per_inch = self.f64()?;
+        let editor = self.string()?.map(String::from);
+
+        let pen_count = self.count(1)?;
+        let mut pens = Vec::with_capacity(pen_count);
+        for _ in 0..pen_count {
+            let pattern = self.pattern()?;
+            let width = self.f64()?;
+            let cap = match self.u8()? {
+                0 => LineCap::Butt,
+                1 => LineCap::Round,
+                2 => LineCap::Square,
+                _ => return Err(BinaryError::InvalidValue("line cap"))
+            };
+            let join = match self.u8()? {
+                0 => LineJoin::Miter,
+                1 => LineJoin::Round,
+                2 => LineJoin::Bevel,
+                _ => return Err(BinaryError::InvalidValue("line join"))
+            };
+            pens.push(Pen { pattern, width, cap, join });
+        }
+
+        let brush_count = self.count(1)?;
+        let mut brushes = Vec::with_capacity(brush_count);
+        for _ in 0..brush_count {
+            let pattern = self.pattern()?;
+            brushes.push(Brush { pattern });
+        }
+
+        let shapes = self.shapes(0)?;
+
+        if self.pos != self.bytes.len() {
+            return Err(BinaryError::InvalidValue("trailing data"));
+        }
+
+        Ok(Image { width, height, unit_per_inch, editor, pens, brushes, shapes })
+    }
+
+    fn pattern(&mut self) -> Result<Pattern, BinaryError> {
+        match self.u8()? {
+            PATTERN_MONOCHROME => {
+                let color = self.color()?;
+                Ok(Pattern::Monochrome(MonochromePattern { color }))
+            },
+            PATTERN_LINEAR_GRADIENT => {
+                let point_1 = self.point()?;
+                let color_1 = self.color()?;
+                let point_2 = self.point()?;
+                let color_2 = self.color()?;
+                Ok(Pattern::LinearGradient(LinearGradientPattern { point_1, color_1, point_2, color_2 }))
+            },
+            PATTERN_RADIAL_GRADIENT => {
+                let center_1 = self.point()?;
+                let radius_1 = self.f64()?;
+                let color_1 = self.color()?;
+                let center_2 = self.point()?;
+                let radius_2 = self.f64()?;
+                let color_2 = self.color()?;
+                Ok(Pattern::RadialGradient(RadialGradientPattern {
+                    center_1, radius_1, color_1, center_2, radius_2, color_2
+                }))
+            },
+            _ => Err(BinaryError::InvalidValue("pattern type"))
+        }
+    }
+
+    // Groups nest no deeper than the JSON parser lets them, so a crafted file
+    // cannot run the decoder out of stack.
+    fn shapes(&mut self, depth: usize) -> Result<Vec<Shape>, BinaryError> {
+        if depth > RECURSION_LIMIT {
+            return Err(BinaryError::InvalidValue("group depth"));
+        }
+
+        let count = self.count(1)?;
+        let mut shapes = Vec::with_capacity(count);
+
+        for _ in 0..count {
+            let shape = match self.u8()? {
+                SHAPE_GROUP => {
+                    let edit_annot = match self.string()? {
+                        None => serde_json::Value::Null,
+                        Some(annot) => serde_json::from_str(annot).map_err(BinaryError::InvalidAnnotation)?
+                    };
+                    let content = self.shapes(depth + 1)?;
+                    Shape::Group(GroupShape { content, edit_annot })
+                },
+                SHAPE_CURVE => {
+                    let pen = self.u32()? as usize;
+                    let data = self.curve_data()?;
+                    Shape::Curve(CurveShape { pen, data })
+                },
+                SHAPE_REGION => {
+                    let flags = self.u8()?;
+                    if flags & !(REGION_PEN | REGION_BRUSH) != 0 {
+                        return Err(BinaryError::InvalidValue("region flags"));
+                    }
+
+                    let pen = if flags & REGION_PEN != 0 { Some(self.u32()? as usize) } else { None };
+                    let brush = if flags & REGION_BRUSH != 0 { Some(self.u32()? as usize) } else { None };
+
+                    let count = self.count(4)?;
+                    let mut data = Vec::with_capacity(count);
+                    for _ in 0..count {
+                        data.push(self.curve_data()?);
+                    }
+
+                    Shape::Region(RegionShape { pen, brush, data })
+                },
+                _ => return Err(BinaryError::InvalidValue("shape type"))
+            };
+
+            shapes.push(shape);
+        }
+
+        Ok(shapes)
+    }
+
+    fn curve_data(&mut self) -> Result<CurveData, BinaryError> {
+        let count = self.count(1)?;
+        let verbs = self.take(count)?;
+
+        let mut point_count = 1;
+        for verb in verbs.iter() {
+            point_count += match *verb {
+                VERB_LINE => 1,
+                VERB_QUADRATIC_BEZIER => 2,
+                VERB_CUBIC_BEZIER => 3,
+                _ => return Err(BinaryError::InvalidValue("segment verb"))
+            };
+        }
+
+        let coords = self.take(point_count * 2 * self.precision.coord_size())?;
+        let mut points = decode_points(coords, self.precision);
+
+        let start = points.next().unwrap();
+        // A single precision container loads into single precision curves,
+        // which hold its coordinates exactly.
+        let mut data = CurveData::with_precision(start, count, self.precision);
+
+        for verb in verbs.iter() {
+            let seg = match *verb {
+                VERB_LINE => Segment::Line(LineSegment {
+                    point_2: points.next().unwrap()
+                }),
+                VERB_QUADRATIC_BEZIER => Segment::QuadraticBezier(QuadraticBezierSegment {
+                    point_2: points.next().unwrap(),
+                    point_3: points.next().unwrap()
+                }),
+                _ => Segment::CubicBezier(CubicBezierSegment {
+                    point_2: points.next().unwrap(),
+                    point_3: points.next().unwrap(),
+                    point_4: points.next().unwrap()
+                })
+            };
+            data.push(seg);
+        }
+
+        Ok(data)
+    }
+}
+
+fn decode_points(coords: &[u8], precision: Precision) -> impl Iterator<Item = Point> + '_ {
+    let size = precision.coord_size() * 2;
+
+    coords.chunks_exact(size).map(move |chunk| match precision {
+        Precision::Single => Point {
+            x: f32::from_le_bytes([chunk[0], chunk[1], chunk[2], chunk[3]]) as f64,
+            y: f32::from_le_bytes([chunk[4], chunk[5], chunk[6], chunk[7]]) as f64
+        },
+        Precision::Double => Point {
+            x: f64::from_le_bytes([chunk[0], chunk[1], chunk[2], chunk[3], chunk[4], chunk[5], chunk[6], chunk[7]]),
+            y: f64::from_le_bytes([chunk[8], chunk[9], chunk[10], chunk[11], chunk[12], chunk[13], chunk[14], chunk[15]])
+        }
+    })
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    const IMAGE_STR: &str = r#"{
+  "width": 640,
+  "height": 480,
+  "unit-per-inch": 96,
+  "editor": "T2SY95",
+  "pens": [{
+    "pattern": { "type": "linear-gradient", "point-1": [0, 0], "color-1": [1, 0, 0], "point-2": [10, 0], "color-2": [0, 0, 1, 0.5] },
+    "width": 1.5,
+    "cap": "square",
+    "join": "bevel"
+  }],
+  "brushes": [{
+    "pattern": { "type": "radial-gradient", "center-1": [5, 5], "radius-1": 1, "color-1": [1, 1, 1], "center-2": [5, 5], "radius-2": 4, "color-2": [0, 0, 0] }
+  }, {
+    "pattern": { "type": "monochrome", "color": [0.25, 0.5, 0.75] }
+  }],
+  "shapes": [{
+    "type": "group",
+    "edit-annot": { "locked": true },
+    "content": [{
+      "type": "curve",
+      "pen": 0,
+      "data": [[0.1, 0.2], ["L", [1, 2]], ["Q", [3, 4], [5, 6]], ["C", [7, 8], [9, 10], [11, 12]]]
+    }]
+  }, {
+    "type": "region",
+    "brush": 1,
+    "data": [[[0, 0], ["L", [10, 0]], ["L", [10, 10]]], [[2, 2]]]
+  }, {
+    "type": "region",
+    "pen": 0,
+    "brush": 0,
+    "data": []
+  }]
+}"#;
+
+    #[test]
+    fn test_binary_round_trip() {
+        let image: Image = serde_json::from_str(IMAGE_STR).unwrap();
+        let bytes = encode_image(&image, Precision::Double);
+        assert!(is_binary(&bytes));
+
+        let decoded = decode_image(&bytes).unwrap();
+        assert_eq!(serde_json::to_string(&image).unwrap(), serde_json::to_string(&decoded).unwrap());
+    }
+
+    #[test]
+    fn test_binary_single_precision() {
+        let image: Image = serde_json::from_str(IMAGE_STR).unwrap();
+        let single = encode_image(&image, Precision::Single);
+        let double = encode_image(&image, Precision::Double);
+        assert!(single.len() < double.len());
+
+        let decoded = decode_image(&single).unwrap();
+        if let Shape::Group(group) = &decoded.shapes[0] {
+            if let Shape::Curve(curve) = &group.content[0] {
+                assert_eq!(0.1f32 as f64, curve.data.start().x);
+                assert_eq!(0.2f32 as f64, curve.data.start().y);
+                assert_eq!(3, curve.data.len());
+            } else {
+                assert!(false);
+            }
+        } else {
+            assert!(false);
+        }
+    }
+
+    #[test]
+    fn test_binary_errors() {
+        let image: Image = serde_json::from_str(IMAGE_STR).unwrap();
+        let bytes = encode_image(&image, Precision::Double);
+
+        assert!(matches!(decode_image(b"LISON"), Err(BinaryError::InvalidMagic)));
+        assert!(matches!(decode_image(&bytes[..bytes.len() - 1]), Err(BinaryError::UnexpectedEnd)));
+
+        let mut bad_version = bytes.clone();
+        bad_version[4] = 99;
+        assert!(matches!(decode_image(&bad_version), Err(BinaryError::UnsupportedVersion(99))));
+
+        let mut trailing = bytes.clone();
+        trailing.push(0);
+        assert!(matches!(decode_image(&trailing), Err(BinaryError::InvalidValue(_))));
+    }
+
+    #[test]
+    fn test_binary_group_depth() {
+        let nested = |depth: usize| {
+            let mut image: Image = serde_json::from_str(IMAGE_STR).unwrap();
+
+            for _ in 0..depth {
+                let content = std::mem::take(&mut image.shapes);
+                image.shapes = vec![Shape::Group(GroupShape { content, edit_annot: serde_json::Value::Null })];
+            }
+
+            encode_image(&image, Precision::Double)
+        };
+
+        assert!(decode_image(&nested(RECURSION_LIMIT - 2)).is_ok());
+        assert!(matches!(decode_image(&nested(RECURSION_LIMIT + 1)), Err(BinaryError::InvalidValue("group depth"))));
+    }
+}
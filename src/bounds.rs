@@ -0,0 +1,331 @@
+use crate::image::*;
+
+// How far from a whole pixel a rectangle's edges may be and still count as
+// pixel-aligned.
+pub(crate) const ALIGNMENT: f64 = 1e-6;
+
+#[derive(Clone, Copy, PartialEq, Debug)]
+pub struct Rect {
+    pub min_x: f64,
+    pub min_y: f64,
+    pub max_x: f64,
+    pub max_y: f64
+}
+
+impl Rect {
+    pub const EMPTY: Rect = Rect {
+        min_x: f64::INFINITY,
+        min_y: f64::INFINITY,
+        max_x: f64::NEG_INFINITY,
+        max_y: f64::NEG_INFINITY
+    };
+
+    pub fn new(x: f64, y: f64, width: f64, height: f64) -> Rect {
+        Rect { min_x: x, min_y: y, max_x: x + width, max_y: y + height }
+    }
+
+    pub fn is_empty(&self) -> bool {
+        !(self.min_x <= self.max_x && self.min_y <= self.max_y)
+    }
+
+    pub fn include(&mut self, point: Point) {
+        self.min_x = self.min_x.min(point.x);
+        self.min_y = self.min_y.min(point.y);
+        self.max_x = self.max_x.max(point.x);
+        self.max_y = self.max_y.max(point.y);
+    }
+
+    pub fn union(&self, other: &Rect) -> Rect {
+        Rect {
+            min_x: self.min_x.min(other.min_x),
+            min_y: self.min_y.min(other.min_y),
+            max_x: self.max_x.max(other.max_x),
+            max_y: self.max_y.max(other.max_y)
+        }
+    }
+
+    pub fn inflate(&self, amount: f64) -> Rect {
+        if self.is_empty() {
+            return *self;
+        }
+
+        Rect {
+            min_x: self.min_x - amount,
+            min_y: self.min_y - amount,
+            max_x: self.max_x + amount,
+            max_y: self.max_y + amount
+        }
+    }
+
+    pub fn scale(&self, factor: f64) -> Rect {
+        if self.is_empty() {
+            return *self;
+        }
+
+        Rect {
+            min_x: self.min_x * factor,
+            min_y: self.min_y * factor,
+            max_x: self.max_x * factor,
+            max_y: self.max_y * factor
+        }
+    }
+
+    // For a rectangle in output pixels.
+    pub(crate) fn is_aligned(&self) -> bool {
+        let whole = |value: f64| (value - value.round()).abs() < ALIGNMENT;
+        whole(self.min_x) && whole(self.min_y) && whole(self.max_x) && whole(self.max_y)
+    }
+
+    pub fn intersects(&self, other: &Rect) -> bool {
+        self.min_x <= other.max_x && other.min_x <= self.max_x
+            && self.min_y <= other.max_y && other.min_y <= self.max_y
+    }
+}
+
+// Cairo's default miter limit. A miter join reaches at most this many
+// half line widths away from the joint.
+pub(crate) const MITER_LIMIT: f64 = 10.0;
+
+pub fn stroke_extent(pen: &Pen) -> f64 {
+    let join = match pen.join {
+        LineJoin::Miter => MITER_LIMIT,
+        LineJoin::Round | LineJoin::Bevel => 1.0
+    };
+    let cap = match pen.cap {
+        LineCap::Square => std::f64::consts::SQRT_2,
+        LineCap::Butt | LineCap::Round => 1.0
+    };
+
+    pen.width.abs() / 2.0 * join.max(cap)
+}
+
+// Solve a * t^2 + b * t + c = 0 for the parameters strictly inside (0, 1).
+fn unit_roots(a: f64, b: f64, c: f64) -> impl Iterator<Item = f64> {
+    let mut roots = [f64::NAN; 2];
+
+    if a.abs() < 1e-12 {
+        if b.abs() >= 1e-12 {
+            roots[0] = -c / b;
+        }
+    } else {
+        let disc = b * b - 4.0 * a * c;
+
+        if disc >= 0.0 {
+            let sqrt = disc.sqrt();
+            roots[0] = (-b + sqrt) / (2.0 * a);
+            roots[1] = (-b - sqrt) / (2.0 * a);
+        }
+    }
+
+    roots.into_iter().filter(|&t| t > 0.0 && t < 1.0)
+}
+
+fn quadratic_extrema(rect: &mut Rect, p1: Point, p2: Point, p3: Point) {
+    let at = |t: f64, a: f64, b: f64, c: f64| {
+        let s = 1.0 - t;
+        s * s * a + 2.0 * s * t * b + t * t * c
+    };
+
+    for t in unit_roots(0.0, p1.x - 2.0 * p2.x + p3.x, p2.x - p1.x) {
+        rect.include(Point { x: at(t, p1.x, p2.x, p3.x), y: at(t, p1.y, p2.y, p3.y) });
+    }
+
+    for t in unit_roots(0.0, p1.y - 2.0 * p2.y + p3.y, p2.y - p1.y) {
+        rect.include(Point { x: at(t, p1.x, p2.x, p3.x), y: at(t, p1.y, p2.y, p3.y) });
+    }
+}
+
+fn cubic_extrema(rect: &mut Rect, p1: Point, p2: Point, p3: Point, p4: Point) {
+    let at = |t: f64, a: f64, b: f64, c: f64, d: f64| {
+        let s = 1.0 - t;
+        s * s * s * a + 3.0 * s * s * t * b + 3.0 * s * t * t * c + t * t * t * d
+    };
+
+    // The derivative divided by 3.
+    let coef = |a: f64, b: f64, c: f64, d: f64| (-a + 3.0 * b - 3.0 * c + d, 2.0 * (a - 2.0 * b + c), b - a);
+
+    let (ax, bx, cx) = coef(p1.x, p2.x, p3.x, p4.x);
+    let (ay, by, cy) = coef(p1.y, p2.y, p3.y, p4.y);
+
+    for t in unit_roots(ax, bx, cx).chain(unit_roots(ay, by, cy)) {
+        rect.include(Point {
+            x: at(t, p1.x, p2.x, p3.x, p4.x),
+            y: at(t, p1.y, p2.y, p3.y, p4.y)
+        });
+    }
+}
+
+pub fn curve_data_bounds(data: &CurveData) -> Rect {
+    let mut rect = Rect::EMPTY;
+    rect.include(data.start());
+
+    let mut current = data.start();
+
+    for seg in data.segments() {
+        match seg {
+            Segment::Line(line) => {
+                current = line.point_2;
+            },
+            Segment::QuadraticBezier(bezier) => {
+                quadratic_extrema(&mut rect, current, bezier.point_2, bezier.point_3);
+                current = bezier.point_3;
+            },
+            Segment::CubicBezier(bezier) => {
+                cubic_extrema(&mut rect, current, bezier.point_2, bezier.point_3, bezier.point_4);
+                current = bezier.point_4;
+            }
+        }
+
+        rect.include(current);
+    }
+
+    rect
+}
+
+// The rectangle a subpath of lines traces when it is one with axis-aligned
+// sides, in either direction and closed or not.
+pub fn rectangle(data: &CurveData) -> Option<Rect> {
+    let mut corners = [data.start(); 5];
+    let mut count = 1;
+
+    for seg in data.segments() {
+        match seg {
+            Segment::Line(line) if count < corners.len() => {
+                corners[count] = line.point_2;
+                count += 1;
+            },
+            _ => return None
+        }
+    }
+
+    if count == 5 && corners[4] == corners[0] {
+        count = 4;
+    }
+
+    if count != 4 {
+        return None;
+    }
+
+    let horizontal = |i: usize| corners[i].y == corners[(i + 1) % 4].y && corners[i].x != corners[(i + 1) % 4].x;
+    let vertical = |i: usize| corners[i].x == corners[(i + 1) % 4].x && corners[i].y != corners[(i + 1) % 4].y;
+
+    if (0..4).all(|i| if i % 2 == 0 { horizontal(i) } else { vertical(i) })
+        || (0..4).all(|i| if i % 2 == 0 { vertical(i) } else { horizontal(i) }) {
+        Some(curve_data_bounds(data))
+    } else {
+        None
+    }
+}
+
+// Opaque solid rectangles with no outline cover whole pixels when their
+// edges land on pixel boundaries, so any number of them in one color can
+// be filled together as a union of rectangles.
+pub(crate) fn opaque_rectangle(brushes: &[Brush], pen: Option<usize>, brush: Option<usize>, data: &[CurveData]) -> Option<Rect> {
+    let opaque = brush.and_then(|brush| brushes.get(brush)).is_some_and(|brush| matches!(&brush.pattern,
+        Pattern::Monochrome(pat) if pat.color.alpha >= 1.0));
+
+    match data {
+        [data] if pen.is_none() && opaque => rectangle(data),
+        _ => None
+    }
+}
+
+fn pen_extent(image: &Image, pen: usize) -> f64 {
+    image.pens.get(pen).map_or(0.0, stroke_extent)
+}
+
+pub fn shape_bounds(shape: &Shape, image: &Image) -> Rect {
+    match shape {
+        Shape::Group(group) => group.content.iter()
+            .fold(Rect::EMPTY, |rect, child| rect.union(&shape_bounds(child, image))),
+        Shape::Curve(curve) => curve_data_bounds(&curve.data)
+            .inflate(pen_extent(image, curve.pen)),
+        Shape::Region(region) => {
+            let rect = region.data.iter()
+                .fold(Rect::EMPTY, |rect, data| rect.union(&curve_data_bounds(data)));
+
+            match region.pen {
+                Some(pen) => rect.inflate(pen_extent(image, pen)),
+                None => rect
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_rect() {
+        assert!(Rect::EMPTY.is_empty());
+        assert!(!Rect::new(0.0, 0.0, 0.0, 0.0).is_empty());
+
+        let r1 = Rect::new(0.0, 0.0, 10.0, 10.0);
+        let r2 = Rect::new(10.0, 5.0, 10.0, 10.0);
+        let r3 = Rect::new(11.0, 0.0, 1.0, 1.0);
+        assert!(r1.intersects(&r2));
+        assert!(!r1.intersects(&r3));
+        assert!(!r1.intersects(&Rect::EMPTY));
+        assert_eq!(Rect { min_x: 0.0, min_y: 0.0, max_x: 20.0, max_y: 15.0 }, r1.union(&r2));
+        assert_eq!(r1, r1.union(&Rect::EMPTY));
+        assert_eq!(Rect { min_x: -1.0, min_y: -1.0, max_x: 11.0, max_y: 11.0 }, r1.inflate(1.0));
+    }
+
+    #[test]
+    fn test_rectangle() {
+        let data = |json: &str| serde_json::from_str::<CurveData>(json).unwrap();
+
+        assert_eq!(Some(Rect::new(1.0, 2.0, 3.0, 4.0)), rectangle(&data("[[1, 2], [\"L\", [4, 2]], [\"L\", [4, 6]], [\"L\", [1, 6]]]")));
+        assert_eq!(Some(Rect::new(1.0, 2.0, 3.0, 4.0)), rectangle(&data("[[1, 2], [\"L\", [1, 6]], [\"L\", [4, 6]], [\"L\", [4, 2]], [\"L\", [1, 2]]]")));
+        assert_eq!(None, rectangle(&data("[[1, 2], [\"L\", [4, 2]], [\"L\", [4, 6]], [\"L\", [2, 6]]]")));
+        assert_eq!(None, rectangle(&data("[[1, 2], [\"L\", [2, 2]], [\"L\", [4, 2]], [\"L\", [4, 6]], [\"L\", [1, 6]]]")));
+        assert_eq!(None, rectangle(&data("[[1, 2], [\"L\", [4, 2]], [\"Q\", [5, 4], [4, 6]], [\"L\", [1, 6]]]")));
+        assert_eq!(None, rectangle(&data("[[1, 2], [\"L\", [4, 2]], [\"L\", [1, 2]], [\"L\", [4, 2]]]")));
+    }
+
+    #[test]
+    fn test_shape_bounds() {
+        let image: Image = serde_json::from_str(r#"{
+  "width": 100,
+  "height": 100,
+  "unit-per-inch": 72,
+  "pens": [{
+    "pattern": { "type": "monochrome", "color": [0, 0, 0] },
+    "width": 2,
+    "cap": "round",
+    "join": "round"
+  }],
+  "brushes": [],
+  "shapes": [{
+    "type": "group",
+    "content": [{
+      "type": "curve",
+      "pen": 0,
+      "data": [[10, 10], ["L", [20, 10]]]
+    }, {
+      "type": "region",
+      "data": [[[30, 30], ["Q", [40, 50], [50, 30]]]]
+    }]
+  }]
+}"#).unwrap();
+
+        let rect = shape_bounds(&image.shapes[0], &image);
+        assert_eq!(Rect { min_x: 9.0, min_y: 9.0, max_x: 50.0, max_y: 40.0 }, rect);
+    }
+
+    #[test]
+    fn test_curve_data_bounds() {
+        let data: CurveData = serde_json::from_str(r#"[[0, 0], ["C", [0, 10], [10, 10], [10, 0]], ["L", [-5, -5]]]"#).unwrap();
+        let rect = curve_data_bounds(&data);
+        assert_eq!(-5.0, rect.min_x);
+        assert_eq!(-5.0, rect.min_y);
+        assert_eq!(10.0, rect.max_x);
+        assert!((rect.max_y - 7.5).abs() < 1e-9);
+
+        let data: CurveData = serde_json::from_str(r#"[[0, 0], ["Q", [20, 5], [0, 10]]]"#).unwrap();
+        let rect = curve_data_bounds(&data);
+        assert!((rect.max_x - 10.0).abs() < 1e-9);
+        assert_eq!(10.0, rect.max_y);
+    }
+}
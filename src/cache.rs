@@ -0,0 +1,376 @@
+use std::collections::{BTreeMap, HashMap, HashSet};
+
+use cairo::{Context, Format, ImageSurface, Matrix, Result};
+
+use crate::bounds::*;
+use crate::hash::*;
+use crate::image::*;
+use crate::render::*;
+
+// Groups are keyed by their translation-invariant hash, the scale they are
+// drawn at and the subpixel position of their anchor, so a cached raster
+// is only reused where it lands on the same pixel grid.
+#[derive(Clone, Copy, PartialEq, Eq, Hash)]
+struct GroupKey {
+    hash: u64,
+    factor: u64,
+    phase: (u16, u16)
+}
+
+// Subpixel positions closer than Cairo's fixed point resolution are
+// treated as equal.
+const PHASES: f64 = 256.0;
+
+const MAX_SEEN: usize = 1 << 16;
+
+struct CachedGroup {
+    surface: ImageSurface,
+    // The group drawn, to check a hit against, and its anchor.
+    group: Shape,
+    anchor: Point,
+    // Offset of the surface from the pixel holding the anchor.
+    x: f64,
+    y: f64,
+    size: usize,
+    used: u64
+}
+
+// Rasters of groups seen more than once, drawn later as a single surface
+// paint. The first copy of a group is drawn as usual, the second is drawn
+// into the cache, and later ones hit it. Entries are evicted least recently
+// used first to stay within the budget in bytes; order maps each entry's
+// last use to its key, so the oldest is found without a scan. Entries name
+// pens and brushes by index, so the cache starts over whenever the pens and
+// brushes it was filled with change.
+pub struct GroupCache {
+    budget: usize,
+    resources: Option<(Vec<Pen>, Vec<Brush>)>,
+    size: usize,
+    clock: u64,
+    hits: usize,
+    seen: HashSet<GroupKey>,
+    entries: HashMap<GroupKey, CachedGroup>,
+    order: BTreeMap<u64, GroupKey>
+}
+
+impl GroupCache {
+    pub fn new(budget: usize) -> GroupCache {
+        GroupCache {
+            budget,
+            resources: None,
+            size: 0,
+            clock: 0,
+            hits: 0,
+            seen: HashSet::new(),
+            entries: HashMap::new(),
+            order: BTreeMap::new()
+        }
+    }
+
+    pub fn size(&self) -> usize {
+        self.size
+    }
+
+    pub fn hits(&self) -> usize {
+        self.hits
+    }
+
+    pub fn clear(&mut self) {
+        self.size = 0;
+        self.seen.clear();
+        self.entries.clear();
+        self.order.clear();
+    }
+
+    fn touch(&mut self, key: &GroupKey) -> Option<&CachedGroup> {
+        self.clock += 1;
+
+        let entry = self.entries.get_mut(key)?;
+        self.order.remove(&entry.used);
+        entry.used = self.clock;
+        self.order.insert(entry.used, *key);
+
+        Some(entry)
+    }
+
+    fn insert(&mut self, key: GroupKey, entry: CachedGroup) {
+        self.size += entry.size;
+        self.order.insert(entry.used, key);
+
+        if let Some(old) = self.entries.insert(key, entry) {
+            self.size -= old.size;
+            self.order.remove(&old.used);
+        }
+
+        while self.size > self.budget {
+            let Some((_, oldest)) = self.order.pop_first() else {
+                break;
+            };
+
+            if let Some(entry) = self.entries.remove(&oldest) {
+                self.size -= entry.size;
+            }
+        }
+    }
+}
+
+struct CacheRenderer<'a> {
+    context: &'a Context,
+    image: &'a Image,
+    resources: &'a Resources,
+    hashes: GroupHashes,
+    scaler: Scaler,
+    base: Matrix
+}
+
+impl CacheRenderer<'_> {
+    fn render_shape(&self, shape: &Shape, cache: &mut GroupCache) -> Result<()> {
+        match shape {
+            Shape::Group(group) => self.render_group(shape, group, cache),
+            _ => render_shape(self.context, shape, self.resources)
+        }
+    }
+
+    fn render_content(&self, group: &GroupShape, cache: &mut GroupCache) -> Result<()> {
+        for child in group.content.iter() {
+            self.render_shape(child, cache)?;
+        }
+
+        Ok(())
+    }
+
+    fn paint(&self, entry: &CachedGroup, x: f64, y: f64) -> Result<()> {
+        self.context.save()?;
+        self.context.set_matrix(self.base);
+        self.context.set_source_surface(&entry.surface, x + entry.x, y + entry.y)?;
+        self.context.paint()?;
+        self.context.restore()
+    }
+
+    fn render_group(&self, shape: &Shape, group: &GroupShape, cache: &mut GroupCache) -> Result<()> {
+        let Some((hash, anchor)) = self.hashes.get(group) else {
+            return self.render_content(group, cache);
+        };
+
+        let factor = self.scaler.factor();
+        let (ax, ay) = (anchor.x * factor, anchor.y * factor);
+        let (x, y) = (ax.floor(), ay.floor());
+
+        let key = GroupKey {
+            hash,
+            factor: factor.to_bits(),
+            phase: (((ax - x) * PHASES) as u16, ((ay - y) * PHASES) as u16)
+        };
+
+        // The hash only says a hit is likely to be a copy.
+        if let Some(entry) = cache.touch(&key) {
+            let offset = Point { x: anchor.x - entry.anchor.x, y: anchor.y - entry.anchor.y };
+
+            if !is_translated_copy(shape, &entry.group, offset) {
+                return self.render_content(group, cache);
+            }
+
+            self.paint(entry, x, y)?;
+            cache.hits += 1;
+            return Ok(());
+        }
+
+        if cache.seen.len() >= MAX_SEEN {
+            cache.seen.clear();
+        }
+
+        if cache.seen.insert(key) {
+            return self.render_content(group, cache);
+        }
+
+        // One extra pixel covers antialiasing.
+        let bounds = shape_bounds(shape, self.image).scale(factor).inflate(1.0);
+        let left = (bounds.min_x - x).floor();
+        let top = (bounds.min_y - y).floor();
+        let width = (bounds.max_x - x).ceil() - left;
+        let height = (bounds.max_y - y).ceil() - top;
+
+        if width * height * 4.0 > cache.budget as f64 {
+            return self.render_content(group, cache);
+        }
+
+        // Caching only saves time, so a group too large for a surface, or
+        // one there is no memory for, is drawn as usual.
+        let Ok(surface) = ImageSurface::create(Format::ARgb32, width as i32, height as i32) else {
+            return self.render_content(group, cache);
+        };
+        {
+            let offscreen = Context::new(&surface)?;
+            offscreen.translate(-(x + left), -(y + top));
+
+            self.scaler.draw(&offscreen, || {
+                for child in group.content.iter() {
+                    render_shape(&offscreen, child, self.resources)?;
+                }
+
+                Ok(())
+            })?;
+        }
+        surface.flush();
+
+        let entry = CachedGroup {
+            size: surface.stride() as usize * height as usize,
+            surface,
+            group: shape.clone(),
+            anchor,
+            x: left,
+            y: top,
+            used: cache.clock
+        };
+
+        self.paint(&entry, x, y)?;
+        cache.insert(key, entry);
+
+        Ok(())
+    }
+}
+
+// Like render_with_resources, but draws repeated groups from cache. The
+// result can differ from a plain render by rounding, and the cached rasters
+// assume the context is not rotated or scaled by the caller.
+pub fn render_with_cache(context: &Context, image: &Image, resources: &Resources, cache: &mut GroupCache, ppi: f64, scale: f64) -> Result<()> {
+    if cache.resources.as_ref().is_none_or(|(pens, brushes)| *pens != image.pens || *brushes != image.brushes) {
+        cache.clear();
+        cache.resources = Some((image.pens.clone(), image.brushes.clone()));
+    }
+
+    let renderer = CacheRenderer {
+        context,
+        image,
+        resources,
+        hashes: GroupHashes::new(image),
+        scaler: Scaler::new(image.unit_per_inch, ppi, scale),
+        base: context.matrix()
+    };
+
+    renderer.scaler.draw(context, || {
+        for shape in image.shapes.iter() {
+            renderer.render_shape(shape, cache)?;
+        }
+
+        Ok(())
+    })
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn icons(count: usize) -> Image {
+        let icon = |x: f64| format!(r#"{{
+      "type": "group",
+      "content": [{{
+        "type": "region",
+        "brush": 0,
+        "data": [[[{}, 10], ["L", [{}, 10]], ["L", [{}, 20]]]]
+      }}, {{
+        "type": "curve",
+        "pen": 0,
+        "data": [[{}, 10], ["L", [{}, 20]]]
+      }}]
+    }}"#, x, x + 10.0, x + 10.0, x, x + 10.0);
+
+        let shapes: Vec<String> = (0..count).map(|i| icon(i as f64 * 20.0)).collect();
+
+        serde_json::from_str(&format!(r#"{{
+  "width": 100,
+  "height": 100,
+  "unit-per-inch": 72,
+  "pens": [{{ "pattern": {{ "type": "monochrome", "color": [0, 0, 0] }}, "width": 1, "cap": "butt", "join": "miter" }}],
+  "brushes": [{{ "pattern": {{ "type": "monochrome", "color": [1, 0, 0] }} }}],
+  "shapes": [{}]
+}}"#, shapes.join(","))).unwrap()
+    }
+
+    fn render_icons(image: &Image, cache: &mut GroupCache) {
+        let surface = ImageSurface::create(Format::ARgb32, 100, 100).unwrap();
+        let context = Context::new(&surface).unwrap();
+        render_with_cache(&context, image, &Resources::new(image), cache, 72.0, 1.0).unwrap();
+    }
+
+    #[test]
+    fn test_group_cache() {
+        let image = icons(4);
+        let mut cache = GroupCache::new(1 << 20);
+
+        render_icons(&image, &mut cache);
+        assert_eq!(2, cache.hits());
+        assert!(cache.size() > 0);
+
+        render_icons(&image, &mut cache);
+        assert_eq!(6, cache.hits());
+
+        cache.clear();
+        assert_eq!(0, cache.size());
+    }
+
+    #[test]
+    fn test_group_cache_checks_hits() {
+        let image = icons(4);
+        let mut cache = GroupCache::new(1 << 20);
+        render_icons(&image, &mut cache);
+        assert_eq!(2, cache.hits());
+
+        // Entries that do not match what they are keyed by are never drawn.
+        for entry in cache.entries.values_mut() {
+            entry.anchor.x += 1.0;
+        }
+
+        render_icons(&image, &mut cache);
+        assert_eq!(2, cache.hits());
+
+        // Other pens empty the cache, leaving only the new icon's entry.
+        assert_eq!(1, cache.entries.len());
+        let mut changed = icons(4);
+        changed.pens[0].width = 2.0;
+        render_icons(&changed, &mut cache);
+        assert_eq!(1, cache.entries.len());
+    }
+
+    #[test]
+    fn test_group_cache_eviction() {
+        let mut cache = GroupCache::new(30);
+        let key = |hash| GroupKey { hash, factor: 0, phase: (0, 0) };
+        let group = Shape::Group(GroupShape { content: Vec::new(), edit_annot: serde_json::Value::Null });
+        let entry = |used| CachedGroup {
+            surface: ImageSurface::create(Format::ARgb32, 1, 1).unwrap(),
+            group: group.clone(),
+            anchor: Point { x: 0.0, y: 0.0 },
+            x: 0.0,
+            y: 0.0,
+            size: 10,
+            used
+        };
+
+        // Inserts follow a miss, as in render_group, which moves the clock.
+        for hash in 0..3 {
+            assert!(cache.touch(&key(hash)).is_none());
+            cache.insert(key(hash), entry(cache.clock));
+        }
+
+        assert!(cache.touch(&key(0)).is_some());
+
+        // 1 is now the least recently used.
+        assert!(cache.touch(&key(3)).is_none());
+        cache.insert(key(3), entry(cache.clock));
+        assert_eq!(30, cache.size());
+        assert!(cache.entries.contains_key(&key(0)));
+        assert!(!cache.entries.contains_key(&key(1)));
+        assert_eq!(3, cache.order.len());
+    }
+
+    #[test]
+    fn test_group_cache_budget() {
+        let image = icons(4);
+        let mut cache = GroupCache::new(16);
+
+        render_icons(&image, &mut cache);
+        assert_eq!(0, cache.hits());
+        assert_eq!(0, cache.size());
+    }
+}
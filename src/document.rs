@@ -0,0 +1,845 @@
+use std::fmt;
+use std::ops::Range;
+
+use serde::Deserialize;
+use serde::de::{DeserializeSeed, Deserializer, Error, IgnoredAny, MapAccess, SeqAccess, Visitor};
+
+use crate::image::*;
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum ShapeKind {
+    Group,
+    Curve { pen: usize },
+    Region { pen: Option<usize>, brush: Option<usize> }
+}
+
+struct Node {
+    kind: ShapeKind,
+    // One past the last node of the subtree.
+    end: usize,
+    subpaths: Range<usize>
+}
+
+// Where a subpath starts in the verb and point buffers. It ends where the
+// next one starts.
+#[derive(Clone, Copy)]
+struct Subpath {
+    verbs: usize,
+    points: usize
+}
+
+// An image held in a few flat buffers instead of a tree of vectors. Shapes
+// are stored in pre-order, each knowing where its subtree ends, and the
+// subpaths of every shape share one verb and one point buffer. Parsing
+// only grows those buffers and dropping frees them at once, which matters
+// when documents are loaded and discarded at a high rate. Edit annotations
+// are skipped. Points are held at one precision for the whole document,
+// double unless parsed through DocumentSeed or built with
+// from_image_with_precision.
+pub struct Document {
+    pub width: f64,
+    pub height: f64,
+    pub unit_per_inch: f64,
+    pub editor: Option<String>,
+    pub pens: Vec<Pen>,
+    pub brushes: Vec<Brush>,
+    nodes: Vec<Node>,
+    subpaths: Vec<Subpath>,
+    verbs: Vec<Verb>,
+    points: PointBuffer
+}
+
+#[derive(Clone, Copy)]
+pub struct ShapeRef<'a> {
+    document: &'a Document,
+    index: usize
+}
+
+impl<'a> ShapeRef<'a> {
+    // The position of the shape in pre-order.
+    pub fn index(&self) -> usize {
+        self.index
+    }
+
+    pub fn kind(&self) -> ShapeKind {
+        self.document.nodes[self.index].kind
+    }
+
+    pub fn children(&self) -> Children<'a> {
+        Children { document: self.document, next: self.index + 1, end: self.document.nodes[self.index].end }
+    }
+
+    // The one subpath of a curve, or the subpaths of a region.
+    pub fn subpaths(&self) -> impl ExactSizeIterator<Item = CurveRef<'a>> + use<'a> {
+        let document = self.document;
+        document.nodes[self.index].subpaths.clone().map(move |i| document.subpath(i))
+    }
+
+    pub fn to_shape(&self) -> Shape {
+        match self.kind() {
+            ShapeKind::Group => Shape::Group(GroupShape {
+                content: self.children().map(|child| child.to_shape()).collect(),
+                edit_annot: serde_json::Value::Null
+            }),
+            ShapeKind::Curve { pen } => Shape::Curve(CurveShape {
+                pen,
+                // A curve always has exactly one subpath.
+                data: self.subpaths().next().unwrap().to_curve_data()
+            }),
+            ShapeKind::Region { pen, brush } => Shape::Region(RegionShape {
+                pen,
+                brush,
+                data: self.subpaths().map(|data| data.to_curve_data()).collect()
+            })
+        }
+    }
+}
+
+pub struct Children<'a> {
+    document: &'a Document,
+    next: usize,
+    end: usize
+}
+
+impl<'a> Iterator for Children<'a> {
+    type Item = ShapeRef<'a>;
+
+    fn next(&mut self) -> Option<ShapeRef<'a>> {
+        if self.next >= self.end {
+            return None;
+        }
+
+        let index = self.next;
+        self.next = self.document.nodes[index].end;
+
+        Some(ShapeRef { document: self.document, index })
+    }
+}
+
+impl Document {
+    pub fn from_image(image: &Image) -> Document {
+        Document::from_image_with_precision(image, Precision::Double)
+    }
+
+    pub fn from_image_with_precision(image: &Image, precision: Precision) -> Document {
+        let mut builder = Builder::new(precision);
+        builder.add_shapes(&image.shapes);
+
+        builder.finish(Header {
+            width: image.width,
+            height: image.height,
+            unit_per_inch: image.unit_per_inch,
+            editor: image.editor.clone(),
+            pens: image.pens.clone(),
+            brushes: image.brushes.clone()
+        })
+    }
+
+    pub fn to_image(&self) -> Image {
+        Image {
+            width: self.width,
+            height: self.height,
+            unit_per_inch: self.unit_per_inch,
+            editor: self.editor.clone(),
+            pens: self.pens.clone(),
+            brushes: self.brushes.clone(),
+            shapes: self.shapes().map(|shape| shape.to_shape()).collect()
+        }
+    }
+
+    pub fn precision(&self) -> Precision {
+        self.points.precision()
+    }
+
+    // The number of shapes, groups included.
+    pub fn len(&self) -> usize {
+        self.nodes.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.nodes.is_empty()
+    }
+
+    pub fn shape(&self, index: usize) -> ShapeRef<'_> {
+        assert!(index < self.nodes.len());
+        ShapeRef { document: self, index }
+    }
+
+    // The top-level shapes.
+    pub fn shapes(&self) -> Children<'_> {
+        Children { document: self, next: 0, end: self.nodes.len() }
+    }
+
+    // The curves and regions in document order, which pre-order already is.
+    pub fn leaves(&self) -> impl Iterator<Item = ShapeRef<'_>> {
+        (0..self.nodes.len())
+            .filter(|&index| self.nodes[index].kind != ShapeKind::Group)
+            .map(|index| ShapeRef { document: self, index })
+    }
+
+    fn subpath(&self, i: usize) -> CurveRef<'_> {
+        let start = self.subpaths[i];
+        let end = self.subpaths.get(i + 1)
+            .copied()
+            .unwrap_or(Subpath { verbs: self.verbs.len(), points: self.points.len() });
+
+        CurveRef::new(&self.verbs[start.verbs..end.verbs], self.points.slice(start.points..end.points))
+    }
+}
+
+struct Header {
+    width: f64,
+    height: f64,
+    unit_per_inch: f64,
+    editor: Option<String>,
+    pens: Vec<Pen>,
+    brushes: Vec<Brush>
+}
+
+struct Builder {
+    nodes: Vec<Node>,
+    subpaths: Vec<Subpath>,
+    verbs: Vec<Verb>,
+    points: PointBuffer
+}
+
+impl Builder {
+    fn new(precision: Precision) -> Builder {
+        Builder { nodes: Vec::new(), subpaths: Vec::new(), verbs: Vec::new(), points: PointBuffer::with_capacity(precision, 0) }
+    }
+
+    // Reserves the node, so that it precedes its content.
+    fn begin_shape(&mut self) -> usize {
+        self.nodes.push(Node { kind: ShapeKind::Group, end: 0, subpaths: 0..0 });
+        self.nodes.len() - 1
+    }
+
+    fn end_shape(&mut self, index: usize, kind: ShapeKind, first_subpath: usize) {
+        let end = self.nodes.len();
+        let subpaths = first_subpath..self.subpaths.len();
+        self.nodes[index] = Node { kind, end, subpaths };
+    }
+
+    fn begin_subpath(&mut self, start: Point) {
+        self.subpaths.push(Subpath { verbs: self.verbs.len(), points: self.points.len() });
+        self.points.push(start);
+    }
+
+    fn add_curve_data(&mut self, data: &CurveData) {
+        self.begin_subpath(data.start());
+        self.verbs.extend_from_slice(data.verbs());
+        for point in data.points().skip(1) {
+            self.points.push(point);
+        }
+    }
+
+    fn add_shapes(&mut self, shapes: &[Shape]) {
+        for shape in shapes {
+            let index = self.begin_shape();
+            let first_subpath = self.subpaths.len();
+
+            let kind = match shape {
+                Shape::Group(group) => {
+                    self.add_shapes(&group.content);
+                    ShapeKind::Group
+                },
+                Shape::Curve(curve) => {
+                    self.add_curve_data(&curve.data);
+                    ShapeKind::Curve { pen: curve.pen }
+                },
+                Shape::Region(region) => {
+                    for data in region.data.iter() {
+                        self.add_curve_data(data);
+                    }
+
+                    ShapeKind::Region { pen: region.pen, brush: region.brush }
+                }
+            };
+
+            self.end_shape(index, kind, first_subpath);
+        }
+    }
+
+    fn finish(self, header: Header) -> Document {
+        Document {
+            width: header.width,
+            height: header.height,
+            unit_per_inch: header.unit_per_inch,
+            editor: header.editor,
+            pens: header.pens,
+            brushes: header.brushes,
+            nodes: self.nodes,
+            subpaths: self.subpaths,
+            verbs: self.verbs,
+            points: self.points
+        }
+    }
+}
+
+#[derive(Deserialize)]
+#[serde(field_identifier, rename_all = "kebab-case")]
+enum DocumentField {
+    Width,
+    Height,
+    UnitPerInch,
+    Editor,
+    Pens,
+    Brushes,
+    Shapes
+}
+
+#[derive(Deserialize, Clone, Copy, PartialEq)]
+#[serde(rename_all = "kebab-case")]
+enum ShapeTag {
+    Group,
+    Curve,
+    Region
+}
+
+#[derive(Deserialize)]
+#[serde(field_identifier, rename_all = "kebab-case")]
+enum ShapeField {
+    Type,
+    Pen,
+    Brush,
+    Content,
+    Data,
+    EditAnnot
+}
+
+const GROUP_FIELDS: &[&str] = &["type", "content", "edit-annot"];
+const CURVE_FIELDS: &[&str] = &["type", "pen", "data"];
+const REGION_FIELDS: &[&str] = &["type", "pen", "brush", "data"];
+
+struct ShapesSeed<'b>(&'b mut Builder);
+
+impl<'de> DeserializeSeed<'de> for ShapesSeed<'_> {
+    type Value = ();
+
+    fn deserialize<D>(self, deserializer: D) -> Result<(), D::Error>
+    where
+        D: Deserializer<'de>
+    {
+        deserializer.deserialize_seq(self)
+    }
+}
+
+impl<'de> Visitor<'de> for ShapesSeed<'_> {
+    type Value = ();
+
+    fn expecting(&self, formatter: &mut fmt::Formatter<'_>) -> fmt::Result {
+        formatter.write_str("shapes")
+    }
+
+    fn visit_seq<A>(self, mut seq: A) -> Result<(), A::Error>
+    where
+        A: SeqAccess<'de>
+    {
+        while seq.next_element_seed(ShapeSeed(&mut *self.0))?.is_some() {}
+
+        Ok(())
+    }
+}
+
+struct ShapeSeed<'b>(&'b mut Builder);
+
+impl<'de> DeserializeSeed<'de> for ShapeSeed<'_> {
+    type Value = ();
+
+    fn deserialize<D>(self, deserializer: D) -> Result<(), D::Error>
+    where
+        D: Deserializer<'de>
+    {
+        deserializer.deserialize_map(self)
+    }
+}
+
+impl<'de> Visitor<'de> for ShapeSeed<'_> {
+    type Value = ();
+
+    fn expecting(&self, formatter: &mut fmt::Formatter<'_>) -> fmt::Result {
+        formatter.write_str("shape")
+    }
+
+    fn visit_map<A>(self, mut map: A) -> Result<(), A::Error>
+    where
+        A: MapAccess<'de>
+    {
+        let builder = self.0;
+        let index = builder.begin_shape();
+        let first_subpath = builder.subpaths.len();
+
+        let mut tag = None;
+        let mut pen = None;
+        let mut brush = None;
+        let mut content = false;
+        let mut data = false;
+        let mut edit_annot = false;
+        let mut pending = None;
+
+        let unexpected = |tag: Option<ShapeTag>, field: &'static str| match tag {
+            Some(ShapeTag::Group) => A::Error::unknown_field(field, GROUP_FIELDS),
+            Some(ShapeTag::Curve) => A::Error::unknown_field(field, CURVE_FIELDS),
+            _ => A::Error::unknown_field(field, REGION_FIELDS)
+        };
+
+        while let Some(key) = map.next_key::<ShapeField>()? {
+            match key {
+                // A repeated field is refused as the derived Image refuses
+                // it; the builder would otherwise keep both values.
+                ShapeField::Type => {
+                    if tag.is_some() {
+                        return Err(A::Error::duplicate_field("type"));
+                    }
+
+                    tag = Some(map.next_value::<ShapeTag>()?);
+                },
+                ShapeField::Pen => {
+                    if pen.is_some() {
+                        return Err(A::Error::duplicate_field("pen"));
+                    }
+
+                    pen = Some(map.next_value::<Option<usize>>()?);
+                },
+                ShapeField::Brush => {
+                    if brush.is_some() {
+                        return Err(A::Error::duplicate_field("brush"));
+                    }
+
+                    brush = Some(map.next_value::<Option<usize>>()?);
+                },
+                ShapeField::Content => {
+                    if tag.is_some_and(|tag| tag != ShapeTag::Group) {
+                        return Err(unexpected(tag, "content"));
+                    }
+
+                    if content {
+                        return Err(A::Error::duplicate_field("content"));
+                    }
+
+                    map.next_value_seed(ShapesSeed(&mut *builder))?;
+                    content = true;
+                },
+                ShapeField::Data => {
+                    if data {
+                        return Err(A::Error::duplicate_field("data"));
+                    }
+
+                    match tag {
+                        Some(ShapeTag::Group) => return Err(unexpected(tag, "data")),
+                        Some(ShapeTag::Curve) => map.next_value_seed(CurveDataSeed(&mut *builder))?,
+                        Some(ShapeTag::Region) => map.next_value_seed(RegionDataSeed(&mut *builder))?,
+                        // The type nearly always comes first. When it does
+                        // not, the data waits for it.
+                        None => pending = Some(map.next_value::<serde_json::Value>()?)
+                    }
+
+                    data = true;
+                },
+                ShapeField::EditAnnot => {
+                    if tag.is_some_and(|tag| tag != ShapeTag::Group) {
+                        return Err(unexpected(tag, "edit-annot"));
+                    }
+
+                    if edit_annot {
+                        return Err(A::Error::duplicate_field("edit-annot"));
+                    }
+
+                    map.next_value::<IgnoredAny>()?;
+                    edit_annot = true;
+                }
+            }
+        }
+
+        let tag = tag.ok_or_else(|| A::Error::missing_field("type"))?;
+
+        if let Some(value) = pending {
+            let result = match tag {
+                ShapeTag::Group => return Err(unexpected(Some(tag), "data")),
+                ShapeTag::Curve => CurveDataSeed(&mut *builder).deserialize(value),
+                ShapeTag::Region => RegionDataSeed(&mut *builder).deserialize(value)
+            };
+
+            result.map_err(A::Error::custom)?;
+        }
+
+        let kind = match tag {
+            ShapeTag::Group => {
+                if pen.is_some() {
+                    return Err(unexpected(Some(tag), "pen"));
+                } else if brush.is_some() {
+                    return Err(unexpected(Some(tag), "brush"));
+                } else if data {
+                    return Err(unexpected(Some(tag), "data"));
+                } else if !content {
+                    return Err(A::Error::missing_field("content"));
+                }
+
+                ShapeKind::Group
+            },
+            ShapeTag::Curve => {
+                if brush.is_some() {
+                    return Err(unexpected(Some(tag), "brush"));
+                } else if content {
+                    return Err(unexpected(Some(tag), "content"));
+                } else if !data {
+                    return Err(A::Error::missing_field("data"));
+                }
+
+                let pen = pen.flatten().ok_or_else(|| A::Error::missing_field("pen"))?;
+                ShapeKind::Curve { pen }
+            },
+            ShapeTag::Region => {
+                if content {
+                    return Err(unexpected(Some(tag), "content"));
+                } else if !data {
+                    return Err(A::Error::missing_field("data"));
+                }
+
+                ShapeKind::Region { pen: pen.flatten(), brush: brush.flatten() }
+            }
+        };
+
+        builder.end_shape(index, kind, first_subpath);
+        Ok(())
+    }
+}
+
+struct CurveDataSeed<'b>(&'b mut Builder);
+
+impl<'de> DeserializeSeed<'de> for CurveDataSeed<'_> {
+    type Value = ();
+
+    fn deserialize<D>(self, deserializer: D) -> Result<(), D::Error>
+    where
+        D: Deserializer<'de>
+    {
+        deserializer.deserialize_seq(self)
+    }
+}
+
+impl<'de> Visitor<'de> for CurveDataSeed<'_> {
+    type Value = ();
+
+    fn expecting(&self, formatter: &mut fmt::Formatter<'_>) -> fmt::Result {
+        formatter.write_str("curve data")
+    }
+
+    fn visit_seq<A>(self, mut seq: A) -> Result<(), A::Error>
+    where
+        A: SeqAccess<'de>
+    {
+        let start = seq.next_element::<Point>()?
+            .ok_or_else(|| A::Error::invalid_length(0, &self))?;
+
+        let builder = self.0;
+        builder.begin_subpath(start);
+
+        while let Some(seg) = seq.next_element::<Segment>()? {
+            push_segment(&mut builder.verbs, &mut builder.points, seg);
+        }
+
+        Ok(())
+    }
+}
+
+struct RegionDataSeed<'b>(&'b mut Builder);
+
+impl<'de> DeserializeSeed<'de> for RegionDataSeed<'_> {
+    type Value = ();
+
+    fn deserialize<D>(self, deserializer: D) -> Result<(), D::Error>
+    where
+        D: Deserializer<'de>
+    {
+        deserializer.deserialize_seq(self)
+    }
+}
+
+impl<'de> Visitor<'de> for RegionDataSeed<'_> {
+    type Value = ();
+
+    fn expecting(&self, formatter: &mut fmt::Formatter<'_>) -> fmt::Result {
+        formatter.write_str("region data")
+    }
+
+    fn visit_seq<A>(self, mut seq: A) -> Result<(), A::Error>
+    where
+        A: SeqAccess<'de>
+    {
+        while seq.next_element_seed(CurveDataSeed(&mut *self.0))?.is_some() {}
+
+        Ok(())
+    }
+}
+
+// Parses a document with its points at a chosen precision, which the
+// Deserialize impl takes as double.
+#[derive(Clone, Copy)]
+pub struct DocumentSeed(pub Precision);
+
+impl<'de> DeserializeSeed<'de> for DocumentSeed {
+    type Value = Document;
+
+    fn deserialize<D>(self, deserializer: D) -> Result<Document, D::Error>
+    where
+        D: Deserializer<'de>
+    {
+        deserializer.deserialize_map(DocumentVisitor(self.0))
+    }
+}
+
+struct DocumentVisitor(Precision);
+
+impl<'de> Visitor<'de> for DocumentVisitor {
+    type Value = Document;
+
+    fn expecting(&self, formatter: &mut fmt::Formatter<'_>) -> fmt::Result {
+        formatter.write_str("document")
+    }
+
+    fn visit_map<A>(self, mut map: A) -> Result<Document, A::Error>
+    where
+        A: MapAccess<'de>
+    {
+        let mut width = None;
+        let mut height = None;
+        let mut unit_per_inch = None;
+        let mut editor = None;
+        let mut pens = None;
+        let mut brushes = None;
+        let mut shapes = false;
+        let mut builder = Builder::new(self.0);
+
+        let mut has_editor = false;
+
+        // As for shapes, a repeated field is refused as the derived Image
+        // refuses it. A second shapes array would be appended to the first.
+        fn first<T, E: Error>(field: &Option<T>, name: &'static str) -> Result<(), E> {
+            match field {
+                Some(_) => Err(E::duplicate_field(name)),
+                None => Ok(())
+            }
+        }
+
+        while let Some(key) = map.next_key::<DocumentField>()? {
+            match key {
+                DocumentField::Width => {
+                    first(&width, "width")?;
+                    width = Some(map.next_value()?);
+                },
+                DocumentField::Height => {
+                    first(&height, "height")?;
+                    height = Some(map.next_value()?);
+                },
+                DocumentField::UnitPerInch => {
+                    first(&unit_per_inch, "unit-per-inch")?;
+                    unit_per_inch = Some(map.next_value()?);
+                },
+                DocumentField::Editor => {
+                    if has_editor {
+                        return Err(A::Error::duplicate_field("editor"));
+                    }
+
+                    editor = map.next_value()?;
+                    has_editor = true;
+                },
+                DocumentField::Pens => {
+                    first(&pens, "pens")?;
+                    pens = Some(map.next_value()?);
+                },
+                DocumentField::Brushes => {
+                    first(&brushes, "brushes")?;
+                    brushes = Some(map.next_value()?);
+                },
+                DocumentField::Shapes => {
+                    if shapes {
+                        return Err(A::Error::duplicate_field("shapes"));
+                    }
+
+                    map.next_value_seed(ShapesSeed(&mut builder))?;
+                    shapes = true;
+                }
+            }
+        }
+
+        if !shapes {
+            return Err(A::Error::missing_field("shapes"));
+        }
+
+        Ok(builder.finish(Header {
+            width: width.ok_or_else(|| A::Error::missing_field("width"))?,
+            height: height.ok_or_else(|| A::Error::missing_field("height"))?,
+            unit_per_inch: unit_per_inch.ok_or_else(|| A::Error::missing_field("unit-per-inch"))?,
+            editor,
+            pens: pens.ok_or_else(|| A::Error::missing_field("pens"))?,
+            brushes: brushes.ok_or_else(|| A::Error::missing_field("brushes"))?
+        }))
+    }
+}
+
+impl<'de> Deserialize<'de> for Document {
+    fn deserialize<D>(deserializer: D) -> Result<Document, D::Error>
+    where
+        D: Deserializer<'de>
+    {
+        DocumentSeed(Precision::Double).deserialize(deserializer)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn strip_annotations(shapes: &mut [Shape]) {
+        for shape in shapes.iter_mut() {
+            if let Shape::Group(group) = shape {
+                group.edit_annot = serde_json::Value::Null;
+                strip_annotations(&mut group.content);
+            }
+        }
+    }
+
+    #[test]
+    fn test_document_matches_image() {
+        for name in ["curve", "region", "pattern"] {
+            let path = format!("{}/samples/{}.lison", env!("CARGO_MANIFEST_DIR"), name);
+            let source = std::fs::read_to_string(path).unwrap();
+
+            let mut image: Image = serde_json::from_str(&source).unwrap();
+            strip_annotations(&mut image.shapes);
+            let expected = serde_json::to_string(&image).unwrap();
+
+            let document: Document = serde_json::from_str(&source).unwrap();
+            assert_eq!(expected, serde_json::to_string(&document.to_image()).unwrap());
+            assert_eq!(expected, serde_json::to_string(&Document::from_image(&image).to_image()).unwrap());
+        }
+    }
+
+    #[test]
+    fn test_document_precision() {
+        let path = format!("{}/samples/curve.lison", env!("CARGO_MANIFEST_DIR"));
+        let source = std::fs::read_to_string(path).unwrap();
+
+        let mut image: Image = serde_json::from_str(&source).unwrap();
+        strip_annotations(&mut image.shapes);
+
+        let double: Document = serde_json::from_str(&source).unwrap();
+        assert_eq!(Precision::Double, double.precision());
+
+        let single = DocumentSeed(Precision::Single).deserialize(&mut serde_json::Deserializer::from_str(&source)).unwrap();
+        assert_eq!(Precision::Single, single.precision());
+        assert!(single.leaves().flat_map(|shape| shape.subpaths()).all(|data| data.precision() == Precision::Single));
+
+        image.set_precision(Precision::Single);
+        let expected = serde_json::to_string(&image).unwrap();
+        assert_eq!(expected, serde_json::to_string(&single.to_image()).unwrap());
+        assert_eq!(expected, serde_json::to_string(&Document::from_image_with_precision(&image, Precision::Single).to_image()).unwrap());
+    }
+
+    #[test]
+    fn test_document_structure() {
+        let document: Document = serde_json::from_str(r#"{
+  "width": 100,
+  "height": 100,
+  "unit-per-inch": 72,
+  "pens": [],
+  "brushes": [],
+  "shapes": [
+    { "type": "group", "edit-annot": { "name": "a" }, "content": [
+      { "data": [[0, 0], ["L", [1, 1]]], "pen": 0, "type": "curve" },
+      { "type": "group", "content": [] },
+      { "type": "region", "brush": 1, "data": [[[2, 2], ["L", [3, 2]]], [[4, 4], ["Q", [5, 5], [6, 4]]]] }
+    ] },
+    { "type": "curve", "pen": 1, "data": [[7, 7]] }
+  ]
+}"#).unwrap();
+
+        assert_eq!(5, document.len());
+
+        let top: Vec<usize> = document.shapes().map(|shape| shape.index()).collect();
+        assert_eq!(vec![0, 4], top);
+
+        let children: Vec<ShapeKind> = document.shape(0).children().map(|shape| shape.kind()).collect();
+        assert_eq!(vec![ShapeKind::Curve { pen: 0 }, ShapeKind::Group, ShapeKind::Region { pen: None, brush: Some(1) }], children);
+
+        let leaves: Vec<usize> = document.leaves().map(|shape| shape.index()).collect();
+        assert_eq!(vec![1, 3, 4], leaves);
+
+        let region: Vec<CurveRef> = document.shape(3).subpaths().collect();
+        assert_eq!(2, region.len());
+        assert_eq!(&[Verb::QuadraticBezier], region[1].verbs());
+        assert_eq!(4.0, region[1].start().x);
+        assert_eq!(3, region[1].points().len());
+
+        let curve: Vec<CurveRef> = document.shape(1).subpaths().collect();
+        assert_eq!(1, curve.len());
+        assert_eq!(1, curve[0].len());
+        assert!(document.shape(4).subpaths().all(|data| data.is_empty()));
+    }
+
+    #[test]
+    fn test_document_errors() {
+        let parse = |shape: &str| serde_json::from_str::<Document>(&format!(r#"{{
+  "width": 100,
+  "height": 100,
+  "unit-per-inch": 72,
+  "pens": [],
+  "brushes": [],
+  "shapes": [{}]
+}}"#, shape)).err().map(|e| e.to_string());
+
+        assert!(parse(r#"{ "type": "curve", "pen": 0, "data": [[0, 0]] }"#).is_none());
+        assert!(parse(r#"{ "pen": 0, "data": [[0, 0]] }"#).unwrap().contains("missing field `type`"));
+        assert!(parse(r#"{ "type": "curve", "data": [[0, 0]] }"#).unwrap().contains("missing field `pen`"));
+        assert!(parse(r#"{ "type": "curve", "pen": 0, "content": [] }"#).unwrap().contains("unknown field `content`"));
+        assert!(parse(r#"{ "type": "region", "data": [], "edit-annot": 1 }"#).unwrap().contains("unknown field `edit-annot`"));
+        assert!(parse(r#"{ "data": [[0, 0], ["X", [1, 1]]], "type": "curve", "pen": 0 }"#).unwrap().contains("unknown variant `X`"));
+        assert!(parse(r#"{ "type": "group" }"#).unwrap().contains("missing field `content`"));
+    }
+
+    #[test]
+    fn test_duplicate_fields() {
+        let source = |shape: &str| format!(r#"{{
+  "width": 100,
+  "height": 100,
+  "unit-per-inch": 72,
+  "pens": [],
+  "brushes": [],
+  "shapes": [{}]
+}}"#, shape);
+
+        for (shape, field) in [
+            (r#"{ "type": "curve", "pen": 0, "data": [[0, 0]], "data": [[1, 1]] }"#, "data"),
+            (r#"{ "type": "curve", "type": "region", "pen": 0, "data": [[0, 0]] }"#, "type"),
+            (r#"{ "data": [], "type": "region", "brush": 0, "brush": 1 }"#, "brush"),
+            (r#"{ "type": "group", "content": [], "content": [] }"#, "content")
+        ] {
+            let source = source(shape);
+            assert!(serde_json::from_str::<Image>(&source).is_err());
+
+            let error = serde_json::from_str::<Document>(&source).err().unwrap().to_string();
+            assert!(error.contains(&format!("duplicate field `{}`", field)), "{}", error);
+        }
+
+        let header = r#""width": 100, "height": 100, "unit-per-inch": 72, "editor": "a", "pens": [], "brushes": [], "shapes": [{ "type": "region", "data": [] }]"#;
+
+        for (repeated, field) in [
+            (r#""width": 50"#, "width"),
+            (r#""height": 50"#, "height"),
+            (r#""unit-per-inch": 96"#, "unit-per-inch"),
+            (r#""editor": "b""#, "editor"),
+            (r#""pens": []"#, "pens"),
+            (r#""brushes": []"#, "brushes"),
+            (r#""shapes": [{ "type": "region", "data": [] }]"#, "shapes")
+        ] {
+            let source = format!("{{ {}, {} }}", header, repeated);
+            assert!(serde_json::from_str::<Image>(&source).is_err());
+
+            let error = serde_json::from_str::<Document>(&source).err().unwrap().to_string();
+            assert!(error.contains(&format!("duplicate field `{}`", field)), "{}", error);
+        }
+
+        assert_eq!(1, serde_json::from_str::<Document>(&format!("{{ {} }}", header)).unwrap().len());
+    }
+}
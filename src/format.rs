@@ -0,0 +1,118 @@
+use std::io;
+
+use serde::Serialize;
+use serde_json::ser::{CompactFormatter, Formatter};
+
+// Writes floats that are exactly an integer, or the nearest f64 to a number
+// of at most precision decimals, as plain digits instead of going through
+// the shortest round-trip algorithm. Every other value is written as
+// serde_json would, so nothing is rounded here; strip::StrippedImage is
+// what rounds coordinates to that many decimals beforehand.
+#[derive(Clone, Copy, Default)]
+pub struct FloatFormatter {
+    precision: Option<u32>
+}
+
+// Above this magnitude an f64 no longer holds every integer exactly.
+const EXACT_LIMIT: f64 = 9007199254740992.0;
+
+pub const MAX_PRECISION: u32 = 15;
+
+impl FloatFormatter {
+    pub fn new(precision: Option<u32>) -> FloatFormatter {
+        FloatFormatter { precision: precision.map(|precision| precision.min(MAX_PRECISION)) }
+    }
+}
+
+fn write_fixed<W: ?Sized + io::Write>(writer: &mut W, mantissa: f64, decimals: u32) -> io::Result<()> {
+    let mut buf = [0u8; 24];
+    let mut pos = buf.len();
+
+    let negative = mantissa < 0.0;
+    let mut digits = mantissa.abs() as u64;
+
+    // Trailing zeros of the fraction are dropped, and so is the point if
+    // nothing remains after it.
+    let mut decimals = decimals;
+
+    while decimals > 0 && digits % 10 == 0 {
+        digits /= 10;
+        decimals -= 1;
+    }
+
+    for i in 0.. {
+        if i == decimals && decimals > 0 {
+            pos -= 1;
+            buf[pos] = b'.';
+        }
+
+        pos -= 1;
+        buf[pos] = b'0' + (digits % 10) as u8;
+        digits /= 10;
+
+        if digits == 0 && i >= decimals {
+            break;
+        }
+    }
+
+    if negative && buf[pos..].iter().any(|&c| c != b'0' && c != b'.') {
+        pos -= 1;
+        buf[pos] = b'-';
+    }
+
+    writer.write_all(&buf[pos..])
+}
+
+impl Formatter for FloatFormatter {
+    fn write_f64<W: ?Sized + io::Write>(&mut self, writer: &mut W, value: f64) -> io::Result<()> {
+        let decimals = self.precision.unwrap_or(0);
+        let scale = 10f64.powi(decimals as i32);
+        let mantissa = (value * scale).round();
+
+        // The digits read back as the same value only where dividing them
+        // out again gives it.
+        if mantissa.abs() < EXACT_LIMIT && mantissa / scale == value {
+            return write_fixed(writer, mantissa, decimals);
+        }
+
+        CompactFormatter.write_f64(writer, value)
+    }
+}
+
+pub fn to_writer<W: io::Write, T: ?Sized + Serialize>(writer: W, value: &T, precision: Option<u32>) -> serde_json::Result<()> {
+    let mut serializer = serde_json::Serializer::with_formatter(writer, FloatFormatter::new(precision));
+    value.serialize(&mut serializer)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn format(values: &[f64], precision: Option<u32>) -> String {
+        let mut buf = Vec::new();
+        to_writer(&mut buf, values, precision).unwrap();
+        String::from_utf8(buf).unwrap()
+    }
+
+    #[test]
+    fn test_float_formatter() {
+        assert_eq!("[72,0,-3,0.5,1e20,0.1]", format(&[72.0, 0.0, -3.0, 0.5, 1e20, 0.1], None));
+        assert_eq!("[3.14,2,-0.5,0.05,0,1e30]", format(&[3.14, 2.0, -0.5, 0.05, -0.0, 1e30], Some(2)));
+        assert_eq!("[1234.5678,-0.0001]", format(&[1234.5678, -0.0001], Some(4)));
+
+        // Values with more decimals are written exactly all the same.
+        assert_eq!("[3.14159,-0.004,0.0504]", format(&[3.14159, -0.004, 0.0504], Some(2)));
+        assert_eq!("[null]", format(&[f64::NAN], None));
+    }
+
+    #[test]
+    fn test_float_formatter_round_trip() {
+        let values: Vec<f64> = (0..1000).map(|i| i as f64 * 0.37 - 100.0).chain([1e-300, 123456789.0, -0.0]).collect();
+        let expected: Vec<f64> = serde_json::from_str(&serde_json::to_string(&values).unwrap()).unwrap();
+
+        for precision in [None, Some(2), Some(MAX_PRECISION)] {
+            let parsed: Vec<f64> = serde_json::from_str(&format(&values, precision)).unwrap();
+            assert_eq!(expected, parsed);
+        }
+    }
+}
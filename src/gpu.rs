@@ -0,0 +1,777 @@
+use std::fmt;
+use std::ops::Range;
+use std::slice;
+use std::sync::mpsc;
+
+use wgpu::util::DeviceExt;
+
+use crate::image::*;
+use crate::raster::flatten;
+use crate::stroke::{Polygon, Stroker, Vector};
+
+#[derive(Debug)]
+pub enum GpuError {
+    Adapter(wgpu::RequestAdapterError),
+    Device(wgpu::RequestDeviceError),
+    Poll(wgpu::PollError),
+    Map(wgpu::BufferAsyncError),
+    InvalidPen { index: usize, count: usize },
+    InvalidBrush { index: usize, count: usize },
+    Size { width: u32, height: u32, limit: u32 }
+}
+
+impl fmt::Display for GpuError {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        match self {
+            GpuError::Adapter(err) => write!(f, "no graphics adapter: {}", err),
+            GpuError::Device(err) => write!(f, "device request failed: {}", err),
+            GpuError::Poll(err) => write!(f, "device poll failed: {}", err),
+            GpuError::Map(err) => write!(f, "readback failed: {}", err),
+            GpuError::InvalidPen { index, count } =>
+                write!(f, "invalid pen index {}, must be less than {}.", index, count),
+            GpuError::InvalidBrush { index, count } =>
+                write!(f, "invalid brush index {}, must be less than {}.", index, count),
+            GpuError::Size { width, height, limit } =>
+                write!(f, "{}x{} exceeds the device limit of {}.", width, height, limit)
+        }
+    }
+}
+
+impl std::error::Error for GpuError {}
+
+const SHADER: &str = r#"
+struct View {
+    scale: vec2<f32>,
+    padding: vec2<f32>,
+}
+
+struct Paint {
+    kind: u32,
+    padding_1: u32,
+    padding_2: u32,
+    padding_3: u32,
+    color_1: vec4<f32>,
+    color_2: vec4<f32>,
+    geometry: vec4<f32>,
+    radius: vec4<f32>,
+}
+
+@group(0) @binding(0) var<uniform> view: View;
+@group(0) @binding(1) var<storage, read> paints: array<Paint>;
+
+struct Varyings {
+    @builtin(position) position: vec4<f32>,
+    @location(0) point: vec2<f32>,
+    @location(1) @interpolate(flat) paint: u32,
+}
+
+@vertex
+fn vs_main(@location(0) point: vec2<f32>, @location(1) paint: u32) -> Varyings {
+    var out: Varyings;
+    out.position = vec4<f32>(point.x * view.scale.x - 1.0, 1.0 - point.y * view.scale.y, 0.0, 1.0);
+    out.point = point;
+    out.paint = paint;
+    return out;
+}
+
+fn gradient(paint: Paint, t: f32) -> vec4<f32> {
+    let color = mix(paint.color_1, paint.color_2, clamp(t, 0.0, 1.0));
+    return vec4<f32>(color.rgb * color.a, color.a);
+}
+
+// The largest t whose circle, of non-negative radius, passes through p, in
+// x, and whether there is one, in y.
+fn radial(paint: Paint, point: vec2<f32>) -> vec2<f32> {
+    let p = point - paint.geometry.xy;
+    let delta = paint.geometry.zw;
+    let r = paint.radius.x;
+    let dr = paint.radius.y;
+    let a = dot(delta, delta) - dr * dr;
+    let b = dot(p, delta) + r * dr;
+    let c = dot(p, p) - r * r;
+
+    if a == 0.0 {
+        let t = c / (2.0 * b);
+        return vec2<f32>(t, select(0.0, 1.0, b != 0.0 && r + t * dr >= 0.0));
+    }
+
+    let discriminant = b * b - a * c;
+
+    if discriminant < 0.0 {
+        return vec2<f32>(0.0, 0.0);
+    }
+
+    let root = sqrt(discriminant);
+    let high = max((b + root) / a, (b - root) / a);
+    let low = min((b + root) / a, (b - root) / a);
+
+    if r + high * dr >= 0.0 {
+        return vec2<f32>(high, 1.0);
+    }
+
+    return vec2<f32>(low, select(0.0, 1.0, r + low * dr >= 0.0));
+}
+
+// Never discards: the cover pass also clears the stencil behind it.
+@fragment
+fn fs_main(in: Varyings) -> @location(0) vec4<f32> {
+    let paint = paints[in.paint];
+
+    if paint.kind == 1u {
+        return gradient(paint, dot(in.point - paint.geometry.xy, paint.geometry.zw));
+    }
+
+    if paint.kind == 2u {
+        let t = radial(paint, in.point);
+        return gradient(paint, t.x) * t.y;
+    }
+
+    return vec4<f32>(paint.color_1.rgb * paint.color_1.a, paint.color_1.a);
+}
+"#;
+
+const COLOR_FORMAT: wgpu::TextureFormat = wgpu::TextureFormat::Rgba8Unorm;
+const STENCIL_FORMAT: wgpu::TextureFormat = wgpu::TextureFormat::Stencil8;
+const SAMPLES: u32 = 4;
+
+// The stencil starts each shape at the middle of its range so that the
+// nonzero passes can count windings either way with saturating arithmetic;
+// wrapping would read a winding of 256 as uncovered. Inverting it for
+// even-odd toggles between 128 and 127.
+const STENCIL_ZERO: u32 = 128;
+
+// Two floats of position and the paint index.
+const VERTEX_SIZE: u64 = 12;
+const PAINT_SIZE: usize = 80;
+
+#[derive(Clone, Copy, PartialEq)]
+enum FillRule {
+    EvenOdd,
+    NonZero
+}
+
+// Each shape is drawn stencil-and-cover: a triangle fan per contour marks
+// the covered samples in the stencil buffer, then a quad over its bounds
+// paints them and resets the stencil to STENCIL_ZERO.
+struct Draw {
+    rule: FillRule,
+    fan: Range<u32>,
+    cover: Range<u32>
+}
+
+pub struct Gpu {
+    device: wgpu::Device,
+    queue: wgpu::Queue,
+    layout: wgpu::BindGroupLayout,
+    even_odd: wgpu::RenderPipeline,
+    non_zero: wgpu::RenderPipeline,
+    cover: wgpu::RenderPipeline
+}
+
+fn stencil_state(front: wgpu::StencilFaceState, back: wgpu::StencilFaceState) -> wgpu::StencilState {
+    wgpu::StencilState { front, back, read_mask: !0, write_mask: !0 }
+}
+
+fn face(compare: wgpu::CompareFunction, pass_op: wgpu::StencilOperation) -> wgpu::StencilFaceState {
+    wgpu::StencilFaceState {
+        compare,
+        fail_op: wgpu::StencilOperation::Keep,
+        depth_fail_op: wgpu::StencilOperation::Keep,
+        pass_op
+    }
+}
+
+impl Gpu {
+    pub fn new() -> Result<Gpu, GpuError> {
+        let instance = wgpu::Instance::new(&wgpu::InstanceDescriptor::default());
+
+        let adapter = pollster::block_on(instance.request_adapter(&wgpu::RequestAdapterOptions {
+            power_preference: wgpu::PowerPreference::HighPerformance,
+            force_fallback_adapter: false,
+            compatible_surface: None
+        })).map_err(GpuError::Adapter)?;
+
+        let (device, queue) = pollster::block_on(adapter.request_device(&wgpu::DeviceDescriptor::default()))
+            .map_err(GpuError::Device)?;
+
+        let module = device.create_shader_module(wgpu::ShaderModuleDescriptor {
+            label: Some("lison"),
+            source: wgpu::ShaderSource::Wgsl(SHADER.into())
+        });
+
+        let layout = device.create_bind_group_layout(&wgpu::BindGroupLayoutDescriptor {
+            label: Some("lison"),
+            entries: &[
+                wgpu::BindGroupLayoutEntry {
+                    binding: 0,
+                    visibility: wgpu::ShaderStages::VERTEX,
+                    ty: wgpu::BindingType::Buffer {
+                        ty: wgpu::BufferBindingType::Uniform,
+                        has_dynamic_offset: false,
+                        min_binding_size: None
+                    },
+                    count: None
+                },
+                wgpu::BindGroupLayoutEntry {
+                    binding: 1,
+                    visibility: wgpu::ShaderStages::FRAGMENT,
+                    ty: wgpu::BindingType::Buffer {
+                        ty: wgpu::BufferBindingType::Storage { read_only: true },
+                        has_dynamic_offset: false,
+                        min_binding_size: None
+                    },
+                    count: None
+                }
+            ]
+        });
+
+        let pipeline_layout = device.create_pipeline_layout(&wgpu::PipelineLayoutDescriptor {
+            label: Some("lison"),
+            bind_group_layouts: &[&layout],
+            push_constant_ranges: &[]
+        });
+
+        let pipeline = |stencil: wgpu::StencilState, writes: wgpu::ColorWrites| {
+            device.create_render_pipeline(&wgpu::RenderPipelineDescriptor {
+                label: Some("lison"),
+                layout: Some(&pipeline_layout),
+                vertex: wgpu::VertexState {
+                    module: &module,
+                    entry_point: Some("vs_main"),
+                    compilation_options: Default::default(),
+                    buffers: &[wgpu::VertexBufferLayout {
+                        array_stride: VERTEX_SIZE,
+                        step_mode: wgpu::VertexStepMode::Vertex,
+                        attributes: &wgpu::vertex_attr_array![0 => Float32x2, 1 => Uint32]
+                    }]
+                },
+                fragment: Some(wgpu::FragmentState {
+                    module: &module,
+                    entry_point: Some("fs_main"),
+                    compilation_options: Default::default(),
+                    targets: &[Some(wgpu::ColorTargetState {
+                        format: COLOR_FORMAT,
+                        blend: Some(wgpu::BlendState::PREMULTIPLIED_ALPHA_BLENDING),
+                        write_mask: writes
+                    })]
+                }),
+                primitive: wgpu::PrimitiveState::default(),
+                depth_stencil: Some(wgpu::DepthStencilState {
+                    format: STENCIL_FORMAT,
+                    depth_write_enabled: false,
+                    depth_compare: wgpu::CompareFunction::Always,
+                    stencil,
+                    bias: wgpu::DepthBiasState::default()
+                }),
+                multisample: wgpu::MultisampleState { count: SAMPLES, mask: !0, alpha_to_coverage_enabled: false },
+                multiview: None,
+                cache: None
+            })
+        };
+
+        let invert = face(wgpu::CompareFunction::Always, wgpu::StencilOperation::Invert);
+        let even_odd = pipeline(stencil_state(invert, invert), wgpu::ColorWrites::empty());
+
+        let non_zero = pipeline(stencil_state(
+            face(wgpu::CompareFunction::Always, wgpu::StencilOperation::IncrementClamp),
+            face(wgpu::CompareFunction::Always, wgpu::StencilOperation::DecrementClamp)
+        ), wgpu::ColorWrites::empty());
+
+        let covered = face(wgpu::CompareFunction::NotEqual, wgpu::StencilOperation::Replace);
+        let cover = pipeline(stencil_state(covered, covered), wgpu::ColorWrites::ALL);
+
+        Ok(Gpu { device, queue, layout, even_odd, non_zero, cover })
+    }
+
+    pub fn max_size(&self) -> u32 {
+        self.device.limits().max_texture_dimension_2d
+    }
+}
+
+fn push_f32s(bytes: &mut Vec<u8>, values: &[f64]) {
+    for &value in values {
+        bytes.extend_from_slice(&(value as f32).to_le_bytes());
+    }
+}
+
+fn push_paint(bytes: &mut Vec<u8>, pattern: &Pattern) {
+    let color = |color: &Color| [color.red, color.green, color.blue, color.alpha];
+
+    let (kind, color_1, color_2, geometry, radius) = match pattern {
+        Pattern::Monochrome(pat) => (0, color(&pat.color), [0.0; 4], [0.0; 4], [0.0; 4]),
+        Pattern::LinearGradient(pat) if pattern.is_degenerate() => (0, color(&pat.color_2), [0.0; 4], [0.0; 4], [0.0; 4]),
+        Pattern::RadialGradient(pat) if pattern.is_degenerate() => (0, color(&pat.color_2), [0.0; 4], [0.0; 4], [0.0; 4]),
+        Pattern::LinearGradient(pat) => {
+            let (dx, dy) = (pat.point_2.x - pat.point_1.x, pat.point_2.y - pat.point_1.y);
+            let length = dx * dx + dy * dy;
+            (1, color(&pat.color_1), color(&pat.color_2), [pat.point_1.x, pat.point_1.y, dx / length, dy / length], [0.0; 4])
+        },
+        Pattern::RadialGradient(pat) => (
+            2,
+            color(&pat.color_1),
+            color(&pat.color_2),
+            [pat.center_1.x, pat.center_1.y, pat.center_2.x - pat.center_1.x, pat.center_2.y - pat.center_1.y],
+            [pat.radius_1, pat.radius_2 - pat.radius_1, 0.0, 0.0]
+        )
+    };
+
+    bytes.extend_from_slice(&(kind as u32).to_le_bytes());
+    bytes.extend_from_slice(&[0; 12]);
+    push_f32s(bytes, &color_1);
+    push_f32s(bytes, &color_2);
+    push_f32s(bytes, &geometry);
+    push_f32s(bytes, &radius);
+}
+
+fn flatten_all(data: &[CurveData], tolerance: f64, points: &mut Vec<Vector>, ends: &mut Vec<usize>) {
+    points.clear();
+    ends.clear();
+
+    for data in data.iter() {
+        flatten(points, data, 1.0, tolerance);
+        ends.push(points.len());
+    }
+}
+
+fn subpaths<'a>(points: &'a [Vector], ends: &'a [usize]) -> impl Iterator<Item = &'a [Vector]> {
+    ends.iter()
+        .scan(0, move |start, &end| {
+            let subpath = &points[*start..end];
+            *start = end;
+            Some(subpath)
+        })
+}
+
+#[derive(Default)]
+struct Geometry {
+    vertices: Vec<u8>,
+    count: u32,
+    indices: Vec<u32>,
+    draws: Vec<Draw>
+}
+
+impl Geometry {
+    fn vertex(&mut self, point: Vector, paint: u32) -> u32 {
+        push_f32s(&mut self.vertices, &[point.0, point.1]);
+        self.vertices.extend_from_slice(&paint.to_le_bytes());
+        self.count += 1;
+        self.count - 1
+    }
+
+    fn add<'a>(&mut self, rule: FillRule, contours: impl Iterator<Item = &'a [Vector]>, paint: u32) {
+        let start = self.indices.len() as u32;
+        let (mut min_x, mut min_y, mut max_x, mut max_y) = (f64::INFINITY, f64::INFINITY, f64::NEG_INFINITY, f64::NEG_INFINITY);
+
+        for contour in contours {
+            if contour.len() < 3 {
+                continue;
+            }
+
+            let first = self.count;
+
+            for &point in contour.iter() {
+                self.vertex(point, paint);
+                min_x = min_x.min(point.0);
+                min_y = min_y.min(point.1);
+                max_x = max_x.max(point.0);
+                max_y = max_y.max(point.1);
+            }
+
+            for i in 1..contour.len() as u32 - 1 {
+                self.indices.extend_from_slice(&[first, first + i, first + i + 1]);
+            }
+        }
+
+        let middle = self.indices.len() as u32;
+
+        if middle == start {
+            return;
+        }
+
+        let corners = [(min_x, min_y), (max_x, min_y), (max_x, max_y), (min_x, max_y)].map(|point| self.vertex(point, paint));
+        self.indices.extend_from_slice(&[corners[0], corners[1], corners[2], corners[0], corners[2], corners[3]]);
+
+        self.draws.push(Draw { rule, fan: start..middle, cover: middle..self.indices.len() as u32 });
+    }
+}
+
+// A document tessellated and uploaded once, which can then be rendered at
+// any scale. Curves are flattened within tolerance, in image units, so the
+// tolerance should be chosen for the largest scale to be rendered.
+pub struct GpuDocument {
+    vertices: wgpu::Buffer,
+    indices: wgpu::Buffer,
+    paints: wgpu::Buffer,
+    draws: Vec<Draw>
+}
+
+// The paint table and geometry of a document, before any upload.
+fn tessellate(image: &Image, tolerance: f64) -> Result<(Vec<u8>, Geometry), GpuError> {
+    let mut paints = Vec::new();
+
+    for brush in image.brushes.iter() {
+        push_paint(&mut paints, &brush.pattern);
+    }
+
+    for pen in image.pens.iter() {
+        push_paint(&mut paints, &pen.pattern);
+    }
+
+    // Storage buffers may not be empty.
+    if paints.is_empty() {
+        paints.resize(PAINT_SIZE, 0);
+    }
+
+    let strokers: Vec<Stroker> = image.pens.iter()
+        .map(|pen| Stroker::new(pen, 1.0, tolerance))
+        .collect();
+
+    let mut geometry = Geometry::default();
+    let mut points = Vec::new();
+    let mut ends = Vec::new();
+
+    for shape in image.leaves() {
+        let (data, closed, pen, brush) = match shape {
+            Shape::Group(_) => continue,
+            Shape::Curve(curve) => (slice::from_ref(&curve.data), false, Some(curve.pen), None),
+            Shape::Region(region) => (&region.data[..], true, region.pen, region.brush)
+        };
+
+        flatten_all(data, tolerance, &mut points, &mut ends);
+
+        if let Some(brush) = brush {
+            if brush >= image.brushes.len() {
+                return Err(GpuError::InvalidBrush { index: brush, count: image.brushes.len() });
+            }
+
+            geometry.add(FillRule::EvenOdd, subpaths(&points, &ends), brush as u32);
+        }
+
+        if let Some(pen) = pen {
+            let Some(stroker) = strokers.get(pen) else {
+                return Err(GpuError::InvalidPen { index: pen, count: strokers.len() });
+            };
+
+            let mut outline = Polygon::new();
+            stroker.stroke(subpaths(&points, &ends), closed, &mut outline);
+            geometry.add(FillRule::NonZero, outline.contours(), (image.brushes.len() + pen) as u32);
+        }
+    }
+
+    Ok((paints, geometry))
+}
+
+impl GpuDocument {
+    pub fn new(gpu: &Gpu, image: &Image, tolerance: f64) -> Result<GpuDocument, GpuError> {
+        let (paints, geometry) = tessellate(image, tolerance)?;
+
+        let buffer = |contents: &[u8], usage: wgpu::BufferUsages| {
+            gpu.device.create_buffer_init(&wgpu::util::BufferInitDescriptor {
+                label: Some("lison"),
+                contents,
+                usage
+            })
+        };
+
+        let indices: Vec<u8> = geometry.indices.iter().flat_map(|index| index.to_le_bytes()).collect();
+
+        Ok(GpuDocument {
+            vertices: buffer(&geometry.vertices, wgpu::BufferUsages::VERTEX),
+            indices: buffer(&indices, wgpu::BufferUsages::INDEX),
+            paints: buffer(&paints, wgpu::BufferUsages::STORAGE),
+            draws: geometry.draws
+        })
+    }
+
+    // Renders at factor output pixels per image unit and writes the result
+    // in Cairo's ARGB32 layout. Samples are antialiased by 4x multisampling,
+    // so edges differ slightly from Cairo's exact coverage.
+    pub fn render_argb32(&self, gpu: &Gpu, factor: f64, width: u32, height: u32, data: &mut [u8], stride: usize) -> Result<(), GpuError> {
+        let limit = gpu.max_size();
+
+        if width == 0 || height == 0 || width > limit || height > limit {
+            return Err(GpuError::Size { width, height, limit });
+        }
+
+        let mut view = Vec::new();
+        push_f32s(&mut view, &[factor * 2.0 / width as f64, factor * 2.0 / height as f64, 0.0, 0.0]);
+
+        let view = gpu.device.create_buffer_init(&wgpu::util::BufferInitDescriptor {
+            label: Some("lison"),
+            contents: &view,
+            usage: wgpu::BufferUsages::UNIFORM
+        });
+
+        let bind_group = gpu.device.create_bind_group(&wgpu::BindGroupDescriptor {
+            label: Some("lison"),
+            layout: &gpu.layout,
+            entries: &[
+                wgpu::BindGroupEntry { binding: 0, resource: view.as_entire_binding() },
+                wgpu::BindGroupEntry { binding: 1, resource: self.paints.as_entire_binding() }
+            ]
+        });
+
+        let size = wgpu::Extent3d { width, height, depth_or_array_layers: 1 };
+        let texture = |format: wgpu::TextureFormat, samples: u32, usage: wgpu::TextureUsages| {
+            gpu.device.create_texture(&wgpu::TextureDescriptor {
+                label: Some("lison"),
+                size,
+                mip_level_count: 1,
+                sample_count: samples,
+                dimension: wgpu::TextureDimension::D2,
+                format,
+                usage,
+                view_formats: &[]
+            })
+        };
+
+        let samples = texture(COLOR_FORMAT, SAMPLES, wgpu::TextureUsages::RENDER_ATTACHMENT);
+        let resolved = texture(COLOR_FORMAT, 1, wgpu::TextureUsages::RENDER_ATTACHMENT | wgpu::TextureUsages::COPY_SRC);
+        let stencil = texture(STENCIL_FORMAT, SAMPLES, wgpu::TextureUsages::RENDER_ATTACHMENT);
+
+        let samples_view = samples.create_view(&wgpu::TextureViewDescriptor::default());
+        let resolved_view = resolved.create_view(&wgpu::TextureViewDescriptor::default());
+        let stencil_view = stencil.create_view(&wgpu::TextureViewDescriptor::default());
+
+        let alignment = wgpu::COPY_BYTES_PER_ROW_ALIGNMENT;
+        let row = (width * 4).div_ceil(alignment) * alignment;
+
+        let readback = gpu.device.create_buffer(&wgpu::BufferDescriptor {
+            label: Some("lison"),
+            size: row as u64 * height as u64,
+            usage: wgpu::BufferUsages::COPY_DST | wgpu::BufferUsages::MAP_READ,
+            mapped_at_creation: false
+        });
+
+        let mut encoder = gpu.device.create_command_encoder(&wgpu::CommandEncoderDescriptor { label: Some("lison") });
+
+        {
+            let mut pass = encoder.begin_render_pass(&wgpu::RenderPassDescriptor {
+                label: Some("lison"),
+                color_attachments: &[Some(wgpu::RenderPassColorAttachment {
+                    view: &samples_view,
+                    depth_slice: None,
+                    resolve_target: Some(&resolved_view),
+                    ops: wgpu::Operations {
+                        load: wgpu::LoadOp::Clear(wgpu::Color::TRANSPARENT),
+                        store: wgpu::StoreOp::Discard
+                    }
+                })],
+                depth_stencil_attachment: Some(wgpu::RenderPassDepthStencilAttachment {
+                    view: &stencil_view,
+                    depth_ops: None,
+                    stencil_ops: Some(wgpu::Operations {
+                        load: wgpu::LoadOp::Clear(STENCIL_ZERO),
+                        store: wgpu::StoreOp::Discard
+                    })
+                }),
+                timestamp_writes: None,
+                occlusion_query_set: None
+            });
+
+            if !self.draws.is_empty() {
+                pass.set_bind_group(0, &bind_group, &[]);
+                pass.set_vertex_buffer(0, self.vertices.slice(..));
+                pass.set_index_buffer(self.indices.slice(..), wgpu::IndexFormat::Uint32);
+                pass.set_stencil_reference(STENCIL_ZERO);
+
+                for draw in self.draws.iter() {
+                    pass.set_pipeline(match draw.rule {
+                        FillRule::EvenOdd => &gpu.even_odd,
+                        FillRule::NonZero => &gpu.non_zero
+                    });
+                    pass.draw_indexed(draw.fan.clone(), 0, 0..1);
+
+                    pass.set_pipeline(&gpu.cover);
+                    pass.draw_indexed(draw.cover.clone(), 0, 0..1);
+                }
+            }
+        }
+
+        encoder.copy_texture_to_buffer(
+            wgpu::TexelCopyTextureInfo {
+                texture: &resolved,
+                mip_level: 0,
+                origin: wgpu::Origin3d::ZERO,
+                aspect: wgpu::TextureAspect::All
+            },
+            wgpu::TexelCopyBufferInfo {
+                buffer: &readback,
+                layout: wgpu::TexelCopyBufferLayout {
+                    offset: 0,
+                    bytes_per_row: Some(row),
+                    rows_per_image: Some(height)
+                }
+            },
+            size
+        );
+
+        gpu.queue.submit(Some(encoder.finish()));
+
+        let slice = readback.slice(..);
+        let (sender, receiver) = mpsc::channel();
+        slice.map_async(wgpu::MapMode::Read, move |result| {
+            let _ = sender.send(result);
+        });
+
+        gpu.device.poll(wgpu::PollType::Wait).map_err(GpuError::Poll)?;
+
+        if let Ok(result) = receiver.recv() {
+            result.map_err(GpuError::Map)?;
+        }
+
+        let mapped = slice.get_mapped_range();
+
+        for y in 0..height as usize {
+            let source = &mapped[y * row as usize..y * row as usize + width as usize * 4];
+            let target = &mut data[y * stride..y * stride + width as usize * 4];
+
+            for (pixel, rgba) in target.chunks_exact_mut(4).zip(source.chunks_exact(4)) {
+                let value = (rgba[3] as u32) << 24 | (rgba[0] as u32) << 16 | (rgba[1] as u32) << 8 | rgba[2] as u32;
+                pixel.copy_from_slice(&value.to_ne_bytes());
+            }
+        }
+
+        drop(mapped);
+        readback.unmap();
+
+        Ok(())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::backend::render_to;
+    use crate::raster::Raster;
+
+    fn parse(shapes: &str) -> Image {
+        serde_json::from_str(&format!(r#"{{
+  "width": 20,
+  "height": 20,
+  "unit-per-inch": 72,
+  "pens": [{{ "pattern": {{ "type": "monochrome", "color": [0, 0, 1] }}, "width": 2, "cap": "butt", "join": "miter" }}],
+  "brushes": [{{ "pattern": {{ "type": "monochrome", "color": [1, 0, 0] }} }}],
+  "shapes": [{}]
+}}"#, shapes)).unwrap()
+    }
+
+    fn vertex(geometry: &Geometry, index: u32) -> (f32, f32, u32) {
+        let bytes = &geometry.vertices[index as usize * VERTEX_SIZE as usize..][..VERTEX_SIZE as usize];
+        let word = |i: usize| <[u8; 4]>::try_from(&bytes[i * 4..i * 4 + 4]).unwrap();
+        (f32::from_le_bytes(word(0)), f32::from_le_bytes(word(1)), u32::from_le_bytes(word(2)))
+    }
+
+    #[test]
+    fn test_geometry_add() {
+        let square = [(2.0, 3.0), (12.0, 3.0), (12.0, 9.0), (2.0, 9.0)];
+        let line = [(0.0, 0.0), (20.0, 20.0)];
+
+        let mut geometry = Geometry::default();
+        geometry.add(FillRule::EvenOdd, [&square[..], &line[..]].into_iter(), 5);
+
+        // A fan of two triangles over the square, for which the line is too
+        // short, then a quad over the bounds of the square alone.
+        assert_eq!(8, geometry.count);
+        assert_eq!(8 * VERTEX_SIZE as usize, geometry.vertices.len());
+        assert_eq!(vec![0, 1, 2, 0, 2, 3, 4, 5, 6, 4, 6, 7], geometry.indices);
+        assert_eq!(1, geometry.draws.len());
+        assert!(geometry.draws[0].rule == FillRule::EvenOdd);
+        assert_eq!(0..6, geometry.draws[0].fan);
+        assert_eq!(6..12, geometry.draws[0].cover);
+
+        assert_eq!((12.0, 3.0, 5), vertex(&geometry, 1));
+        assert_eq!((2.0, 3.0, 5), vertex(&geometry, 4));
+        assert_eq!((12.0, 3.0, 5), vertex(&geometry, 5));
+        assert_eq!((12.0, 9.0, 5), vertex(&geometry, 6));
+        assert_eq!((2.0, 9.0, 5), vertex(&geometry, 7));
+
+        // Nothing to fill draws nothing.
+        geometry.add(FillRule::NonZero, [&line[..]].into_iter(), 0);
+        assert_eq!(8, geometry.count);
+        assert_eq!(1, geometry.draws.len());
+
+        let triangle = [(0.0, 0.0), (4.0, 0.0), (0.0, 4.0)];
+        geometry.add(FillRule::NonZero, [&triangle[..], &square[..]].into_iter(), 1);
+        assert_eq!(8 + 3 + 4 + 4, geometry.count);
+        assert_eq!(2, geometry.draws.len());
+        assert!(geometry.draws[1].rule == FillRule::NonZero);
+        assert_eq!(12..21, geometry.draws[1].fan);
+        assert_eq!(21..27, geometry.draws[1].cover);
+        assert_eq!(&[8, 9, 10, 11, 12, 13, 11, 13, 14], &geometry.indices[12..21]);
+        assert_eq!((0.0, 0.0, 1), vertex(&geometry, 15));
+        assert_eq!((12.0, 9.0, 1), vertex(&geometry, 17));
+    }
+
+    #[test]
+    fn test_tessellate() {
+        let image = parse(r#"
+    { "type": "region", "brush": 0, "pen": 0, "data": [[[2, 2], ["L", [12, 2]], ["L", [12, 12]], ["L", [2, 12]]]] },
+    { "type": "curve", "pen": 0, "data": [[2, 15], ["L", [18, 15]]] }"#);
+
+        let (paints, geometry) = tessellate(&image, 0.1).unwrap();
+        assert_eq!(2 * PAINT_SIZE, paints.len());
+
+        // The fill, then the outlines of both strokes, each using the paint
+        // of its pen after the brushes.
+        let rules: Vec<_> = geometry.draws.iter().map(|draw| draw.rule == FillRule::EvenOdd).collect();
+        assert_eq!(vec![true, false, false], rules);
+        assert_eq!((2.0, 2.0, 0), vertex(&geometry, 0));
+
+        for (draw, next) in geometry.draws.iter().zip(geometry.draws.iter().skip(1)) {
+            assert_eq!(draw.fan.end, draw.cover.start);
+            assert_eq!(draw.cover.end, next.fan.start);
+        }
+
+        for draw in geometry.draws.iter() {
+            assert_eq!(0, draw.fan.len() % 3);
+            assert_eq!(6, draw.cover.len());
+        }
+
+        let last = geometry.draws.last().unwrap();
+        assert_eq!(geometry.indices.len() as u32, last.cover.end);
+        assert!(geometry.indices.iter().all(|&index| index < geometry.count));
+        assert_eq!(1, vertex(&geometry, geometry.indices[last.cover.start as usize]).2);
+
+        let corners: Vec<_> = geometry.indices[last.cover.start as usize..].iter().map(|&index| vertex(&geometry, index)).collect();
+        assert!(corners.contains(&(2.0, 14.0, 1)) && corners.contains(&(18.0, 16.0, 1)));
+
+        assert!(matches!(tessellate(&parse(r#"{ "type": "region", "brush": 1, "data": [[[2, 2], ["L", [12, 2]], ["L", [12, 12]]]] }"#), 0.1),
+            Err(GpuError::InvalidBrush { index: 1, count: 1 })));
+        assert!(matches!(tessellate(&parse(r#"{ "type": "curve", "pen": 2, "data": [[2, 15], ["L", [18, 15]]] }"#), 0.1),
+            Err(GpuError::InvalidPen { index: 2, count: 1 })));
+    }
+
+    #[test]
+    fn test_render_argb32() {
+        // Only where there is an adapter to render on.
+        let Ok(gpu) = Gpu::new() else {
+            return;
+        };
+
+        // Edges on whole pixels, so that multisampling covers them exactly.
+        let image = parse(r#"
+    { "type": "region", "brush": 0, "data": [
+      [[2, 2], ["L", [12, 2]], ["L", [12, 12]], ["L", [2, 12]]],
+      [[4, 4], ["L", [6, 4]], ["L", [6, 6]], ["L", [4, 6]]]
+    ] },
+    { "type": "region", "pen": 0, "data": [[[8, 8], ["L", [16, 8]], ["L", [16, 16]], ["L", [8, 16]]]] },
+    { "type": "curve", "pen": 0, "data": [[2, 18], ["L", [18, 18]]] }"#);
+
+        let (width, height) = (20, 20);
+        let stride = width as usize * 4;
+
+        let mut expected = vec![0; stride * height as usize];
+        let mut raster = Raster::new(width as usize, height as usize);
+        render_to(&mut raster, &image, 72.0, 1.0).unwrap();
+        raster.write_argb32(&mut expected, stride);
+
+        let mut actual = vec![0; stride * height as usize];
+        let document = GpuDocument::new(&gpu, &image, 0.1).unwrap();
+        document.render_argb32(&gpu, 1.0, width, height, &mut actual, stride).unwrap();
+
+        for (i, (a, b)) in expected.iter().zip(actual.iter()).enumerate() {
+            assert!(a.abs_diff(*b) <= 2, "byte {} of pixel ({}, {}): {} != {}", i % 4, i / 4 % 20, i / stride, a, b);
+        }
+    }
+}
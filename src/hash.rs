@@ -0,0 +1,524 @@
+use std::collections::HashMap;
+use std::hash::{DefaultHasher, Hasher};
+
+use crate::image::*;
+
+// Content hashes of shapes, for telling which ones changed between two
+// versions of a document. Floats are hashed by their bits, edit-annot is
+// ignored, and pen and brush indices are replaced by the hash of what they
+// refer to, so reordering the resource lists changes nothing.
+pub struct ResourceHashes {
+    pens: Vec<(u64, bool)>,
+    brushes: Vec<(u64, bool)>
+}
+
+// Gradients are fixed in user space, so a shape using one looks different
+// once translated.
+fn is_movable(pattern: &Pattern) -> bool {
+    matches!(pattern, Pattern::Monochrome(_))
+}
+
+impl ResourceHashes {
+    pub fn new(image: &Image) -> ResourceHashes {
+        ResourceHashes {
+            pens: image.pens.iter()
+                .map(|pen| (pen_hash(pen), is_movable(&pen.pattern)))
+                .collect(),
+            brushes: image.brushes.iter()
+                .map(|brush| (finish(|state| hash_pattern(state, &brush.pattern)), is_movable(&brush.pattern)))
+                .collect()
+        }
+    }
+
+    fn pen(&self, pen: usize) -> (u64, bool) {
+        self.pens.get(pen).copied().unwrap_or((u64::MAX, false))
+    }
+
+    fn brush(&self, brush: usize) -> (u64, bool) {
+        self.brushes.get(brush).copied().unwrap_or((u64::MAX, false))
+    }
+}
+
+fn finish(hash: impl FnOnce(&mut DefaultHasher)) -> u64 {
+    let mut state = DefaultHasher::new();
+    hash(&mut state);
+    state.finish()
+}
+
+fn hash_point(state: &mut impl Hasher, point: Point, origin: Point) {
+    state.write_u64((point.x - origin.x).to_bits());
+    state.write_u64((point.y - origin.y).to_bits());
+}
+
+fn hash_color(state: &mut impl Hasher, color: &Color) {
+    for value in [color.red, color.green, color.blue, color.alpha] {
+        state.write_u64(value.to_bits());
+    }
+}
+
+fn hash_pattern(state: &mut impl Hasher, pattern: &Pattern) {
+    match pattern {
+        Pattern::Monochrome(pat) => {
+            state.write_u8(0);
+            hash_color(state, &pat.color);
+        },
+        Pattern::LinearGradient(pat) => {
+            state.write_u8(1);
+            hash_point(state, pat.point_1, ORIGIN);
+            hash_color(state, &pat.color_1);
+            hash_point(state, pat.point_2, ORIGIN);
+            hash_color(state, &pat.color_2);
+        },
+        Pattern::RadialGradient(pat) => {
+            state.write_u8(2);
+            hash_point(state, pat.center_1, ORIGIN);
+            state.write_u64(pat.radius_1.to_bits());
+            hash_color(state, &pat.color_1);
+            hash_point(state, pat.center_2, ORIGIN);
+            state.write_u64(pat.radius_2.to_bits());
+            hash_color(state, &pat.color_2);
+        }
+    }
+}
+
+fn hash_pen(state: &mut impl Hasher, pen: &Pen) {
+    hash_pattern(state, &pen.pattern);
+    state.write_u64(pen.width.to_bits());
+    state.write_u8(pen.cap as u8);
+    state.write_u8(pen.join as u8);
+}
+
+fn hash_curve_data(state: &mut impl Hasher, data: &CurveData, origin: Point) {
+    hash_point(state, data.start(), origin);
+    state.write_usize(data.len());
+
+    for seg in data.segments() {
+        match seg {
+            Segment::Line(line) => {
+                state.write_u8(b'L');
+                hash_point(state, line.point_2, origin);
+            },
+            Segment::QuadraticBezier(bezier) => {
+                state.write_u8(b'Q');
+                hash_point(state, bezier.point_2, origin);
+                hash_point(state, bezier.point_3, origin);
+            },
+            Segment::CubicBezier(bezier) => {
+                state.write_u8(b'C');
+                hash_point(state, bezier.point_2, origin);
+                hash_point(state, bezier.point_3, origin);
+                hash_point(state, bezier.point_4, origin);
+            }
+        }
+    }
+}
+
+fn hash_option(state: &mut impl Hasher, value: Option<u64>) {
+    match value {
+        Some(value) => {
+            state.write_u8(1);
+            state.write_u64(value);
+        },
+        None => {
+            state.write_u8(0);
+        }
+    }
+}
+
+// Hashes shape with every point taken relative to origin. Returns whether
+// the shape would look the same translated, which is not the case if it
+// uses a gradient.
+fn hash_shape(state: &mut impl Hasher, shape: &Shape, resources: &ResourceHashes, origin: Point) -> bool {
+    match shape {
+        Shape::Group(group) => {
+            state.write_u8(0);
+            state.write_usize(group.content.len());
+
+            group.content.iter()
+                .fold(true, |movable, child| hash_shape(state, child, resources, origin) && movable)
+        },
+        Shape::Curve(curve) => {
+            let (pen, movable) = resources.pen(curve.pen);
+            state.write_u8(1);
+            state.write_u64(pen);
+            hash_curve_data(state, &curve.data, origin);
+            movable
+        },
+        Shape::Region(region) => {
+            let pen = region.pen.map(|pen| resources.pen(pen));
+            let brush = region.brush.map(|brush| resources.brush(brush));
+            state.write_u8(2);
+            hash_option(state, pen.map(|(hash, _)| hash));
+            hash_option(state, brush.map(|(hash, _)| hash));
+            state.write_usize(region.data.len());
+
+            for data in region.data.iter() {
+                hash_curve_data(state, data, origin);
+            }
+
+            pen.is_none_or(|(_, movable)| movable) && brush.is_none_or(|(_, movable)| movable)
+        }
+    }
+}
+
+const ORIGIN: Point = Point { x: 0.0, y: 0.0 };
+
+pub(crate) fn pen_hash(pen: &Pen) -> u64 {
+    finish(|state| hash_pen(state, pen))
+}
+
+pub(crate) fn curve_hash(data: &[CurveData], closed: bool) -> u64 {
+    finish(|state| {
+        state.write_u8(closed as u8);
+        state.write_usize(data.len());
+
+        for data in data.iter() {
+            hash_curve_data(state, data, ORIGIN);
+        }
+    })
+}
+
+pub fn shape_hash(shape: &Shape, resources: &ResourceHashes) -> u64 {
+    finish(|state| {
+        hash_shape(state, shape, resources, ORIGIN);
+    })
+}
+
+// The first point drawn by a shape, which anchors its translation-invariant
+// hash.
+pub fn anchor(shape: &Shape) -> Option<Point> {
+    match shape {
+        Shape::Group(group) => group.content.iter().find_map(anchor),
+        Shape::Curve(curve) => Some(curve.data.start()),
+        Shape::Region(region) => region.data.first().map(|data| data.start())
+    }
+}
+
+// What a shape contributes to the translation-invariant hash of its
+// parent: its own hash measured from its anchor, the anchor, and whether it
+// would look the same translated.
+#[derive(Clone, Copy)]
+struct Translated {
+    hash: u64,
+    anchor: Option<Point>,
+    movable: bool
+}
+
+// Hashes shape bottom-up, each group from the hashes of its children, so
+// every node is hashed once however deep it is nested. Groups are passed to
+// visit in the order they start, preorder, once their hash is known.
+fn hash_translated<'a>(shape: &'a Shape, resources: &ResourceHashes, preorder: &mut usize, visit: &mut impl FnMut(&'a GroupShape, usize, Option<(u64, Point)>)) -> Translated {
+    match shape {
+        Shape::Group(group) => {
+            let order = *preorder;
+            *preorder += 1;
+
+            let children: Vec<Translated> = group.content.iter()
+                .map(|child| hash_translated(child, resources, preorder, visit))
+                .collect();
+            let anchor = children.iter().find_map(|child| child.anchor);
+            let hash = finish(|state| {
+                state.write_u8(0);
+                state.write_usize(children.len());
+
+                for child in children.iter() {
+                    state.write_u64(child.hash);
+
+                    match (child.anchor, anchor) {
+                        (Some(point), Some(origin)) => {
+                            state.write_u8(1);
+                            hash_point(state, point, origin);
+                        },
+                        _ => state.write_u8(0)
+                    }
+                }
+            });
+            let movable = children.iter().all(|child| child.movable);
+
+            visit(group, order, anchor.filter(|_| movable).map(|anchor| (hash, anchor)));
+            Translated { hash, anchor, movable }
+        },
+        _ => {
+            let anchor = anchor(shape);
+            let mut movable = true;
+            let hash = finish(|state| {
+                movable = hash_shape(state, shape, resources, anchor.unwrap_or(ORIGIN));
+            });
+
+            Translated { hash, anchor, movable }
+        }
+    }
+}
+
+// A hash that is equal for exact translated copies of a shape, measured
+// from its anchor. None if the shape draws nothing or would look different
+// translated.
+pub fn translated_shape_hash(shape: &Shape, resources: &ResourceHashes) -> Option<(u64, Point)> {
+    let translated = hash_translated(shape, resources, &mut 0, &mut |_, _, _| {});
+    translated.anchor.filter(|_| translated.movable).map(|anchor| (translated.hash, anchor))
+}
+
+// The translated hash of every group in an image that has one, found in a
+// single bottom-up walk and looked up by address.
+pub struct GroupHashes {
+    hashes: HashMap<usize, (u64, Point)>
+}
+
+impl GroupHashes {
+    pub fn new(image: &Image) -> GroupHashes {
+        let resources = ResourceHashes::new(image);
+        let mut hashes = HashMap::new();
+        let mut visit = |group: &GroupShape, _, hash: Option<(u64, Point)>| {
+            if let Some(hash) = hash {
+                hashes.insert(address(group), hash);
+            }
+        };
+
+        for shape in image.shapes.iter() {
+            hash_translated(shape, &resources, &mut 0, &mut visit);
+        }
+
+        GroupHashes { hashes }
+    }
+
+    // As translated_shape_hash, for a group of the image.
+    pub fn get(&self, group: &GroupShape) -> Option<(u64, Point)> {
+        self.hashes.get(&address(group)).copied()
+    }
+}
+
+fn is_translated_data(copy: &CurveData, original: &CurveData, offset: Point) -> bool {
+    copy.verbs() == original.verbs() && copy.points().zip(original.points())
+        .all(|(p, q)| p == Point { x: q.x + offset.x, y: q.y + offset.y })
+}
+
+fn is_translated_content(copy: &[Shape], original: &[Shape], offset: Point) -> bool {
+    copy.len() == original.len() && copy.iter().zip(original.iter())
+        .all(|(copy, original)| is_translated_copy(copy, original, offset))
+}
+
+// Whether copy draws exactly what original draws moved by offset, with the
+// same pens and brushes. Hashes only say this is likely.
+pub fn is_translated_copy(copy: &Shape, original: &Shape, offset: Point) -> bool {
+    match (copy, original) {
+        (Shape::Group(copy), Shape::Group(original)) => is_translated_content(&copy.content, &original.content, offset),
+        (Shape::Curve(copy), Shape::Curve(original)) =>
+            copy.pen == original.pen && is_translated_data(&copy.data, &original.data, offset),
+        (Shape::Region(copy), Shape::Region(original)) =>
+            copy.pen == original.pen && copy.brush == original.brush && copy.data.len() == original.data.len()
+                && copy.data.iter().zip(original.data.iter()).all(|(copy, original)| is_translated_data(copy, original, offset)),
+        _ => false
+    }
+}
+
+// The groups that occur more than once as translated copies, numbered in
+// the order of their first occurrence, for writers that define a group
+// once and place it wherever it repeats. Every group is hashed once, and
+// copies are compared with their first occurrence before they count.
+pub struct RepeatedGroups<'a> {
+    groups: Vec<(&'a GroupShape, Point)>,
+    // Each copy by address, with its number and offset.
+    placements: HashMap<usize, (usize, Point)>
+}
+
+struct Candidate<'a> {
+    order: usize,
+    group: &'a GroupShape,
+    anchor: Point,
+    copies: Vec<(&'a GroupShape, Point)>
+}
+
+fn address(group: &GroupShape) -> usize {
+    group as *const GroupShape as usize
+}
+
+impl<'a> RepeatedGroups<'a> {
+    pub fn new(image: &'a Image) -> RepeatedGroups<'a> {
+        let resources = ResourceHashes::new(image);
+        let mut candidates: Vec<Candidate<'a>> = Vec::new();
+        let mut by_hash: HashMap<u64, Vec<usize>> = HashMap::new();
+        let mut preorder = 0;
+
+        let mut visit = |group: &'a GroupShape, order: usize, hash: Option<(u64, Point)>| {
+            let Some((hash, anchor)) = hash else {
+                return;
+            };
+
+            let same = by_hash.entry(hash).or_default();
+
+            for &candidate in same.iter() {
+                let candidate = &mut candidates[candidate];
+                let offset = Point { x: anchor.x - candidate.anchor.x, y: anchor.y - candidate.anchor.y };
+
+                if is_translated_content(&group.content, &candidate.group.content, offset) {
+                    candidate.copies.push((group, offset));
+                    return;
+                }
+            }
+
+            same.push(candidates.len());
+            candidates.push(Candidate { order, group, anchor, copies: Vec::new() });
+        };
+
+        for shape in image.shapes.iter() {
+            hash_translated(shape, &resources, &mut preorder, &mut visit);
+        }
+
+        candidates.retain(|candidate| !candidate.copies.is_empty());
+        candidates.sort_by_key(|candidate| candidate.order);
+
+        let mut groups = Vec::new();
+        let mut placements = HashMap::new();
+
+        for (id, candidate) in candidates.into_iter().enumerate() {
+            groups.push((candidate.group, candidate.anchor));
+            placements.insert(address(candidate.group), (id, ORIGIN));
+
+            for (copy, offset) in candidate.copies {
+                placements.insert(address(copy), (id, offset));
+            }
+        }
+
+        RepeatedGroups { groups, placements }
+    }
+
+    pub fn len(&self) -> usize {
+        self.groups.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.groups.is_empty()
+    }
+
+    // Each repeated group as first seen, with its anchor.
+    pub fn groups(&self) -> &[(&'a GroupShape, Point)] {
+        &self.groups
+    }
+
+    // The number of the group shape repeats, and how far shape is moved
+    // from that group's first occurrence. shape must be part of the image.
+    pub fn find(&self, shape: &Shape) -> Option<(usize, Point)> {
+        match shape {
+            Shape::Group(group) => self.placements.get(&address(group)).copied(),
+            _ => None
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn parse(pens: &str, shape: &str) -> Image {
+        serde_json::from_str(&format!(r#"{{
+  "width": 100,
+  "height": 100,
+  "unit-per-inch": 72,
+  "pens": [{}],
+  "brushes": [],
+  "shapes": [{}]
+}}"#, pens, shape)).unwrap()
+    }
+
+    fn hash(image: &Image) -> u64 {
+        shape_hash(&image.shapes[0], &ResourceHashes::new(image))
+    }
+
+    const PEN_1: &str = r#"{ "pattern": { "type": "monochrome", "color": [0, 0, 0] }, "width": 1, "cap": "butt", "join": "miter" }"#;
+    const PEN_2: &str = r#"{ "pattern": { "type": "monochrome", "color": [0, 0, 0] }, "width": 2, "cap": "butt", "join": "miter" }"#;
+
+    #[test]
+    fn test_shape_hash() {
+        let curve = r#"{ "type": "curve", "pen": 0, "data": [[0, 0], ["L", [10, 10]]] }"#;
+        let base = hash(&parse(PEN_1, curve));
+
+        assert_eq!(base, hash(&parse(PEN_1, curve)));
+        assert_eq!(base, hash(&parse(&format!("{}, {}", PEN_2, PEN_1), &curve.replace(r#""pen": 0"#, r#""pen": 1"#))));
+        assert_ne!(base, hash(&parse(PEN_2, curve)));
+        assert_ne!(base, hash(&parse(PEN_1, &curve.replace("10, 10", "10, 11"))));
+
+        let group = format!(r#"{{ "type": "group", "content": [{}] }}"#, curve);
+        let annotated = format!(r#"{{ "type": "group", "content": [{}], "edit-annot": {{ "name": "a" }} }}"#, curve);
+        assert_eq!(hash(&parse(PEN_1, &group)), hash(&parse(PEN_1, &annotated)));
+        assert_ne!(base, hash(&parse(PEN_1, &group)));
+    }
+
+    #[test]
+    fn test_translated_shape_hash() {
+        let translated = |pens: &str, shape: &str| {
+            let image = parse(pens, shape);
+            translated_shape_hash(&image.shapes[0], &ResourceHashes::new(&image))
+                .map(|(hash, origin)| (hash, origin.x, origin.y))
+        };
+
+        let group = r#"{ "type": "group", "content": [{ "type": "curve", "pen": 0, "data": [[1, 2], ["L", [10, 10]]] }] }"#;
+        let moved = r#"{ "type": "group", "content": [{ "type": "curve", "pen": 0, "data": [[11, 22], ["L", [20, 30]]] }] }"#;
+        let changed = r#"{ "type": "group", "content": [{ "type": "curve", "pen": 0, "data": [[11, 22], ["L", [20, 31]]] }] }"#;
+
+        let (hash, x, y) = translated(PEN_1, group).unwrap();
+        assert_eq!((1.0, 2.0), (x, y));
+        assert_eq!(Some((hash, 11.0, 22.0)), translated(PEN_1, moved));
+        assert_ne!(hash, translated(PEN_1, changed).unwrap().0);
+
+        let gradient = r#"{ "pattern": { "type": "linear-gradient", "point-1": [0, 0], "color-1": [0, 0, 0], "point-2": [1, 0], "color-2": [1, 1, 1] }, "width": 1, "cap": "butt", "join": "miter" }"#;
+        assert_eq!(None, translated(gradient, group));
+        assert_eq!(None, translated(PEN_1, r#"{ "type": "group", "content": [] }"#));
+    }
+
+    #[test]
+    fn test_repeated_groups() {
+        let group = r#"{ "type": "group", "content": [{ "type": "curve", "pen": 0, "data": [[1, 2], ["L", [10, 10]]] }] }"#;
+        let moved = r#"{ "type": "group", "content": [{ "type": "curve", "pen": 0, "data": [[11, 22], ["L", [20, 30]]] }] }"#;
+        let other = r#"{ "type": "group", "content": [{ "type": "curve", "pen": 0, "data": [[0, 0], ["L", [1, 1]]] }] }"#;
+        let image = parse(PEN_1, &format!("{}, {}, {}", other, group, moved));
+
+        let repeats = RepeatedGroups::new(&image);
+        assert_eq!(1, repeats.len());
+        assert_eq!((1.0, 2.0), (repeats.groups()[0].1.x, repeats.groups()[0].1.y));
+        assert!(repeats.find(&image.shapes[0]).is_none());
+        assert_eq!(Some((0, 0.0, 0.0)), repeats.find(&image.shapes[1]).map(|(id, offset)| (id, offset.x, offset.y)));
+        assert_eq!(Some((0, 10.0, 20.0)), repeats.find(&image.shapes[2]).map(|(id, offset)| (id, offset.x, offset.y)));
+
+        // Nested copies are found too, in the order they start.
+        let outer = format!(r#"{{ "type": "group", "content": [{}, {}] }}"#, group, other);
+        let image = parse(PEN_1, &format!("{}, {}, {}", outer, outer.replace("[1, 1]", "[1, 2]"), moved));
+        let repeats = RepeatedGroups::new(&image);
+        assert_eq!(1, repeats.len());
+        let Shape::Group(outer) = &image.shapes[0] else { unreachable!() };
+        assert_eq!(Some(0), repeats.find(&outer.content[0]).map(|(id, _)| id));
+        assert_eq!(Some(0), repeats.find(&image.shapes[2]).map(|(id, _)| id));
+        assert!(repeats.find(&image.shapes[0]).is_none());
+    }
+
+    #[test]
+    fn test_group_hashes() {
+        let inner = r#"{ "type": "group", "content": [{ "type": "curve", "pen": 0, "data": [[1, 2], ["L", [10, 10]]] }] }"#;
+        let image = parse(PEN_1, &format!(r#"{{ "type": "group", "content": [{}, {}] }}, {{ "type": "group", "content": [] }}"#, inner, inner));
+        let hashes = GroupHashes::new(&image);
+        let resources = ResourceHashes::new(&image);
+
+        let Shape::Group(outer) = &image.shapes[0] else { unreachable!() };
+        let Shape::Group(first) = &outer.content[0] else { unreachable!() };
+        let same = |hash: Option<(u64, Point)>, expected: Option<(u64, Point)>|
+            hash.map(|(hash, p)| (hash, p.x, p.y)) == expected.map(|(hash, p)| (hash, p.x, p.y));
+
+        assert!(same(translated_shape_hash(&image.shapes[0], &resources), hashes.get(outer)));
+        assert!(same(translated_shape_hash(&outer.content[0], &resources), hashes.get(first)));
+        let Shape::Group(empty) = &image.shapes[1] else { unreachable!() };
+        assert!(hashes.get(empty).is_none());
+    }
+
+    #[test]
+    fn test_is_translated_copy() {
+        let image = parse(PEN_1, r#"{ "type": "group", "content": [{ "type": "curve", "pen": 0, "data": [[1, 2], ["L", [10, 10]]] }] },
+  { "type": "group", "content": [{ "type": "curve", "pen": 0, "data": [[11, 22], ["L", [20, 30]]] }] },
+  { "type": "group", "content": [{ "type": "curve", "pen": 1, "data": [[11, 22], ["L", [20, 30]]] }] },
+  { "type": "group", "content": [{ "type": "curve", "pen": 0, "data": [[11, 22], ["Q", [20, 30], [20, 30]]] }] }"#);
+        let offset = Point { x: 10.0, y: 20.0 };
+
+        assert!(is_translated_copy(&image.shapes[1], &image.shapes[0], offset));
+        assert!(!is_translated_copy(&image.shapes[1], &image.shapes[0], Point { x: 10.0, y: 20.000000000000004 }));
+        assert!(!is_translated_copy(&image.shapes[2], &image.shapes[0], offset));
+        assert!(!is_translated_copy(&image.shapes[3], &image.shapes[0], offset));
+    }
+}
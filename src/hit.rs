@@ -0,0 +1,223 @@
+use crate::bounds::Rect;
+use crate::image::*;
+use crate::index::SpatialIndex;
+use crate::raster::flatten;
+use crate::stroke::Vector;
+
+// Curves are tested as polylines within a hundredth of a point of them.
+const FLATNESS: f64 = 0.01 / 72.0;
+
+fn distance_to_line(point: Vector, p0: Vector, p1: Vector) -> f64 {
+    let (dx, dy) = (p1.0 - p0.0, p1.1 - p0.1);
+    let length = dx * dx + dy * dy;
+
+    let t = if length > 0.0 {
+        (((point.0 - p0.0) * dx + (point.1 - p0.1) * dy) / length).clamp(0.0, 1.0)
+    } else {
+        0.0
+    };
+
+    (point.0 - p0.0 - t * dx).hypot(point.1 - p0.1 - t * dy)
+}
+
+fn distance_to_polyline(point: Vector, polyline: &[Vector], closed: bool) -> f64 {
+    let closing = match (closed, polyline.first(), polyline.last()) {
+        (true, Some(&first), Some(&last)) => distance_to_line(point, last, first),
+        _ => f64::INFINITY
+    };
+
+    polyline.windows(2)
+        .map(|line| distance_to_line(point, line[0], line[1]))
+        .fold(closing, f64::min)
+}
+
+// Whether a ray from point to the right crosses the closed polygon an odd
+// number of times.
+fn crosses_odd(point: Vector, polygon: &[Vector]) -> bool {
+    let mut odd = false;
+    let mut previous = match polygon.last() {
+        Some(&last) => last,
+        None => return false
+    };
+
+    for &current in polygon {
+        if (current.1 > point.1) != (previous.1 > point.1) {
+            let x = previous.0 + (point.1 - previous.1) / (current.1 - previous.1) * (current.0 - previous.0);
+
+            if x > point.0 {
+                odd = !odd;
+            }
+        }
+
+        previous = current;
+    }
+
+    odd
+}
+
+// Answers which shapes are under a point or inside a box, through the
+// bounding box index and then exactly: regions are filled even-odd as the
+// renderer fills them, and strokes reach half the pen width from the
+// curve. Shapes are named by their index paths through the groups.
+pub struct HitTester<'a> {
+    image: &'a Image,
+    index: SpatialIndex<'a>,
+    flatness: f64
+}
+
+impl<'a> HitTester<'a> {
+    pub fn new(image: &'a Image) -> HitTester<'a> {
+        HitTester::with_index(image, SpatialIndex::new(image))
+    }
+
+    pub fn with_index(image: &'a Image, index: SpatialIndex<'a>) -> HitTester<'a> {
+        HitTester { image, index, flatness: FLATNESS * image.unit_per_inch }
+    }
+
+    pub fn index(&self) -> &SpatialIndex<'a> {
+        &self.index
+    }
+
+    fn half_width(&self, pen: usize) -> Option<f64> {
+        self.image.pens.get(pen).map(|pen| pen.width.abs() / 2.0)
+    }
+
+    // Joins and caps are taken as round, which errs by at most the corner
+    // of a miter or square cap.
+    fn hits(&self, shape: &Shape, point: Vector, tolerance: f64, points: &mut Vec<Vector>, starts: &mut Vec<usize>) -> bool {
+        points.clear();
+        starts.clear();
+
+        let (pen, brush, closed) = match shape {
+            Shape::Group(_) => return false,
+            Shape::Curve(curve) => {
+                starts.push(0);
+                flatten(points, &curve.data, 1.0, self.flatness);
+                (Some(curve.pen), None, false)
+            },
+            Shape::Region(region) => {
+                for data in &region.data {
+                    starts.push(points.len());
+                    flatten(points, data, 1.0, self.flatness);
+                }
+
+                (region.pen, region.brush, true)
+            }
+        };
+
+        starts.push(points.len());
+
+        let subpaths = starts.windows(2).map(|range| &points[range[0]..range[1]]);
+        let distance = || subpaths.clone()
+            .map(|subpath| distance_to_polyline(point, subpath, closed))
+            .fold(f64::INFINITY, f64::min);
+
+        if brush.is_some() {
+            let inside = subpaths.clone()
+                .fold(false, |odd, subpath| odd != crosses_odd(point, subpath));
+
+            if inside || distance() <= tolerance {
+                return true;
+            }
+        }
+
+        pen.and_then(|pen| self.half_width(pen))
+            .is_some_and(|half_width| distance() <= half_width + tolerance)
+    }
+
+    // The shapes painted at point or within tolerance of it, topmost first.
+    fn hits_at(&self, point: Point, tolerance: f64) -> impl Iterator<Item = &[usize]> {
+        let rect = Rect::new(point.x, point.y, 0.0, 0.0).inflate(tolerance.max(0.0));
+        let mut found = Vec::new();
+        let (mut points, mut starts) = (Vec::new(), Vec::new());
+
+        self.index.query(&rect, &mut found);
+
+        found.into_iter()
+            .rev()
+            .filter(move |&id| self.hits(self.index.shape(id), (point.x, point.y), tolerance, &mut points, &mut starts))
+            .map(|id| self.index.path(id))
+    }
+
+    pub fn hit_test(&self, point: Point, tolerance: f64) -> Option<&[usize]> {
+        self.hits_at(point, tolerance).next()
+    }
+
+    pub fn hit_all(&self, point: Point, tolerance: f64) -> Vec<&[usize]> {
+        self.hits_at(point, tolerance).collect()
+    }
+
+    // The shapes lying entirely inside rect, in document order.
+    pub fn select(&self, rect: &Rect) -> Vec<&[usize]> {
+        let mut found = Vec::new();
+        self.index.query(rect, &mut found);
+
+        found.into_iter()
+            .filter(|&id| {
+                let bounds = self.index.shape_bounds(id);
+                rect.min_x <= bounds.min_x && bounds.max_x <= rect.max_x
+                    && rect.min_y <= bounds.min_y && bounds.max_y <= rect.max_y
+            })
+            .map(|id| self.index.path(id))
+            .collect()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn point(x: f64, y: f64) -> Point {
+        Point { x, y }
+    }
+
+    #[test]
+    fn test_hit_test() {
+        let image: Image = serde_json::from_str(r#"{
+  "width": 100,
+  "height": 100,
+  "unit-per-inch": 72,
+  "pens": [{
+    "pattern": { "type": "monochrome", "color": [0, 0, 0] },
+    "width": 2,
+    "cap": "round",
+    "join": "round"
+  }],
+  "brushes": [{ "pattern": { "type": "monochrome", "color": [1, 0, 0] } }],
+  "shapes": [
+    { "type": "group", "content": [
+      { "type": "region", "brush": 0, "data": [
+        [[0, 0], ["L", [10, 0]], ["L", [10, 10]], ["L", [0, 10]]],
+        [[3, 3], ["L", [7, 3]], ["L", [7, 7]], ["L", [3, 7]]]
+      ] }
+    ] },
+    { "type": "region", "brush": 0, "data": [[[8, 8], ["L", [12, 8]], ["Q", [14, 10], [12, 12]], ["L", [8, 12]]]] },
+    { "type": "curve", "pen": 0, "data": [[0, 20], ["C", [5, 20], [15, 20], [20, 20]]] },
+    { "type": "region", "pen": 0, "data": [[[30, 0], ["L", [40, 0]], ["L", [40, 10]], ["L", [30, 10]]]] }
+  ]
+}"#).unwrap();
+
+        let tester = HitTester::new(&image);
+        let path = |path: &[usize]| Some(path.to_vec());
+        let hit = |x, y, tolerance| tester.hit_test(point(x, y), tolerance).map(<[usize]>::to_vec);
+
+        assert_eq!(path(&[0, 0]), hit(1.0, 1.0, 0.0));
+        assert_eq!(None, hit(5.0, 5.0, 0.0));
+        assert_eq!(path(&[0, 0]), hit(5.0, 6.5, 1.0));
+        assert_eq!(path(&[1]), hit(9.0, 9.0, 0.0));
+        assert_eq!(path(&[1]), hit(12.9, 10.0, 0.0));
+        assert_eq!(path(&[2]), hit(10.0, 20.9, 0.0));
+        assert_eq!(None, hit(10.0, 21.5, 0.0));
+        assert_eq!(path(&[2]), hit(10.0, 21.5, 1.0));
+
+        // An unfilled region is hit on its outline only.
+        assert_eq!(path(&[3]), hit(30.5, 5.0, 0.0));
+        assert_eq!(None, hit(35.0, 5.0, 0.0));
+
+        let all: Vec<Vec<usize>> = tester.hit_all(point(9.0, 9.0), 0.0).into_iter().map(<[usize]>::to_vec).collect();
+        assert_eq!(vec![vec![1], vec![0, 0]], all);
+
+        let selected: Vec<Vec<usize>> = tester.select(&Rect::new(-1.0, -1.0, 16.0, 16.0)).into_iter().map(<[usize]>::to_vec).collect();
+        assert_eq!(vec![vec![0, 0], vec![1]], selected);
+    }
+}
@@ -1,5 +1,6 @@
 
 use std::fmt;
+use std::ops::Range;
 use serde::{Deserialize, Serialize};
 use serde::de::{Deserializer, SeqAccess, Visitor};
 use serde::ser::{Serializer, SerializeSeq};
@@ -17,7 +18,7 @@ pub struct Image {
     pub shapes: Vec<Shape>
 }
 
-#[derive(Clone, Copy)]
+#[derive(Clone, Copy, PartialEq)]
 pub struct Point {
     pub x: f64,
     pub y: f64
@@ -69,7 +70,7 @@ impl Serialize for Point {
     }
 }
 
-#[derive(Clone, Copy)]
+#[derive(Clone, Copy, PartialEq)]
 pub struct Color {
     pub red: f64,
     pub green: f64,
@@ -133,13 +134,13 @@ impl Serialize for Color {
     }
 }
 
-#[derive(Deserialize, Serialize, Clone, Copy)]
+#[derive(Deserialize, Serialize, Clone, Copy, PartialEq)]
 #[serde(rename_all = "kebab-case", deny_unknown_fields)]
 pub struct MonochromePattern {
     pub color: Color
 }
 
-#[derive(Deserialize, Serialize, Clone, Copy)]
+#[derive(Deserialize, Serialize, Clone, Copy, PartialEq)]
 #[serde(rename_all = "kebab-case", deny_unknown_fields)]
 pub struct LinearGradientPattern {
     pub point_1: Point,
@@ -148,7 +149,7 @@ pub struct LinearGradientPattern {
     pub color_2: Color
 }
 
-#[derive(Deserialize, Serialize, Clone, Copy)]
+#[derive(Deserialize, Serialize, Clone, Copy, PartialEq)]
 #[serde(rename_all = "kebab-case", deny_unknown_fields)]
 pub struct RadialGradientPattern {
     pub center_1: Point,
@@ -159,7 +160,7 @@ pub struct RadialGradientPattern {
     pub color_2: Color
 }
 
-#[derive(Deserialize, Serialize, Clone, Copy)]
+#[derive(Deserialize, Serialize, Clone, Copy, PartialEq)]
 #[serde(rename_all = "kebab-case", tag = "type")]
 pub enum Pattern {
     Monochrome(MonochromePattern),
@@ -167,6 +168,18 @@ pub enum Pattern {
     RadialGradient(RadialGradientPattern)
 }
 
+impl Pattern {
+    // A gradient whose two ends coincide does not vary in any direction;
+    // it is drawn in its last color, as Cairo pads it.
+    pub fn is_degenerate(&self) -> bool {
+        match self {
+            Pattern::Monochrome(_) => false,
+            Pattern::LinearGradient(pat) => pat.point_1 == pat.point_2,
+            Pattern::RadialGradient(pat) => pat.center_1 == pat.center_2 && pat.radius_1 == pat.radius_2
+        }
+    }
+}
+
 #[derive(Clone, Copy, PartialEq, Eq)]
 pub enum LineCap {
     Butt,
@@ -317,7 +330,7 @@ impl Serialize for LineJoin {
     }
 }
 
-#[derive(Deserialize, Serialize, Clone, Copy)]
+#[derive(Deserialize, Serialize, Clone, Copy, PartialEq)]
 #[serde(rename_all = "kebab-case", deny_unknown_fields)]
 pub struct Pen {
     pub pattern: Pattern,
@@ -326,7 +339,7 @@ pub struct Pen {
     pub join: LineJoin
 }
 
-#[derive(Deserialize, Serialize, Clone, Copy)]
+#[derive(Deserialize, Serialize, Clone, Copy, PartialEq)]
 #[serde(rename_all = "kebab-case", deny_unknown_fields)]
 pub struct Brush {
     pub pattern: Pattern
@@ -390,6 +403,68 @@ pub enum Segment {
     CubicBezier(CubicBezierSegment)
 }
 
+#[derive(Clone, Copy)]
+enum SegmentTag {
+    Line,
+    QuadraticBezier,
+    CubicBezier
+}
+
+struct SegmentTagVisitor;
+
+impl<'de> Visitor<'de> for SegmentTagVisitor {
+    type Value = SegmentTag;
+
+    fn expecting(&self, formatter: &mut fmt::Formatter<'_>) -> fmt::Result {
+        formatter.write_str("segment tag")
+    }
+
+    fn visit_str<E>(self, v: &str) -> Result<SegmentTag, E>
+    where
+        E: serde::de::Error
+    {
+        match v {
+            "L" => Ok(SegmentTag::Line),
+            "Q" => Ok(SegmentTag::QuadraticBezier),
+            "C" => Ok(SegmentTag::CubicBezier),
+            other => Err(serde::de::Error::unknown_variant(other, &["L", "Q", "C"]))
+        }
+    }
+
+    fn visit_borrowed_str<E>(self, v: &'de str) -> Result<SegmentTag, E>
+    where
+        E: serde::de::Error
+    {
+        match v {
+            "L" => Ok(SegmentTag::Line),
+            "Q" => Ok(SegmentTag::QuadraticBezier),
+            "C" => Ok(SegmentTag::CubicBezier),
+            other => Err(serde::de::Error::unknown_variant(other, &["L", "Q", "C"]))
+        }
+    }
+
+    fn visit_string<E>(self, v: String) -> Result<SegmentTag, E>
+    where
+        E: serde::de::Error
+    {
+        match v.as_str() {
+            "L" => Ok(SegmentTag::Line),
+            "Q" => Ok(SegmentTag::QuadraticBezier),
+            "C" => Ok(SegmentTag::CubicBezier),
+            other => Err(serde::de::Error::unknown_variant(other, &["L", "Q", "C"]))
+        }
+    }
+}
+
+impl<'de> Deserialize<'de> for SegmentTag {
+    fn deserialize<D>(deserializer: D) -> Result<SegmentTag, D::Error>
+    where
+        D: Deserializer<'de>
+    {
+        deserializer.deserialize_str(SegmentTagVisitor)
+    }
+}
+
 struct SegmentVisitor;
 
 impl<'de> Visitor<'de> for SegmentVisitor {
@@ -403,11 +478,11 @@ impl<'de> Visitor<'de> for SegmentVisitor {
     where
         A: SeqAccess<'de>
     {
-        let tag = seq.next_element::<String>()?
+        let tag = seq.next_element::<SegmentTag>()?
             .ok_or_else(|| serde::de::Error::invalid_length(0, &self))?;
 
-        match tag.as_str() {
-            "L" => {
+        match tag {
+            SegmentTag::Line => {
                 let point_2 = seq.next_element::<Point>()?
                     .ok_or_else(|| serde::de::Error::invalid_length(1, &self))?;
 
@@ -416,7 +491,7 @@ impl<'de> Visitor<'de> for SegmentVisitor {
                     Some(_) => Err(serde::de::Error::invalid_length(2, &self))
                 }
             },
-            "Q" => {
+            SegmentTag::QuadraticBezier => {
                 let point_2 = seq.next_element::<Point>()?
                     .ok_or_else(|| serde::de::Error::invalid_length(1, &self))?;
                 let point_3 = seq.next_element::<Point>()?
@@ -427,7 +502,7 @@ impl<'de> Visitor<'de> for SegmentVisitor {
                     Some(_) => Err(serde::de::Error::invalid_length(3, &self))
                 }
             },
-            "C" => {
+            SegmentTag::CubicBezier => {
                 let point_2 = seq.next_element::<Point>()?
                     .ok_or_else(|| serde::de::Error::invalid_length(1, &self))?;
                 let point_3 = seq.next_element::<Point>()?
@@ -439,8 +514,7 @@ impl<'de> Visitor<'de> for SegmentVisitor {
                     None => Ok(Segment::CubicBezier(CubicBezierSegment { point_2, point_3, point_4 })),
                     Some(_) => Err(serde::de::Error::invalid_length(4, &self))
                 }
-            },
-            other => Err(serde::de::Error::unknown_variant(other, &["L", "Q", "C"]))
+            }
         }
     }
 }
@@ -483,12 +557,317 @@ impl Serialize for Segment {
     }
 }
 
+// The precision curve points are stored at. Single halves the size of
+// every point, for documents whose coordinates need no more.
+#[derive(Clone, Copy, PartialEq, Eq, Debug)]
+pub enum Precision {
+    Single,
+    Double
+}
+
+#[derive(Clone, Copy, PartialEq, Eq, Debug)]
+#[repr(u8)]
+pub enum Verb {
+    Line,
+    QuadraticBezier,
+    CubicBezier
+}
+
+impl Verb {
+    pub fn points(self) -> usize {
+        match self {
+            Verb::Line => 1,
+            Verb::QuadraticBezier => 2,
+            Verb::CubicBezier => 3
+        }
+    }
+}
+
+// Points at one precision, chosen per curve or per document.
+#[derive(Clone)]
+pub(crate) enum PointBuffer {
+    Single(Vec<[f32; 2]>),
+    Double(Vec<[f64; 2]>)
+}
+
+impl PointBuffer {
+    pub(crate) fn with_capacity(precision: Precision, capacity: usize) -> PointBuffer {
+        match precision {
+            Precision::Single => PointBuffer::Single(Vec::with_capacity(capacity)),
+            Precision::Double => PointBuffer::Double(Vec::with_capacity(capacity))
+        }
+    }
+
+    pub(crate) fn precision(&self) -> Precision {
+        match self {
+            PointBuffer::Single(_) => Precision::Single,
+            PointBuffer::Double(_) => Precision::Double
+        }
+    }
+
+    pub(crate) fn len(&self) -> usize {
+        match self {
+            PointBuffer::Single(points) => points.len(),
+            PointBuffer::Double(points) => points.len()
+        }
+    }
+
+    pub(crate) fn push(&mut self, point: Point) {
+        match self {
+            PointBuffer::Single(points) => points.push([point.x as f32, point.y as f32]),
+            PointBuffer::Double(points) => points.push([point.x, point.y])
+        }
+    }
+
+    pub(crate) fn slice(&self, range: Range<usize>) -> PointSlice<'_> {
+        match self {
+            PointBuffer::Single(points) => PointSlice::Single(&points[range]),
+            PointBuffer::Double(points) => PointSlice::Double(&points[range])
+        }
+    }
+
+    fn view(&self) -> PointSlice<'_> {
+        self.slice(0..self.len())
+    }
+}
+
+#[derive(Clone, Copy)]
+pub(crate) enum PointSlice<'a> {
+    Single(&'a [[f32; 2]]),
+    Double(&'a [[f64; 2]])
+}
+
+impl<'a> PointSlice<'a> {
+    fn len(self) -> usize {
+        match self {
+            PointSlice::Single(points) => points.len(),
+            PointSlice::Double(points) => points.len()
+        }
+    }
+
+    fn get(self, i: usize) -> Point {
+        match self {
+            PointSlice::Single(points) => Point { x: points[i][0] as f64, y: points[i][1] as f64 },
+            PointSlice::Double(points) => Point { x: points[i][0], y: points[i][1] }
+        }
+    }
+
+    fn split_at(self, mid: usize) -> (PointSlice<'a>, PointSlice<'a>) {
+        match self {
+            PointSlice::Single(points) => {
+                let (head, tail) = points.split_at(mid);
+                (PointSlice::Single(head), PointSlice::Single(tail))
+            },
+            PointSlice::Double(points) => {
+                let (head, tail) = points.split_at(mid);
+                (PointSlice::Double(head), PointSlice::Double(tail))
+            }
+        }
+    }
+
+    fn to_buffer(self) -> PointBuffer {
+        match self {
+            PointSlice::Single(points) => PointBuffer::Single(points.to_vec()),
+            PointSlice::Double(points) => PointBuffer::Double(points.to_vec())
+        }
+    }
+}
+
+// A subpath packed as one verb byte per segment and the points of all the
+// segments after the start point, so a line costs a verb and a point rather
+// than the size of the largest Segment.
 #[derive(Clone)]
 pub struct CurveData {
-    pub start: Point,
-    pub segments: Vec<Segment>
+    verbs: Vec<Verb>,
+    points: PointBuffer
+}
+
+pub(crate) fn push_segment(verbs: &mut Vec<Verb>, points: &mut PointBuffer, seg: Segment) {
+    match seg {
+        Segment::Line(line) => {
+            verbs.push(Verb::Line);
+            points.push(line.point_2);
+        },
+        Segment::QuadraticBezier(bezier) => {
+            verbs.push(Verb::QuadraticBezier);
+            points.push(bezier.point_2);
+            points.push(bezier.point_3);
+        },
+        Segment::CubicBezier(bezier) => {
+            verbs.push(Verb::CubicBezier);
+            points.push(bezier.point_2);
+            points.push(bezier.point_3);
+            points.push(bezier.point_4);
+        }
+    }
+}
+
+impl CurveData {
+    pub fn new(start: Point) -> CurveData {
+        CurveData::with_precision(start, 0, Precision::Double)
+    }
+
+    pub fn with_capacity(start: Point, segments: usize) -> CurveData {
+        CurveData::with_precision(start, segments, Precision::Double)
+    }
+
+    // Points pushed to a single precision curve are rounded to f32.
+    pub fn with_precision(start: Point, segments: usize, precision: Precision) -> CurveData {
+        let mut points = PointBuffer::with_capacity(precision, 1 + segments);
+        points.push(start);
+
+        CurveData { verbs: Vec::with_capacity(segments), points }
+    }
+
+    pub fn from_segments(start: Point, segments: impl IntoIterator<Item = Segment>) -> CurveData {
+        let mut data = CurveData::new(start);
+
+        for seg in segments {
+            data.push(seg);
+        }
+
+        data
+    }
+
+    pub fn view(&self) -> CurveRef<'_> {
+        CurveRef { verbs: &self.verbs, points: self.points.view() }
+    }
+
+    pub fn precision(&self) -> Precision {
+        self.points.precision()
+    }
+
+    // The same curve stored at another precision.
+    pub fn to_precision(&self, precision: Precision) -> CurveData {
+        let mut points = PointBuffer::with_capacity(precision, self.points.len());
+
+        for point in self.points() {
+            points.push(point);
+        }
+
+        CurveData { verbs: self.verbs.clone(), points }
+    }
+
+    pub fn start(&self) -> Point {
+        self.view().start()
+    }
+
+    // The number of segments.
+    pub fn len(&self) -> usize {
+        self.verbs.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.verbs.is_empty()
+    }
+
+    pub fn verbs(&self) -> &[Verb] {
+        &self.verbs
+    }
+
+    // Every point in order, starting with the start point.
+    pub fn points(&self) -> impl ExactSizeIterator<Item = Point> + '_ {
+        self.view().points()
+    }
+
+    pub fn push(&mut self, seg: Segment) {
+        push_segment(&mut self.verbs, &mut self.points, seg);
+    }
+
+    pub fn segments(&self) -> Segments<'_> {
+        self.view().segments()
+    }
+}
+
+// A subpath borrowed from packed storage, either a CurveData or the shared
+// buffers of a Document.
+#[derive(Clone, Copy)]
+pub struct CurveRef<'a> {
+    verbs: &'a [Verb],
+    points: PointSlice<'a>
+}
+
+impl<'a> CurveRef<'a> {
+    // points starts with the start point and holds every point of verbs.
+    pub(crate) fn new(verbs: &'a [Verb], points: PointSlice<'a>) -> CurveRef<'a> {
+        CurveRef { verbs, points }
+    }
+
+    pub fn start(&self) -> Point {
+        self.points.get(0)
+    }
+
+    pub fn len(&self) -> usize {
+        self.verbs.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.verbs.is_empty()
+    }
+
+    pub fn verbs(&self) -> &'a [Verb] {
+        self.verbs
+    }
+
+    pub fn precision(&self) -> Precision {
+        match self.points {
+            PointSlice::Single(_) => Precision::Single,
+            PointSlice::Double(_) => Precision::Double
+        }
+    }
+
+    pub fn points(&self) -> impl ExactSizeIterator<Item = Point> + use<'a> {
+        let points = self.points;
+        (0..points.len()).map(move |i| points.get(i))
+    }
+
+    pub fn segments(&self) -> Segments<'a> {
+        Segments { verbs: self.verbs.iter(), points: self.points.split_at(1).1 }
+    }
+
+    pub fn to_curve_data(&self) -> CurveData {
+        CurveData { verbs: self.verbs.to_vec(), points: self.points.to_buffer() }
+    }
+}
+
+pub struct Segments<'a> {
+    verbs: std::slice::Iter<'a, Verb>,
+    points: PointSlice<'a>
 }
 
+impl Iterator for Segments<'_> {
+    type Item = Segment;
+
+    fn next(&mut self) -> Option<Segment> {
+        let verb = *self.verbs.next()?;
+        let (points, rest) = self.points.split_at(verb.points());
+        self.points = rest;
+
+        Some(match verb {
+            Verb::Line => Segment::Line(LineSegment {
+                point_2: points.get(0)
+            }),
+            Verb::QuadraticBezier => Segment::QuadraticBezier(QuadraticBezierSegment {
+                point_2: points.get(0),
+                point_3: points.get(1)
+            }),
+            Verb::CubicBezier => Segment::CubicBezier(CubicBezierSegment {
+                point_2: points.get(0),
+                point_3: points.get(1),
+                point_4: points.get(2)
+            })
+        })
+    }
+
+    fn size_hint(&self) -> (usize, Option<usize>) {
+        self.verbs.size_hint()
+    }
+}
+
+impl ExactSizeIterator for Segments<'_> {}
+
+const MAX_PREALLOCATED_SEGMENTS: usize = 1 << 16;
+
 struct CurveDataVisitor;
 
 impl<'de> Visitor<'de> for CurveDataVisitor {
@@ -505,13 +884,14 @@ impl<'de> Visitor<'de> for CurveDataVisitor {
         let start = seq.next_element::<Point>()?
             .ok_or_else(|| serde::de::Error::invalid_length(0, &self))?;
 
-        let mut segments = vec![];
+        let capacity = seq.size_hint().map_or(0, |len| len.saturating_sub(1));
+        let mut data = CurveData::with_capacity(start, capacity.min(MAX_PREALLOCATED_SEGMENTS));
 
         while let Some(seg) = seq.next_element::<Segment>()? {
-            segments.push(seg);
+            data.push(seg);
         }
 
-        Ok(CurveData { start, segments })
+        Ok(data)
     }
 }
 
@@ -530,9 +910,9 @@ impl Serialize for CurveData {
         S: Serializer
     {
         let mut seq = serializer.serialize_seq(None)?;
-        seq.serialize_element(&self.start)?;
+        seq.serialize_element(&self.start())?;
 
-        for seg in self.segments.iter() {
+        for seg in self.segments() {
             seq.serialize_element(&seg)?;
         }
 
@@ -540,6 +920,71 @@ impl Serialize for CurveData {
     }
 }
 
+// The curves and regions of a shape tree in document order. Groups carry
+// no drawing state, so drawing the leaves is the same as drawing the tree.
+pub struct Leaves<'a> {
+    stack: Vec<(usize, std::slice::Iter<'a, Shape>)>
+}
+
+impl Leaves<'_> {
+    // The index path through the groups to the leaf last returned.
+    pub fn path(&self) -> impl Iterator<Item = usize> + '_ {
+        self.stack.iter().map(|(len, iter)| len - iter.len() - 1)
+    }
+}
+
+impl<'a> Iterator for Leaves<'a> {
+    type Item = &'a Shape;
+
+    fn next(&mut self) -> Option<&'a Shape> {
+        while let Some((_, iter)) = self.stack.last_mut() {
+            match iter.next() {
+                Some(Shape::Group(group)) => {
+                    self.stack.push((group.content.len(), group.content.iter()));
+                },
+                Some(shape) => {
+                    return Some(shape);
+                },
+                None => {
+                    self.stack.pop();
+                }
+            }
+        }
+
+        None
+    }
+}
+
+pub fn leaves(shapes: &[Shape]) -> Leaves<'_> {
+    Leaves { stack: vec![(shapes.len(), shapes.iter())] }
+}
+
+impl Image {
+    pub fn leaves(&self) -> Leaves<'_> {
+        leaves(&self.shapes)
+    }
+
+    // Stores every curve at precision, which for Single rounds the points
+    // to f32 and halves their size.
+    pub fn set_precision(&mut self, precision: Precision) {
+        set_precision(&mut self.shapes, precision);
+    }
+}
+
+fn set_precision(shapes: &mut [Shape], precision: Precision) {
+    for shape in shapes.iter_mut() {
+        match shape {
+            Shape::Group(group) => set_precision(&mut group.content, precision),
+            Shape::Curve(curve) => curve.data = curve.data.to_precision(precision),
+            Shape::Region(region) => {
+                for data in region.data.iter_mut() {
+                    *data = data.to_precision(precision);
+                }
+            }
+        }
+    }
+}
+
 #[cfg(test)]
 mod tests {
     use super::*;
@@ -979,6 +1424,20 @@ mod tests {
             point_3: Point { x: 18.0, y: 19.0 },
             point_4: Point { x: 20.0, y: 21.0 },
         }), seg3);
+
+        let seg4_str = r#"["L", [22, 23]]"#;
+        let seg4: Segment = serde_json::from_reader(seg4_str.as_bytes()).unwrap();
+        assert_near!(Segment::Line(LineSegment {
+            point_2: Point { x: 22.0, y: 23.0 }
+        }), seg4);
+
+        let bad_seg1_str = r#"["X", [1, 2]]"#;
+        let bad_seg1 = serde_json::from_str::<Segment>(bad_seg1_str);
+        assert!(bad_seg1.is_err());
+
+        let bad_seg2_str = r#"["L", [1, 2], [3, 4]]"#;
+        let bad_seg2 = serde_json::from_str::<Segment>(bad_seg2_str);
+        assert!(bad_seg2.is_err());
     }
 
     #[test]
@@ -1013,32 +1472,100 @@ mod tests {
   ["Q", [14, 15], [16, 17]]
 ]"#;
         let dat: CurveData = serde_json::from_str(dat_str).unwrap();
-        assert_near!(10.0, dat.start.x);
-        assert_near!(11.0, dat.start.y);
-        assert_eq!(2, dat.segments.len());
+        assert_near!(10.0, dat.start().x);
+        assert_near!(11.0, dat.start().y);
+        assert_eq!(2, dat.len());
+        assert_eq!(&[Verb::Line, Verb::QuadraticBezier], dat.verbs());
+        let segments: Vec<Segment> = dat.segments().collect();
         assert_near!(Segment::Line(LineSegment {
             point_2: Point { x: 12.0, y: 13.0 }
-        }), dat.segments[0]);
+        }), segments[0]);
         assert_near!(Segment::QuadraticBezier(QuadraticBezierSegment {
             point_2: Point { x: 14.0, y: 15.0 },
             point_3: Point { x: 16.0, y: 17.0 }
-        }), dat.segments[1]);
+        }), segments[1]);
+    }
+
+    #[test]
+    fn test_curve_data_packing() {
+        let dat: CurveData = serde_json::from_str(r#"[[0, 1], ["L", [2, 3]], ["C", [4, 5], [6, 7], [8, 9]], ["Q", [10, 11], [12, 13]]]"#).unwrap();
+        assert_eq!(&[Verb::Line, Verb::CubicBezier, Verb::QuadraticBezier], dat.verbs());
+        assert_eq!(7, dat.points().len());
+        assert!(dat.points().enumerate().all(|(i, p)| p.x == 2.0 * i as f64 && p.y == 2.0 * i as f64 + 1.0));
+        assert_eq!(3, dat.segments().len());
+
+        match dat.segments().nth(1) {
+            Some(Segment::CubicBezier(bezier)) => {
+                assert_near!(Point { x: 8.0, y: 9.0 }, bezier.point_4);
+            },
+            _ => assert!(false)
+        }
+    }
+
+    #[test]
+    fn test_curve_data_precision() {
+        let dat: CurveData = serde_json::from_str(r#"[[0.1, 1], ["L", [2, 3]], ["Q", [4, 5.3], [6, 7]]]"#).unwrap();
+        assert_eq!(Precision::Double, dat.precision());
+
+        let single = dat.to_precision(Precision::Single);
+        assert_eq!(Precision::Single, single.precision());
+        assert_eq!(dat.verbs(), single.verbs());
+        assert_eq!(0.1f32 as f64, single.start().x);
+
+        let points: Vec<(f64, f64)> = single.points().map(|p| (p.x, p.y)).collect();
+        assert_eq!(vec![(0.1f32 as f64, 1.0), (2.0, 3.0), (4.0, 5.3f32 as f64), (6.0, 7.0)], points);
+
+        match single.segments().nth(1) {
+            Some(Segment::QuadraticBezier(bezier)) => assert_eq!(5.3f32 as f64, bezier.point_2.y),
+            _ => assert!(false)
+        }
+
+        // What a curve holds at f32 comes back exactly at f64.
+        let double = single.to_precision(Precision::Double);
+        assert_eq!(serde_json::to_string(&single).unwrap(), serde_json::to_string(&double).unwrap());
+        assert_eq!(Precision::Single, single.view().to_curve_data().precision());
+
+        let mut pushed = CurveData::with_precision(Point { x: 0.0, y: 0.0 }, 1, Precision::Single);
+        pushed.push(Segment::Line(LineSegment { point_2: Point { x: 0.1, y: 0.2 } }));
+        assert_eq!(0.2f32 as f64, pushed.segments().next().map(|seg| match seg {
+            Segment::Line(line) => line.point_2.y,
+            _ => 0.0
+        }).unwrap());
+    }
+
+    #[test]
+    fn test_image_set_precision() {
+        let mut image: Image = serde_json::from_str(r#"{
+  "width": 10, "height": 10, "unit-per-inch": 72, "pens": [], "brushes": [],
+  "shapes": [
+    { "type": "group", "content": [{ "type": "curve", "pen": 0, "data": [[0.1, 0.2]] }] },
+    { "type": "region", "data": [[[0.3, 0.4]], [[0.5, 0.6]]] }
+  ]
+}"#).unwrap();
+
+        image.set_precision(Precision::Single);
+
+        let precisions: Vec<Precision> = image.leaves()
+            .flat_map(|shape| match shape {
+                Shape::Curve(curve) => vec![curve.data.precision()],
+                Shape::Region(region) => region.data.iter().map(|data| data.precision()).collect(),
+                Shape::Group(_) => vec![]
+            })
+            .collect();
+        assert_eq!(vec![Precision::Single; 3], precisions);
     }
 
     #[test]
     fn test_curve_data_ser() {
-        let dat = CurveData {
-            start: Point { x: 1.0, y: 2.0 },
-            segments: vec![
-                Segment::Line(LineSegment {
-                    point_2: Point { x: 3.0, y: 4.0 }
-                }),
-                Segment::QuadraticBezier(QuadraticBezierSegment {
-                    point_2: Point { x: 5.0, y: 6.0 },
-                    point_3: Point { x: 7.0, y: 8.0 }
-                })
-            ]
-        };
+        let dat = CurveData::from_segments(Point { x: 1.0, y: 2.0 }, [
+            Segment::Line(LineSegment {
+                point_2: Point { x: 3.0, y: 4.0 }
+            }),
+            Segment::QuadraticBezier(QuadraticBezierSegment {
+                point_2: Point { x: 5.0, y: 6.0 },
+                point_3: Point { x: 7.0, y: 8.0 }
+            })
+        ]);
         let dat_str = serde_json::to_string(&dat).unwrap();
         assert_eq!(r#"[[1.0,2.0],["L",[3.0,4.0]],["Q",[5.0,6.0],[7.0,8.0]]]"#, &dat_str);
     }
@@ -1080,16 +1607,17 @@ mod tests {
         let sh2: Shape = serde_json::from_str(sh2_str).unwrap();
         if let Shape::Curve(s) = sh2 {
             assert_eq!(3, s.pen);
-            assert_near!(10.0, s.data.start.x);
-            assert_near!(11.0, s.data.start.y);
-            assert_eq!(2, s.data.segments.len());
+            assert_near!(10.0, s.data.start().x);
+            assert_near!(11.0, s.data.start().y);
+            assert_eq!(2, s.data.len());
+            let segments: Vec<Segment> = s.data.segments().collect();
             assert_near!(Segment::Line(LineSegment {
                 point_2: Point { x: 12.0, y: 13.0 }
-            }), s.data.segments[0]);
+            }), segments[0]);
             assert_near!(Segment::QuadraticBezier(QuadraticBezierSegment {
                 point_2: Point { x: 14.0, y: 15.0 },
                 point_3: Point { x: 16.0, y: 17.0 }
-            }), s.data.segments[1]);
+            }), segments[1]);
         } else {
             assert!(false);
         }
@@ -1104,8 +1632,8 @@ mod tests {
             assert_eq!(Some(0), s.pen);
             assert_eq!(None, s.brush);
             assert_eq!(1, s.data.len());
-            assert_near!(7.0, s.data[0].start.x);
-            assert_near!(8.0, s.data[0].start.y);
+            assert_near!(7.0, s.data[0].start().x);
+            assert_near!(8.0, s.data[0].start().y);
         } else {
             assert!(false);
         }
@@ -1134,14 +1662,11 @@ mod tests {
 
         let sh3 = Shape::Curve(CurveShape {
             pen: 1,
-            data: CurveData {
-                start: Point { x: 1.0, y: 2.0 },
-                segments: vec![
-                    Segment::Line(LineSegment {
-                        point_2: Point { x: 3.0, y: 4.0 }
-                    })
-                ]
-            }
+            data: CurveData::from_segments(Point { x: 1.0, y: 2.0 }, [
+                Segment::Line(LineSegment {
+                    point_2: Point { x: 3.0, y: 4.0 }
+                })
+            ])
         });
         let sh3_str = serde_json::to_string(&sh3).unwrap();
         assert_eq!(r#"{"type":"curve","pen":1,"data":[[1.0,2.0],["L",[3.0,4.0]]]}"#, &sh3_str);
@@ -1150,14 +1675,11 @@ mod tests {
             pen: Some(0),
             brush: None,
             data: vec![
-                CurveData {
-                    start: Point { x: 5.0, y: 6.0 },
-                    segments: vec![
-                        Segment::Line(LineSegment {
-                            point_2: Point { x: 7.0, y: 8.0 }
-                        })
-                    ]
-                }
+                CurveData::from_segments(Point { x: 5.0, y: 6.0 }, [
+                    Segment::Line(LineSegment {
+                        point_2: Point { x: 7.0, y: 8.0 }
+                    })
+                ])
             ]
         });
         let sh4_str = serde_json::to_string(&sh4).unwrap();
@@ -1167,10 +1689,7 @@ mod tests {
             pen: None,
             brush: Some(1),
             data: vec![
-                CurveData {
-                    start: Point { x: 9.0, y: 10.0 },
-                    segments: vec![]
-                }
+                CurveData::new(Point { x: 9.0, y: 10.0 })
             ]
         });
         let sh5_str = serde_json::to_string(&sh5).unwrap();
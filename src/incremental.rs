@@ -0,0 +1,191 @@
+use cairo::{Context, Format, ImageSurface, Result};
+
+use crate::bounds::*;
+use crate::hash::*;
+use crate::image::*;
+use crate::render::*;
+
+#[derive(Clone, Copy)]
+struct LeafState {
+    hash: u64,
+    bounds: Rect
+}
+
+// Keeps the surface of the last rendered version of a document and, given
+// the next version, repaints only where leaves were added, removed or
+// changed. Leaves rather than top-level shapes are compared, since editor
+// exports usually wrap everything in a single group.
+pub struct IncrementalRenderer {
+    surface: ImageSurface,
+    ppi: f64,
+    scale: f64,
+    unit_per_inch: Option<f64>,
+    leaves: Vec<LeafState>
+}
+
+impl IncrementalRenderer {
+    pub fn new(width: i32, height: i32, ppi: f64, scale: f64) -> Result<IncrementalRenderer> {
+        Ok(IncrementalRenderer {
+            surface: ImageSurface::create(Format::ARgb32, width, height)?,
+            ppi,
+            scale,
+            unit_per_inch: None,
+            leaves: Vec::new()
+        })
+    }
+
+    pub fn surface(&self) -> &ImageSurface {
+        &self.surface
+    }
+
+    pub fn into_surface(self) -> ImageSurface {
+        self.surface
+    }
+
+    // Forces the next update to repaint everything.
+    pub fn invalidate(&mut self) {
+        self.unit_per_inch = None;
+        self.leaves.clear();
+    }
+
+    fn full_rect(&self) -> Rect {
+        Rect::new(0.0, 0.0, self.surface.width().into(), self.surface.height().into())
+    }
+
+    fn damage(&self, leaves: &[LeafState]) -> Rect {
+        let old = &self.leaves;
+
+        let prefix = old.iter().zip(leaves.iter())
+            .take_while(|(a, b)| a.hash == b.hash)
+            .count();
+        let suffix = old[prefix..].iter().rev().zip(leaves[prefix..].iter().rev())
+            .take_while(|(a, b)| a.hash == b.hash)
+            .count();
+
+        let old = &old[prefix..old.len() - suffix];
+        let new = &leaves[prefix..leaves.len() - suffix];
+
+        // Leaves edited in place keep their positions; anything else damages
+        // the whole changed run.
+        if old.len() == new.len() {
+            old.iter().zip(new.iter())
+                .filter(|(a, b)| a.hash != b.hash)
+                .fold(Rect::EMPTY, |rect, (a, b)| rect.union(&a.bounds).union(&b.bounds))
+        } else {
+            old.iter().chain(new.iter())
+                .fold(Rect::EMPTY, |rect, leaf| rect.union(&leaf.bounds))
+        }
+    }
+
+    // Brings the surface up to date with image and returns the repainted
+    // area in pixels, which is empty when nothing changed.
+    pub fn update(&mut self, image: &Image) -> Result<Rect> {
+        let scaler = Scaler::new(image.unit_per_inch, self.ppi, self.scale);
+        let hashes = ResourceHashes::new(image);
+
+        let shapes: Vec<&Shape> = image.leaves().collect();
+        let leaves: Vec<LeafState> = shapes.iter()
+            .map(|shape| LeafState {
+                hash: shape_hash(shape, &hashes),
+                // One extra pixel covers antialiasing.
+                bounds: shape_bounds(shape, image).scale(scaler.factor()).inflate(1.0)
+            })
+            .collect();
+
+        let damage = if self.unit_per_inch == Some(image.unit_per_inch) {
+            self.damage(&leaves)
+        } else {
+            self.full_rect()
+        };
+
+        let full = self.full_rect();
+        let damage = Rect {
+            min_x: damage.min_x.max(full.min_x).floor(),
+            min_y: damage.min_y.max(full.min_y).floor(),
+            max_x: damage.max_x.min(full.max_x).ceil(),
+            max_y: damage.max_y.min(full.max_y).ceil()
+        };
+
+        self.unit_per_inch = Some(image.unit_per_inch);
+        self.leaves = leaves;
+
+        if damage.is_empty() || damage.min_x == damage.max_x || damage.min_y == damage.max_y {
+            return Ok(Rect::EMPTY);
+        }
+
+        let context = Context::new(&self.surface)?;
+
+        // The clip is pixel aligned, so the pixels inside it come out exactly
+        // as a full repaint would leave them.
+        context.rectangle(damage.min_x, damage.min_y, damage.max_x - damage.min_x, damage.max_y - damage.min_y);
+        context.clip();
+        context.set_operator(cairo::Operator::Clear);
+        context.paint()?;
+
+        let resources = Resources::new(image);
+
+        scaler.draw(&context, || {
+            for (shape, leaf) in shapes.iter().zip(self.leaves.iter()) {
+                if leaf.bounds.intersects(&damage) {
+                    render_shape(&context, shape, &resources)?;
+                }
+            }
+
+            Ok(())
+        })?;
+
+        Ok(damage)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn document(x: f64) -> Image {
+        serde_json::from_str(&format!(r#"{{
+  "width": 100,
+  "height": 100,
+  "unit-per-inch": 72,
+  "pens": [],
+  "brushes": [{{ "pattern": {{ "type": "monochrome", "color": [1, 0, 0] }} }}],
+  "shapes": [{{
+    "type": "group",
+    "content": [{{
+      "type": "region",
+      "brush": 0,
+      "data": [[[10, 10], ["L", [20, 10]], ["L", [20, 20]]]]
+    }}, {{
+      "type": "region",
+      "brush": 0,
+      "data": [[[{}, 50], ["L", [{}, 50]], ["L", [{}, 60]]]]
+    }}]
+  }}]
+}}"#, x, x + 10.0, x + 10.0)).unwrap()
+    }
+
+    fn pixels(surface: &ImageSurface) -> Vec<u8> {
+        let mut pixels = Vec::new();
+        surface.flush();
+        surface.with_data(|data| pixels.extend_from_slice(data)).unwrap();
+        pixels
+    }
+
+    #[test]
+    fn test_incremental_renderer() {
+        let mut renderer = IncrementalRenderer::new(100, 100, 72.0, 1.0).unwrap();
+
+        assert_eq!(Rect::new(0.0, 0.0, 100.0, 100.0), renderer.update(&document(50.0)).unwrap());
+        assert!(renderer.update(&document(50.0)).unwrap().is_empty());
+
+        let damage = renderer.update(&document(70.0)).unwrap();
+        assert_eq!(Rect { min_x: 49.0, min_y: 49.0, max_x: 81.0, max_y: 61.0 }, damage);
+
+        let mut expected = IncrementalRenderer::new(100, 100, 72.0, 1.0).unwrap();
+        expected.update(&document(70.0)).unwrap();
+        assert_eq!(pixels(expected.surface()), pixels(renderer.surface()));
+
+        renderer.invalidate();
+        assert_eq!(Rect::new(0.0, 0.0, 100.0, 100.0), renderer.update(&document(70.0)).unwrap());
+    }
+}
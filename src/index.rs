@@ -0,0 +1,315 @@
+use std::ops::Range;
+
+use crate::bounds::*;
+use crate::image::*;
+
+struct Leaf<'a> {
+    shape: &'a Shape,
+    bounds: Rect,
+    path: Range<usize>
+}
+
+// A grid over part of the leaves, stored compressed: the leaves of cell i
+// are entries[starts[i]..starts[i + 1]], in document order.
+struct Grid {
+    columns: usize,
+    rows: usize,
+    cell_width: f64,
+    cell_height: f64,
+    starts: Vec<usize>,
+    entries: Vec<usize>
+}
+
+impl Grid {
+    fn new(bounds: &Rect, size: usize) -> Grid {
+        Grid {
+            columns: size,
+            rows: size,
+            cell_width: (bounds.max_x - bounds.min_x) / size as f64,
+            cell_height: (bounds.max_y - bounds.min_y) / size as f64,
+            starts: vec![0; size * size + 1],
+            entries: Vec::new()
+        }
+    }
+
+    fn cell_range(&self, origin: &Rect, rect: &Rect) -> (usize, usize, usize, usize) {
+        let column = |x: f64| {
+            if self.cell_width > 0.0 {
+                (((x - origin.min_x) / self.cell_width).max(0.0) as usize).min(self.columns - 1)
+            } else {
+                0
+            }
+        };
+        let row = |y: f64| {
+            if self.cell_height > 0.0 {
+                (((y - origin.min_y) / self.cell_height).max(0.0) as usize).min(self.rows - 1)
+            } else {
+                0
+            }
+        };
+
+        (column(rect.min_x), row(rect.min_y), column(rect.max_x), row(rect.max_y))
+    }
+}
+
+fn cell_count((x0, y0, x1, y1): (usize, usize, usize, usize)) -> usize {
+    (x1 - x0 + 1) * (y1 - y0 + 1)
+}
+
+// A hierarchy of uniform grids over the leaf shapes, each with half the
+// columns and rows of the one before, down to a single cell. Every leaf is
+// stored in the finest grid where it spans at most MAX_LEAF_CELLS cells, so
+// long strokes and backgrounds cannot make the index quadratic in the
+// number of leaves and a small query visits a few cells per grid. The index
+// paths of the leaves are packed into paths.
+pub struct SpatialIndex<'a> {
+    leaves: Vec<Leaf<'a>>,
+    paths: Vec<usize>,
+    bounds: Rect,
+    grids: Vec<Grid>
+}
+
+const MAX_GRID_SIZE: usize = 256;
+const MAX_LEAF_CELLS: usize = 16;
+
+impl<'a> SpatialIndex<'a> {
+    pub fn new(image: &'a Image) -> SpatialIndex<'a> {
+        let mut leaves = Vec::new();
+        let mut paths = Vec::new();
+        let mut iter = image.leaves();
+
+        while let Some(shape) = iter.next() {
+            let bounds = shape_bounds(shape, image);
+
+            if bounds.is_empty() {
+                continue;
+            }
+
+            let start = paths.len();
+            paths.extend(iter.path());
+            leaves.push(Leaf { shape, bounds, path: start..paths.len() });
+        }
+
+        let bounds = leaves.iter()
+            .fold(Rect::EMPTY, |rect, leaf| rect.union(&leaf.bounds));
+
+        let mut size = ((leaves.len() as f64).sqrt().ceil() as usize).clamp(1, MAX_GRID_SIZE);
+        let mut grids = vec![Grid::new(&bounds, size)];
+
+        while size > 1 {
+            size = size.div_ceil(2);
+            grids.push(Grid::new(&bounds, size));
+        }
+
+        let levels: Vec<usize> = leaves.iter()
+            .map(|leaf| {
+                let fits = |grid: &Grid| cell_count(grid.cell_range(&bounds, &leaf.bounds)) <= MAX_LEAF_CELLS;
+                grids.iter().position(fits).unwrap_or(grids.len() - 1)
+            })
+            .collect();
+
+        for (leaf, &level) in leaves.iter().zip(levels.iter()) {
+            let grid = &mut grids[level];
+            let (x0, y0, x1, y1) = grid.cell_range(&bounds, &leaf.bounds);
+
+            for y in y0..=y1 {
+                for x in x0..=x1 {
+                    grid.starts[y * grid.columns + x + 1] += 1;
+                }
+            }
+        }
+
+        for grid in grids.iter_mut() {
+            for i in 1..grid.starts.len() {
+                grid.starts[i] += grid.starts[i - 1];
+            }
+
+            grid.entries = vec![0; grid.starts[grid.columns * grid.rows]];
+        }
+
+        let mut fills: Vec<Vec<usize>> = grids.iter().map(|grid| grid.starts.clone()).collect();
+
+        for (id, (leaf, &level)) in leaves.iter().zip(levels.iter()).enumerate() {
+            let (grid, fill) = (&mut grids[level], &mut fills[level]);
+            let (x0, y0, x1, y1) = grid.cell_range(&bounds, &leaf.bounds);
+
+            for y in y0..=y1 {
+                for x in x0..=x1 {
+                    let cell = y * grid.columns + x;
+                    grid.entries[fill[cell]] = id;
+                    fill[cell] += 1;
+                }
+            }
+        }
+
+        SpatialIndex { leaves, paths, bounds, grids }
+    }
+
+    pub fn len(&self) -> usize {
+        self.leaves.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.leaves.is_empty()
+    }
+
+    pub fn bounds(&self) -> Rect {
+        self.bounds
+    }
+
+    pub fn shape(&self, id: usize) -> &'a Shape {
+        self.leaves[id].shape
+    }
+
+    pub fn shape_bounds(&self, id: usize) -> Rect {
+        self.leaves[id].bounds
+    }
+
+    pub fn path(&self, id: usize) -> &[usize] {
+        &self.paths[self.leaves[id].path.clone()]
+    }
+
+    // Fills found with the ids of the leaves overlapping rect, in document
+    // order. The vector is reused to avoid an allocation per query.
+    pub fn query(&self, rect: &Rect, found: &mut Vec<usize>) {
+        found.clear();
+
+        if !rect.intersects(&self.bounds) {
+            return;
+        }
+
+        // Sorting the candidates of a query covering most of the finest
+        // grid costs more than testing every leaf.
+        let finest = &self.grids[0];
+
+        if cell_count(finest.cell_range(&self.bounds, rect)) * 2 > finest.columns * finest.rows {
+            found.extend((0..self.leaves.len()).filter(|&id| self.leaves[id].bounds.intersects(rect)));
+            return;
+        }
+
+        for grid in self.grids.iter() {
+            let (x0, y0, x1, y1) = grid.cell_range(&self.bounds, rect);
+
+            for y in y0..=y1 {
+                for x in x0..=x1 {
+                    let cell = y * grid.columns + x;
+
+                    found.extend(grid.entries[grid.starts[cell]..grid.starts[cell + 1]].iter()
+                        .copied()
+                        .filter(|&id| self.leaves[id].bounds.intersects(rect)));
+                }
+            }
+        }
+
+        found.sort_unstable();
+        found.dedup();
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn grid_image(count: usize) -> Image {
+        let mut shapes = Vec::new();
+
+        for i in 0..count {
+            let x = (i % 10) as f64 * 10.0;
+            let y = (i / 10) as f64 * 10.0;
+            shapes.push(format!(
+                r#"{{ "type": "region", "brush": 0, "data": [[[{}, {}], ["L", [{}, {}]], ["L", [{}, {}]]]] }}"#,
+                x, y, x + 5.0, y, x + 5.0, y + 5.0
+            ));
+        }
+
+        serde_json::from_str(&format!(r#"{{
+  "width": 100,
+  "height": 100,
+  "unit-per-inch": 72,
+  "pens": [],
+  "brushes": [{{ "pattern": {{ "type": "monochrome", "color": [0, 0, 0] }} }}],
+  "shapes": [{{ "type": "group", "content": [{}] }}]
+}}"#, shapes.join(","))).unwrap()
+    }
+
+    #[test]
+    fn test_spatial_index() {
+        let image = grid_image(100);
+        let index = SpatialIndex::new(&image);
+        assert_eq!(100, index.len());
+        assert_eq!(&[0, 42], index.path(42));
+        assert_eq!(Rect { min_x: 0.0, min_y: 0.0, max_x: 95.0, max_y: 95.0 }, index.bounds());
+
+        let mut found = Vec::new();
+        index.query(&Rect::new(12.0, 12.0, 15.0, 10.0), &mut found);
+        assert_eq!(vec![11, 12, 21, 22], found);
+
+        index.query(&Rect::new(6.0, 6.0, 3.0, 3.0), &mut found);
+        assert!(found.is_empty());
+
+        index.query(&Rect::new(-10.0, -10.0, 200.0, 200.0), &mut found);
+        assert_eq!((0..100).collect::<Vec<_>>(), found);
+
+        let rect = Rect::new(33.0, 47.0, 21.0, 30.0);
+        index.query(&rect, &mut found);
+        let expected: Vec<usize> = (0..100).filter(|&id| index.shape_bounds(id).intersects(&rect)).collect();
+        assert_eq!(expected, found);
+    }
+
+    #[test]
+    fn test_oversized_leaves() {
+        let mut shapes = Vec::new();
+
+        for i in 0..400 {
+            let (x, y) = ((i % 20) as f64 * 5.0, (i / 20) as f64 * 5.0);
+            shapes.push(format!(r#"{{ "type": "curve", "pen": 0, "data": [[{}, {}], ["L", [{}, {}]]] }}"#, x, y, x + 1.0, y + 1.0));
+            shapes.push(format!(r#"{{ "type": "curve", "pen": 0, "data": [[0, {}], ["L", [100, {}]]] }}"#, i as f64 * 0.25, i as f64 * 0.25));
+        }
+
+        let image: Image = serde_json::from_str(&format!(r#"{{
+  "width": 100,
+  "height": 100,
+  "unit-per-inch": 72,
+  "pens": [{{ "pattern": {{ "type": "monochrome", "color": [0, 0, 0] }}, "width": 1, "cap": "round", "join": "round" }}],
+  "brushes": [],
+  "shapes": [{}]
+}}"#, shapes.join(","))).unwrap();
+
+        let index = SpatialIndex::new(&image);
+        assert_eq!(800, index.len());
+        assert!(index.grids[0].entries.iter().all(|&id| id % 2 == 0));
+
+        let entries: usize = index.grids.iter().map(|grid| grid.entries.len()).sum();
+        assert!(entries <= index.len() * MAX_LEAF_CELLS);
+
+        let mut found = Vec::new();
+        let rect = Rect::new(50.0, 50.0, 2.0, 2.0);
+        index.query(&rect, &mut found);
+        let expected: Vec<usize> = (0..800).filter(|&id| index.shape_bounds(id).intersects(&rect)).collect();
+        assert!(found.contains(&401));
+        assert_eq!(expected, found);
+
+        // The long strokes live in coarser grids, so a small query only
+        // looks at the ones passing near it.
+        let candidates: usize = index.grids.iter()
+            .map(|grid| {
+                let (x0, y0, x1, y1) = grid.cell_range(&index.bounds, &rect);
+                (y0..=y1).flat_map(|y| (x0..=x1).map(move |x| y * grid.columns + x))
+                    .map(|cell| grid.starts[cell + 1] - grid.starts[cell])
+                    .sum::<usize>()
+            })
+            .sum();
+        assert!(candidates < 200, "{} candidates", candidates);
+    }
+
+    #[test]
+    fn test_empty_spatial_index() {
+        let image = grid_image(0);
+        let index = SpatialIndex::new(&image);
+        assert!(index.is_empty());
+
+        let mut found = Vec::new();
+        index.query(&Rect::new(0.0, 0.0, 100.0, 100.0), &mut found);
+        assert!(found.is_empty());
+    }
+}
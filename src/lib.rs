@@ -1,3 +1,31 @@
 
 pub mod image;
+pub mod document;
+pub mod binary;
+pub mod load;
+pub mod scan;
+pub mod validate;
 pub mod render;
+pub mod hit;
+pub mod lod;
+pub mod plan;
+pub mod stream;
+pub mod bounds;
+pub mod index;
+pub mod tile;
+pub mod pyramid;
+pub mod strip;
+pub mod format;
+pub mod hash;
+pub mod png;
+pub mod svg;
+pub mod pdf;
+pub mod incremental;
+pub mod cache;
+pub mod profile;
+pub mod backend;
+pub mod stroke;
+pub mod raster;
+pub mod service;
+#[cfg(feature = "gpu")]
+pub mod gpu;
@@ -0,0 +1,160 @@
+use std::fmt;
+use std::fs::File;
+use std::io::{self, Read};
+use std::ops::Deref;
+use std::path::Path;
+use std::thread;
+
+use memmap2::Mmap;
+
+use crate::binary::{decode_image, is_binary, BinaryError};
+use crate::document::Document;
+use crate::image::Image;
+use crate::scan::parse_image_parallel;
+use crate::validate::{ValidImage, ValidationError};
+
+#[derive(Debug)]
+pub enum LoadError {
+    Io(io::Error),
+    Parse(serde_json::Error),
+    Binary(BinaryError),
+    Invalid(ValidationError)
+}
+
+impl fmt::Display for LoadError {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        match self {
+            LoadError::Io(err) => write!(f, "{}", err),
+            LoadError::Parse(err) => write!(f, "{}", err),
+            LoadError::Binary(err) => write!(f, "{}", err),
+            LoadError::Invalid(err) => write!(f, "{}", err)
+        }
+    }
+}
+
+impl std::error::Error for LoadError {}
+
+// The contents of an input file, mapped when it is a regular file and read
+// into memory otherwise.
+pub enum FileBytes {
+    Mapped(Mmap),
+    Read(Vec<u8>)
+}
+
+impl Deref for FileBytes {
+    type Target = [u8];
+
+    fn deref(&self) -> &[u8] {
+        match self {
+            FileBytes::Mapped(map) => map,
+            FileBytes::Read(bytes) => bytes
+        }
+    }
+}
+
+// Pipes, FIFOs and terminals such as /dev/stdin cannot be mapped.
+pub fn map_file<P: AsRef<Path>>(path: P) -> Result<FileBytes, LoadError> {
+    let mut file = File::open(path).map_err(LoadError::Io)?;
+
+    if !file.metadata().map_err(LoadError::Io)?.is_file() {
+        let mut bytes = Vec::new();
+        file.read_to_end(&mut bytes).map_err(LoadError::Io)?;
+        return Ok(FileBytes::Read(bytes));
+    }
+
+    // The mapping is only read while parsing. Like any reader of a file
+    // that is being rewritten underneath it, the result is unspecified
+    // if another process truncates the input meanwhile.
+    unsafe { Mmap::map(&file) }.map(FileBytes::Mapped).map_err(LoadError::Io)
+}
+
+pub fn load_image<P: AsRef<Path>>(path: P) -> Result<Image, LoadError> {
+    let map = map_file(path)?;
+    parse_image(&map)
+}
+
+// Below this, threads cost more than they save.
+const PARALLEL_THRESHOLD: usize = 1 << 20;
+
+pub fn parse_image(bytes: &[u8]) -> Result<Image, LoadError> {
+    if is_binary(bytes) {
+        decode_image(bytes).map_err(LoadError::Binary)
+    } else if bytes.len() >= PARALLEL_THRESHOLD {
+        let threads = thread::available_parallelism().map_or(1, |threads| threads.get());
+        parse_image_parallel(bytes, threads).map_err(LoadError::Parse)
+    } else {
+        serde_json::from_slice(bytes).map_err(LoadError::Parse)
+    }
+}
+
+// For the renderers: an image that loads through here renders without
+// errors from its contents.
+pub fn load_valid_image<P: AsRef<Path>>(path: P) -> Result<ValidImage, LoadError> {
+    ValidImage::new(load_image(path)?).map_err(LoadError::Invalid)
+}
+
+pub fn load_document<P: AsRef<Path>>(path: P) -> Result<Document, LoadError> {
+    let map = map_file(path)?;
+    parse_document(&map)
+}
+
+// The binary container decodes to an Image first.
+pub fn parse_document(bytes: &[u8]) -> Result<Document, LoadError> {
+    if is_binary(bytes) {
+        decode_image(bytes).map(|image| Document::from_image(&image)).map_err(LoadError::Binary)
+    } else {
+        serde_json::from_slice(bytes).map_err(LoadError::Parse)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn sample_path(name: &str) -> String {
+        format!("{}/samples/{}.lison", env!("CARGO_MANIFEST_DIR"), name)
+    }
+
+    #[test]
+    fn test_load_image() {
+        let image = load_image(sample_path("region")).unwrap();
+        assert_eq!(100.0, image.width);
+        assert_eq!(100.0, image.height);
+        assert_eq!(72.0, image.unit_per_inch);
+        assert_eq!(1, image.pens.len());
+        assert_eq!(2, image.brushes.len());
+    }
+
+    #[test]
+    fn test_load_document() {
+        let document = load_document(sample_path("region")).unwrap();
+        assert_eq!(100.0, document.width);
+        assert_eq!(2, document.brushes.len());
+        assert!(matches!(load_document(sample_path("missing")), Err(LoadError::Io(_))));
+    }
+
+    #[test]
+    fn test_load_image_errors() {
+        assert!(matches!(load_image(sample_path("missing")), Err(LoadError::Io(_))));
+        assert!(matches!(load_image(env!("CARGO_MANIFEST_DIR").to_string() + "/Cargo.toml"), Err(LoadError::Parse(_))));
+        assert!(matches!(parse_image(b"LISB"), Err(LoadError::Binary(_))));
+        assert!(load_valid_image(sample_path("region")).is_ok());
+    }
+
+    #[test]
+    fn test_map_file() {
+        assert!(matches!(map_file(sample_path("region")), Ok(FileBytes::Mapped(_))));
+
+        // A device cannot be mapped, so it is read.
+        #[cfg(unix)]
+        assert!(matches!(map_file("/dev/null"), Ok(FileBytes::Read(bytes)) if bytes.is_empty()));
+    }
+
+    #[test]
+    fn test_parse_binary_image() {
+        let image = load_image(sample_path("pattern")).unwrap();
+        let bytes = crate::binary::encode_image(&image, crate::binary::Precision::Double);
+        let decoded = parse_image(&bytes).unwrap();
+        assert_eq!(serde_json::to_string(&image).unwrap(), serde_json::to_string(&decoded).unwrap());
+    }
+}
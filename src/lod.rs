@@ -0,0 +1,318 @@
+use crate::bounds::*;
+use crate::image::*;
+use crate::raster::Paint;
+use crate::render::{plot_curve_data, Resources, Scaler};
+
+use cairo::{Context, Result};
+
+// Half a pixel, below which a thumbnail cannot show a bend.
+pub const DEFAULT_DETAIL: f64 = 0.5;
+
+// A run longer than this is cut, which bounds the work of checking it.
+const MAX_RUN: usize = 64;
+
+// Coverage below half an 8-bit step does not change any pixel.
+const MIN_COVERAGE: f64 = 0.5 / 255.0;
+
+#[derive(Debug, Default, Clone, Copy, PartialEq, Eq)]
+pub struct LodStats {
+    pub segments: usize,
+    pub simplified_segments: usize,
+    pub dots: usize,
+    pub dropped: usize
+}
+
+fn distance_to_chord(point: Point, from: Point, to: Point) -> f64 {
+    let (dx, dy) = (to.x - from.x, to.y - from.y);
+    let length = dx * dx + dy * dy;
+
+    let t = if length > 0.0 {
+        (((point.x - from.x) * dx + (point.y - from.y) * dy) / length).clamp(0.0, 1.0)
+    } else {
+        0.0
+    };
+
+    (point.x - from.x - t * dx).hypot(point.y - from.y - t * dy)
+}
+
+fn segment_points(seg: &Segment) -> ([Point; 3], usize) {
+    match seg {
+        Segment::Line(line) => ([line.point_2; 3], 1),
+        Segment::QuadraticBezier(bezier) => ([bezier.point_2, bezier.point_3, bezier.point_3], 2),
+        Segment::CubicBezier(bezier) => ([bezier.point_2, bezier.point_3, bezier.point_4], 3)
+    }
+}
+
+// Replaces each run of segments whose points all stay within tolerance of
+// the chord from the run's start to its end with that chord. A curve lies
+// inside the hull of its control points, so the whole run does too.
+pub fn simplify(data: &CurveData, tolerance: f64) -> CurveData {
+    let mut simplified = CurveData::with_capacity(data.start(), data.len());
+    let mut anchor = data.start();
+    let mut run: Vec<Point> = Vec::new();
+
+    let flat = |points: &[Point], from: Point, to: Point| {
+        points.iter().all(|&point| distance_to_chord(point, from, to) <= tolerance)
+    };
+
+    for seg in data.segments() {
+        let (points, count) = segment_points(&seg);
+        let points = &points[..count];
+        let end = points[count - 1];
+
+        if let Some(&last) = run.last() {
+            if run.len() + count <= MAX_RUN && flat(points, anchor, end) && flat(&run, anchor, end) {
+                run.extend_from_slice(points);
+                continue;
+            }
+
+            simplified.push(Segment::Line(LineSegment { point_2: last }));
+            anchor = last;
+            run.clear();
+        }
+
+        if flat(points, anchor, end) {
+            run.extend_from_slice(points);
+        } else {
+            simplified.push(seg);
+            anchor = end;
+        }
+    }
+
+    if let Some(&last) = run.last() {
+        simplified.push(Segment::Line(LineSegment { point_2: last }));
+    }
+
+    simplified
+}
+
+// The unpremultiplied color of pattern at a point in image units.
+fn color_at(pattern: &Pattern, point: Point) -> Color {
+    let [red, green, blue, alpha] = Paint::new(pattern, 1.0).color(point.x, point.y).unwrap_or([0.0; 4]);
+    let unpremultiply = |value: f32| if alpha > 0.0 { (value / alpha) as f64 } else { 0.0 };
+
+    Color {
+        red: unpremultiply(red),
+        green: unpremultiply(green),
+        blue: unpremultiply(blue),
+        alpha: alpha as f64
+    }
+}
+
+struct Lod<'a> {
+    image: &'a Image,
+    resources: &'a Resources,
+    factor: f64,
+    tolerance: f64,
+    stats: LodStats
+}
+
+impl Lod<'_> {
+    fn plot(&mut self, context: &Context, data: &CurveData, closed: bool) {
+        let simplified = simplify(data, self.tolerance);
+
+        self.stats.segments += data.len();
+        self.stats.simplified_segments += simplified.len();
+
+        plot_curve_data(context, &simplified, closed);
+    }
+
+    // A region within one pixel is drawn as a pixel sized square of its
+    // color at its center, weighted by how much of the pixel its bounds
+    // cover. The
+    // outline is painted last and so is taken over the fill. Returns whether
+    // the region was handled.
+    fn dot(&mut self, context: &Context, region: &RegionShape) -> Result<bool> {
+        let rect = region.data.iter()
+            .fold(Rect::EMPTY, |rect, data| rect.union(&curve_data_bounds(data)));
+        let extent = region.pen.and_then(|pen| self.image.pens.get(pen)).map_or(0.0, stroke_extent);
+        let rect = rect.inflate(extent).scale(self.factor);
+
+        if rect.is_empty() || rect.max_x - rect.min_x >= 1.0 || rect.max_y - rect.min_y >= 1.0 {
+            return Ok(false);
+        }
+
+        let pattern = match (region.pen, region.brush) {
+            (Some(pen), _) => self.image.pens.get(pen).map(|pen| &pen.pattern),
+            (None, Some(brush)) => self.image.brushes.get(brush).map(|brush| &brush.pattern),
+            (None, None) => return Ok(true)
+        };
+
+        let Some(pattern) = pattern else {
+            return Ok(false);
+        };
+
+        let center = Point { x: (rect.min_x + rect.max_x) / 2.0 / self.factor, y: (rect.min_y + rect.max_y) / 2.0 / self.factor };
+        let color = color_at(pattern, center);
+        let alpha = color.alpha * (rect.max_x - rect.min_x).max(0.0) * (rect.max_y - rect.min_y).max(0.0);
+
+        if alpha < MIN_COVERAGE {
+            self.stats.dropped += 1;
+            return Ok(true);
+        }
+
+        let size = 1.0 / self.factor;
+        let (x, y) = (center.x - size / 2.0, center.y - size / 2.0);
+
+        context.set_source_rgba(color.red, color.green, color.blue, alpha);
+        context.rectangle(x, y, size, size);
+        context.fill()?;
+
+        self.stats.dots += 1;
+        Ok(true)
+    }
+
+    fn shape(&mut self, context: &Context, shape: &Shape) -> Result<()> {
+        match shape {
+            Shape::Group(group) => {
+                for child in &group.content {
+                    self.shape(context, child)?;
+                }
+
+                Ok(())
+            },
+            Shape::Curve(curve) => {
+                self.plot(context, &curve.data, false);
+                self.resources.set_pen(context, curve.pen)?;
+                context.stroke()
+            },
+            Shape::Region(region) => self.region(context, region)
+        }
+    }
+
+    fn region(&mut self, context: &Context, region: &RegionShape) -> Result<()> {
+        if self.dot(context, region)? {
+            return Ok(());
+        }
+
+        for (i, data) in region.data.iter().enumerate() {
+            if i > 0 {
+                context.new_sub_path();
+            }
+
+            self.plot(context, data, true);
+        }
+
+        if let Some(brush) = region.brush {
+            self.resources.set_brush(context, brush)?;
+            context.fill_preserve()?;
+        }
+
+        if let Some(pen) = region.pen {
+            self.resources.set_pen(context, pen)?;
+            context.stroke()
+        } else {
+            context.new_path();
+            Ok(())
+        }
+    }
+}
+
+// Renders for a small output, leaving out detail finer than tolerance
+// output pixels. The result matches render to within about tolerance.
+pub fn render_lod(context: &Context, image: &Image, ppi: f64, scale: f64, tolerance: f64) -> Result<LodStats> {
+    let resources = Resources::new(image);
+    render_lod_with_resources(context, image, &resources, ppi, scale, tolerance)
+}
+
+pub fn render_lod_with_resources(context: &Context, image: &Image, resources: &Resources, ppi: f64, scale: f64, tolerance: f64) -> Result<LodStats> {
+    let scaler = Scaler::new(image.unit_per_inch, ppi, scale);
+
+    let mut lod = Lod {
+        image,
+        resources,
+        factor: scaler.factor(),
+        tolerance: tolerance / scaler.factor(),
+        stats: LodStats::default()
+    };
+
+    scaler.draw(context, || {
+        for shape in &image.shapes {
+            lod.shape(context, shape)?;
+        }
+
+        Ok(())
+    })?;
+
+    Ok(lod.stats)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn data(json: &str) -> CurveData {
+        serde_json::from_str(json).unwrap()
+    }
+
+    fn verbs(data: &CurveData) -> Vec<Verb> {
+        data.verbs().to_vec()
+    }
+
+    #[test]
+    fn test_simplify() {
+        // A zigzag within the tolerance becomes one line.
+        let zigzag = data(r#"[[0, 0], ["L", [1, 0.1]], ["L", [2, -0.1]], ["L", [3, 0.1]], ["L", [4, 0]]]"#);
+        let simplified = simplify(&zigzag, 0.5);
+        assert_eq!(vec![Verb::Line], verbs(&simplified));
+        assert!(simplified.points().last() == Some(Point { x: 4.0, y: 0.0 }));
+
+        // A flat curve becomes a line, a bent one is kept.
+        let curves = data(r#"[[0, 0], ["C", [1, 0.1], [2, 0.1], [3, 0]], ["Q", [4, 10], [5, 0]], ["L", [6, 0]]]"#);
+        let simplified = simplify(&curves, 0.5);
+        assert_eq!(vec![Verb::Line, Verb::QuadraticBezier, Verb::Line], verbs(&simplified));
+
+        // Corners survive.
+        let square = data(r#"[[0, 0], ["L", [10, 0]], ["L", [10, 10]], ["L", [0, 10]]]"#);
+        assert_eq!(3, simplify(&square, 0.5).len());
+        assert_eq!(0, simplify(&data("[[0, 0]]"), 0.5).len());
+    }
+
+    #[test]
+    fn test_render_lod() {
+        let image: Image = serde_json::from_str(r#"{
+  "width": 100,
+  "height": 100,
+  "unit-per-inch": 72,
+  "pens": [{
+    "pattern": { "type": "monochrome", "color": [0, 0, 0] },
+    "width": 1,
+    "cap": "round",
+    "join": "round"
+  }],
+  "brushes": [
+    { "pattern": { "type": "monochrome", "color": [1, 0, 0] } },
+    { "pattern": { "type": "monochrome", "color": [0, 0, 1, 0.001] } },
+    { "pattern": { "type": "linear-gradient", "point-1": [0, 0], "point-2": [100, 0], "color-1": [1, 0, 0], "color-2": [0, 0, 1] } }
+  ],
+  "shapes": [
+    { "type": "region", "brush": 0, "data": [[[0, 0], ["L", [50, 0]], ["L", [50, 0.1]], ["L", [50, 50]], ["L", [0, 50]]]] },
+    { "type": "group", "content": [
+      { "type": "region", "brush": 0, "data": [[[60, 60], ["L", [60.5, 60]], ["L", [60.5, 60.5]]]] },
+      { "type": "region", "brush": 1, "data": [[[70, 70], ["L", [70.5, 70]], ["L", [70.5, 70.5]]]] },
+      { "type": "region", "brush": 2, "data": [[[10.05, 60.05], ["L", [10.95, 60.05]], ["L", [10.95, 60.95]], ["L", [10.05, 60.95]]]] }
+    ] },
+    { "type": "curve", "pen": 0, "data": [[0, 80], ["C", [30, 80.1], [60, 80.1], [90, 80]]] }
+  ]
+}"#).unwrap();
+
+        let draw = |draw: &mut dyn FnMut(&Context)| {
+            let mut surface = cairo::ImageSurface::create(cairo::Format::ARgb32, 100, 100).unwrap();
+            draw(&Context::new(&surface).unwrap());
+            surface.flush();
+            surface.data().unwrap().to_vec()
+        };
+
+        let mut stats = LodStats::default();
+        let lod = draw(&mut |context| stats = render_lod(context, &image, 72.0, 1.0, DEFAULT_DETAIL).unwrap());
+        assert_eq!(LodStats { segments: 5, simplified_segments: 4, dots: 2, dropped: 1 }, stats);
+
+        // Straightening the curve moves its edges by up to 0.075 pixels, or
+        // 19 steps of coverage. Dots take the colors their regions have,
+        // where averaging the gradient's stops would be about 80 off in red
+        // and blue.
+        let exact = draw(&mut |context| crate::render::render(context, &image, 72.0, 1.0).unwrap());
+        let difference = lod.iter().zip(exact.iter()).map(|(&a, &b)| a.abs_diff(b)).max().unwrap();
+        assert!(difference <= 24, "differs by {}", difference);
+    }
+}
@@ -0,0 +1,506 @@
+use std::io::{self, Write};
+
+use flate2::Compression;
+use flate2::write::ZlibEncoder;
+
+use crate::bounds::{Rect, shape_bounds};
+use crate::hash::RepeatedGroups;
+use crate::image::*;
+use crate::validate::Resource;
+
+// Object numbers fixed ahead of the ones handed out while writing.
+const CATALOG: usize = 1;
+const PAGES: usize = 2;
+const PAGE: usize = 3;
+const CONTENT: usize = 4;
+const RESOURCES: usize = 5;
+
+#[derive(Clone, Copy, PartialEq)]
+enum State {
+    Alpha { stroke: bool, alpha: u64 },
+    Mask(Resource)
+}
+
+// A gradient whose stops differ in alpha is masked by the same gradient in
+// gray; a uniform alpha is a constant one.
+fn state(resource: Resource, pattern: &Pattern, stroke: bool) -> Option<State> {
+    let (alpha_1, alpha_2) = match pattern {
+        Pattern::Monochrome(pat) => (pat.color.alpha, pat.color.alpha),
+        Pattern::LinearGradient(pat) => (pat.color_1.alpha, pat.color_2.alpha),
+        Pattern::RadialGradient(pat) => (pat.color_1.alpha, pat.color_2.alpha)
+    };
+
+    if alpha_1 != alpha_2 {
+        Some(State::Mask(resource))
+    } else if alpha_1 < 1.0 {
+        Some(State::Alpha { stroke, alpha: alpha_1.max(0.0).to_bits() })
+    } else {
+        None
+    }
+}
+
+fn pattern_name(resource: Resource) -> String {
+    match resource {
+        Resource::Pen(index) => format!("P{}", index),
+        Resource::Brush(index) => format!("B{}", index)
+    }
+}
+
+fn write_path(out: &mut Vec<u8>, data: &CurveData, closed: bool) -> io::Result<()> {
+    let mut current = data.start();
+    writeln!(out, "{} {} m", current.x, current.y)?;
+
+    for seg in data.segments() {
+        match seg {
+            Segment::Line(line) => {
+                writeln!(out, "{} {} l", line.point_2.x, line.point_2.y)?;
+                current = line.point_2;
+            },
+            Segment::QuadraticBezier(bezier) => {
+                let (p1, p2, p3) = (current, bezier.point_2, bezier.point_3);
+                writeln!(out, "{} {} {} {} {} {} c",
+                    p1.x / 3.0 + p2.x * 2.0 / 3.0, p1.y / 3.0 + p2.y * 2.0 / 3.0,
+                    p3.x / 3.0 + p2.x * 2.0 / 3.0, p3.y / 3.0 + p2.y * 2.0 / 3.0,
+                    p3.x, p3.y)?;
+                current = p3;
+            },
+            Segment::CubicBezier(bezier) => {
+                writeln!(out, "{} {} {} {} {} {} c",
+                    bezier.point_2.x, bezier.point_2.y, bezier.point_3.x, bezier.point_3.y, bezier.point_4.x, bezier.point_4.y)?;
+                current = bezier.point_4;
+            }
+        }
+    }
+
+    if closed {
+        writeln!(out, "h")?;
+    }
+
+    Ok(())
+}
+
+// The pen and brush a content stream has set outside any q, so runs of
+// shapes drawn alike set them once.
+#[derive(Default)]
+struct Current {
+    pen: Option<usize>,
+    brush: Option<usize>
+}
+
+struct Content<'a> {
+    image: &'a Image,
+    repeats: RepeatedGroups<'a>,
+    states: Vec<State>
+}
+
+impl Content<'_> {
+    fn state_name(&mut self, state: State) -> usize {
+        match self.states.iter().position(|&known| known == state) {
+            Some(index) => index,
+            None => {
+                self.states.push(state);
+                self.states.len() - 1
+            }
+        }
+    }
+
+    fn write_paint(out: &mut Vec<u8>, resource: Resource, pattern: &Pattern, stroke: bool) -> io::Result<()> {
+        match (pattern, stroke) {
+            (Pattern::Monochrome(pat), false) => writeln!(out, "{} {} {} rg", pat.color.red, pat.color.green, pat.color.blue),
+            (Pattern::Monochrome(pat), true) => writeln!(out, "{} {} {} RG", pat.color.red, pat.color.green, pat.color.blue),
+            (_, false) => writeln!(out, "/Pattern cs /{} scn", pattern_name(resource)),
+            (_, true) => writeln!(out, "/Pattern CS /{} SCN", pattern_name(resource))
+        }
+    }
+
+    fn write_pen(out: &mut Vec<u8>, index: usize, pen: &Pen) -> io::Result<()> {
+        let cap = match pen.cap {
+            LineCap::Butt => 0,
+            LineCap::Round => 1,
+            LineCap::Square => 2
+        };
+        let join = match pen.join {
+            LineJoin::Miter => 0,
+            LineJoin::Round => 1,
+            LineJoin::Bevel => 2
+        };
+
+        writeln!(out, "{} w {} J {} j", pen.width, cap, join)?;
+        Content::write_paint(out, Resource::Pen(index), &pen.pattern, true)
+    }
+
+    // Paints path with the brush, the pen or both. A paint with alpha is
+    // drawn inside q and Q with its graphics state, which leaves current
+    // as it was.
+    fn paint(&mut self, out: &mut Vec<u8>, path: &[u8], brush: Option<usize>, pen: Option<usize>, current: &mut Current) -> io::Result<()> {
+        let brush = brush.and_then(|index| self.image.brushes.get(index).map(|brush| (index, &brush.pattern)));
+        let pen = pen.and_then(|index| self.image.pens.get(index).map(|pen| (index, pen)));
+
+        let fill_state = brush.and_then(|(index, pattern)| state(Resource::Brush(index), pattern, false));
+        let stroke_state = pen.and_then(|(index, pen)| state(Resource::Pen(index), &pen.pattern, true));
+
+        if let (Some((brush, pattern)), Some((pen, pen_data)), None, None) = (brush, pen, fill_state, stroke_state) {
+            if current.brush != Some(brush) {
+                Content::write_paint(out, Resource::Brush(brush), pattern, false)?;
+                current.brush = Some(brush);
+            }
+
+            if current.pen != Some(pen) {
+                Content::write_pen(out, pen, pen_data)?;
+                current.pen = Some(pen);
+            }
+
+            out.extend_from_slice(path);
+            return writeln!(out, "B*");
+        }
+
+        if let Some((index, pattern)) = brush {
+            match fill_state {
+                Some(state) => {
+                    let name = self.state_name(state);
+                    writeln!(out, "q /G{} gs", name)?;
+                    Content::write_paint(out, Resource::Brush(index), pattern, false)?;
+                    out.extend_from_slice(path);
+                    writeln!(out, "f* Q")?;
+                },
+                None => {
+                    if current.brush != Some(index) {
+                        Content::write_paint(out, Resource::Brush(index), pattern, false)?;
+                        current.brush = Some(index);
+                    }
+
+                    out.extend_from_slice(path);
+                    writeln!(out, "f*")?;
+                }
+            }
+        }
+
+        if let Some((index, pen)) = pen {
+            match stroke_state {
+                Some(state) => {
+                    let name = self.state_name(state);
+                    writeln!(out, "q /G{} gs", name)?;
+                    Content::write_pen(out, index, pen)?;
+                    out.extend_from_slice(path);
+                    writeln!(out, "S Q")?;
+                },
+                None => {
+                    if current.pen != Some(index) {
+                        Content::write_pen(out, index, pen)?;
+                        current.pen = Some(index);
+                    }
+
+                    out.extend_from_slice(path);
+                    writeln!(out, "S")?;
+                }
+            }
+        }
+
+        Ok(())
+    }
+
+    fn write_shapes(&mut self, out: &mut Vec<u8>, shapes: &[Shape], current: &mut Current) -> io::Result<()> {
+        let mut path = Vec::new();
+
+        for shape in shapes {
+            path.clear();
+
+            match shape {
+                Shape::Group(group) => match self.repeats.find(shape) {
+                    Some((id, offset)) if offset.x == 0.0 && offset.y == 0.0 => writeln!(out, "/X{} Do", id)?,
+                    Some((id, offset)) => writeln!(out, "q 1 0 0 1 {} {} cm /X{} Do Q", offset.x, offset.y, id)?,
+                    None => self.write_shapes(out, &group.content, current)?
+                },
+                Shape::Curve(curve) => {
+                    write_path(&mut path, &curve.data, false)?;
+                    self.paint(out, &path, None, Some(curve.pen), current)?;
+                },
+                Shape::Region(region) => {
+                    for data in &region.data {
+                        write_path(&mut path, data, true)?;
+                    }
+
+                    self.paint(out, &path, region.brush, region.pen, current)?;
+                }
+            }
+        }
+
+        Ok(())
+    }
+}
+
+struct Objects {
+    data: Vec<u8>,
+    offsets: Vec<usize>,
+    next: usize
+}
+
+impl Objects {
+    fn allocate(&mut self) -> usize {
+        self.next += 1;
+        self.next - 1
+    }
+
+    fn begin(&mut self, id: usize) -> io::Result<()> {
+        if self.offsets.len() <= id {
+            self.offsets.resize(id + 1, 0);
+        }
+
+        self.offsets[id] = self.data.len();
+        writeln!(self.data, "{} 0 obj", id)
+    }
+
+    fn object(&mut self, id: usize, body: &str) -> io::Result<()> {
+        self.begin(id)?;
+        writeln!(self.data, "{}", body)?;
+        writeln!(self.data, "endobj")
+    }
+
+    fn stream(&mut self, id: usize, dictionary: &str, content: &[u8]) -> io::Result<()> {
+        let mut encoder = ZlibEncoder::new(Vec::new(), Compression::default());
+        encoder.write_all(content)?;
+        let compressed = encoder.finish()?;
+
+        self.begin(id)?;
+        if dictionary.is_empty() {
+            writeln!(self.data, "<< /Filter /FlateDecode /Length {} >>", compressed.len())?;
+        } else {
+            writeln!(self.data, "<< {} /Filter /FlateDecode /Length {} >>", dictionary, compressed.len())?;
+        }
+        writeln!(self.data, "stream")?;
+        self.data.extend_from_slice(&compressed);
+        writeln!(self.data, "\nendstream")?;
+        writeln!(self.data, "endobj")
+    }
+}
+
+fn function(color_1: &Color, color_2: &Color, gray: bool) -> String {
+    if gray {
+        format!("<< /FunctionType 2 /Domain [0 1] /C0 [{}] /C1 [{}] /N 1 >>", color_1.alpha, color_2.alpha)
+    } else {
+        format!("<< /FunctionType 2 /Domain [0 1] /C0 [{} {} {}] /C1 [{} {} {}] /N 1 >>",
+            color_1.red, color_1.green, color_1.blue, color_2.red, color_2.green, color_2.blue)
+    }
+}
+
+// Cairo pads gradients past their ends, as Extend does.
+fn shading(pattern: &Pattern, gray: bool) -> Option<String> {
+    let space = if gray { "/DeviceGray" } else { "/DeviceRGB" };
+
+    match pattern {
+        Pattern::Monochrome(_) => None,
+        Pattern::LinearGradient(pat) => Some(format!(
+            "<< /ShadingType 2 /ColorSpace {} /Coords [{} {} {} {}] /Function {} /Extend [true true] >>",
+            space, pat.point_1.x, pat.point_1.y, pat.point_2.x, pat.point_2.y, function(&pat.color_1, &pat.color_2, gray))),
+        Pattern::RadialGradient(pat) => Some(format!(
+            "<< /ShadingType 3 /ColorSpace {} /Coords [{} {} {} {} {} {}] /Function {} /Extend [true true] >>",
+            space, pat.center_1.x, pat.center_1.y, pat.radius_1, pat.center_2.x, pat.center_2.y, pat.radius_2,
+            function(&pat.color_1, &pat.color_2, gray)))
+    }
+}
+
+// Writes image as a one page PDF, scale times its size at 72 points per
+// inch. Every gradient pen and brush is one shared shading pattern, alpha
+// values are shared graphics states, and each group repeated as a
+// translated copy is one form drawn wherever it repeats.
+pub fn write_pdf<W: Write>(writer: &mut W, image: &Image, scale: f64) -> io::Result<()> {
+    let factor = 72.0 / image.unit_per_inch * scale;
+    let (width, height) = (image.width * factor, image.height * factor);
+
+    // Everything is drawn in document units with y pointing down, the way
+    // the renderer does.
+    let matrix = format!("[{} 0 0 {} 0 {}]", factor, -factor, height);
+
+    let mut content = Content { image, repeats: RepeatedGroups::new(image), states: Vec::new() };
+
+    let mut page = Vec::new();
+    writeln!(page, "{} 0 0 {} 0 {} cm", factor, -factor, height)?;
+    content.write_shapes(&mut page, &image.shapes, &mut Current::default())?;
+
+    let mut forms = Vec::new();
+
+    for index in 0..content.repeats.len() {
+        let group = content.repeats.groups()[index].0;
+        let bounds = group.content.iter()
+            .fold(Rect::EMPTY, |bounds, shape| bounds.union(&shape_bounds(shape, image)))
+            .inflate(1.0);
+
+        // A form that draws nothing still needs a box.
+        let bounds = if bounds.is_empty() { Rect::new(0.0, 0.0, 0.0, 0.0) } else { bounds };
+
+        let mut form = Vec::new();
+        content.write_shapes(&mut form, &group.content, &mut Current::default())?;
+        forms.push((bounds, form));
+    }
+
+    let mut objects = Objects { data: Vec::new(), offsets: Vec::new(), next: RESOURCES + 1 };
+    writeln!(objects.data, "%PDF-1.4")?;
+    objects.data.extend_from_slice(b"%\xe2\xe3\xcf\xd3\n");
+
+    objects.object(CATALOG, &format!("<< /Type /Catalog /Pages {} 0 R >>", PAGES))?;
+    objects.object(PAGES, &format!("<< /Type /Pages /Kids [{} 0 R] /Count 1 >>", PAGE))?;
+    objects.object(PAGE, &format!(
+        "<< /Type /Page /Parent {} 0 R /MediaBox [0 0 {} {}] /Resources {} 0 R /Contents {} 0 R /Group << /S /Transparency /CS /DeviceRGB >> >>",
+        PAGES, width, height, RESOURCES, CONTENT))?;
+    objects.stream(CONTENT, "", &page)?;
+
+    let mut patterns = Vec::new();
+    let resources = image.pens.iter().enumerate().map(|(index, pen)| (Resource::Pen(index), &pen.pattern))
+        .chain(image.brushes.iter().enumerate().map(|(index, brush)| (Resource::Brush(index), &brush.pattern)));
+
+    for (resource, pattern) in resources {
+        let Some(shading) = shading(pattern, false) else {
+            continue;
+        };
+
+        let shading_id = objects.allocate();
+        objects.object(shading_id, &shading)?;
+
+        let pattern_id = objects.allocate();
+        objects.object(pattern_id, &format!("<< /PatternType 2 /Shading {} 0 R /Matrix {} >>", shading_id, matrix))?;
+        patterns.push(format!("/{} {} 0 R", pattern_name(resource), pattern_id));
+    }
+
+    let mut states = Vec::new();
+
+    for (name, state) in content.states.iter().enumerate() {
+        let id = objects.allocate();
+
+        match *state {
+            State::Alpha { stroke, alpha } => {
+                let operator = if stroke { "CA" } else { "ca" };
+                objects.object(id, &format!("<< /Type /ExtGState /{} {} >>", operator, f64::from_bits(alpha)))?;
+            },
+            State::Mask(resource) => {
+                let pattern = match resource {
+                    Resource::Pen(index) => &image.pens[index].pattern,
+                    Resource::Brush(index) => &image.brushes[index].pattern
+                };
+
+                let shading_id = objects.allocate();
+                objects.object(shading_id, &shading(pattern, true).unwrap_or_default())?;
+
+                // The mask is drawn in the space current when the state is
+                // set, which is document units.
+                let mask_id = objects.allocate();
+                objects.stream(mask_id, &format!(
+                    "/Type /XObject /Subtype /Form /BBox [0 0 {} {}] /Group << /S /Transparency /CS /DeviceGray >> /Resources << /Shading << /S0 {} 0 R >> >>",
+                    image.width, image.height, shading_id), b"/S0 sh\n")?;
+
+                objects.object(id, &format!("<< /Type /ExtGState /SMask << /Type /Mask /S /Luminosity /G {} 0 R >> >>", mask_id))?;
+            }
+        }
+
+        states.push(format!("/G{} {} 0 R", name, id));
+    }
+
+    let mut xobjects = Vec::new();
+
+    for (index, (bounds, form)) in forms.iter().enumerate() {
+        let id = objects.allocate();
+        objects.stream(id, &format!("/Type /XObject /Subtype /Form /BBox [{} {} {} {}] /Resources {} 0 R",
+            bounds.min_x, bounds.min_y, bounds.max_x, bounds.max_y, RESOURCES), form)?;
+        xobjects.push(format!("/X{} {} 0 R", index, id));
+    }
+
+    objects.object(RESOURCES, &format!("<< /Pattern << {} >> /ExtGState << {} >> /XObject << {} >> >>",
+        patterns.join(" "), states.join(" "), xobjects.join(" ")))?;
+
+    let xref = objects.data.len();
+    writeln!(objects.data, "xref")?;
+    writeln!(objects.data, "0 {}", objects.offsets.len())?;
+    writeln!(objects.data, "0000000000 65535 f ")?;
+
+    for &offset in &objects.offsets[1..] {
+        writeln!(objects.data, "{:010} 00000 n ", offset)?;
+    }
+
+    writeln!(objects.data, "trailer")?;
+    writeln!(objects.data, "<< /Size {} /Root {} 0 R >>", objects.offsets.len(), CATALOG)?;
+    writeln!(objects.data, "startxref")?;
+    writeln!(objects.data, "{}", xref)?;
+    writeln!(objects.data, "%%EOF")?;
+
+    writer.write_all(&objects.data)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    use flate2::read::ZlibDecoder;
+    use std::io::Read;
+
+    fn streams(pdf: &[u8]) -> Vec<String> {
+        let mut streams = Vec::new();
+        let mut rest = pdf;
+
+        while let Some(start) = rest.windows(7).position(|window| window == b"stream\n") {
+            let data = &rest[start + 7..];
+            let end = data.windows(10).position(|window| window == b"\nendstream").unwrap();
+
+            let mut text = String::new();
+            ZlibDecoder::new(&data[..end]).read_to_string(&mut text).unwrap();
+            streams.push(text);
+            rest = &data[end + 10..];
+        }
+
+        streams
+    }
+
+    #[test]
+    fn test_write_pdf() {
+        let image: Image = serde_json::from_str(r#"{
+  "width": 100,
+  "height": 50,
+  "unit-per-inch": 72,
+  "pens": [{
+    "pattern": { "type": "monochrome", "color": [1, 0, 0, 0.5] },
+    "width": 2,
+    "cap": "round",
+    "join": "bevel"
+  }],
+  "brushes": [{
+    "pattern": { "type": "linear-gradient", "point-1": [0, 0], "color-1": [0, 0, 0], "point-2": [100, 0], "color-2": [1, 1, 1, 0] }
+  }, {
+    "pattern": { "type": "monochrome", "color": [0, 0, 1] }
+  }],
+  "shapes": [
+    { "type": "region", "brush": 0, "data": [[[0, 0], ["L", [10, 0]], ["Q", [10, 10], [0, 10]]]] },
+    { "type": "region", "brush": 1, "data": [[[0, 0], ["L", [10, 0]], ["L", [0, 10]]]] },
+    { "type": "region", "brush": 1, "data": [[[20, 0], ["L", [30, 0]], ["L", [20, 10]]]] },
+    { "type": "group", "content": [{ "type": "curve", "pen": 0, "data": [[20, 20], ["C", [21, 20], [22, 21], [22, 22]]] }] },
+    { "type": "group", "content": [{ "type": "curve", "pen": 0, "data": [[30, 25], ["C", [31, 25], [32, 26], [32, 27]]] }] }
+  ]
+}"#).unwrap();
+
+        let mut pdf = Vec::new();
+        write_pdf(&mut pdf, &image, 2.0).unwrap();
+
+        let text = String::from_utf8_lossy(&pdf);
+        assert!(text.starts_with("%PDF-1.4\n"));
+        assert!(text.contains("/MediaBox [0 0 200 100]"));
+        assert_eq!(1, text.matches("/ShadingType 2 /ColorSpace /DeviceRGB").count());
+        assert_eq!(1, text.matches("/ShadingType 2 /ColorSpace /DeviceGray").count());
+        assert_eq!(1, text.matches("/CA 0.5").count());
+        assert!(text.contains("/Resources 5 0 R"));
+        assert!(text.ends_with("%%EOF\n"));
+
+        let streams = streams(&pdf);
+        let page = &streams[0];
+        assert!(page.starts_with("2 0 0 -2 0 100 cm\n"));
+        assert!(page.contains("q /G0 gs\n/Pattern cs /B0 scn\n0 0 m\n"));
+        assert_eq!(1, page.matches("0 0 1 rg").count());
+        assert!(page.contains("/X0 Do\n"));
+        assert!(page.contains("q 1 0 0 1 10 5 cm /X0 Do Q\n"));
+
+        let form = streams.iter().find(|stream| stream.contains("20 20 m")).unwrap();
+        assert!(form.contains("2 w 1 J 2 j\n1 0 0 RG\n20 20 m\n21 20 22 21 22 22 c\nS Q\n"));
+
+        // The xref entries point at their objects.
+        let xref = text.rfind("\nxref\n").unwrap() + 1;
+        let entry = &text[xref..].lines().nth(3).unwrap()[..10];
+        let offset: usize = entry.parse().unwrap();
+        assert!(pdf[offset..].starts_with(b"1 0 obj"));
+    }
+}
@@ -0,0 +1,417 @@
+use std::fmt;
+use std::ops::Range;
+
+use crate::bounds::*;
+use crate::image::*;
+use crate::render::{Batcher, Resources, Scaler, Style};
+
+use cairo::Context;
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum PlanError {
+    InvalidPen { index: usize, count: usize },
+    InvalidBrush { index: usize, count: usize }
+}
+
+impl fmt::Display for PlanError {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        match self {
+            PlanError::InvalidPen { index, count } =>
+                write!(f, "invalid pen index {}, must be less than {}.", index, count),
+            PlanError::InvalidBrush { index, count } =>
+                write!(f, "invalid brush index {}, must be less than {}.", index, count)
+        }
+    }
+}
+
+impl std::error::Error for PlanError {}
+
+#[derive(Clone, Copy)]
+enum PathElement {
+    MoveTo(Point),
+    LineTo(Point),
+    CurveTo(Point, Point, Point),
+    ClosePath
+}
+
+#[derive(Clone)]
+enum Command {
+    Stroke { pen: usize, path: Range<usize> },
+    Region { pen: Option<usize>, brush: Option<usize>, path: Range<usize>, rect: Option<Rect> }
+}
+
+impl Command {
+    fn style(&self) -> Style {
+        match self {
+            Command::Stroke { pen, .. } => Style::Stroke(*pen),
+            Command::Region { pen, brush, .. } => Style::Region(*pen, *brush)
+        }
+    }
+
+    fn path(&self) -> Range<usize> {
+        match self {
+            Command::Stroke { path, .. } | Command::Region { path, .. } => path.clone()
+        }
+    }
+}
+
+#[derive(Debug, Default, Clone, Copy, PartialEq, Eq)]
+pub struct ReplayStats {
+    pub draw_calls: usize,
+    pub saved_draw_calls: usize,
+    pub fast_rects: usize
+}
+
+pub struct RenderPlan {
+    unit_per_inch: f64,
+    pens: Vec<Pen>,
+    brushes: Vec<Brush>,
+    commands: Vec<Command>,
+    bounds: Vec<Rect>,
+    elements: Vec<PathElement>
+}
+
+impl RenderPlan {
+    pub fn new(image: &Image) -> Result<RenderPlan, PlanError> {
+        let mut plan = RenderPlan {
+            unit_per_inch: image.unit_per_inch,
+            pens: image.pens.clone(),
+            brushes: image.brushes.clone(),
+            commands: Vec::new(),
+            bounds: Vec::new(),
+            elements: Vec::new()
+        };
+
+        for shape in image.leaves() {
+            plan.add_shape(shape)?;
+            plan.bounds.push(shape_bounds(shape, image));
+        }
+
+        Ok(plan)
+    }
+
+    fn check_pen(&self, pen: usize) -> Result<usize, PlanError> {
+        if pen < self.pens.len() {
+            Ok(pen)
+        } else {
+            Err(PlanError::InvalidPen { index: pen, count: self.pens.len() })
+        }
+    }
+
+    fn check_brush(&self, brush: usize) -> Result<usize, PlanError> {
+        if brush < self.brushes.len() {
+            Ok(brush)
+        } else {
+            Err(PlanError::InvalidBrush { index: brush, count: self.brushes.len() })
+        }
+    }
+
+    fn add_shape(&mut self, shape: &Shape) -> Result<(), PlanError> {
+        match shape {
+            Shape::Group(_) => {},
+            Shape::Curve(curve) => {
+                let pen = self.check_pen(curve.pen)?;
+                let start = self.elements.len();
+                self.add_curve_data(&curve.data, false);
+                let path = start..self.elements.len();
+                self.commands.push(Command::Stroke { pen, path });
+            },
+            Shape::Region(region) => {
+                let pen = region.pen.map(|pen| self.check_pen(pen)).transpose()?;
+                let brush = region.brush.map(|brush| self.check_brush(brush)).transpose()?;
+                let start = self.elements.len();
+
+                for data in region.data.iter() {
+                    self.add_curve_data(data, true);
+                }
+
+                let path = start..self.elements.len();
+                let rect = opaque_rectangle(&self.brushes, pen, brush, &region.data);
+                self.commands.push(Command::Region { pen, brush, path, rect });
+            }
+        }
+
+        Ok(())
+    }
+
+    fn add_curve_data(&mut self, data: &CurveData, closed: bool) {
+        self.elements.push(PathElement::MoveTo(data.start()));
+
+        let mut current = data.start();
+
+        for seg in data.segments() {
+            match seg {
+                Segment::Line(line) => {
+                    self.elements.push(PathElement::LineTo(line.point_2));
+                    current = line.point_2;
+                },
+                Segment::QuadraticBezier(bezier) => {
+                    let p1 = current;
+                    let p2 = bezier.point_2;
+                    let p3 = bezier.point_3;
+                    self.elements.push(PathElement::CurveTo(
+                        Point {
+                            x: 1.0 / 3.0 * p1.x + 2.0 / 3.0 * p2.x,
+                            y: 1.0 / 3.0 * p1.y + 2.0 / 3.0 * p2.y
+                        },
+                        Point {
+                            x: 1.0 / 3.0 * p3.x + 2.0 / 3.0 * p2.x,
+                            y: 1.0 / 3.0 * p3.y + 2.0 / 3.0 * p2.y
+                        },
+                        p3
+                    ));
+                    current = p3;
+                },
+                Segment::CubicBezier(bezier) => {
+                    self.elements.push(PathElement::CurveTo(bezier.point_2, bezier.point_3, bezier.point_4));
+                    current = bezier.point_4;
+                }
+            }
+        }
+
+        if closed {
+            self.elements.push(PathElement::ClosePath);
+        }
+    }
+
+    pub fn replay(&self, context: &Context, ppi: f64, scale: f64) -> cairo::Result<()> {
+        self.replay_with_stats(context, ppi, scale).map(|_| ())
+    }
+
+    pub fn replay_with_stats(&self, context: &Context, ppi: f64, scale: f64) -> cairo::Result<ReplayStats> {
+        let scaler = Scaler::new(self.unit_per_inch, ppi, scale);
+        let resources = Resources::prepare(&self.pens, &self.brushes);
+        let mut stats = ReplayStats::default();
+
+        scaler.draw(context, || self.replay_commands(context, &resources, scaler.factor(), None, &mut stats))?;
+
+        Ok(stats)
+    }
+
+    // Replays only the commands that reach rect, given in output pixels
+    // before any transformation the caller has applied to the context.
+    pub fn replay_region(&self, context: &Context, rect: &Rect, ppi: f64, scale: f64) -> cairo::Result<ReplayStats> {
+        let scaler = Scaler::new(self.unit_per_inch, ppi, scale);
+        let resources = Resources::prepare(&self.pens, &self.brushes);
+        let mut stats = ReplayStats::default();
+
+        // One extra pixel covers antialiasing.
+        let rect = rect.inflate(1.0).scale(1.0 / scaler.factor());
+
+        scaler.draw(context, || self.replay_commands(context, &resources, scaler.factor(), Some(&rect), &mut stats))?;
+
+        Ok(stats)
+    }
+
+    fn replay_commands(&self, context: &Context, resources: &Resources, factor: f64, visible: Option<&Rect>, stats: &mut ReplayStats) -> cairo::Result<()> {
+        // Safety: new checked every index against the pens and brushes the
+        // resources are prepared from.
+        let mut batcher = unsafe { Batcher::new_unchecked(context, resources, factor) };
+
+        for (command, bounds) in self.commands.iter().zip(self.bounds.iter()) {
+            if visible.is_some_and(|visible| !visible.intersects(bounds)) {
+                continue;
+            }
+
+            match command {
+                Command::Region { brush: Some(brush), rect: Some(rect), .. } if batcher.aligned(rect) => {
+                    batcher.add_rect(*brush, rect)?;
+                },
+                _ => batcher.add(command.style(), bounds, || self.plot(context, command.path()))?
+            }
+        }
+
+        *stats = batcher.finish()?;
+        Ok(())
+    }
+
+    fn plot(&self, context: &Context, path: Range<usize>) {
+        for element in self.elements[path].iter() {
+            match element {
+                PathElement::MoveTo(p) => context.move_to(p.x, p.y),
+                PathElement::LineTo(p) => context.line_to(p.x, p.y),
+                PathElement::CurveTo(p1, p2, p3) => context.curve_to(p1.x, p1.y, p2.x, p2.y, p3.x, p3.y),
+                PathElement::ClosePath => context.close_path()
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn parse(image_str: &str) -> Image {
+        serde_json::from_str(image_str).unwrap()
+    }
+
+    #[test]
+    fn test_plan_flattens_groups() {
+        let image = parse(r#"{
+  "width": 100,
+  "height": 100,
+  "unit-per-inch": 72,
+  "pens": [{
+    "pattern": { "type": "monochrome", "color": [0, 0, 0] },
+    "width": 1,
+    "cap": "butt",
+    "join": "miter"
+  }],
+  "brushes": [],
+  "shapes": [{
+    "type": "group",
+    "content": [{
+      "type": "group",
+      "content": [{
+        "type": "curve",
+        "pen": 0,
+        "data": [[0, 0], ["L", [10, 0]], ["Q", [20, 0], [20, 10]]]
+      }]
+    }, {
+      "type": "region",
+      "pen": 0,
+      "data": [[[0, 0], ["L", [10, 10]]], [[5, 5]]]
+    }]
+  }]
+}"#);
+        let plan = RenderPlan::new(&image).unwrap();
+        assert_eq!(2, plan.commands.len());
+        assert_eq!(8, plan.elements.len());
+
+        match &plan.commands[0] {
+            Command::Stroke { pen, path } => {
+                assert_eq!(0, *pen);
+                assert_eq!(0..3, *path);
+            },
+            _ => assert!(false)
+        }
+
+        match plan.elements[2] {
+            PathElement::CurveTo(p1, p2, p3) => {
+                assert!((p1.x - 50.0 / 3.0).abs() < 1e-9 && p1.y.abs() < 1e-9);
+                assert!((p2.x - 20.0).abs() < 1e-9 && (p2.y - 10.0 / 3.0).abs() < 1e-9);
+                assert!((p3.x - 20.0).abs() < 1e-9 && (p3.y - 10.0).abs() < 1e-9);
+            },
+            _ => assert!(false)
+        }
+
+        match &plan.commands[1] {
+            Command::Region { pen, brush, path, .. } => {
+                assert_eq!(Some(0), *pen);
+                assert_eq!(None, *brush);
+                assert_eq!(3..8, *path);
+            },
+            _ => assert!(false)
+        }
+    }
+
+    #[test]
+    fn test_plan_rejects_bad_indices() {
+        let image = parse(r#"{
+  "width": 100,
+  "height": 100,
+  "unit-per-inch": 72,
+  "pens": [],
+  "brushes": [],
+  "shapes": [{ "type": "curve", "pen": 0, "data": [[0, 0]] }]
+}"#);
+        assert_eq!(Some(PlanError::InvalidPen { index: 0, count: 0 }), RenderPlan::new(&image).err());
+
+        let image2 = parse(r#"{
+  "width": 100,
+  "height": 100,
+  "unit-per-inch": 72,
+  "pens": [],
+  "brushes": [],
+  "shapes": [{ "type": "group", "content": [{ "type": "region", "brush": 2, "data": [] }] }]
+}"#);
+        assert_eq!(Some(PlanError::InvalidBrush { index: 2, count: 0 }), RenderPlan::new(&image2).err());
+    }
+
+    #[test]
+    fn test_plan_merges_draw_calls() {
+        let image = parse(r#"{
+  "width": 100,
+  "height": 100,
+  "unit-per-inch": 72,
+  "pens": [{
+    "pattern": { "type": "monochrome", "color": [0, 0, 0] },
+    "width": 1,
+    "cap": "butt",
+    "join": "round"
+  }],
+  "brushes": [{ "pattern": { "type": "monochrome", "color": [1, 0, 0] } }],
+  "shapes": [
+    { "type": "curve", "pen": 0, "data": [[0, 0], ["L", [10, 0]]] },
+    { "type": "curve", "pen": 0, "data": [[0, 10], ["L", [10, 10]]] },
+    { "type": "curve", "pen": 0, "data": [[0, 20], ["L", [10, 20]]] },
+    { "type": "curve", "pen": 0, "data": [[5, 20], ["L", [5, 30]]] },
+    { "type": "region", "brush": 0, "data": [[[50, 50], ["L", [60, 50]], ["L", [60, 60]]]] },
+    { "type": "region", "data": [[[0, 0], ["L", [100, 100]]]] },
+    { "type": "region", "brush": 0, "data": [[[70, 50], ["L", [80, 50]], ["L", [80, 60]]]] },
+    { "type": "region", "pen": 0, "brush": 0, "data": [[[70, 50], ["L", [80, 50]], ["L", [80, 60]]]] }
+  ]
+}"#);
+        let plan = RenderPlan::new(&image).unwrap();
+
+        let surface = cairo::ImageSurface::create(cairo::Format::ARgb32, 100, 100).unwrap();
+        let context = Context::new(&surface).unwrap();
+        let stats = plan.replay_with_stats(&context, 72.0, 1.0).unwrap();
+
+        assert_eq!(ReplayStats { draw_calls: 5, saved_draw_calls: 3, fast_rects: 0 }, stats);
+    }
+
+    #[test]
+    fn test_plan_replays_region() {
+        let image = parse(r#"{
+  "width": 100,
+  "height": 100,
+  "unit-per-inch": 72,
+  "pens": [],
+  "brushes": [{ "pattern": { "type": "monochrome", "color": [1, 0, 0, 0.5] } }],
+  "shapes": [
+    { "type": "region", "brush": 0, "data": [[[0, 0], ["L", [10, 0]], ["L", [10, 10]]]] },
+    { "type": "region", "brush": 0, "data": [[[50, 50], ["L", [60, 50]], ["L", [60, 60]]]] },
+    { "type": "region", "brush": 0, "data": [[[90, 90], ["L", [100, 90]], ["L", [100, 100]]]] }
+  ]
+}"#);
+        let plan = RenderPlan::new(&image).unwrap();
+
+        let surface = cairo::ImageSurface::create(cairo::Format::ARgb32, 100, 100).unwrap();
+        let context = Context::new(&surface).unwrap();
+
+        let stats = plan.replay_region(&context, &Rect::new(80.0, 80.0, 40.0, 40.0), 144.0, 1.0).unwrap();
+        assert_eq!(1, stats.draw_calls);
+
+        let stats = plan.replay_region(&context, &Rect::new(300.0, 300.0, 10.0, 10.0), 144.0, 1.0).unwrap();
+        assert_eq!(0, stats.draw_calls);
+    }
+
+    #[test]
+    fn test_plan_fills_aligned_rectangles() {
+        let image = parse(r#"{
+  "width": 100,
+  "height": 100,
+  "unit-per-inch": 72,
+  "pens": [],
+  "brushes": [
+    { "pattern": { "type": "monochrome", "color": [1, 0, 0] } },
+    { "pattern": { "type": "monochrome", "color": [0, 0, 1, 0.5] } }
+  ],
+  "shapes": [
+    { "type": "region", "brush": 0, "data": [[[0, 0], ["L", [10, 0]], ["L", [10, 10]], ["L", [0, 10]]]] },
+    { "type": "region", "brush": 0, "data": [[[5, 5], ["L", [5, 20]], ["L", [20, 20]], ["L", [20, 5]], ["L", [5, 5]]]] },
+    { "type": "region", "brush": 0, "data": [[[30, 0], ["L", [40, 0]], ["L", [40, 10]], ["L", [30, 10]]]] },
+    { "type": "region", "brush": 0, "data": [[[50, 0.5], ["L", [60, 0.5]], ["L", [60, 10]], ["L", [50, 10]]]] },
+    { "type": "region", "brush": 1, "data": [[[70, 0], ["L", [80, 0]], ["L", [80, 10]], ["L", [70, 10]]]] }
+  ]
+}"#);
+        let plan = RenderPlan::new(&image).unwrap();
+
+        let surface = cairo::ImageSurface::create(cairo::Format::ARgb32, 100, 100).unwrap();
+        let context = Context::new(&surface).unwrap();
+        let stats = plan.replay_with_stats(&context, 72.0, 1.0).unwrap();
+
+        assert_eq!(ReplayStats { draw_calls: 3, saved_draw_calls: 2, fast_rects: 3 }, stats);
+    }
+}
@@ -0,0 +1,464 @@
+use std::io::{self, Write};
+use std::sync::Mutex;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::thread;
+
+use flate2::{Compress, Compression, FlushCompress, Status};
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Filter {
+    None,
+    Sub,
+    Up,
+    Average,
+    Paeth,
+    // Picks, for each row, the filter with the smallest sum of absolute
+    // differences, as libpng does.
+    Adaptive
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub struct PngOptions {
+    // zlib's scale, 0 to 9.
+    pub level: u32,
+    pub filter: Filter,
+    pub threads: usize
+}
+
+impl Default for PngOptions {
+    fn default() -> PngOptions {
+        PngOptions { level: 6, filter: Filter::Adaptive, threads: 1 }
+    }
+}
+
+// Rows are filtered and deflated in chunks of about this many bytes. Each
+// chunk ends on a sync flush, so the compressed chunks join into one
+// stream, and the output is the same however many threads made it.
+const CHUNK_SIZE: usize = 1 << 18;
+
+const BYTES_PER_PIXEL: usize = 4;
+
+const ADLER_BASE: u32 = 65521;
+
+// The most bytes that can be summed before the sums could overflow.
+const ADLER_BLOCK: usize = 5552;
+
+fn adler32(data: &[u8]) -> u32 {
+    let (mut a, mut b) = (1u32, 0u32);
+
+    for block in data.chunks(ADLER_BLOCK) {
+        for &byte in block {
+            a += byte as u32;
+            b += a;
+        }
+
+        a %= ADLER_BASE;
+        b %= ADLER_BASE;
+    }
+
+    b << 16 | a
+}
+
+// The checksum of two concatenated buffers from the checksums of each, as
+// zlib's adler32_combine.
+fn adler32_combine(adler_1: u32, adler_2: u32, length_2: usize) -> u32 {
+    let base = ADLER_BASE as u64;
+    let remainder = length_2 as u64 % base;
+
+    let mut sum_1 = adler_1 as u64 & 0xffff;
+    let mut sum_2 = remainder * sum_1 % base;
+    sum_1 += (adler_2 as u64 & 0xffff) + base - 1;
+    sum_2 += (adler_1 as u64 >> 16) + (adler_2 as u64 >> 16) + base - remainder;
+
+    sum_1 %= base;
+    sum_2 %= base;
+
+    (sum_2 << 16 | sum_1) as u32
+}
+
+fn unpremultiply(value: u8, alpha: u8) -> u8 {
+    ((value as u32 * 255 + alpha as u32 / 2) / alpha as u32) as u8
+}
+
+// Converts a row of Cairo's native-endian premultiplied ARGB32 to straight
+// RGBA, as Cairo's own PNG writer does.
+fn convert_row(source: &[u8], row: &mut [u8]) {
+    for (pixel, rgba) in source.chunks_exact(4).zip(row.chunks_exact_mut(4)) {
+        let argb = u32::from_ne_bytes([pixel[0], pixel[1], pixel[2], pixel[3]]);
+        let alpha = (argb >> 24) as u8;
+
+        if alpha == 0 {
+            rgba.fill(0);
+        } else {
+            rgba[0] = unpremultiply((argb >> 16) as u8, alpha);
+            rgba[1] = unpremultiply((argb >> 8) as u8, alpha);
+            rgba[2] = unpremultiply(argb as u8, alpha);
+            rgba[3] = alpha;
+        }
+    }
+}
+
+fn paeth(a: u8, b: u8, c: u8) -> u8 {
+    let p = a as i16 + b as i16 - c as i16;
+    let (pa, pb, pc) = ((p - a as i16).abs(), (p - b as i16).abs(), (p - c as i16).abs());
+
+    if pa <= pb && pa <= pc {
+        a
+    } else if pb <= pc {
+        b
+    } else {
+        c
+    }
+}
+
+fn filter_row(filter: Filter, row: &[u8], previous: &[u8], output: &mut [u8]) {
+    let left = |i: usize| if i >= BYTES_PER_PIXEL { row[i - BYTES_PER_PIXEL] } else { 0 };
+    let upper_left = |i: usize| if i >= BYTES_PER_PIXEL { previous[i - BYTES_PER_PIXEL] } else { 0 };
+
+    for i in 0..row.len() {
+        output[i] = match filter {
+            Filter::Sub => row[i].wrapping_sub(left(i)),
+            Filter::Up => row[i].wrapping_sub(previous[i]),
+            Filter::Average => row[i].wrapping_sub(((left(i) as u16 + previous[i] as u16) / 2) as u8),
+            Filter::Paeth => row[i].wrapping_sub(paeth(left(i), previous[i], upper_left(i))),
+            Filter::None | Filter::Adaptive => row[i]
+        };
+    }
+}
+
+fn filter_tag(filter: Filter) -> u8 {
+    match filter {
+        Filter::None | Filter::Adaptive => 0,
+        Filter::Sub => 1,
+        Filter::Up => 2,
+        Filter::Average => 3,
+        Filter::Paeth => 4
+    }
+}
+
+// Appends the filter byte and the filtered row.
+fn push_filtered(filter: Filter, row: &[u8], previous: &[u8], scratch: &mut [u8], output: &mut Vec<u8>) {
+    let filter = if filter != Filter::Adaptive {
+        filter
+    } else {
+        let cost = |bytes: &[u8]| bytes.iter().map(|&byte| (byte as i8).unsigned_abs() as u64).sum::<u64>();
+
+        [Filter::None, Filter::Sub, Filter::Up, Filter::Average, Filter::Paeth].into_iter()
+            .min_by_key(|&filter| {
+                filter_row(filter, row, previous, scratch);
+                cost(scratch)
+            })
+            .unwrap()
+    };
+
+    filter_row(filter, row, previous, scratch);
+    output.push(filter_tag(filter));
+    output.extend_from_slice(scratch);
+}
+
+struct Chunk {
+    compressed: Vec<u8>,
+    adler: u32,
+    length: usize
+}
+
+fn deflate(data: &[u8], level: u32, last: bool) -> io::Result<Vec<u8>> {
+    let mut compress = Compress::new(Compression::new(level.min(9)), false);
+    let mut output = Vec::with_capacity(data.len() / 2 + 64);
+    let flush = if last { FlushCompress::Finish } else { FlushCompress::Sync };
+
+    loop {
+        if output.len() == output.capacity() {
+            output.reserve(output.capacity());
+        }
+
+        let consumed = compress.total_in() as usize;
+        let status = compress.compress_vec(&data[consumed..], &mut output, flush)
+            .map_err(|err| io::Error::new(io::ErrorKind::Other, err))?;
+
+        // A flush is complete once all input is in and room is left over.
+        let flushed = compress.total_in() as usize == data.len() && output.len() < output.capacity();
+
+        if status == Status::StreamEnd || (!last && flushed) {
+            return Ok(output);
+        }
+    }
+}
+
+fn encode_chunk(rows: std::ops::Range<usize>, width: usize, data: &[u8], stride: usize, options: &PngOptions, last: bool) -> io::Result<Chunk> {
+    let row_bytes = width * BYTES_PER_PIXEL;
+    let mut previous = vec![0; row_bytes];
+    let mut row = vec![0; row_bytes];
+    let mut scratch = vec![0; row_bytes];
+    let mut filtered = Vec::with_capacity((row_bytes + 1) * rows.len());
+
+    if rows.start > 0 {
+        convert_row(&data[(rows.start - 1) * stride..][..row_bytes], &mut previous);
+    }
+
+    for y in rows {
+        convert_row(&data[y * stride..][..row_bytes], &mut row);
+        push_filtered(options.filter, &row, &previous, &mut scratch, &mut filtered);
+        std::mem::swap(&mut row, &mut previous);
+    }
+
+    Ok(Chunk {
+        compressed: deflate(&filtered, options.level, last)?,
+        adler: adler32(&filtered),
+        length: filtered.len()
+    })
+}
+
+fn write_chunk<W: Write>(writer: &mut W, tag: &[u8; 4], data: &[u8]) -> io::Result<()> {
+    let length = u32::try_from(data.len())
+        .map_err(|_| io::Error::new(io::ErrorKind::InvalidInput, "png chunk too large"))?;
+
+    let mut crc = crc32fast::Hasher::new();
+    crc.update(tag);
+    crc.update(data);
+
+    writer.write_all(&length.to_be_bytes())?;
+    writer.write_all(tag)?;
+    writer.write_all(data)?;
+    writer.write_all(&crc.finalize().to_be_bytes())
+}
+
+fn encode_png<W: Write>(writer: &mut W, width: usize, height: usize, data: &[u8], stride: usize, options: &PngOptions, chunk_rows: usize) -> io::Result<()> {
+    let (Ok(png_width), Ok(png_height)) = (u32::try_from(width), u32::try_from(height)) else {
+        return Err(io::Error::new(io::ErrorKind::InvalidInput, "image too large for png"));
+    };
+
+    writer.write_all(b"\x89PNG\r\n\x1a\n")?;
+
+    let mut header = Vec::with_capacity(13);
+    header.extend_from_slice(&png_width.to_be_bytes());
+    header.extend_from_slice(&png_height.to_be_bytes());
+    // 8-bit RGBA, deflate, adaptive filtering, no interlace.
+    header.extend_from_slice(&[8, 6, 0, 0, 0]);
+    write_chunk(writer, b"IHDR", &header)?;
+
+    let count = height.div_ceil(chunk_rows).max(1);
+    let rows = |i: usize| i * chunk_rows..((i + 1) * chunk_rows).min(height);
+
+    let chunks: Vec<Mutex<Option<io::Result<Chunk>>>> = (0..count).map(|_| Mutex::new(None)).collect();
+    let next = AtomicUsize::new(0);
+
+    thread::scope(|scope| {
+        for _ in 0..options.threads.clamp(1, count) {
+            scope.spawn(|| loop {
+                let i = next.fetch_add(1, Ordering::Relaxed);
+
+                if i >= count {
+                    break;
+                }
+
+                *chunks[i].lock().unwrap() = Some(encode_chunk(rows(i), width, data, stride, options, i + 1 == count));
+            });
+        }
+    });
+
+    // zlib's header for the default window, flagged with the level.
+    let level = match options.level {
+        0 | 1 => 0,
+        2..=5 => 1,
+        6 => 2,
+        _ => 3
+    };
+    let mut zlib = vec![0x78, level << 6];
+    zlib[1] |= ((31 - (zlib[0] as u16 * 256 + zlib[1] as u16) % 31) % 31) as u8;
+
+    let mut adler = 1;
+
+    for (i, chunk) in chunks.into_iter().enumerate() {
+        let chunk = chunk.into_inner().unwrap().unwrap()?;
+        adler = adler32_combine(adler, chunk.adler, chunk.length);
+        zlib.extend_from_slice(&chunk.compressed);
+
+        if i + 1 == count {
+            zlib.extend_from_slice(&adler.to_be_bytes());
+        }
+
+        write_chunk(writer, b"IDAT", &zlib)?;
+        zlib.clear();
+    }
+
+    write_chunk(writer, b"IEND", &[])
+}
+
+// data is in Cairo's ARGB32 layout.
+pub fn write_png<W: Write>(writer: &mut W, width: usize, height: usize, data: &[u8], stride: usize, options: &PngOptions) -> io::Result<()> {
+    let chunk_rows = (CHUNK_SIZE / (width * BYTES_PER_PIXEL + 1).max(1)).max(1);
+    encode_png(writer, width, height, data, stride, options, chunk_rows)
+}
+
+// Straight RGBA, row after row with no header.
+pub fn write_rgba<W: Write>(writer: &mut W, width: usize, height: usize, data: &[u8], stride: usize) -> io::Result<()> {
+    let mut row = vec![0; width * BYTES_PER_PIXEL];
+
+    for y in 0..height {
+        convert_row(&data[y * stride..][..row.len()], &mut row);
+        writer.write_all(&row)?;
+    }
+
+    Ok(())
+}
+
+// Binary PPM, which has no alpha: the colours are left premultiplied, as if
+// composited over black.
+pub fn write_ppm<W: Write>(writer: &mut W, width: usize, height: usize, data: &[u8], stride: usize) -> io::Result<()> {
+    write!(writer, "P6\n{} {}\n255\n", width, height)?;
+
+    let mut row = Vec::with_capacity(width * 3);
+
+    for y in 0..height {
+        row.clear();
+
+        for pixel in data[y * stride..][..width * BYTES_PER_PIXEL].chunks_exact(4) {
+            let argb = u32::from_ne_bytes([pixel[0], pixel[1], pixel[2], pixel[3]]);
+            row.extend_from_slice(&[(argb >> 16) as u8, (argb >> 8) as u8, argb as u8]);
+        }
+
+        writer.write_all(&row)?;
+    }
+
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+    use std::io::Read;
+
+    use super::*;
+
+    // A 7 by 5 gradient with varying alpha, in Cairo's layout.
+    fn sample() -> (usize, usize, Vec<u8>, usize) {
+        let (width, height, stride) = (7, 5, 32);
+        let mut data = vec![0xee; stride * height];
+
+        for y in 0..height {
+            for x in 0..width {
+                let alpha = ((x * 40 + y * 10) % 256) as u32;
+                let value = |c: usize| (c as u32 * alpha / 255) & 0xff;
+                let argb = alpha << 24 | value(x * 30) << 16 | value(y * 50) << 8 | value(255);
+                data[y * stride + x * 4..][..4].copy_from_slice(&argb.to_ne_bytes());
+            }
+        }
+
+        (width, height, data, stride)
+    }
+
+    fn decode(png: &[u8]) -> (u32, u32, Vec<u8>) {
+        assert_eq!(b"\x89PNG\r\n\x1a\n", &png[..8]);
+
+        let mut position = 8;
+        let mut header = Vec::new();
+        let mut zlib = Vec::new();
+
+        while position < png.len() {
+            let length = u32::from_be_bytes(png[position..position + 4].try_into().unwrap()) as usize;
+            let tag = &png[position + 4..position + 8];
+            let body = &png[position + 8..position + 8 + length];
+            let crc = u32::from_be_bytes(png[position + 8 + length..position + 12 + length].try_into().unwrap());
+
+            let mut hasher = crc32fast::Hasher::new();
+            hasher.update(&png[position + 4..position + 8 + length]);
+            assert_eq!(hasher.finalize(), crc);
+
+            match tag {
+                b"IHDR" => header = body.to_vec(),
+                b"IDAT" => zlib.extend_from_slice(body),
+                _ => {}
+            }
+
+            position += 12 + length;
+        }
+
+        let width = u32::from_be_bytes(header[0..4].try_into().unwrap());
+        let height = u32::from_be_bytes(header[4..8].try_into().unwrap());
+
+        let mut filtered = Vec::new();
+        flate2::read::ZlibDecoder::new(&zlib[..]).read_to_end(&mut filtered).unwrap();
+
+        let row_bytes = width as usize * 4;
+        let mut pixels: Vec<u8> = Vec::new();
+        let mut previous = vec![0u8; row_bytes];
+
+        for line in filtered.chunks(row_bytes + 1) {
+            let mut row = line[1..].to_vec();
+
+            for i in 0..row_bytes {
+                let left = if i >= 4 { row[i - 4] } else { 0 };
+                let upper_left = if i >= 4 { previous[i - 4] } else { 0 };
+
+                row[i] = row[i].wrapping_add(match line[0] {
+                    0 => 0,
+                    1 => left,
+                    2 => previous[i],
+                    3 => ((left as u16 + previous[i] as u16) / 2) as u8,
+                    4 => paeth(left, previous[i], upper_left),
+                    _ => panic!("bad filter")
+                });
+            }
+
+            pixels.extend_from_slice(&row);
+            previous = row;
+        }
+
+        (width, height, pixels)
+    }
+
+    #[test]
+    fn test_adler32() {
+        let data: Vec<u8> = (0..20000u32).map(|i| (i * 7 % 251) as u8).collect();
+        assert_eq!(1, adler32(&[]));
+        assert_eq!(0x11e60398, adler32(b"Wikipedia"));
+
+        for split in [0, 1, 5552, 12345, 20000] {
+            let (a, b) = data.split_at(split);
+            assert_eq!(adler32(&data), adler32_combine(adler32(a), adler32(b), b.len()));
+        }
+    }
+
+    #[test]
+    fn test_write_png() {
+        let (width, height, data, stride) = sample();
+
+        let mut expected = Vec::new();
+        write_rgba(&mut expected, width, height, &data, stride).unwrap();
+        assert_eq!(width * height * 4, expected.len());
+
+        for filter in [Filter::None, Filter::Sub, Filter::Up, Filter::Average, Filter::Paeth, Filter::Adaptive] {
+            for level in [0, 1, 6, 9] {
+                let options = PngOptions { level, filter, threads: 1 };
+                let mut png = Vec::new();
+                write_png(&mut png, width, height, &data, stride, &options).unwrap();
+                assert_eq!((width as u32, height as u32, expected.clone()), decode(&png));
+            }
+        }
+    }
+
+    #[test]
+    fn test_parallel_png() {
+        let (width, height, data, stride) = sample();
+        let options = |threads| PngOptions { level: 6, filter: Filter::Adaptive, threads };
+
+        let mut serial = Vec::new();
+        encode_png(&mut serial, width, height, &data, stride, &options(1), 2).unwrap();
+
+        let mut parallel = Vec::new();
+        encode_png(&mut parallel, width, height, &data, stride, &options(4), 2).unwrap();
+        assert_eq!(serial, parallel);
+
+        let mut expected = Vec::new();
+        write_rgba(&mut expected, width, height, &data, stride).unwrap();
+        assert_eq!((width as u32, height as u32, expected), decode(&parallel));
+    }
+
+    #[test]
+    fn test_write_ppm() {
+        let mut ppm = Vec::new();
+        let data = [0x80204060u32.to_ne_bytes(), 0u32.to_ne_bytes()].concat();
+        write_ppm(&mut ppm, 1, 2, &data, 4).unwrap();
+        assert_eq!(b"P6\n1 2\n255\n\x20\x40\x60\0\0\0".to_vec(), ppm);
+    }
+}
@@ -0,0 +1,215 @@
+use std::cmp::Reverse;
+use std::collections::BinaryHeap;
+use std::fmt;
+use std::time::{Duration, Instant};
+
+use crate::image::*;
+use crate::render::*;
+
+const PHASES: [Phase; 7] = [
+    Phase::Parse,
+    Phase::Resources,
+    Phase::Path,
+    Phase::Pattern,
+    Phase::Fill,
+    Phase::Stroke,
+    Phase::Encode
+];
+
+fn phase_name(phase: Phase) -> &'static str {
+    match phase {
+        Phase::Parse => "parse",
+        Phase::Resources => "resources",
+        Phase::Path => "path",
+        Phase::Pattern => "pattern",
+        Phase::Fill => "fill",
+        Phase::Stroke => "stroke",
+        Phase::Encode => "encode"
+    }
+}
+
+#[derive(Debug, Default, Clone, Copy, PartialEq, Eq)]
+pub struct Counts {
+    pub shapes: usize,
+    pub segments: usize,
+    pub subpaths: usize,
+    pub patterns: usize,
+    pub draw_calls: usize
+}
+
+// Collects the time spent in each phase and the slowest leaf shapes, each
+// named by its index path through the groups.
+pub struct Profiler {
+    top: usize,
+    phases: [Duration; PHASES.len()],
+    phase_start: Option<Instant>,
+    path: Vec<usize>,
+    starts: Vec<(Instant, bool)>,
+    slowest: BinaryHeap<Reverse<(Duration, Vec<usize>)>>,
+    counts: Counts
+}
+
+impl Profiler {
+    pub fn new(top: usize) -> Profiler {
+        Profiler {
+            top,
+            phases: [Duration::ZERO; PHASES.len()],
+            phase_start: None,
+            path: Vec::new(),
+            starts: Vec::new(),
+            slowest: BinaryHeap::new(),
+            counts: Counts::default()
+        }
+    }
+
+    pub fn time<T>(&mut self, phase: Phase, run: impl FnOnce() -> T) -> T {
+        self.begin_phase(phase);
+        let result = run();
+        self.end_phase(phase);
+        result
+    }
+
+    pub fn phase_time(&self, phase: Phase) -> Duration {
+        self.phases[phase as usize]
+    }
+
+    pub fn counts(&self) -> Counts {
+        self.counts
+    }
+
+    // The slowest leaves, slowest first.
+    pub fn slowest(&self) -> Vec<(Vec<usize>, Duration)> {
+        let mut slowest: Vec<(Vec<usize>, Duration)> = self.slowest.iter()
+            .map(|Reverse((duration, path))| (path.clone(), *duration))
+            .collect();
+
+        slowest.sort_by(|a, b| b.1.cmp(&a.1).then_with(|| a.0.cmp(&b.0)));
+        slowest
+    }
+
+    fn record(&mut self, duration: Duration) {
+        if self.top == 0 {
+            return;
+        }
+
+        if self.slowest.len() < self.top {
+            self.slowest.push(Reverse((duration, self.path.clone())));
+        } else if self.slowest.peek().is_some_and(|Reverse((fastest, _))| duration > *fastest) {
+            self.slowest.pop();
+            self.slowest.push(Reverse((duration, self.path.clone())));
+        }
+    }
+}
+
+impl RenderHook for Profiler {
+    fn begin_shape(&mut self, index: usize, shape: &Shape) {
+        self.counts.shapes += 1;
+
+        match shape {
+            Shape::Group(_) => {},
+            Shape::Curve(curve) => {
+                self.counts.subpaths += 1;
+                self.counts.segments += curve.data.len();
+            },
+            Shape::Region(region) => {
+                self.counts.subpaths += region.data.len();
+                self.counts.segments += region.data.iter().map(|data| data.len()).sum::<usize>();
+            }
+        }
+
+        self.path.push(index);
+        self.starts.push((Instant::now(), !matches!(shape, Shape::Group(_))));
+    }
+
+    fn end_shape(&mut self) {
+        if let Some((start, leaf)) = self.starts.pop() {
+            if leaf {
+                self.record(start.elapsed());
+            }
+        }
+
+        self.path.pop();
+    }
+
+    fn begin_phase(&mut self, _phase: Phase) {
+        self.phase_start = Some(Instant::now());
+    }
+
+    fn end_phase(&mut self, phase: Phase) {
+        if let Some(start) = self.phase_start.take() {
+            self.phases[phase as usize] += start.elapsed();
+        }
+
+        match phase {
+            Phase::Pattern => self.counts.patterns += 1,
+            Phase::Fill | Phase::Stroke => self.counts.draw_calls += 1,
+            _ => {}
+        }
+    }
+}
+
+fn millis(duration: Duration) -> f64 {
+    duration.as_secs_f64() * 1000.0
+}
+
+impl fmt::Display for Profiler {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        for phase in PHASES {
+            writeln!(f, "{:<10} {:>10.3} ms", phase_name(phase), millis(self.phase_time(phase)))?;
+        }
+
+        let counts = self.counts;
+        writeln!(f, "shapes {}, segments {}, subpaths {}, patterns {}, draw calls {}",
+            counts.shapes, counts.segments, counts.subpaths, counts.patterns, counts.draw_calls)?;
+
+        let slowest = self.slowest();
+
+        if !slowest.is_empty() {
+            writeln!(f, "slowest shapes:")?;
+        }
+
+        for (path, duration) in slowest {
+            let path: Vec<String> = path.iter().map(|index| index.to_string()).collect();
+            writeln!(f, "{:>10.3} ms  {}", millis(duration), path.join("/"))?;
+        }
+
+        Ok(())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_profiler() {
+        let image: Image = serde_json::from_str(r#"{
+  "width": 100,
+  "height": 100,
+  "unit-per-inch": 72,
+  "pens": [{ "pattern": { "type": "monochrome", "color": [0, 0, 0] }, "width": 1, "cap": "butt", "join": "miter" }],
+  "brushes": [{ "pattern": { "type": "monochrome", "color": [1, 0, 0] } }],
+  "shapes": [
+    { "type": "curve", "pen": 0, "data": [[0, 0], ["L", [10, 10]], ["Q", [20, 0], [30, 10]]] },
+    {
+      "type": "group",
+      "content": [
+        { "type": "region", "brush": 0, "data": [[[10, 10], ["L", [20, 10]], ["L", [20, 20]]]] },
+        { "type": "region", "pen": 0, "brush": 0, "data": [[[50, 50], ["L", [60, 50]]], [[70, 70], ["L", [80, 80]]]] }
+      ]
+    }
+  ]
+}"#).unwrap();
+
+        let surface = cairo::ImageSurface::create(cairo::Format::ARgb32, 100, 100).unwrap();
+        let context = cairo::Context::new(&surface).unwrap();
+        let mut profiler = Profiler::new(2);
+        render_with_hook(&context, &image, 72.0, 1.0, &mut profiler).unwrap();
+
+        assert_eq!(Counts { shapes: 4, segments: 6, subpaths: 4, patterns: 4, draw_calls: 4 }, profiler.counts());
+
+        let slowest: Vec<Vec<usize>> = profiler.slowest().into_iter().map(|(path, _)| path).collect();
+        assert_eq!(2, slowest.len());
+        assert!(slowest.iter().all(|path| [vec![0], vec![1, 0], vec![1, 1]].contains(path)));
+    }
+}
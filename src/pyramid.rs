@@ -0,0 +1,421 @@
+use std::fmt;
+use std::fs;
+use std::io::{self, Write};
+use std::path::PathBuf;
+use std::sync::atomic::{AtomicBool, AtomicUsize, Ordering};
+use std::sync::mpsc;
+use std::thread;
+
+use crate::image::*;
+use crate::index::*;
+use crate::png::*;
+use crate::render::*;
+use crate::tile::*;
+
+pub const TILE_SIZE: i32 = 256;
+
+// Level 0 fits in one tile and every level doubles the one above it, up to
+// the deepest at the scale asked for.
+#[derive(Clone, Copy, PartialEq, Debug)]
+pub struct Level {
+    pub level: u32,
+    pub scale: f64,
+    pub width: i32,
+    pub height: i32
+}
+
+// None when the deepest level is too large for a surface or has no size.
+pub fn pyramid_levels(image: &Image, ppi: f64, scale: f64, tile_size: i32) -> Option<Vec<Level>> {
+    let size = |scale: f64| {
+        let factor = ppi / image.unit_per_inch * scale;
+        (image.width * factor, image.height * factor)
+    };
+
+    let (width, height) = size(scale);
+
+    if !(width.round() >= 1.0 && height.round() >= 1.0 && width.round() <= i32::MAX.into() && height.round() <= i32::MAX.into()) || tile_size <= 0 {
+        return None;
+    }
+
+    let mut levels = Vec::new();
+    let mut scale = scale;
+
+    loop {
+        let (width, height) = size(scale);
+        let (width, height) = (width.round().max(1.0) as i32, height.round().max(1.0) as i32);
+        levels.push(Level { level: 0, scale, width, height });
+
+        if width <= tile_size && height <= tile_size {
+            break;
+        }
+
+        scale /= 2.0;
+    }
+
+    levels.reverse();
+
+    for (number, level) in levels.iter_mut().enumerate() {
+        level.level = number as u32;
+    }
+
+    Some(levels)
+}
+
+// Where finished tiles go, named by level, column and row.
+pub trait TileSink {
+    fn write_tile(&mut self, level: u32, column: i32, row: i32, png: &[u8]) -> io::Result<()>;
+}
+
+// Tiles as <root>/<level>/<column>_<row>.png.
+pub struct DirectorySink {
+    root: PathBuf,
+    created: Vec<u32>
+}
+
+impl DirectorySink {
+    pub fn new(root: impl Into<PathBuf>) -> DirectorySink {
+        DirectorySink { root: root.into(), created: Vec::new() }
+    }
+}
+
+impl TileSink for DirectorySink {
+    fn write_tile(&mut self, level: u32, column: i32, row: i32, png: &[u8]) -> io::Result<()> {
+        let directory = self.root.join(level.to_string());
+
+        if !self.created.contains(&level) {
+            fs::create_dir_all(&directory)?;
+            self.created.push(level);
+        }
+
+        fs::write(directory.join(format!("{}_{}.png", column, row)), png)
+    }
+}
+
+const BLOCK: usize = 512;
+
+fn octal(field: &mut [u8], value: u64) {
+    let end = field.len() - 1;
+    field[..end].copy_from_slice(format!("{:0width$o}", value, width = end).as_bytes());
+}
+
+// The same tree in a ustar archive, which unlike zip has no limit on the
+// number of entries before extensions. finish writes the closing blocks.
+pub struct TarSink<W: Write> {
+    writer: W
+}
+
+impl<W: Write> TarSink<W> {
+    pub fn new(writer: W) -> TarSink<W> {
+        TarSink { writer }
+    }
+
+    pub fn finish(mut self) -> io::Result<W> {
+        self.writer.write_all(&[0; BLOCK * 2])?;
+        self.writer.flush()?;
+        Ok(self.writer)
+    }
+}
+
+impl<W: Write> TileSink for TarSink<W> {
+    fn write_tile(&mut self, level: u32, column: i32, row: i32, png: &[u8]) -> io::Result<()> {
+        let name = format!("{}/{}_{}.png", level, column, row);
+        let mut header = [0; BLOCK];
+
+        header[..name.len()].copy_from_slice(name.as_bytes());
+        octal(&mut header[100..108], 0o644);
+        octal(&mut header[108..116], 0);
+        octal(&mut header[116..124], 0);
+        octal(&mut header[124..136], png.len() as u64);
+        octal(&mut header[136..148], 0);
+        header[156] = b'0';
+        header[257..265].copy_from_slice(b"ustar\x0000");
+
+        // The checksum is taken with its own field as spaces.
+        header[148..156].fill(b' ');
+        let checksum: u32 = header.iter().map(|&byte| u32::from(byte)).sum();
+        octal(&mut header[148..155], checksum.into());
+        header[154] = 0;
+
+        self.writer.write_all(&header)?;
+        self.writer.write_all(png)?;
+        self.writer.write_all(&[0; BLOCK][..(BLOCK - png.len() % BLOCK) % BLOCK])
+    }
+}
+
+#[derive(Debug)]
+pub enum PyramidError {
+    Tile(TileError),
+    Io(io::Error)
+}
+
+impl fmt::Display for PyramidError {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        match self {
+            PyramidError::Tile(err) => write!(f, "{}", err),
+            PyramidError::Io(err) => write!(f, "{}", err)
+        }
+    }
+}
+
+impl std::error::Error for PyramidError {}
+
+#[derive(Clone, Copy, PartialEq, Debug, Default)]
+pub struct PyramidStats {
+    pub written: usize,
+    pub skipped: usize
+}
+
+struct PyramidTile {
+    level: Level,
+    column: i32,
+    row: i32,
+    tile: Tile
+}
+
+// The tiles of every level, numbered level by level in the order of
+// split_tiles, and found from their number instead of listed up front.
+struct PyramidTiles<'a> {
+    levels: &'a [Level],
+    tile_size: i32,
+    // The number of the first tile of each level, then the tile count.
+    starts: Vec<usize>
+}
+
+impl PyramidTiles<'_> {
+    fn new(levels: &[Level], tile_size: i32) -> PyramidTiles<'_> {
+        let mut starts = vec![0];
+
+        for level in levels.iter() {
+            let count = if level.width > 0 && level.height > 0 && tile_size > 0 {
+                (level.width as usize).div_ceil(tile_size as usize) * (level.height as usize).div_ceil(tile_size as usize)
+            } else {
+                0
+            };
+
+            starts.push(starts[starts.len() - 1] + count);
+        }
+
+        PyramidTiles { levels, tile_size, starts }
+    }
+
+    fn len(&self) -> usize {
+        self.starts[self.levels.len()]
+    }
+
+    fn get(&self, number: usize) -> PyramidTile {
+        // The last level starting at or before number, past any empty one.
+        let index = self.starts.partition_point(|&start| start <= number) - 1;
+        let level = self.levels[index];
+        let offset = number - self.starts[index];
+        let columns = (level.width as usize).div_ceil(self.tile_size as usize);
+
+        let (column, row) = ((offset % columns) as i32, (offset / columns) as i32);
+        let (x, y) = (column * self.tile_size, row * self.tile_size);
+
+        PyramidTile {
+            level,
+            column,
+            row,
+            tile: Tile { x, y, width: self.tile_size.min(level.width - x), height: self.tile_size.min(level.height - y) }
+        }
+    }
+}
+
+// Encodes a tile, or None if it holds no shape or nothing of them shows.
+fn render_pyramid_tile(tile: &PyramidTile, image: &Image, index: &SpatialIndex, resources: &Resources, ppi: f64, png: &PngOptions, found: &mut Vec<usize>) -> Result<Option<Vec<u8>>, PyramidError> {
+    let factor = ppi / image.unit_per_inch * tile.level.scale;
+
+    // The rectangle render_region_of_interest_with_index queries.
+    let rect = tile.tile.rect().inflate(1.0).scale(1.0 / factor);
+
+    found.clear();
+    index.query(&rect, found);
+
+    if found.is_empty() {
+        return Ok(None);
+    }
+
+    let pixels = render_tile(&tile.tile, image, index, resources, ppi, tile.level.scale)
+        .map_err(PyramidError::Tile)?;
+
+    if pixels.iter().all(|&byte| byte == 0) {
+        return Ok(None);
+    }
+
+    let (width, height) = (tile.tile.width as usize, tile.tile.height as usize);
+    let mut encoded = Vec::new();
+    write_png(&mut encoded, width, height, &pixels, width * 4, png).map_err(PyramidError::Io)?;
+
+    Ok(Some(encoded))
+}
+
+// Renders every level on threads threads from one index, each tile from
+// the shapes overlapping it, and hands the tiles to sink as they finish.
+pub fn build_pyramid(image: &Image, index: &SpatialIndex, levels: &[Level], ppi: f64, tile_size: i32, threads: usize, png: &PngOptions, sink: &mut dyn TileSink) -> Result<PyramidStats, PyramidError> {
+    let tiles = PyramidTiles::new(levels, tile_size);
+
+    let threads = threads.clamp(1, tiles.len().max(1));
+    let next = AtomicUsize::new(0);
+    let failed = AtomicBool::new(false);
+    let mut stats = PyramidStats::default();
+
+    thread::scope(|scope| {
+        let (sender, receiver) = mpsc::sync_channel(threads);
+
+        for _ in 0..threads {
+            let sender = sender.clone();
+            let (tiles, next, failed) = (&tiles, &next, &failed);
+
+            scope.spawn(move || {
+                let resources = Resources::new(image);
+                let mut found = Vec::new();
+
+                while !failed.load(Ordering::Relaxed) {
+                    let number = next.fetch_add(1, Ordering::Relaxed);
+
+                    if number >= tiles.len() {
+                        break;
+                    }
+
+                    let result = render_pyramid_tile(&tiles.get(number), image, index, &resources, ppi, png, &mut found);
+
+                    if result.is_err() {
+                        failed.store(true, Ordering::Relaxed);
+                    }
+
+                    if sender.send((number, result)).is_err() {
+                        break;
+                    }
+                }
+            });
+        }
+
+        drop(sender);
+
+        for (number, result) in receiver {
+            let tile = tiles.get(number);
+
+            match result.inspect_err(|_| failed.store(true, Ordering::Relaxed))? {
+                Some(encoded) => {
+                    sink.write_tile(tile.level.level, tile.column, tile.row, &encoded)
+                        .map_err(PyramidError::Io)
+                        .inspect_err(|_| failed.store(true, Ordering::Relaxed))?;
+                    stats.written += 1;
+                },
+                None => stats.skipped += 1
+            }
+        }
+
+        Ok(())
+    })?;
+
+    Ok(stats)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    struct Collect(Vec<(u32, i32, i32, usize)>);
+
+    impl TileSink for Collect {
+        fn write_tile(&mut self, level: u32, column: i32, row: i32, png: &[u8]) -> io::Result<()> {
+            assert!(png.starts_with(b"\x89PNG\r\n\x1a\n"));
+            self.0.push((level, column, row, png.len()));
+            Ok(())
+        }
+    }
+
+    fn image() -> Image {
+        serde_json::from_str(r#"{
+  "width": 1000,
+  "height": 300,
+  "unit-per-inch": 72,
+  "pens": [],
+  "brushes": [{ "pattern": { "type": "monochrome", "color": [1, 0, 0] } }],
+  "shapes": [{ "type": "region", "brush": 0, "data": [[[10, 10], ["L", [50, 10]], ["L", [50, 50]], ["L", [10, 50]]]] }]
+}"#).unwrap()
+    }
+
+    #[test]
+    fn test_pyramid_levels() {
+        let levels = pyramid_levels(&image(), 72.0, 2.0, TILE_SIZE).unwrap();
+        assert_eq!(vec![
+            Level { level: 0, scale: 0.25, width: 250, height: 75 },
+            Level { level: 1, scale: 0.5, width: 500, height: 150 },
+            Level { level: 2, scale: 1.0, width: 1000, height: 300 },
+            Level { level: 3, scale: 2.0, width: 2000, height: 600 }
+        ], levels);
+
+        assert!(pyramid_levels(&image(), 72.0, 0.0, TILE_SIZE).is_none());
+        assert!(pyramid_levels(&image(), 72.0, 1e10, TILE_SIZE).is_none());
+    }
+
+    #[test]
+    fn test_pyramid_tiles() {
+        let levels = pyramid_levels(&image(), 72.0, 2.0, TILE_SIZE).unwrap();
+        let tiles = PyramidTiles::new(&levels, TILE_SIZE);
+
+        let expected: Vec<_> = levels.iter()
+            .flat_map(|&level| split_tiles(level.width, level.height, TILE_SIZE).into_iter().map(move |tile| (level.level, tile)))
+            .collect();
+
+        assert_eq!(35, tiles.len());
+        assert_eq!(expected.len(), tiles.len());
+
+        for (number, (level, tile)) in expected.into_iter().enumerate() {
+            let found = tiles.get(number);
+            assert_eq!(level, found.level.level);
+            assert_eq!(tile, found.tile);
+            assert_eq!((tile.x / TILE_SIZE, tile.y / TILE_SIZE), (found.column, found.row));
+        }
+
+        // The deepest level of a large image has more tiles than would be
+        // worth listing, and its last one is found all the same.
+        let levels = [Level { level: 0, scale: 1.0, width: 1, height: 1 }, Level { level: 1, scale: 1.0, width: i32::MAX, height: i32::MAX }];
+        let tiles = PyramidTiles::new(&levels, TILE_SIZE);
+        let side = (i32::MAX as usize).div_ceil(TILE_SIZE as usize);
+        assert_eq!(1 + side * side, tiles.len());
+
+        let last = tiles.get(tiles.len() - 1);
+        assert_eq!((1, side as i32 - 1, side as i32 - 1), (last.level.level, last.column, last.row));
+        assert_eq!(Tile { x: (side as i32 - 1) * TILE_SIZE, y: (side as i32 - 1) * TILE_SIZE, width: 255, height: 255 }, last.tile);
+    }
+
+    #[test]
+    fn test_build_pyramid() {
+        let image = image();
+        let index = SpatialIndex::new(&image);
+        let levels = pyramid_levels(&image, 72.0, 2.0, TILE_SIZE).unwrap();
+
+        for threads in [1, 3] {
+            let mut sink = Collect(Vec::new());
+            let stats = build_pyramid(&image, &index, &levels, 72.0, TILE_SIZE, threads, &PngOptions::default(), &mut sink).unwrap();
+
+            // 1 + 2 + 8 + 24 tiles, of which the square lies in one per level.
+            assert_eq!(PyramidStats { written: 4, skipped: 31 }, stats);
+
+            let mut written: Vec<_> = sink.0.iter().map(|&(level, column, row, _)| (level, column, row)).collect();
+            written.sort();
+            assert_eq!(vec![(0, 0, 0), (1, 0, 0), (2, 0, 0), (3, 0, 0)], written);
+        }
+    }
+
+    #[test]
+    fn test_tar_sink() {
+        let mut sink = TarSink::new(Vec::new());
+        sink.write_tile(2, 3, 4, b"tile").unwrap();
+        let tar = sink.finish().unwrap();
+
+        assert_eq!(BLOCK * 4, tar.len());
+        assert!(tar.starts_with(b"2/3_4.png\0"));
+        assert_eq!(b"00000000004\0", &tar[124..136]);
+        assert_eq!(b"ustar\x0000", &tar[257..265]);
+        assert_eq!(b"tile", &tar[BLOCK..BLOCK + 4]);
+
+        let checksum: u32 = tar[..BLOCK].iter().enumerate()
+            .map(|(i, &byte)| if (148..156).contains(&i) { u32::from(b' ') } else { u32::from(byte) })
+            .sum();
+        assert_eq!(format!("{:06o}\0 ", checksum).as_bytes(), &tar[148..156]);
+    }
+}
@@ -0,0 +1,813 @@
+use std::fmt;
+
+use crate::backend::Backend;
+use crate::bounds::rectangle;
+use crate::hash::{curve_hash, pen_hash};
+use crate::image::*;
+use crate::stroke::*;
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum RasterError {
+    InvalidPen { index: usize, count: usize },
+    InvalidBrush { index: usize, count: usize }
+}
+
+impl fmt::Display for RasterError {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        match self {
+            RasterError::InvalidPen { index, count } =>
+                write!(f, "invalid pen index {}, must be less than {}.", index, count),
+            RasterError::InvalidBrush { index, count } =>
+                write!(f, "invalid brush index {}, must be less than {}.", index, count)
+        }
+    }
+}
+
+impl std::error::Error for RasterError {}
+
+// Cairo's default, in pixels.
+pub const DEFAULT_TOLERANCE: f64 = 0.1;
+
+const MAX_DEPTH: u32 = 16;
+
+// In points, about 16 MiB.
+pub const DEFAULT_STROKE_CACHE: usize = 1 << 20;
+
+#[derive(Clone, Copy, PartialEq)]
+enum FillRule {
+    EvenOdd,
+    NonZero
+}
+
+impl FillRule {
+    fn coverage(self, winding: f32) -> f32 {
+        match self {
+            FillRule::EvenOdd => {
+                let winding = winding.abs() % 2.0;
+
+                if winding > 1.0 {
+                    2.0 - winding
+                } else {
+                    winding
+                }
+            },
+            FillRule::NonZero => winding.abs().min(1.0)
+        }
+    }
+}
+
+fn premultiply(color: &Color) -> [f32; 4] {
+    let alpha = color.alpha as f32;
+    [color.red as f32 * alpha, color.green as f32 * alpha, color.blue as f32 * alpha, alpha]
+}
+
+// Gradients interpolate unpremultiplied colors and pad beyond their ends,
+// as Cairo does.
+fn interpolate(colors: &[Color; 2], t: f64) -> [f32; 4] {
+    let t = t.clamp(0.0, 1.0);
+    let mix = |a: f64, b: f64| a + (b - a) * t;
+    let [a, b] = colors;
+
+    premultiply(&Color {
+        red: mix(a.red, b.red),
+        green: mix(a.green, b.green),
+        blue: mix(a.blue, b.blue),
+        alpha: mix(a.alpha, b.alpha)
+    })
+}
+
+// Patterns with their geometry in output pixels.
+pub(crate) enum Paint {
+    Solid([f32; 4]),
+    Linear { origin: Vector, direction: Vector, colors: [Color; 2] },
+    Radial { center: Vector, radius: f64, delta: Vector, delta_radius: f64, colors: [Color; 2] }
+}
+
+impl Paint {
+    pub(crate) fn new(pattern: &Pattern, factor: f64) -> Paint {
+        match pattern {
+            Pattern::Monochrome(pat) => Paint::Solid(premultiply(&pat.color)),
+            Pattern::LinearGradient(pat) if pattern.is_degenerate() => Paint::Solid(premultiply(&pat.color_2)),
+            Pattern::RadialGradient(pat) if pattern.is_degenerate() => Paint::Solid(premultiply(&pat.color_2)),
+            Pattern::LinearGradient(pat) => {
+                let (dx, dy) = ((pat.point_2.x - pat.point_1.x) * factor, (pat.point_2.y - pat.point_1.y) * factor);
+                let length = dx * dx + dy * dy;
+
+                Paint::Linear {
+                    origin: (pat.point_1.x * factor, pat.point_1.y * factor),
+                    direction: (dx / length, dy / length),
+                    colors: [pat.color_1, pat.color_2]
+                }
+            },
+            Pattern::RadialGradient(pat) => Paint::Radial {
+                center: (pat.center_1.x * factor, pat.center_1.y * factor),
+                radius: pat.radius_1 * factor,
+                delta: ((pat.center_2.x - pat.center_1.x) * factor, (pat.center_2.y - pat.center_1.y) * factor),
+                delta_radius: (pat.radius_2 - pat.radius_1) * factor,
+                colors: [pat.color_1, pat.color_2]
+            }
+        }
+    }
+
+    // Premultiplied, or None where a radial gradient is not drawn.
+    pub(crate) fn color(&self, x: f64, y: f64) -> Option<[f32; 4]> {
+        match self {
+            Paint::Solid(color) => Some(*color),
+            Paint::Linear { origin, direction, colors } => {
+                let t = (x - origin.0) * direction.0 + (y - origin.1) * direction.1;
+                Some(interpolate(colors, t))
+            },
+            Paint::Radial { center, radius, delta, delta_radius, colors } => {
+                // The largest t whose circle, of non-negative radius, passes
+                // through the point.
+                let (px, py) = (x - center.0, y - center.1);
+                let a = delta.0 * delta.0 + delta.1 * delta.1 - delta_radius * delta_radius;
+                let b = px * delta.0 + py * delta.1 + radius * delta_radius;
+                let c = px * px + py * py - radius * radius;
+                let valid = |t: f64| radius + t * delta_radius >= 0.0;
+
+                let t = if a == 0.0 {
+                    Some(c / (2.0 * b)).filter(|&t| b != 0.0 && valid(t))
+                } else {
+                    let discriminant = b * b - a * c;
+
+                    if discriminant < 0.0 {
+                        None
+                    } else {
+                        let root = discriminant.sqrt();
+                        let (t1, t2) = ((b + root) / a, (b - root) / a);
+                        let (high, low) = if t1 > t2 { (t1, t2) } else { (t2, t1) };
+
+                        [high, low].into_iter().find(|&t| valid(t))
+                    }
+                };
+
+                t.map(|t| interpolate(colors, t))
+            }
+        }
+    }
+}
+
+fn over(pixel: &mut [f32; 4], color: &[f32; 4], coverage: f32) {
+    let rest = 1.0 - color[3] * coverage;
+
+    for i in 0..4 {
+        pixel[i] = color[i] * coverage + pixel[i] * rest;
+    }
+}
+
+struct Canvas {
+    width: usize,
+    height: usize,
+    pixels: Vec<[f32; 4]>
+}
+
+impl Canvas {
+    fn composite_row(&mut self, x: usize, y: usize, coverage: &[f32], paint: &Paint) {
+        let start = y * self.width + x;
+        let line = &mut self.pixels[start..start + coverage.len()];
+
+        match paint {
+            // Kept free of branches so it vectorizes.
+            Paint::Solid(color) => {
+                for (pixel, &coverage) in line.iter_mut().zip(coverage.iter()) {
+                    over(pixel, color, coverage);
+                }
+            },
+            _ => {
+                for (i, (pixel, &coverage)) in line.iter_mut().zip(coverage.iter()).enumerate() {
+                    if coverage > 0.0 {
+                        if let Some(color) = paint.color((x + i) as f64 + 0.5, y as f64 + 0.5) {
+                            over(pixel, &color, coverage);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // Paints whole pixels, clipped to the canvas.
+    fn fill_rect(&mut self, x1: f64, y1: f64, x2: f64, y2: f64, color: [f32; 4]) {
+        let clamp = |value: f64, limit: usize| value.clamp(0.0, limit as f64) as usize;
+        let (x1, x2) = (clamp(x1, self.width), clamp(x2, self.width));
+        let (y1, y2) = (clamp(y1, self.height), clamp(y2, self.height));
+
+        for y in y1..y2 {
+            self.pixels[y * self.width + x1..y * self.width + x2].fill(color);
+        }
+    }
+}
+
+fn flatten_cubic(points: &mut Vec<Vector>, p0: Vector, p1: Vector, p2: Vector, p3: Vector, tolerance: f64, depth: u32) {
+    // How far the curve can stray from its chord, times four.
+    let ux = 3.0 * p1.0 - 2.0 * p0.0 - p3.0;
+    let uy = 3.0 * p1.1 - 2.0 * p0.1 - p3.1;
+    let vx = 3.0 * p2.0 - 2.0 * p3.0 - p0.0;
+    let vy = 3.0 * p2.1 - 2.0 * p3.1 - p0.1;
+
+    if depth == 0 || (ux * ux).max(vx * vx) + (uy * uy).max(vy * vy) <= 16.0 * tolerance * tolerance {
+        points.push(p3);
+        return;
+    }
+
+    let mid = |a: Vector, b: Vector| ((a.0 + b.0) * 0.5, (a.1 + b.1) * 0.5);
+    let p01 = mid(p0, p1);
+    let p12 = mid(p1, p2);
+    let p23 = mid(p2, p3);
+    let p012 = mid(p01, p12);
+    let p123 = mid(p12, p23);
+    let p0123 = mid(p012, p123);
+
+    flatten_cubic(points, p0, p01, p012, p0123, tolerance, depth - 1);
+    flatten_cubic(points, p0123, p123, p23, p3, tolerance, depth - 1);
+}
+
+// Appends data to points as a polyline in output pixels, no further than
+// tolerance from the curve.
+pub(crate) fn flatten(points: &mut Vec<Vector>, data: &CurveData, factor: f64, tolerance: f64) {
+    let map = |p: Point| (p.x * factor, p.y * factor);
+    let mut current = map(data.start());
+
+    points.push(current);
+
+    for seg in data.segments() {
+        match seg {
+            Segment::Line(line) => {
+                current = map(line.point_2);
+                points.push(current);
+            },
+            Segment::QuadraticBezier(bezier) => {
+                let p2 = map(bezier.point_2);
+                let p3 = map(bezier.point_3);
+                let c1 = (current.0 / 3.0 + p2.0 * 2.0 / 3.0, current.1 / 3.0 + p2.1 * 2.0 / 3.0);
+                let c2 = (p3.0 / 3.0 + p2.0 * 2.0 / 3.0, p3.1 / 3.0 + p2.1 * 2.0 / 3.0);
+                flatten_cubic(points, current, c1, c2, p3, tolerance, MAX_DEPTH);
+                current = p3;
+            },
+            Segment::CubicBezier(bezier) => {
+                let p4 = map(bezier.point_4);
+                flatten_cubic(points, current, map(bezier.point_2), map(bezier.point_3), p4, tolerance, MAX_DEPTH);
+                current = p4;
+            }
+        }
+    }
+}
+
+// Adds the signed area a line covers to the cells of each pixel it crosses,
+// so that a running sum along a row gives the winding number of each pixel.
+// x must lie within 0..=width, with two spare cells at the end of each row.
+fn accumulate_line(cells: &mut [f32], stride: usize, height: usize, p0: (f32, f32), p1: (f32, f32)) {
+    if p0.1 == p1.1 {
+        return;
+    }
+
+    let (direction, p0, p1) = if p0.1 < p1.1 { (1.0, p0, p1) } else { (-1.0, p1, p0) };
+    let dxdy = (p1.0 - p0.0) / (p1.1 - p0.1);
+    let mut x = p0.0;
+
+    if p0.1 < 0.0 {
+        x -= p0.1 * dxdy;
+    }
+
+    let top = p0.1.max(0.0) as usize;
+    let bottom = (p1.1.ceil().max(0.0) as usize).min(height);
+
+    for y in top..bottom {
+        let line = &mut cells[y * stride..(y + 1) * stride];
+        let dy = ((y + 1) as f32).min(p1.1) - (y as f32).max(p0.1);
+        let next = x + dxdy * dy;
+        let d = dy * direction;
+        let (x0, x1) = if x < next { (x, next) } else { (next, x) };
+        let x0_floor = x0.floor();
+        let x0i = x0_floor as usize;
+        let x1_ceil = x1.ceil();
+        let x1i = x1_ceil as usize;
+
+        if x1i <= x0i + 1 {
+            let middle = 0.5 * (x + next) - x0_floor;
+            line[x0i] += d - d * middle;
+            line[x0i + 1] += d * middle;
+        } else {
+            let s = (x1 - x0).recip();
+            let x0f = x0 - x0_floor;
+            let a0 = 0.5 * s * (1.0 - x0f) * (1.0 - x0f);
+            let x1f = x1 - x1_ceil + 1.0;
+            let am = 0.5 * s * x1f * x1f;
+
+            line[x0i] += d * a0;
+
+            if x1i == x0i + 2 {
+                line[x0i + 1] += d * (1.0 - a0 - am);
+            } else {
+                let a1 = s * (1.5 - x0f);
+                line[x0i + 1] += d * (a1 - a0);
+
+                for cell in line[x0i + 2..x1i - 1].iter_mut() {
+                    *cell += d * s;
+                }
+
+                let a2 = a1 + (x1i - x0i - 3) as f32 * s;
+                line[x1i - 1] += d * (1.0 - a2 - am);
+            }
+
+            line[x1i] += d * am;
+        }
+
+        x = next;
+    }
+}
+
+// Splits a line where it leaves 0..=width and clamps the pieces outside to
+// the edges, which leaves the coverage inside unchanged.
+fn clip_line(cells: &mut [f32], stride: usize, height: usize, width: f32, p0: (f32, f32), p1: (f32, f32)) {
+    let mut ts = [0.0, 1.0, 1.0, 1.0];
+    let mut count = 1;
+
+    if p0.0 != p1.0 {
+        for edge in [0.0, width] {
+            let t = (edge - p0.0) / (p1.0 - p0.0);
+
+            if t > 0.0 && t < 1.0 {
+                ts[count] = t;
+                count += 1;
+            }
+        }
+    }
+
+    ts[1..count].sort_by(|a, b| a.total_cmp(b));
+    ts[count] = 1.0;
+
+    let at = |t: f32| ((p0.0 + (p1.0 - p0.0) * t).clamp(0.0, width), p0.1 + (p1.1 - p0.1) * t);
+
+    for i in 0..count {
+        accumulate_line(cells, stride, height, at(ts[i]), at(ts[i + 1]));
+    }
+}
+
+#[derive(Default)]
+struct Scratch {
+    points: Vec<Vector>,
+    ends: Vec<usize>,
+    edges: Vec<(Vector, Vector)>,
+    cells: Vec<f32>,
+    row: Vec<f32>
+}
+
+impl Scratch {
+    fn flatten(&mut self, data: &[CurveData], factor: f64, tolerance: f64) {
+        self.points.clear();
+        self.ends.clear();
+
+        for data in data.iter() {
+            flatten(&mut self.points, data, factor, tolerance);
+            self.ends.push(self.points.len());
+        }
+    }
+
+    fn subpaths(&self) -> impl Iterator<Item = &[Vector]> {
+        self.ends.iter()
+            .scan(0, |start, &end| {
+                let subpath = &self.points[*start..end];
+                *start = end;
+                Some(subpath)
+            })
+    }
+
+    fn fill_edges(&mut self) {
+        let mut edges = std::mem::take(&mut self.edges);
+        edges.clear();
+
+        for subpath in self.subpaths() {
+            for (i, &p) in subpath.iter().enumerate() {
+                edges.push((p, subpath[(i + 1) % subpath.len()]));
+            }
+        }
+
+        self.edges = edges;
+    }
+
+    fn polygon_edges(&mut self, polygon: &Polygon) {
+        self.edges.clear();
+
+        for contour in polygon.contours() {
+            for (i, &p) in contour.iter().enumerate() {
+                self.edges.push((p, contour[(i + 1) % contour.len()]));
+            }
+        }
+    }
+
+    fn rasterize(&mut self, canvas: &mut Canvas, rule: FillRule, paint: &Paint) {
+        let (mut min_x, mut min_y, mut max_x, mut max_y) = (f64::INFINITY, f64::INFINITY, f64::NEG_INFINITY, f64::NEG_INFINITY);
+
+        for &(p, _) in self.edges.iter() {
+            min_x = min_x.min(p.0);
+            min_y = min_y.min(p.1);
+            max_x = max_x.max(p.0);
+            max_y = max_y.max(p.1);
+        }
+
+        let left = min_x.floor().max(0.0);
+        let top = min_y.floor().max(0.0);
+        let right = max_x.ceil().min(canvas.width as f64);
+        let bottom = max_y.ceil().min(canvas.height as f64);
+
+        if !(left < right && top < bottom) {
+            return;
+        }
+
+        let (width, height) = ((right - left) as usize, (bottom - top) as usize);
+        let stride = width + 2;
+
+        self.cells.clear();
+        self.cells.resize(stride * height, 0.0);
+
+        let local = |p: Vector| ((p.0 - left) as f32, (p.1 - top) as f32);
+
+        for &(p, q) in self.edges.iter() {
+            clip_line(&mut self.cells, stride, height, width as f32, local(p), local(q));
+        }
+
+        for y in 0..height {
+            let mut winding = 0.0;
+
+            self.row.clear();
+            self.row.extend(self.cells[y * stride..y * stride + width].iter().map(|&cell| {
+                winding += cell;
+                rule.coverage(winding)
+            }));
+
+            canvas.composite_row(left as usize, top as usize + y, &self.row, paint);
+        }
+    }
+}
+
+struct RasterPen {
+    paint: Paint,
+    stroker: Stroker,
+    pen: Pen,
+    hash: u64
+}
+
+// A software rasterizer that needs nothing but this crate. Curves are
+// flattened to polylines and filled through an accumulation buffer, with
+// antialiasing by exact area coverage. Strokes are turned into polygons
+// first and kept for the next render at the same scale, so a Raster reused
+// through clear draws them faster.
+pub struct Raster {
+    canvas: Canvas,
+    tolerance: f64,
+    factor: f64,
+    pens: Vec<RasterPen>,
+    brushes: Vec<Paint>,
+    strokes: StrokeCache,
+    scratch: Scratch,
+    fast_fills: usize
+}
+
+impl Raster {
+    pub fn new(width: usize, height: usize) -> Raster {
+        Raster {
+            canvas: Canvas { width, height, pixels: vec![[0.0; 4]; width * height] },
+            tolerance: DEFAULT_TOLERANCE,
+            factor: 1.0,
+            pens: Vec::new(),
+            brushes: Vec::new(),
+            strokes: StrokeCache::new(DEFAULT_STROKE_CACHE),
+            scratch: Scratch::default(),
+            fast_fills: 0
+        }
+    }
+
+    // Makes every pixel transparent again, keeping the stroke cache.
+    pub fn clear(&mut self) {
+        self.canvas.pixels.fill([0.0; 4]);
+    }
+
+    // Clears to a canvas of another size, keeping the stroke cache.
+    pub fn resize(&mut self, width: usize, height: usize) {
+        self.canvas.width = width;
+        self.canvas.height = height;
+        self.canvas.pixels.clear();
+        self.canvas.pixels.resize(width * height, [0.0; 4]);
+    }
+
+    pub fn stroke_cache(&self) -> &StrokeCache {
+        &self.strokes
+    }
+
+    pub fn stroke_cache_mut(&mut self) -> &mut StrokeCache {
+        &mut self.strokes
+    }
+
+    // How many fills of the last render were opaque pixel-aligned rectangles
+    // painted without computing coverage.
+    pub fn fast_fills(&self) -> usize {
+        self.fast_fills
+    }
+
+    pub fn width(&self) -> usize {
+        self.canvas.width
+    }
+
+    pub fn height(&self) -> usize {
+        self.canvas.height
+    }
+
+    // The furthest a flattened curve may stray from the exact one, in pixels.
+    pub fn set_tolerance(&mut self, tolerance: f64) {
+        self.tolerance = tolerance;
+    }
+
+    // Premultiplied red, green, blue and alpha.
+    pub fn pixel(&self, x: usize, y: usize) -> [f32; 4] {
+        self.canvas.pixels[y * self.canvas.width + x]
+    }
+
+    // Writes the pixels in Cairo's ARGB32 layout.
+    pub fn write_argb32(&self, data: &mut [u8], stride: usize) {
+        if self.canvas.width == 0 {
+            return;
+        }
+
+        let byte = |value: f32| (value.clamp(0.0, 1.0) * 255.0).round() as u32;
+
+        for (y, line) in self.canvas.pixels.chunks(self.canvas.width).enumerate() {
+            for (x, pixel) in line.iter().enumerate() {
+                let value = byte(pixel[3]) << 24 | byte(pixel[0]) << 16 | byte(pixel[1]) << 8 | byte(pixel[2]);
+                data[y * stride + x * 4..y * stride + x * 4 + 4].copy_from_slice(&value.to_ne_bytes());
+            }
+        }
+    }
+}
+
+impl Backend for Raster {
+    type Error = RasterError;
+
+    fn begin(&mut self, image: &Image, factor: f64) -> Result<(), RasterError> {
+        self.factor = factor;
+        self.fast_fills = 0;
+        self.pens = image.pens.iter()
+            .map(|pen| RasterPen {
+                paint: Paint::new(&pen.pattern, factor),
+                stroker: Stroker::new(pen, factor, self.tolerance),
+                pen: *pen,
+                hash: pen_hash(pen)
+            })
+            .collect();
+        self.brushes = image.brushes.iter()
+            .map(|brush| Paint::new(&brush.pattern, factor))
+            .collect();
+
+        Ok(())
+    }
+
+    fn fill(&mut self, data: &[CurveData], brush: usize) -> Result<(), RasterError> {
+        let paint = self.brushes.get(brush)
+            .ok_or(RasterError::InvalidBrush { index: brush, count: self.brushes.len() })?;
+
+        if let (Paint::Solid(color), [data]) = (paint, data) {
+            if color[3] >= 1.0 {
+                if let Some(rect) = rectangle(data).map(|rect| rect.scale(self.factor)) {
+                    if rect.is_aligned() {
+                        self.canvas.fill_rect(rect.min_x.round(), rect.min_y.round(), rect.max_x.round(), rect.max_y.round(), *color);
+                        self.fast_fills += 1;
+                        return Ok(());
+                    }
+                }
+            }
+        }
+
+        self.scratch.flatten(data, self.factor, self.tolerance);
+        self.scratch.fill_edges();
+        self.scratch.rasterize(&mut self.canvas, FillRule::EvenOdd, paint);
+
+        Ok(())
+    }
+
+    fn stroke(&mut self, data: &[CurveData], closed: bool, pen: usize) -> Result<(), RasterError> {
+        let pen = self.pens.get(pen)
+            .ok_or(RasterError::InvalidPen { index: pen, count: self.pens.len() })?;
+
+        let key = StrokeKey {
+            curve: curve_hash(data, closed),
+            pen: pen.hash,
+            factor: self.factor.to_bits(),
+            tolerance: self.tolerance.to_bits()
+        };
+
+        let scratch = &mut self.scratch;
+        let (factor, tolerance) = (self.factor, self.tolerance);
+
+        let polygon = self.strokes.get_or_insert(key, data, closed, &pen.pen, |polygon| {
+            scratch.flatten(data, factor, tolerance);
+            pen.stroker.stroke(scratch.subpaths(), closed, polygon);
+        });
+
+        scratch.polygon_edges(polygon);
+        scratch.rasterize(&mut self.canvas, FillRule::NonZero, &pen.paint);
+
+        Ok(())
+    }
+
+    fn end(&mut self) -> Result<(), RasterError> {
+        Ok(())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::backend::render_to;
+
+    fn parse(brushes: &str, shapes: &str) -> Image {
+        serde_json::from_str(&format!(r#"{{
+  "width": 20,
+  "height": 20,
+  "unit-per-inch": 72,
+  "pens": [{{ "pattern": {{ "type": "monochrome", "color": [0, 0, 1] }}, "width": 2, "cap": "butt", "join": "miter" }}],
+  "brushes": [{}],
+  "shapes": [{}]
+}}"#, brushes, shapes)).unwrap()
+    }
+
+    const RED: &str = r#"{ "pattern": { "type": "monochrome", "color": [1, 0, 0] } }"#;
+
+    fn assert_close(expected: [f32; 4], actual: [f32; 4]) {
+        assert!(expected.iter().zip(actual.iter()).all(|(a, b)| (a - b).abs() < 1e-4), "{:?} != {:?}", expected, actual);
+    }
+
+    #[test]
+    fn test_raster_fill() {
+        let image = parse(RED, r#"
+    { "type": "region", "brush": 0, "data": [
+      [[2, 2], ["L", [12.5, 2]], ["L", [12.5, 12]], ["L", [2, 12]]],
+      [[4, 4], ["L", [6, 4]], ["L", [6, 6]], ["L", [4, 6]]]
+    ] }"#);
+
+        let mut raster = Raster::new(20, 20);
+        render_to(&mut raster, &image, 72.0, 1.0).unwrap();
+
+        assert_close([1.0, 0.0, 0.0, 1.0], raster.pixel(3, 3));
+        assert_close([0.0; 4], raster.pixel(5, 5));
+        assert_close([0.5, 0.0, 0.0, 0.5], raster.pixel(12, 5));
+        assert_close([0.0; 4], raster.pixel(15, 15));
+        assert_close([0.0; 4], raster.pixel(1, 1));
+    }
+
+    #[test]
+    fn test_raster_fast_fill() {
+        // The second rectangle has a redundant corner, so takes the slow path.
+        let image = parse(RED, r#"
+    { "type": "region", "brush": 0, "data": [[[-5, 2], ["L", [8, 2]], ["L", [8, 9]], ["L", [-5, 9]]]] },
+    { "type": "region", "brush": 0, "data": [[[-5, 12], ["L", [2, 12]], ["L", [8, 12]], ["L", [8, 19]], ["L", [-5, 19]]]] },
+    { "type": "region", "brush": 0, "data": [[[10, 2.5], ["L", [18, 2.5]], ["L", [18, 9]], ["L", [10, 9]]]] }"#);
+
+        let mut raster = Raster::new(20, 20);
+        render_to(&mut raster, &image, 72.0, 1.0).unwrap();
+
+        assert_eq!(1, raster.fast_fills());
+
+        for y in 0..7 {
+            for x in 0..10 {
+                assert_close(raster.pixel(x, y + 12), raster.pixel(x, y + 2));
+            }
+        }
+
+        assert_close([0.5, 0.0, 0.0, 0.5], raster.pixel(12, 2));
+
+        render_to(&mut raster, &image, 72.0, 1.5).unwrap();
+        assert_eq!(0, raster.fast_fills());
+    }
+
+    #[test]
+    fn test_raster_clipping() {
+        let image = parse(RED, r#"
+    { "type": "region", "brush": 0, "data": [[[-10, -10], ["L", [30, 10]], ["L", [-10, 30]]]] }"#);
+
+        let mut raster = Raster::new(20, 20);
+        render_to(&mut raster, &image, 72.0, 1.0).unwrap();
+
+        assert_close([1.0, 0.0, 0.0, 1.0], raster.pixel(0, 10));
+        assert_close([1.0, 0.0, 0.0, 1.0], raster.pixel(10, 10));
+        assert_close([0.0; 4], raster.pixel(19, 0));
+    }
+
+    #[test]
+    fn test_raster_stroke() {
+        let image = parse(RED, r#"{ "type": "curve", "pen": 0, "data": [[2, 5], ["L", [18, 5]], ["L", [18, 15]]] }"#);
+
+        let mut raster = Raster::new(40, 40);
+        render_to(&mut raster, &image, 72.0, 2.0).unwrap();
+
+        assert_close([0.0, 0.0, 1.0, 1.0], raster.pixel(10, 9));
+        assert_close([0.0, 0.0, 1.0, 1.0], raster.pixel(35, 20));
+        assert_close([0.0; 4], raster.pixel(10, 12));
+    }
+
+    #[test]
+    fn test_raster_stroke_cache() {
+        let image = parse(RED, r#"{ "type": "curve", "pen": 0, "data": [[2, 5], ["L", [18, 5]]] }"#);
+
+        let mut raster = Raster::new(20, 20);
+        render_to(&mut raster, &image, 72.0, 1.0).unwrap();
+        let first = raster.pixel(10, 5);
+        assert_eq!(0, raster.stroke_cache().hits());
+
+        raster.clear();
+        assert_close([0.0; 4], raster.pixel(10, 5));
+
+        render_to(&mut raster, &image, 72.0, 1.0).unwrap();
+        assert_eq!(1, raster.stroke_cache().hits());
+        assert_close(first, raster.pixel(10, 5));
+
+        render_to(&mut raster, &image, 72.0, 2.0).unwrap();
+        assert_eq!(1, raster.stroke_cache().hits());
+
+        raster.resize(30, 10);
+        assert_eq!((30, 10), (raster.width(), raster.height()));
+        render_to(&mut raster, &image, 72.0, 1.0).unwrap();
+        assert_eq!(2, raster.stroke_cache().hits());
+        assert_close(first, raster.pixel(10, 5));
+
+        // Another document with the same pen and a different curve strokes it.
+        let moved = parse(RED, r#"{ "type": "curve", "pen": 0, "data": [[2, 8], ["L", [18, 8]]] }"#);
+        raster.resize(20, 20);
+        render_to(&mut raster, &moved, 72.0, 1.0).unwrap();
+        assert_eq!(2, raster.stroke_cache().hits());
+        assert_close(first, raster.pixel(10, 8));
+        assert_close([0.0; 4], raster.pixel(10, 5));
+    }
+
+    #[test]
+    fn test_raster_gradient() {
+        let gradient = r#"{ "pattern": { "type": "linear-gradient", "point-1": [0, 0], "color-1": [0, 0, 0], "point-2": [20, 0], "color-2": [1, 1, 1] } }"#;
+        let image = parse(gradient, r#"
+    { "type": "region", "brush": 0, "data": [[[0, 0], ["L", [20, 0]], ["L", [20, 20]], ["L", [0, 20]]]] }"#);
+
+        let mut raster = Raster::new(20, 20);
+        render_to(&mut raster, &image, 72.0, 1.0).unwrap();
+
+        assert_close([0.525, 0.525, 0.525, 1.0], raster.pixel(10, 3));
+
+        let radial = r#"{ "pattern": { "type": "radial-gradient", "center-1": [10, 10], "radius-1": 0, "color-1": [1, 1, 1], "center-2": [10, 10], "radius-2": 10, "color-2": [0, 0, 0] } }"#;
+        let image = parse(radial, r#"
+    { "type": "region", "brush": 0, "data": [[[0, 0], ["L", [20, 0]], ["L", [20, 20]], ["L", [0, 20]]]] }"#);
+
+        let mut raster = Raster::new(20, 20);
+        render_to(&mut raster, &image, 72.0, 1.0).unwrap();
+
+        assert_close([0.92929, 0.92929, 0.92929, 1.0], raster.pixel(10, 10));
+        assert_close([0.0, 0.0, 0.0, 1.0], raster.pixel(0, 0));
+    }
+
+    #[test]
+    fn test_raster_matches_cairo() {
+        for name in ["curve", "region", "pattern"] {
+            let path = format!("{}/samples/{}.lison", env!("CARGO_MANIFEST_DIR"), name);
+            let image = crate::load::load_image(path).unwrap();
+            let (width, height) = ((image.width * 2.0).ceil() as usize, (image.height * 2.0).ceil() as usize);
+
+            let mut surface = cairo::ImageSurface::create(cairo::Format::ARgb32, width as i32, height as i32).unwrap();
+            crate::render::render(&cairo::Context::new(&surface).unwrap(), &image, 144.0, 1.0).unwrap();
+            surface.flush();
+            let stride = surface.stride() as usize;
+            let expected = surface.data().unwrap().to_vec();
+
+            let mut raster = Raster::new(width, height);
+            render_to(&mut raster, &image, 144.0, 1.0).unwrap();
+            let mut actual = vec![0; expected.len()];
+            raster.write_argb32(&mut actual, stride);
+
+            // Cairo samples coverage where Raster computes it exactly, and
+            // both flatten curves to within a tenth of a pixel, so edge
+            // pixels may differ by a few tens of steps.
+            let difference = expected.iter().zip(actual.iter()).map(|(&a, &b)| a.abs_diff(b)).max().unwrap();
+            assert!(difference <= 48, "{} differs by {}", name, difference);
+        }
+    }
+
+    #[test]
+    fn test_flatten_tolerance() {
+        let image = parse(RED, r#"{ "type": "curve", "pen": 0, "data": [[0, 0], ["Q", [10, 20], [20, 0]]] }"#);
+        let Shape::Curve(curve) = &image.shapes[0] else { unreachable!() };
+
+        for tolerance in [1.0, 0.1, 0.01] {
+            let mut points = Vec::new();
+            flatten(&mut points, &curve.data, 1.0, tolerance);
+
+            // The curve is y = 40t(1 - t) with x = 20t.
+            for pair in points.windows(2) {
+                let (p, q) = (pair[0], pair[1]);
+                let t = (p.0 + q.0) / 40.0;
+                let middle = (p.1 + q.1) / 2.0;
+                assert!((40.0 * t * (1.0 - t) - middle).abs() <= tolerance);
+            }
+        }
+
+        let mut coarse = Vec::new();
+        let mut fine = Vec::new();
+        flatten(&mut coarse, &curve.data, 1.0, 1.0);
+        flatten(&mut fine, &curve.data, 1.0, 0.01);
+        assert!(coarse.len() < fine.len());
+    }
+}
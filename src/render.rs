@@ -1,65 +1,466 @@
 
+use crate::bounds::{Rect, opaque_rectangle, shape_bounds};
+use crate::document::*;
 use crate::image::*;
+use crate::index::SpatialIndex;
+use crate::plan::ReplayStats;
+use crate::validate::ValidImage;
 
 use cairo::{Context, Result};
 
-struct Scaler {
+pub(crate) struct Scaler {
     factor: f64
 }
 
 impl Scaler {
-    fn new(image: &Image, ppi: f64, scale: f64) -> Scaler {
+    pub(crate) fn new(unit_per_inch: f64, ppi: f64, scale: f64) -> Scaler {
         Scaler {
-            factor: ppi / image.unit_per_inch * scale
+            factor: ppi / unit_per_inch * scale
         }
     }
 
-    fn scale(&self, value: f64) -> f64 {
-        value * self.factor
+    pub(crate) fn from_factor(factor: f64) -> Scaler {
+        Scaler { factor }
+    }
+
+    pub(crate) fn factor(&self) -> f64 {
+        self.factor
+    }
+
+    pub(crate) fn begin(&self, context: &Context) -> Result<()> {
+        context.save()?;
+        context.scale(self.factor, self.factor);
+        context.set_operator(cairo::Operator::Over);
+        context.set_fill_rule(cairo::FillRule::EvenOdd);
+        context.new_path();
+
+        Ok(())
+    }
+
+    pub(crate) fn draw<F>(&self, context: &Context, draw: F) -> Result<()>
+    where
+        F: FnOnce() -> Result<()>
+    {
+        self.begin(context)?;
+
+        let result = draw();
+
+        context.restore()?;
+        result
+    }
+}
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Phase {
+    Parse,
+    Resources,
+    Path,
+    Pattern,
+    Fill,
+    Stroke,
+    Encode
+}
+
+// Observes a render as it happens. Every method defaults to doing nothing
+// and the renderer is generic over the hook, so rendering with () compiles
+// to the same code as having no hook at all.
+pub trait RenderHook {
+    fn begin_shape(&mut self, _index: usize, _shape: &Shape) {}
+    fn end_shape(&mut self) {}
+    fn begin_phase(&mut self, _phase: Phase) {}
+    fn end_phase(&mut self, _phase: Phase) {}
+}
+
+impl RenderHook for () {}
+
+fn phase<H: RenderHook, T>(hook: &mut H, phase: Phase, run: impl FnOnce() -> T) -> T {
+    hook.begin_phase(phase);
+    let result = run();
+    hook.end_phase(phase);
+    result
+}
+
+pub struct Resources {
+    pens: Vec<PreparedPen>,
+    brushes: Vec<cairo::Pattern>
+}
+
+struct PreparedPen {
+    pattern: cairo::Pattern,
+    width: f64,
+    cap: cairo::LineCap,
+    join: cairo::LineJoin
+}
+
+impl Resources {
+    pub fn new(image: &Image) -> Resources {
+        Resources::prepare(&image.pens, &image.brushes)
+    }
+
+    pub(crate) fn prepare(pens: &[Pen], brushes: &[Brush]) -> Resources {
+        let pens = pens.iter()
+            .map(|pen| PreparedPen {
+                pattern: create_pattern(&pen.pattern),
+                width: pen.width,
+                cap: translate_line_cap(pen.cap),
+                join: translate_line_join(pen.join)
+            })
+            .collect();
+
+        let brushes = brushes.iter()
+            .map(|brush| create_pattern(&brush.pattern))
+            .collect();
+
+        Resources { pens, brushes }
+    }
+
+    // An index out of range fails the draw instead of the process; see
+    // Image::validate for finding one before drawing anything.
+    pub(crate) fn set_pen(&self, context: &Context, pen: usize) -> Result<()> {
+        set_pen(context, self.pens.get(pen).ok_or(cairo::Error::InvalidIndex)?)
+    }
+
+    pub(crate) fn set_brush(&self, context: &Context, brush: usize) -> Result<()> {
+        set_brush(context, self.brushes.get(brush).ok_or(cairo::Error::InvalidIndex)?)
+    }
+
+    // Safety: pen must be less than the number of pens.
+    pub(crate) unsafe fn set_pen_unchecked(&self, context: &Context, pen: usize) -> Result<()> {
+        set_pen(context, unsafe { self.pens.get_unchecked(pen) })
+    }
+
+    // Safety: brush must be less than the number of brushes.
+    pub(crate) unsafe fn set_brush_unchecked(&self, context: &Context, brush: usize) -> Result<()> {
+        set_brush(context, unsafe { self.brushes.get_unchecked(brush) })
     }
 }
 
 pub fn render(context: &Context, image: &Image, ppi: f64, scale: f64) -> Result<()> {
-    let scaler = Scaler::new(image, ppi, scale);
+    let resources = Resources::new(image);
+    render_with_resources(context, image, &resources, ppi, scale)
+}
+
+pub fn render_with_resources(context: &Context, image: &Image, resources: &Resources, ppi: f64, scale: f64) -> Result<()> {
+    render_with_stats(context, image, resources, ppi, scale).map(|_| ())
+}
+
+pub fn render_with_stats(context: &Context, image: &Image, resources: &Resources, ppi: f64, scale: f64) -> Result<ReplayStats> {
+    let scaler = Scaler::new(image.unit_per_inch, ppi, scale);
+    let mut stats = ReplayStats::default();
 
-    context.set_operator(cairo::Operator::Over);
-    context.set_fill_rule(cairo::FillRule::EvenOdd);
-    context.new_path();
+    scaler.draw(context, || {
+        let leaves = image.leaves().map(|shape| (shape, shape_bounds(shape, image)));
+        stats = draw_leaves(Batcher::new(context, resources, scaler.factor), leaves, &image.brushes)?;
+        Ok(())
+    })?;
 
-    for shape in image.shapes.iter() {
-        render_shape(context, shape, image, &scaler)?;
+    Ok(stats)
+}
+
+pub fn render_valid(context: &Context, image: &ValidImage, ppi: f64, scale: f64) -> Result<()> {
+    let scaler = Scaler::new(image.unit_per_inch, ppi, scale);
+    let resources = Resources::new(image);
+
+    scaler.draw(context, || {
+        let leaves = image.leaves().map(|shape| (shape, shape_bounds(shape, image)));
+        // Safety: the resources come from the image, and a valid image only
+        // uses pens and brushes it has.
+        let batcher = unsafe { Batcher::new_unchecked(context, &resources, scaler.factor) };
+        draw_leaves(batcher, leaves, &image.brushes).map(|_| ())
+    })
+}
+
+// Hooks see every shape on its own, so this path never batches.
+
+pub fn render_with_hook<H: RenderHook>(context: &Context, image: &Image, ppi: f64, scale: f64, hook: &mut H) -> Result<()> {
+    let resources = phase(hook, Phase::Resources, || Resources::new(image));
+    draw_shapes(context, image, &resources, ppi, scale, hook)
+}
+
+fn draw_shapes<H: RenderHook>(context: &Context, image: &Image, resources: &Resources, ppi: f64, scale: f64, hook: &mut H) -> Result<()> {
+    let scaler = Scaler::new(image.unit_per_inch, ppi, scale);
+
+    scaler.draw(context, || {
+        for (index, shape) in image.shapes.iter().enumerate() {
+            render_shape_with_hook(context, index, shape, resources, hook)?;
+        }
+
+        Ok(())
+    })
+}
+
+pub fn render_document(context: &Context, document: &Document, ppi: f64, scale: f64) -> Result<()> {
+    let scaler = Scaler::new(document.unit_per_inch, ppi, scale);
+    let resources = Resources::prepare(&document.pens, &document.brushes);
+
+    scaler.draw(context, || {
+        for shape in document.leaves() {
+            render_shape_ref(context, shape, &resources)?;
+        }
+
+        Ok(())
+    })
+}
+
+fn render_shape_ref(context: &Context, shape: ShapeRef<'_>, resources: &Resources) -> Result<()> {
+    match shape.kind() {
+        ShapeKind::Group => Ok(()),
+        ShapeKind::Curve { pen } => render_leaf(context, shape.subpaths(), false, Some(pen), None, resources, &mut ()),
+        ShapeKind::Region { pen, brush } => render_leaf(context, shape.subpaths(), true, pen, brush, resources, &mut ())
     }
+}
 
-    Ok(())
+// rect is in output pixels, before any transformation the caller has
+// applied to the context.
+pub fn render_region_of_interest(context: &Context, image: &Image, rect: &Rect, ppi: f64, scale: f64) -> Result<()> {
+    let index = SpatialIndex::new(image);
+    let resources = Resources::new(image);
+    render_region_of_interest_with_index(context, image, &index, &resources, rect, ppi, scale)
+}
+
+pub fn render_region_of_interest_with_index(context: &Context, image: &Image, index: &SpatialIndex, resources: &Resources, rect: &Rect, ppi: f64, scale: f64) -> Result<()> {
+    let scaler = Scaler::new(image.unit_per_inch, ppi, scale);
+
+    // One extra pixel covers antialiasing.
+    let rect = rect.inflate(1.0).scale(1.0 / scaler.factor);
+
+    let mut found = Vec::new();
+    index.query(&rect, &mut found);
+
+    scaler.draw(context, || {
+        let leaves = found.iter().map(|&id| (index.shape(id), index.shape_bounds(id)));
+        draw_leaves(Batcher::new(context, resources, scaler.factor), leaves, &image.brushes).map(|_| ())
+    })
+}
+
+fn draw_leaves<'a>(mut batcher: Batcher<'_>, leaves: impl Iterator<Item = (&'a Shape, Rect)>, brushes: &[Brush]) -> Result<ReplayStats> {
+    let context = batcher.context;
+
+    for (shape, bounds) in leaves {
+        match shape {
+            Shape::Group(_) => {},
+            Shape::Curve(curve) => batcher.add(Style::Stroke(curve.pen), &bounds, || {
+                plot_curve_data(context, &curve.data, false);
+            })?,
+            Shape::Region(region) => {
+                let rect = opaque_rectangle(brushes, region.pen, region.brush, &region.data);
+
+                match (region.brush, rect) {
+                    (Some(brush), Some(rect)) if batcher.aligned(&rect) => batcher.add_rect(brush, &rect)?,
+                    _ => batcher.add(Style::Region(region.pen, region.brush), &bounds, || {
+                        for (i, data) in region.data.iter().enumerate() {
+                            if i > 0 {
+                                context.new_sub_path();
+                            }
+
+                            plot_curve_data(context, data, true);
+                        }
+                    })?
+                }
+            }
+        }
+    }
+
+    batcher.finish()
+}
+
+#[derive(Clone, Copy, PartialEq)]
+pub(crate) enum Style {
+    Stroke(usize),
+    Region(Option<usize>, Option<usize>),
+    Rect(usize)
+}
+
+impl Style {
+    fn draw_calls(&self) -> usize {
+        match self {
+            Style::Stroke(_) | Style::Rect(_) => 1,
+            Style::Region(pen, brush) => pen.is_some() as usize + brush.is_some() as usize
+        }
+    }
+}
+
+// Consecutive leaves drawn with the same pen and brush are emitted as one
+// path when none of them come within a pixel of each other, since no pixel
+// can then tell the difference. Checking each new leaf against the whole
+// batch is quadratic, so batches are capped.
+const MAX_BATCH: usize = 64;
+
+// Collects leaves into batches and draws each batch with one fill or
+// stroke. The context must already be scaled to image units.
+pub(crate) struct Batcher<'a> {
+    context: &'a Context,
+    resources: &'a Resources,
+    matrix: cairo::Matrix,
+    // Half a pixel on each side keeps batched shapes a pixel apart.
+    margin: f64,
+    style: Option<Style>,
+    batch: Vec<Rect>,
+    stats: ReplayStats,
+    checked: bool
 }
 
-fn render_shape(context: &Context, shape: &Shape, image: &Image, scaler: &Scaler) -> Result<()> {
-    match shape {
-        Shape::Group(group) => render_group(context, group, image, scaler),
-        Shape::Curve(curve) => render_curve(context, curve, image, scaler),
-        Shape::Region(region) => render_region(context, region, image, scaler)
+impl<'a> Batcher<'a> {
+    pub(crate) fn new(context: &'a Context, resources: &'a Resources, factor: f64) -> Batcher<'a> {
+        Batcher {
+            context,
+            resources,
+            matrix: context.matrix(),
+            margin: 0.5 / factor,
+            style: None,
+            batch: Vec::with_capacity(MAX_BATCH),
+            stats: ReplayStats::default(),
+            checked: true
+        }
+    }
+
+    // Safety: every pen and brush index added must be in range for
+    // resources.
+    pub(crate) unsafe fn new_unchecked(context: &'a Context, resources: &'a Resources, factor: f64) -> Batcher<'a> {
+        Batcher { checked: false, ..Batcher::new(context, resources, factor) }
+    }
+
+    // Whether rect, in image units, has all its edges on whole pixels.
+    pub(crate) fn aligned(&self, rect: &Rect) -> bool {
+        let matrix = &self.matrix;
+        let (x1, y1) = (rect.min_x * matrix.xx() + matrix.x0(), rect.min_y * matrix.yy() + matrix.y0());
+        let (x2, y2) = (rect.max_x * matrix.xx() + matrix.x0(), rect.max_y * matrix.yy() + matrix.y0());
+
+        matrix.xy() == 0.0 && matrix.yx() == 0.0 && Rect { min_x: x1, min_y: y1, max_x: x2, max_y: y2 }.is_aligned()
+    }
+
+    // plot adds the leaf's subpaths to the context's current path.
+    pub(crate) fn add(&mut self, style: Style, bounds: &Rect, plot: impl FnOnce()) -> Result<()> {
+        if style == Style::Region(None, None) {
+            return Ok(());
+        }
+
+        let bounds = bounds.inflate(self.margin);
+
+        if self.style == Some(style) && self.batch.len() < MAX_BATCH && !self.batch.iter().any(|rect| rect.intersects(&bounds)) {
+            self.stats.saved_draw_calls += style.draw_calls();
+        } else {
+            self.begin(style)?;
+        }
+
+        self.batch.push(bounds);
+
+        if self.batch.len() > 1 {
+            self.context.new_sub_path();
+        }
+
+        plot();
+        Ok(())
+    }
+
+    // Adds an opaque solid rectangle that is aligned. Overlapping
+    // rectangles need no check as their union is filled.
+    pub(crate) fn add_rect(&mut self, brush: usize, rect: &Rect) -> Result<()> {
+        let style = Style::Rect(brush);
+        self.stats.fast_rects += 1;
+
+        if self.style == Some(style) {
+            self.stats.saved_draw_calls += 1;
+        } else {
+            self.begin(style)?;
+        }
+
+        self.context.rectangle(rect.min_x, rect.min_y, rect.max_x - rect.min_x, rect.max_y - rect.min_y);
+        Ok(())
+    }
+
+    pub(crate) fn finish(mut self) -> Result<ReplayStats> {
+        if let Some(style) = self.style.take() {
+            self.draw(style)?;
+        }
+
+        Ok(self.stats)
+    }
+
+    fn begin(&mut self, style: Style) -> Result<()> {
+        if let Some(style) = self.style.replace(style) {
+            self.draw(style)?;
+        }
+
+        self.batch.clear();
+        Ok(())
+    }
+
+    fn draw(&mut self, style: Style) -> Result<()> {
+        let (context, resources, checked) = (self.context, self.resources, self.checked);
+        self.stats.draw_calls += style.draw_calls();
+
+        // Safety: new_unchecked's caller vouches for the indices.
+        let set_pen = |pen| if checked { resources.set_pen(context, pen) } else { unsafe { resources.set_pen_unchecked(context, pen) } };
+        let set_brush = |brush| if checked { resources.set_brush(context, brush) } else { unsafe { resources.set_brush_unchecked(context, brush) } };
+
+        match style {
+            Style::Stroke(pen) => {
+                set_pen(pen)?;
+                context.stroke()
+            },
+            Style::Rect(brush) => {
+                set_brush(brush)?;
+                context.set_fill_rule(cairo::FillRule::Winding);
+                let result = context.fill();
+                context.set_fill_rule(cairo::FillRule::EvenOdd);
+                result
+            },
+            Style::Region(pen, brush) => {
+                if let Some(brush) = brush {
+                    set_brush(brush)?;
+                    context.fill_preserve()?;
+                }
+
+                if let Some(pen) = pen {
+                    set_pen(pen)?;
+                    context.stroke()
+                } else {
+                    context.new_path();
+                    Ok(())
+                }
+            }
+        }
     }
 }
 
-fn render_group(context: &Context, group: &GroupShape, image: &Image, scaler: &Scaler) -> Result<()> {
-    for child in group.content.iter() {
-        render_shape(context, child, image, scaler)?;
+pub(crate) fn render_shape(context: &Context, shape: &Shape, resources: &Resources) -> Result<()> {
+    render_shape_with_hook(context, 0, shape, resources, &mut ())
+}
+
+fn render_shape_with_hook<H: RenderHook>(context: &Context, index: usize, shape: &Shape, resources: &Resources, hook: &mut H) -> Result<()> {
+    hook.begin_shape(index, shape);
+
+    let result = match shape {
+        Shape::Group(group) => render_group(context, group, resources, hook),
+        Shape::Curve(curve) => render_curve(context, curve, resources, hook),
+        Shape::Region(region) => render_region(context, region, resources, hook)
+    };
+
+    hook.end_shape();
+    result
+}
+
+fn render_group<H: RenderHook>(context: &Context, group: &GroupShape, resources: &Resources, hook: &mut H) -> Result<()> {
+    for (index, child) in group.content.iter().enumerate() {
+        render_shape_with_hook(context, index, child, resources, hook)?;
     }
 
     Ok(())
 }
 
-fn set_pattern(context: &Context, pattern: &Pattern, scaler: &Scaler) -> Result<()> {
+fn create_pattern(pattern: &Pattern) -> cairo::Pattern {
     match pattern {
         Pattern::Monochrome(pat) => {
-            context.set_source_rgba(pat.color.red, pat.color.green, pat.color.blue, pat.color.alpha);
+            let solid = cairo::SolidPattern::from_rgba(pat.color.red, pat.color.green, pat.color.blue, pat.color.alpha);
+            cairo::Pattern::clone(&solid)
         },
         Pattern::LinearGradient(pat) => {
             let grad = cairo::LinearGradient::new(
-                scaler.scale(pat.point_1.x),
-                scaler.scale(pat.point_1.y),
-                scaler.scale(pat.point_2.x),
-                scaler.scale(pat.point_2.y)
+                pat.point_1.x,
+                pat.point_1.y,
+                pat.point_2.x,
+                pat.point_2.y
             );
             grad.add_color_stop_rgba(
                 0.0,
@@ -75,16 +476,16 @@ fn set_pattern(context: &Context, pattern: &Pattern, scaler: &Scaler) -> Result<
                 pat.color_2.blue,
                 pat.color_2.alpha
             );
-            context.set_source(grad)?;
+            cairo::Pattern::clone(&grad)
         },
         Pattern::RadialGradient(pat) => {
             let grad = cairo::RadialGradient::new(
-                scaler.scale(pat.center_1.x),
-                scaler.scale(pat.center_1.y),
-                scaler.scale(pat.radius_1),
-                scaler.scale(pat.center_2.x),
-                scaler.scale(pat.center_2.y),
-                scaler.scale(pat.radius_2),
+                pat.center_1.x,
+                pat.center_1.y,
+                pat.radius_1,
+                pat.center_2.x,
+                pat.center_2.y,
+                pat.radius_2,
             );
             grad.add_color_stop_rgba(
                 0.0,
@@ -100,11 +501,9 @@ fn set_pattern(context: &Context, pattern: &Pattern, scaler: &Scaler) -> Result<
                 pat.color_2.blue,
                 pat.color_2.alpha
             );
-            context.set_source(grad)?;
+            cairo::Pattern::clone(&grad)
         }
     }
-
-    Ok(())
 }
 
 fn translate_line_cap(cap: LineCap) -> cairo::LineCap {
@@ -123,51 +522,57 @@ fn translate_line_join(join: LineJoin) -> cairo::LineJoin {
     }
 }
 
-fn set_pen(context: &Context, pen: &Pen, scaler: &Scaler) -> Result<()> {
-    set_pattern(context, &pen.pattern, scaler)?;
-    context.set_line_width(scaler.scale(pen.width));
-    context.set_line_cap(translate_line_cap(pen.cap));
-    context.set_line_join(translate_line_join(pen.join));
+fn set_pen(context: &Context, pen: &PreparedPen) -> Result<()> {
+    context.set_source(&pen.pattern)?;
+    context.set_line_width(pen.width);
+    context.set_line_cap(pen.cap);
+    context.set_line_join(pen.join);
 
     Ok(())
 }
 
-fn set_brush(context: &Context, brush: &Brush, scaler: &Scaler) -> Result<()> {
-    set_pattern(context, &brush.pattern, scaler)
+fn set_brush(context: &Context, brush: &cairo::Pattern) -> Result<()> {
+    context.set_source(brush)
+}
+
+pub(crate) fn plot_curve_data(context: &Context, data: &CurveData, closed: bool) {
+    plot_curve(context, data.view(), closed);
 }
 
-fn plot_curve_data(context: &Context, data: &CurveData, scaler: &Scaler, closed: bool) -> Result<()> {
-    context.move_to(scaler.scale(data.start.x), scaler.scale(data.start.y));
+pub(crate) fn plot_curve(context: &Context, data: CurveRef<'_>, closed: bool) {
+    let mut current = data.start();
+    context.move_to(current.x, current.y);
 
-    for seg in data.segments.iter() {
+    for seg in data.segments() {
         match seg {
             Segment::Line(line) => {
-                context.line_to(scaler.scale(line.point_2.x), scaler.scale(line.point_2.y));
+                context.line_to(line.point_2.x, line.point_2.y);
+                current = line.point_2;
             },
             Segment::QuadraticBezier(bezier) => {
-                let (x1, y1) = context.current_point()?;
-                let x2 = scaler.scale(bezier.point_2.x);
-                let y2 = scaler.scale(bezier.point_2.y);
-                let x3 = scaler.scale(bezier.point_3.x);
-                let y3 = scaler.scale(bezier.point_3.y);
+                let p1 = current;
+                let p2 = bezier.point_2;
+                let p3 = bezier.point_3;
                 context.curve_to(
-                    1.0 / 3.0 * x1 + 2.0 / 3.0 * x2,
-                    1.0 / 3.0 * y1 + 2.0 / 3.0 * y2,
-                    1.0 / 3.0 * x3 + 2.0 / 3.0 * x2,
-                    1.0 / 3.0 * y3 + 2.0 / 3.0 * y2,
-                    x3,
-                    y3
+                    1.0 / 3.0 * p1.x + 2.0 / 3.0 * p2.x,
+                    1.0 / 3.0 * p1.y + 2.0 / 3.0 * p2.y,
+                    1.0 / 3.0 * p3.x + 2.0 / 3.0 * p2.x,
+                    1.0 / 3.0 * p3.y + 2.0 / 3.0 * p2.y,
+                    p3.x,
+                    p3.y
                 );
+                current = p3;
             },
             Segment::CubicBezier(bezier) => {
                 context.curve_to(
-                    scaler.scale(bezier.point_2.x),
-                    scaler.scale(bezier.point_2.y),
-                    scaler.scale(bezier.point_3.x),
-                    scaler.scale(bezier.point_3.y),
-                    scaler.scale(bezier.point_4.x),
-                    scaler.scale(bezier.point_4.y)
+                    bezier.point_2.x,
+                    bezier.point_2.y,
+                    bezier.point_3.x,
+                    bezier.point_3.y,
+                    bezier.point_4.x,
+                    bezier.point_4.y
                 );
+                current = bezier.point_4;
             }
         }
     }
@@ -175,50 +580,184 @@ fn plot_curve_data(context: &Context, data: &CurveData, scaler: &Scaler, closed:
     if closed {
         context.close_path();
     }
+}
 
-    Ok(())
+fn render_curve<H: RenderHook>(context: &Context, curve: &CurveShape, resources: &Resources, hook: &mut H) -> Result<()> {
+    render_leaf(context, [curve.data.view()].into_iter(), false, Some(curve.pen), None, resources, hook)
 }
 
-fn render_curve(context: &Context, curve: &CurveShape, image: &Image, scaler: &Scaler) -> Result<()> {
-    plot_curve_data(context, &curve.data, scaler, false)?;
+fn render_region<H: RenderHook>(context: &Context, region: &RegionShape, resources: &Resources, hook: &mut H) -> Result<()> {
+    render_leaf(context, region.data.iter().map(|data| data.view()), true, region.pen, region.brush, resources, hook)
+}
+
+// Curves and regions of an Image or a Document are all drawn here.
+fn render_leaf<'a, H: RenderHook>(context: &Context, subpaths: impl Iterator<Item = CurveRef<'a>>, closed: bool, pen: Option<usize>, brush: Option<usize>, resources: &Resources, hook: &mut H) -> Result<()> {
+    phase(hook, Phase::Path, || {
+        for (i, data) in subpaths.enumerate() {
+            if i > 0 {
+                context.new_sub_path();
+            }
 
-    if curve.pen >= image.pens.len() {
-        panic!("invalid pen index {}, must be less than {}.", curve.pen, image.pens.len());
+            plot_curve(context, data, closed);
+        }
+    });
+
+    if let Some(brush) = brush {
+        phase(hook, Phase::Pattern, || resources.set_brush(context, brush))?;
+        phase(hook, Phase::Fill, || context.fill_preserve())?;
     }
 
-    set_pen(context, &image.pens[curve.pen], scaler)?;
-    context.stroke()
+    if let Some(pen) = pen {
+        phase(hook, Phase::Pattern, || resources.set_pen(context, pen))?;
+        phase(hook, Phase::Stroke, || context.stroke())
+    } else {
+        context.new_path();
+        Ok(())
+    }
 }
 
-fn render_region(context: &Context, region: &RegionShape, image: &Image, scaler: &Scaler) -> Result<()> {
-    if region.data.len() != 0 {
-        plot_curve_data(context, &region.data[0], scaler, true)?;
-    }
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn render_sample(name: &str, draw: impl FnOnce(&Context, &Image) -> Result<()>) -> Vec<u8> {
+        let path = format!("{}/samples/{}.lison", env!("CARGO_MANIFEST_DIR"), name);
+        let image = crate::load::load_image(path).unwrap();
+
+        let mut surface = cairo::ImageSurface::create(cairo::Format::ARgb32, 200, 200).unwrap();
+        {
+            let context = Context::new(&surface).unwrap();
+            draw(&context, &image).unwrap();
+        }
+        surface.flush();
 
-    for i in 1..region.data.len() {
-        context.new_sub_path();
-        plot_curve_data(context, &region.data[i], scaler, true)?;
+        let data = surface.data().unwrap();
+        data.to_vec()
     }
 
-    if let Some(brush) = region.brush {
-        if brush >= image.brushes.len() {
-            panic!("invalid brush index {}, must be less than {}.", brush, image.brushes.len());
+    #[test]
+    fn test_render_samples() {
+        for name in ["curve", "pattern", "region"] {
+            let expected = render_sample(name, |context, image| render(context, image, 144.0, 1.0));
+
+            let resources = render_sample(name, |context, image| {
+                render_with_resources(context, image, &Resources::new(image), 72.0, 2.0)
+            });
+            assert_eq!(expected, resources);
+
+            let whole = render_sample(name, |context, image| {
+                render_region_of_interest(context, image, &Rect::new(0.0, 0.0, 200.0, 200.0), 144.0, 1.0)
+            });
+            assert_eq!(expected, whole);
         }
+    }
 
-        set_brush(context, &image.brushes[brush], scaler)?;
-        context.fill_preserve()?;
+    #[test]
+    fn test_render_valid() {
+        for name in ["curve", "pattern", "region"] {
+            let expected = render_sample(name, |context, image| render(context, image, 144.0, 1.0));
+            let valid = render_sample(name, |context, image| {
+                render_valid(context, &ValidImage::new(image.clone()).unwrap(), 144.0, 1.0)
+            });
+            assert_eq!(expected, valid);
+        }
     }
 
-    if let Some(pen) = region.pen {
-        if pen >= image.pens.len() {
-            panic!("invalid pen index {}, must be less than {}.", pen, image.pens.len());
+    #[test]
+    fn test_render_document() {
+        for name in ["curve", "pattern", "region"] {
+            let expected = render_sample(name, |context, image| render(context, image, 144.0, 1.0));
+            let document = render_sample(name, |context, image| {
+                render_document(context, &Document::from_image(image), 144.0, 1.0)
+            });
+            assert_eq!(expected, document);
         }
+    }
 
-        set_pen(context, &image.pens[pen], scaler)?;
-        context.stroke()?;
-    } else {
-        context.new_path();
+    #[test]
+    fn test_render_merges_draw_calls() {
+        let image: Image = serde_json::from_str(r#"{
+  "width": 100,
+  "height": 100,
+  "unit-per-inch": 72,
+  "pens": [{
+    "pattern": { "type": "monochrome", "color": [0, 0, 0] },
+    "width": 1,
+    "cap": "butt",
+    "join": "round"
+  }],
+  "brushes": [{ "pattern": { "type": "monochrome", "color": [1, 0, 0] } }],
+  "shapes": [
+    { "type": "curve", "pen": 0, "data": [[0, 0], ["L", [10, 0]]] },
+    { "type": "group", "content": [
+      { "type": "curve", "pen": 0, "data": [[0, 10], ["L", [10, 10]]] },
+      { "type": "curve", "pen": 0, "data": [[0, 20], ["L", [10, 20]]] }
+    ] },
+    { "type": "curve", "pen": 0, "data": [[5, 20], ["L", [5, 30]]] },
+    { "type": "region", "brush": 0, "data": [[[50, 50], ["L", [60, 50]], ["L", [60, 60]]]] },
+    { "type": "region", "data": [[[0, 0], ["L", [100, 100]]]] },
+    { "type": "region", "brush": 0, "data": [[[70, 50], ["L", [80, 50]], ["L", [80, 60]]]] },
+    { "type": "region", "pen": 0, "brush": 0, "data": [[[70, 50], ["L", [80, 50]], ["L", [80, 60]]]] }
+  ]
+}"#).unwrap();
+
+        let surface = cairo::ImageSurface::create(cairo::Format::ARgb32, 100, 100).unwrap();
+        let context = Context::new(&surface).unwrap();
+        let stats = render_with_stats(&context, &image, &Resources::new(&image), 72.0, 1.0).unwrap();
+
+        assert_eq!(ReplayStats { draw_calls: 5, saved_draw_calls: 3, fast_rects: 0 }, stats);
     }
 
-    Ok(())
+    #[test]
+    fn test_render_fills_aligned_rectangles() {
+        let image: Image = serde_json::from_str(r#"{
+  "width": 100,
+  "height": 100,
+  "unit-per-inch": 72,
+  "pens": [],
+  "brushes": [
+    { "pattern": { "type": "monochrome", "color": [1, 0, 0] } },
+    { "pattern": { "type": "monochrome", "color": [0, 0, 1, 0.5] } }
+  ],
+  "shapes": [
+    { "type": "region", "brush": 0, "data": [[[0, 0], ["L", [10, 0]], ["L", [10, 10]], ["L", [0, 10]]]] },
+    { "type": "region", "brush": 0, "data": [[[5, 5], ["L", [5, 20]], ["L", [20, 20]], ["L", [20, 5]], ["L", [5, 5]]]] },
+    { "type": "region", "brush": 0, "data": [[[30, 0], ["L", [40, 0]], ["L", [40, 10]], ["L", [30, 10]]]] },
+    { "type": "region", "brush": 0, "data": [[[50, 0.5], ["L", [60, 0.5]], ["L", [60, 10]], ["L", [50, 10]]]] },
+    { "type": "region", "brush": 1, "data": [[[70, 0], ["L", [80, 0]], ["L", [80, 10]], ["L", [70, 10]]]] }
+  ]
+}"#).unwrap();
+
+        let surface = cairo::ImageSurface::create(cairo::Format::ARgb32, 100, 100).unwrap();
+        let context = Context::new(&surface).unwrap();
+        let stats = render_with_stats(&context, &image, &Resources::new(&image), 72.0, 1.0).unwrap();
+
+        assert_eq!(ReplayStats { draw_calls: 3, saved_draw_calls: 2, fast_rects: 3 }, stats);
+    }
+
+    #[test]
+    fn test_render_bad_index() {
+        let image: Image = serde_json::from_str(r#"{
+  "width": 100,
+  "height": 100,
+  "unit-per-inch": 72,
+  "pens": [],
+  "brushes": [],
+  "shapes": [{ "type": "region", "brush": 1, "data": [[[0, 0], ["L", [10, 0]], ["L", [0, 10]]]] }]
+}"#).unwrap();
+
+        let surface = cairo::ImageSurface::create(cairo::Format::ARgb32, 100, 100).unwrap();
+        let context = Context::new(&surface).unwrap();
+        assert_eq!(Err(cairo::Error::InvalidIndex), render(&context, &image, 72.0, 1.0));
+        assert_eq!(Err(cairo::Error::InvalidIndex), render_document(&context, &Document::from_image(&image), 72.0, 1.0));
+    }
+
+    #[test]
+    fn test_render_region_of_interest() {
+        let empty = render_sample("region", |_, _| Ok(()));
+        let outside = render_sample("region", |context, image| {
+            render_region_of_interest(context, image, &Rect::new(1000.0, 1000.0, 10.0, 10.0), 72.0, 1.0)
+        });
+        assert_eq!(empty, outside);
+    }
 }
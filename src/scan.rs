@@ -0,0 +1,349 @@
+use std::ops::Range;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::thread;
+
+use crate::image::{Image, Shape};
+
+const ONES: u64 = 0x0101_0101_0101_0101;
+const HIGHS: u64 = 0x8080_8080_8080_8080;
+
+// serde_json gives up at 128 nested arrays and objects. An element parsed
+// on its own is two levels shallower than in its document, so deeper
+// documents are left to the sequential parser to fail as before.
+pub(crate) const RECURSION_LIMIT: usize = 128;
+
+// The elements handed out to a thread at a time.
+const BLOCK: usize = 64;
+
+fn has_zero(word: u64) -> bool {
+    word.wrapping_sub(ONES) & !word & HIGHS != 0
+}
+
+// Whether the eight bytes may hold a quote, a backslash, a bracket or a
+// brace. Masking with 0xd9 folds all four brackets and braces onto 0x59,
+// together with 'Y', '_', 'y' and DEL, which the bytewise pass ignores.
+fn structural(word: u64) -> bool {
+    has_zero(word ^ (ONES * 0x22))
+        || has_zero(word ^ (ONES * 0x5c))
+        || has_zero((word & (ONES * 0xd9)) ^ (ONES * 0x59))
+}
+
+fn skip_whitespace(bytes: &[u8], mut i: usize) -> usize {
+    while i < bytes.len() && matches!(bytes[i], b' ' | b'\t' | b'\n' | b'\r') {
+        i += 1;
+    }
+
+    i
+}
+
+// Where the top level shapes array and each of its elements lie.
+#[derive(Debug, PartialEq)]
+pub struct Layout {
+    pub shapes: Range<usize>,
+    pub elements: Vec<Range<usize>>
+}
+
+#[derive(Default)]
+struct Scanner {
+    depth: usize,
+    in_string: bool,
+    escaped: bool,
+    string_start: usize,
+    // The '[' that opens the shapes array, once its key has been seen.
+    shapes_start: Option<usize>,
+    shapes: Option<Range<usize>>,
+    in_shapes: bool,
+    element_start: usize,
+    elements: Vec<Range<usize>>
+}
+
+impl Scanner {
+    fn step(&mut self, bytes: &[u8], i: usize) -> Option<()> {
+        let byte = bytes[i];
+
+        if self.in_string {
+            if self.escaped {
+                self.escaped = false;
+            } else if byte == b'\\' {
+                self.escaped = true;
+            } else if byte == b'"' {
+                self.in_string = false;
+                self.end_string(bytes, i)?;
+            }
+
+            return Some(());
+        }
+
+        match byte {
+            b'"' => {
+                // Shapes are objects; anything else is left to serde_json.
+                if self.in_shapes && self.depth == 2 {
+                    return None;
+                }
+
+                self.in_string = true;
+                self.string_start = i;
+            },
+            b'{' | b'[' => {
+                self.depth += 1;
+
+                if self.depth >= RECURSION_LIMIT {
+                    return None;
+                }
+
+                if self.depth == 2 && self.shapes_start == Some(i) {
+                    self.in_shapes = true;
+                } else if self.in_shapes && self.depth == 3 {
+                    self.element_start = i;
+                }
+            },
+            b'}' | b']' => {
+                if self.in_shapes && self.depth == 3 {
+                    self.elements.push(self.element_start..i + 1);
+                } else if self.in_shapes && self.depth == 2 {
+                    let start = self.shapes_start?;
+                    self.shapes = Some(start..i + 1);
+                    self.in_shapes = false;
+                }
+
+                self.depth = self.depth.checked_sub(1)?;
+            },
+            _ => {}
+        }
+
+        Some(())
+    }
+
+    // A "shapes" string directly in the root object followed by a colon is
+    // the key; its value has to be an array.
+    fn end_string(&mut self, bytes: &[u8], end: usize) -> Option<()> {
+        if self.depth != 1 || &bytes[self.string_start + 1..end] != b"shapes" {
+            return Some(());
+        }
+
+        let colon = skip_whitespace(bytes, end + 1);
+
+        if bytes.get(colon) != Some(&b':') {
+            return Some(());
+        }
+
+        if self.shapes_start.is_some() {
+            return None;
+        }
+
+        let start = skip_whitespace(bytes, colon + 1);
+
+        if bytes.get(start) != Some(&b'[') {
+            return None;
+        }
+
+        self.shapes_start = Some(start);
+        Some(())
+    }
+}
+
+// Finds the shapes array, skipping eight bytes at a time past words with
+// nothing structural in them. None when the document has no such array
+// or is laid out in a way only the sequential parser should judge.
+pub fn scan(bytes: &[u8]) -> Option<Layout> {
+    let mut scanner = Scanner::default();
+    let mut i = 0;
+
+    while i < bytes.len() {
+        if let Some(word) = bytes.get(i..i + 8) {
+            let word = u64::from_le_bytes(word.try_into().unwrap());
+
+            if !structural(word) {
+                // An escape ends on the first byte skipped.
+                scanner.escaped = false;
+                i += 8;
+                continue;
+            }
+
+            for j in i..i + 8 {
+                scanner.step(bytes, j)?;
+            }
+
+            i += 8;
+        } else {
+            scanner.step(bytes, i)?;
+            i += 1;
+        }
+    }
+
+    if scanner.in_string || scanner.depth != 0 {
+        return None;
+    }
+
+    let shapes = scanner.shapes?;
+    let elements = scanner.elements;
+
+    // Only whitespace and single commas may lie between the elements.
+    let mut position = shapes.start + 1;
+
+    for (n, element) in elements.iter().enumerate() {
+        position = skip_whitespace(bytes, position);
+
+        if n > 0 {
+            if bytes[position] != b',' {
+                return None;
+            }
+
+            position = skip_whitespace(bytes, position + 1);
+        }
+
+        if position != element.start {
+            return None;
+        }
+
+        position = element.end;
+    }
+
+    if skip_whitespace(bytes, position) != shapes.end - 1 {
+        return None;
+    }
+
+    Some(Layout { shapes, elements })
+}
+
+fn parse_layout(bytes: &[u8], layout: &Layout, threads: usize) -> serde_json::Result<Image> {
+    let mut header = Vec::with_capacity(bytes.len() - layout.shapes.len() + 2);
+    header.extend_from_slice(&bytes[..layout.shapes.start]);
+    header.extend_from_slice(b"[]");
+    header.extend_from_slice(&bytes[layout.shapes.end..]);
+
+    let mut image: Image = serde_json::from_slice(&header)?;
+
+    let blocks: Vec<&[Range<usize>]> = layout.elements.chunks(BLOCK).collect();
+    let next = AtomicUsize::new(0);
+
+    let mut parsed = thread::scope(|scope| {
+        let workers: Vec<_> = (0..threads.min(blocks.len()).max(1))
+            .map(|_| scope.spawn(|| {
+                let mut parsed = Vec::new();
+
+                loop {
+                    let number = next.fetch_add(1, Ordering::Relaxed);
+
+                    let Some(block) = blocks.get(number) else {
+                        break;
+                    };
+
+                    let shapes = block.iter()
+                        .map(|element| serde_json::from_slice::<Shape>(&bytes[element.clone()]))
+                        .collect::<serde_json::Result<Vec<Shape>>>()?;
+
+                    parsed.push((number, shapes));
+                }
+
+                Ok(parsed)
+            }))
+            .collect();
+
+        workers.into_iter()
+            .map(|worker| worker.join().unwrap())
+            .collect::<serde_json::Result<Vec<Vec<(usize, Vec<Shape>)>>>>()
+    })?.concat();
+
+    parsed.sort_unstable_by_key(|(number, _)| *number);
+    image.shapes = parsed.into_iter().flat_map(|(_, shapes)| shapes).collect();
+
+    Ok(image)
+}
+
+// Parses the elements of shapes on up to threads threads. The result is
+// the same as serde_json::from_slice's, errors included: any failure is
+// reported by parsing the whole document again sequentially.
+pub fn parse_image_parallel(bytes: &[u8], threads: usize) -> serde_json::Result<Image> {
+    scan(bytes)
+        .and_then(|layout| parse_layout(bytes, &layout, threads).ok())
+        .map_or_else(|| serde_json::from_slice(bytes), Ok)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn sample(name: &str) -> Vec<u8> {
+        std::fs::read(format!("{}/samples/{}.lison", env!("CARGO_MANIFEST_DIR"), name)).unwrap()
+    }
+
+    fn word(bytes: &[u8; 8]) -> u64 {
+        u64::from_le_bytes(*bytes)
+    }
+
+    fn many_shapes(count: usize) -> String {
+        let shapes: Vec<String> = (0..count)
+            .map(|i| format!(r#"{{ "type": "region", "brush": 0, "data": [[[{}, 0], ["L", [1, 1]]]] }}"#, i))
+            .collect();
+
+        format!(r#"{{
+  "width": 100, "height": 100, "unit-per-inch": 72,
+  "pens": [],
+  "brushes": [{{ "pattern": {{ "type": "monochrome", "color": [1, 0, 0] }} }}],
+  "shapes": [{}]
+}}"#, shapes.join(",\n"))
+    }
+
+    #[test]
+    fn test_structural() {
+        assert!(!structural(word(b"12.5, -3")));
+        assert!(!structural(word(b"        ")));
+        for bytes in [b"1, [2, 3", b"0]      ", b"  {     ", b"       }", b"\"type\": ", b"a\\nb    "] {
+            assert!(structural(word(bytes)));
+        }
+    }
+
+    #[test]
+    fn test_scan() {
+        let text = br#"{"editor": "a\"[{", "shapes" : [ {"type": "group", "content": [], "edit-annot": "]}\\"},
+ {"type": "curve", "pen": 0, "data": [[0, 0]]} ], "width": 1}"#;
+        let layout = scan(text).unwrap();
+        assert_eq!(2, layout.elements.len());
+        assert_eq!(b'[', text[layout.shapes.start]);
+        assert_eq!(b']', text[layout.shapes.end - 1]);
+        assert_eq!(br#"{"type": "curve", "pen": 0, "data": [[0, 0]]}"#, &text[layout.elements[1].clone()]);
+
+        assert!(scan(br#"{"shapes": [{}, 1]}"#).is_none());
+        assert!(scan(br#"{"shapes": [{}, ]}"#).is_none());
+        assert!(scan(br#"{"shapes": [], "shapes": []}"#).is_none());
+        assert!(scan(br#"{"shapes": ["a"]}"#).is_none());
+        assert!(scan(br#"{"pens": []}"#).is_none());
+        assert_eq!(Some(0), scan(br#"{"editor": "shapes", "shapes": []}"#).map(|layout| layout.elements.len()));
+    }
+
+    #[test]
+    fn test_parse_image_parallel() {
+        let mut documents: Vec<Vec<u8>> = ["curve", "pattern", "region"].into_iter().map(sample).collect();
+        documents.push(many_shapes(300).into_bytes());
+
+        for bytes in documents {
+            let expected: Image = serde_json::from_slice(&bytes).unwrap();
+
+            for threads in [1, 3] {
+                let image = parse_image_parallel(&bytes, threads).unwrap();
+                assert_eq!(serde_json::to_string(&expected).unwrap(), serde_json::to_string(&image).unwrap());
+            }
+        }
+    }
+
+    #[test]
+    fn test_parallel_errors() {
+        let many = many_shapes(200);
+        let deep = format!(r#"{{"width": 1, "height": 1, "unit-per-inch": 1, "pens": [], "brushes": [], "shapes": [{}{}]}}"#,
+            r#"{"type": "group", "content": ["#.repeat(63), "]}".repeat(63));
+
+        for text in [
+            many.replacen(r#""brush": 0, "data": [[[150"#, r#""brush": 0, "size": 1, "data": [[[150"#, 1),
+            many.replacen(r#""type": "region", "brush": 0, "data": [[[199"#, r#""type": "regoin", "brush": 0, "data": [[[199"#, 1),
+            many.replacen(r#""unit-per-inch": 72"#, r#""unit-per-inch": 72, "dpi": 72"#, 1),
+            many.replacen("]\n}", "],\n  \"shapes\": []\n}", 1),
+            many.replacen("}]\n}", "},]\n}", 1),
+            deep
+        ] {
+            let expected = serde_json::from_str::<Image>(&text).err().unwrap().to_string();
+            let error = parse_image_parallel(text.as_bytes(), 4).err().unwrap().to_string();
+            assert_eq!(expected, error);
+        }
+    }
+}
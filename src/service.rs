@@ -0,0 +1,339 @@
+use std::collections::HashMap;
+use std::fmt;
+use std::fs;
+use std::io::{self, BufRead, Read};
+use std::path::{Path, PathBuf};
+use std::sync::Arc;
+use std::time::SystemTime;
+
+use serde::Deserialize;
+
+use crate::bounds::Rect;
+use crate::load::*;
+use crate::plan::*;
+use crate::png::*;
+
+#[derive(Debug)]
+pub enum ServiceError {
+    Request(serde_json::Error),
+    RequestTooLong,
+    Load(PathBuf, LoadError),
+    Plan(PlanError),
+    Size,
+    TooLarge,
+    Render(cairo::Error),
+    Encode
+}
+
+impl fmt::Display for ServiceError {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        match self {
+            ServiceError::Request(err) => write!(f, "invalid request: {}", err),
+            ServiceError::RequestTooLong => write!(f, "request longer than {} bytes.", MAX_REQUEST),
+            ServiceError::Load(path, err) => write!(f, "failed to load '{}': {}", path.display(), err),
+            ServiceError::Plan(err) => write!(f, "{}", err),
+            ServiceError::Size => write!(f, "bad image dimension."),
+            ServiceError::TooLarge => write!(f, "image larger than {} pixels.", MAX_PIXELS),
+            ServiceError::Render(err) => write!(f, "rendering operation failed: {}", err),
+            ServiceError::Encode => write!(f, "png encoding failed.")
+        }
+    }
+}
+
+impl std::error::Error for ServiceError {}
+
+// The largest output a request may ask for, 256 MiB of pixels, so one line
+// cannot make the server allocate without bound.
+pub const MAX_PIXELS: u64 = 1 << 26;
+
+// The longest request line, so a client that never sends a newline cannot
+// make the server buffer without bound.
+pub const MAX_REQUEST: usize = 1 << 16;
+
+fn default_ppi() -> f64 {
+    96.0
+}
+
+fn default_scale() -> f64 {
+    1.0
+}
+
+// One line of the request protocol, e.g.
+// {"id": 3, "path": "a.lison", "ppi": 96, "scale": 2, "viewport": [0, 0, 256, 256]}
+// The viewport is x, y, width and height in output pixels; without one the
+// whole image is rendered.
+#[derive(Deserialize, Debug, Clone, PartialEq)]
+#[serde(rename_all = "kebab-case", deny_unknown_fields)]
+pub struct Request {
+    #[serde(default)]
+    pub id: u64,
+    pub path: PathBuf,
+    #[serde(default = "default_ppi")]
+    pub ppi: f64,
+    #[serde(default = "default_scale")]
+    pub scale: f64,
+    #[serde(default)]
+    pub viewport: Option<[f64; 4]>
+}
+
+impl Request {
+    pub fn parse(line: &str) -> Result<Request, ServiceError> {
+        serde_json::from_str(line).map_err(ServiceError::Request)
+    }
+}
+
+// Reads the next request line, without its newline, or None at the end of
+// input. No more than MAX_REQUEST bytes of a line are kept; the rest of a
+// longer one is skipped and it reads as ServiceError::RequestTooLong.
+pub fn read_request(input: &mut impl BufRead) -> io::Result<Option<Result<String, ServiceError>>> {
+    let mut line = Vec::new();
+
+    if input.by_ref().take(MAX_REQUEST as u64 + 1).read_until(b'\n', &mut line)? == 0 {
+        return Ok(None);
+    }
+
+    if line.last() == Some(&b'\n') {
+        line.pop();
+    } else if line.len() > MAX_REQUEST {
+        loop {
+            let buffer = input.fill_buf()?;
+
+            if buffer.is_empty() {
+                break;
+            }
+
+            match buffer.iter().position(|&byte| byte == b'\n') {
+                Some(end) => {
+                    input.consume(end + 1);
+                    break;
+                },
+                None => {
+                    let length = buffer.len();
+                    input.consume(length);
+                }
+            }
+        }
+
+        return Ok(Some(Err(ServiceError::RequestTooLong)));
+    }
+
+    String::from_utf8(line)
+        .map(|line| Some(Ok(line)))
+        .map_err(|err| io::Error::new(io::ErrorKind::InvalidData, err))
+}
+
+// A parsed and planned document, ready to be replayed at any size.
+pub struct Prepared {
+    pub width: f64,
+    pub height: f64,
+    pub unit_per_inch: f64,
+    pub plan: RenderPlan
+}
+
+impl Prepared {
+    pub fn load<P: AsRef<Path>>(path: P) -> Result<Prepared, ServiceError> {
+        let image = load_valid_image(path.as_ref()).map_err(|err| ServiceError::Load(path.as_ref().to_path_buf(), err))?;
+        let plan = RenderPlan::new(&image).map_err(ServiceError::Plan)?;
+
+        Ok(Prepared { width: image.width, height: image.height, unit_per_inch: image.unit_per_inch, plan })
+    }
+
+    pub fn render_png(&self, request: &Request) -> Result<Vec<u8>, ServiceError> {
+        let factor = request.ppi / self.unit_per_inch * request.scale;
+
+        let [x, y, width, height] = request.viewport
+            .unwrap_or([0.0, 0.0, (self.width * factor).round(), (self.height * factor).round()]);
+
+        let size = |value: f64| if value > 0.0 && value <= i32::MAX.into() { Some(value.round() as i32) } else { None };
+        let (Some(width), Some(height)) = (size(width), size(height)) else {
+            return Err(ServiceError::Size);
+        };
+
+        if width as u64 * height as u64 > MAX_PIXELS {
+            return Err(ServiceError::TooLarge);
+        }
+
+        let surface = cairo::ImageSurface::create(cairo::Format::ARgb32, width, height)
+            .map_err(|_| ServiceError::Size)?;
+
+        {
+            let context = cairo::Context::new(&surface).map_err(ServiceError::Render)?;
+            context.translate(-x, -y);
+
+            let viewport = Rect::new(x, y, width as f64, height as f64);
+            self.plan.replay_region(&context, &viewport, request.ppi, request.scale)
+                .map_err(ServiceError::Render)?;
+        }
+
+        // Requests already run in parallel, so each is encoded on one thread.
+        let mut png = Vec::new();
+        let mut result = Ok(());
+        surface.with_data(|data| {
+            result = write_png(&mut png, width as usize, height as usize, data, surface.stride() as usize, &PngOptions::default());
+        }).map_err(|_| ServiceError::Encode)?;
+        result.map_err(|_| ServiceError::Encode)?;
+
+        Ok(png)
+    }
+}
+
+struct CachedDocument {
+    modified: SystemTime,
+    length: u64,
+    prepared: Arc<Prepared>,
+    used: u64
+}
+
+// Prepared documents keyed by path, dropped once the file's modification
+// time or length changes, and evicted least recently used first beyond
+// capacity documents.
+pub struct DocumentCache {
+    capacity: usize,
+    clock: u64,
+    hits: usize,
+    entries: HashMap<PathBuf, CachedDocument>
+}
+
+impl DocumentCache {
+    pub fn new(capacity: usize) -> DocumentCache {
+        DocumentCache { capacity, clock: 0, hits: 0, entries: HashMap::new() }
+    }
+
+    pub fn len(&self) -> usize {
+        self.entries.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.entries.is_empty()
+    }
+
+    pub fn hits(&self) -> usize {
+        self.hits
+    }
+
+    pub fn clear(&mut self) {
+        self.entries.clear();
+    }
+
+    pub fn get(&mut self, path: &Path, modified: SystemTime, length: u64) -> Option<Arc<Prepared>> {
+        self.clock += 1;
+
+        match self.entries.get_mut(path) {
+            Some(entry) if entry.modified == modified && entry.length == length => {
+                entry.used = self.clock;
+                self.hits += 1;
+                Some(entry.prepared.clone())
+            },
+            Some(_) => {
+                self.entries.remove(path);
+                None
+            },
+            None => None
+        }
+    }
+
+    pub fn insert(&mut self, path: PathBuf, modified: SystemTime, length: u64, prepared: Arc<Prepared>) {
+        if self.capacity == 0 {
+            return;
+        }
+
+        self.clock += 1;
+
+        while self.entries.len() >= self.capacity && !self.entries.contains_key(&path) {
+            let Some(oldest) = self.entries.iter().min_by_key(|(_, entry)| entry.used).map(|(path, _)| path.clone()) else {
+                break;
+            };
+
+            self.entries.remove(&oldest);
+        }
+
+        self.entries.insert(path, CachedDocument { modified, length, prepared, used: self.clock });
+    }
+}
+
+// The file's stamp, used to tell whether a cached document is still current.
+pub fn file_stamp(path: &Path) -> Result<(SystemTime, u64), ServiceError> {
+    let error = |err| ServiceError::Load(path.to_path_buf(), LoadError::Io(err));
+    let metadata = fs::metadata(path).map_err(error)?;
+    let modified = metadata.modified().map_err(error)?;
+
+    Ok((modified, metadata.len()))
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn sample_path(name: &str) -> PathBuf {
+        PathBuf::from(format!("{}/samples/{}.lison", env!("CARGO_MANIFEST_DIR"), name))
+    }
+
+    #[test]
+    fn test_read_request() {
+        let long = "x".repeat(MAX_REQUEST + 10);
+        let exact = "y".repeat(MAX_REQUEST);
+        let text = format!("{{\"path\": \"a\"}}\n{}\n{}\nlast", long, exact);
+        let mut input = io::BufReader::with_capacity(1000, text.as_bytes());
+
+        assert_eq!("{\"path\": \"a\"}", read_request(&mut input).unwrap().unwrap().unwrap());
+        assert!(matches!(read_request(&mut input).unwrap(), Some(Err(ServiceError::RequestTooLong))));
+        assert_eq!(exact, read_request(&mut input).unwrap().unwrap().unwrap());
+        assert_eq!("last", read_request(&mut input).unwrap().unwrap().unwrap());
+        assert!(read_request(&mut input).unwrap().is_none());
+
+        assert!(read_request(&mut &b"\xff\n"[..]).is_err());
+    }
+
+    #[test]
+    fn test_request_parse() {
+        let request = Request::parse(r#"{"id": 7, "path": "a.lison", "scale": 2, "viewport": [0, 0, 256, 128]}"#).unwrap();
+        assert_eq!(Request {
+            id: 7,
+            path: PathBuf::from("a.lison"),
+            ppi: 96.0,
+            scale: 2.0,
+            viewport: Some([0.0, 0.0, 256.0, 128.0])
+        }, request);
+
+        assert!(matches!(Request::parse(r#"{"ppi": 96}"#), Err(ServiceError::Request(_))));
+        assert!(matches!(Request::parse(r#"{"path": "a", "size": 1}"#), Err(ServiceError::Request(_))));
+        assert!(matches!(Request::parse("render a.lison"), Err(ServiceError::Request(_))));
+    }
+
+    #[test]
+    fn test_document_cache() {
+        let mut cache = DocumentCache::new(2);
+        let time = SystemTime::UNIX_EPOCH;
+        let later = time + std::time::Duration::from_secs(1);
+        let prepared = || Arc::new(Prepared::load(sample_path("region")).unwrap());
+
+        cache.insert(PathBuf::from("a"), time, 1, prepared());
+        cache.insert(PathBuf::from("b"), time, 1, prepared());
+        assert!(cache.get(Path::new("a"), time, 1).is_some());
+
+        // b is the least recently used.
+        cache.insert(PathBuf::from("c"), time, 1, prepared());
+        assert_eq!(2, cache.len());
+        assert!(cache.get(Path::new("b"), time, 1).is_none());
+        assert!(cache.get(Path::new("c"), time, 1).is_some());
+
+        // A changed file is a miss and drops the stale entry.
+        assert!(cache.get(Path::new("a"), later, 1).is_none());
+        assert!(cache.get(Path::new("c"), time, 2).is_none());
+        assert!(cache.is_empty());
+        assert_eq!(2, cache.hits());
+    }
+
+    #[test]
+    fn test_render_png() {
+        let prepared = Prepared::load(sample_path("region")).unwrap();
+        let request = |viewport| Request { id: 0, path: sample_path("region"), ppi: 72.0, scale: 1.0, viewport };
+
+        assert!(prepared.render_png(&request(None)).is_ok());
+        assert!(prepared.render_png(&request(Some([10.0, 10.0, 32.0, 32.0]))).is_ok());
+        assert!(matches!(prepared.render_png(&request(Some([0.0, 0.0, 0.0, 32.0]))), Err(ServiceError::Size)));
+        assert!(matches!(prepared.render_png(&request(Some([0.0, 0.0, 65536.0, 65536.0]))), Err(ServiceError::TooLarge)));
+        assert!(matches!(Prepared::load(sample_path("missing")), Err(ServiceError::Load(..))));
+        assert!(file_stamp(&sample_path("region")).is_ok());
+    }
+}
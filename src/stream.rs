@@ -0,0 +1,380 @@
+use std::fmt;
+use std::io;
+
+use serde::Deserialize;
+use serde::de::{DeserializeSeed, Deserializer, MapAccess, SeqAccess, Visitor};
+
+use crate::image::*;
+use crate::render::{render_shape, Resources, Scaler};
+
+use cairo::Context;
+
+#[derive(Clone, Copy)]
+pub struct Header {
+    pub width: f64,
+    pub height: f64,
+    pub unit_per_inch: f64
+}
+
+#[derive(Debug)]
+pub enum StreamError<E> {
+    Parse(serde_json::Error),
+    Render(cairo::Error),
+    Target(E)
+}
+
+impl<E: fmt::Display> fmt::Display for StreamError<E> {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        match self {
+            StreamError::Parse(err) => write!(f, "{}", err),
+            StreamError::Render(err) => write!(f, "{}", err),
+            StreamError::Target(err) => write!(f, "{}", err)
+        }
+    }
+}
+
+impl<E: fmt::Debug + fmt::Display> std::error::Error for StreamError<E> {}
+
+enum Failure<E> {
+    Render(cairo::Error),
+    Target(E)
+}
+
+#[derive(Deserialize)]
+#[serde(field_identifier, rename_all = "kebab-case")]
+enum Field {
+    Width,
+    Height,
+    UnitPerInch,
+    Editor,
+    Pens,
+    Brushes,
+    Shapes
+}
+
+const FIELDS: &[&str] = &["width", "height", "unit-per-inch", "editor", "pens", "brushes", "shapes"];
+
+pub fn render_from_reader<R, F, E>(reader: R, ppi: f64, scale: f64, create_context: F) -> Result<(), StreamError<E>>
+where
+    R: io::Read,
+    F: FnOnce(&Header) -> Result<Context, E>
+{
+    let mut deserializer = serde_json::Deserializer::from_reader(reader);
+    render_from_deserializer(&mut deserializer, ppi, scale, create_context)
+}
+
+pub fn render_from_slice<F, E>(bytes: &[u8], ppi: f64, scale: f64, create_context: F) -> Result<(), StreamError<E>>
+where
+    F: FnOnce(&Header) -> Result<Context, E>
+{
+    let mut deserializer = serde_json::Deserializer::from_slice(bytes);
+    render_from_deserializer(&mut deserializer, ppi, scale, create_context)
+}
+
+fn render_from_deserializer<'de, R, F, E>(
+    deserializer: &mut serde_json::Deserializer<R>,
+    ppi: f64,
+    scale: f64,
+    create_context: F
+) -> Result<(), StreamError<E>>
+where
+    R: serde_json::de::Read<'de>,
+    F: FnOnce(&Header) -> Result<Context, E>
+{
+    let mut failure = None;
+
+    let streamer = Streamer {
+        ppi,
+        scale,
+        create_context: Some(create_context),
+        failure: &mut failure
+    };
+
+    let result = streamer.deserialize(&mut *deserializer)
+        .and_then(|_| deserializer.end());
+
+    match failure {
+        Some(Failure::Render(err)) => Err(StreamError::Render(err)),
+        Some(Failure::Target(err)) => Err(StreamError::Target(err)),
+        None => result.map_err(StreamError::Parse)
+    }
+}
+
+struct Streamer<'a, F, E> {
+    ppi: f64,
+    scale: f64,
+    create_context: Option<F>,
+    failure: &'a mut Option<Failure<E>>
+}
+
+impl<'a, F, E> Streamer<'a, F, E>
+where
+    F: FnOnce(&Header) -> Result<Context, E>
+{
+    fn start<Err: serde::de::Error>(&mut self, header: &Header) -> Result<Context, Err> {
+        let create_context = self.create_context.take()
+            .ok_or_else(|| Err::custom("rendering started twice"))?;
+
+        let context = create_context(header).map_err(|err| self.fail(Failure::Target(err)))?;
+
+        Scaler::new(header.unit_per_inch, self.ppi, self.scale)
+            .begin(&context)
+            .map_err(|err| self.fail(Failure::Render(err)))?;
+
+        Ok(context)
+    }
+
+    fn finish<Err: serde::de::Error>(&mut self, context: &Context) -> Result<(), Err> {
+        context.restore().map_err(|err| self.fail(Failure::Render(err)))
+    }
+
+    fn fail<Err: serde::de::Error>(&mut self, failure: Failure<E>) -> Err {
+        *self.failure = Some(failure);
+        Err::custom("rendering failed")
+    }
+}
+
+impl<'de, 'a, F, E> DeserializeSeed<'de> for Streamer<'a, F, E>
+where
+    F: FnOnce(&Header) -> Result<Context, E>
+{
+    type Value = ();
+
+    fn deserialize<D>(self, deserializer: D) -> Result<(), D::Error>
+    where
+        D: Deserializer<'de>
+    {
+        deserializer.deserialize_struct("Image", FIELDS, self)
+    }
+}
+
+impl<'de, 'a, F, E> Visitor<'de> for Streamer<'a, F, E>
+where
+    F: FnOnce(&Header) -> Result<Context, E>
+{
+    type Value = ();
+
+    fn expecting(&self, formatter: &mut fmt::Formatter<'_>) -> fmt::Result {
+        formatter.write_str("image")
+    }
+
+    fn visit_map<A>(mut self, mut map: A) -> Result<(), A::Error>
+    where
+        A: MapAccess<'de>
+    {
+        let mut width: Option<f64> = None;
+        let mut height: Option<f64> = None;
+        let mut unit_per_inch: Option<f64> = None;
+        let mut editor: Option<Option<String>> = None;
+        let mut pens: Option<Vec<Pen>> = None;
+        let mut brushes: Option<Vec<Brush>> = None;
+        let mut buffered: Option<Vec<Shape>> = None;
+        let mut streamed = false;
+
+        while let Some(field) = map.next_key::<Field>()? {
+            match field {
+                Field::Width => {
+                    if width.is_some() {
+                        return Err(serde::de::Error::duplicate_field("width"));
+                    }
+                    width = Some(map.next_value()?);
+                },
+                Field::Height => {
+                    if height.is_some() {
+                        return Err(serde::de::Error::duplicate_field("height"));
+                    }
+                    height = Some(map.next_value()?);
+                },
+                Field::UnitPerInch => {
+                    if unit_per_inch.is_some() {
+                        return Err(serde::de::Error::duplicate_field("unit-per-inch"));
+                    }
+                    unit_per_inch = Some(map.next_value()?);
+                },
+                Field::Editor => {
+                    if editor.is_some() {
+                        return Err(serde::de::Error::duplicate_field("editor"));
+                    }
+                    editor = Some(map.next_value()?);
+                },
+                Field::Pens => {
+                    if pens.is_some() {
+                        return Err(serde::de::Error::duplicate_field("pens"));
+                    }
+                    pens = Some(map.next_value()?);
+                },
+                Field::Brushes => {
+                    if brushes.is_some() {
+                        return Err(serde::de::Error::duplicate_field("brushes"));
+                    }
+                    brushes = Some(map.next_value()?);
+                },
+                Field::Shapes => {
+                    if streamed || buffered.is_some() {
+                        return Err(serde::de::Error::duplicate_field("shapes"));
+                    }
+
+                    match (width, height, unit_per_inch, &pens, &brushes) {
+                        (Some(width), Some(height), Some(unit_per_inch), Some(pens), Some(brushes)) => {
+                            let header = Header { width, height, unit_per_inch };
+                            let resources = Resources::prepare(pens, brushes);
+                            let context = self.start(&header)?;
+
+                            map.next_value_seed(ShapeStream {
+                                context: &context,
+                                resources: &resources,
+                                failure: &mut *self.failure
+                            })?;
+
+                            self.finish(&context)?;
+                            streamed = true;
+                        },
+                        _ => {
+                            buffered = Some(map.next_value()?);
+                        }
+                    }
+                }
+            }
+        }
+
+        let width = width.ok_or_else(|| serde::de::Error::missing_field("width"))?;
+        let height = height.ok_or_else(|| serde::de::Error::missing_field("height"))?;
+        let unit_per_inch = unit_per_inch.ok_or_else(|| serde::de::Error::missing_field("unit-per-inch"))?;
+        let pens = pens.ok_or_else(|| serde::de::Error::missing_field("pens"))?;
+        let brushes = brushes.ok_or_else(|| serde::de::Error::missing_field("brushes"))?;
+
+        if streamed {
+            return Ok(());
+        }
+
+        let shapes = buffered.ok_or_else(|| serde::de::Error::missing_field("shapes"))?;
+        let header = Header { width, height, unit_per_inch };
+        let resources = Resources::prepare(&pens, &brushes);
+        let context = self.start(&header)?;
+
+        for shape in shapes.iter() {
+            render_shape(&context, shape, &resources)
+                .map_err(|err| self.fail(Failure::Render(err)))?;
+        }
+
+        self.finish(&context)
+    }
+}
+
+struct ShapeStream<'a, 'b, E> {
+    context: &'a Context,
+    resources: &'a Resources,
+    failure: &'b mut Option<Failure<E>>
+}
+
+impl<'de, 'a, 'b, E> DeserializeSeed<'de> for ShapeStream<'a, 'b, E> {
+    type Value = ();
+
+    fn deserialize<D>(self, deserializer: D) -> Result<(), D::Error>
+    where
+        D: Deserializer<'de>
+    {
+        deserializer.deserialize_seq(self)
+    }
+}
+
+impl<'de, 'a, 'b, E> Visitor<'de> for ShapeStream<'a, 'b, E> {
+    type Value = ();
+
+    fn expecting(&self, formatter: &mut fmt::Formatter<'_>) -> fmt::Result {
+        formatter.write_str("shapes")
+    }
+
+    fn visit_seq<A>(self, mut seq: A) -> Result<(), A::Error>
+    where
+        A: SeqAccess<'de>
+    {
+        while let Some(shape) = seq.next_element::<Shape>()? {
+            if let Err(err) = render_shape(self.context, &shape, self.resources) {
+                *self.failure = Some(Failure::Render(err));
+                return Err(serde::de::Error::custom("rendering failed"));
+            }
+        }
+
+        Ok(())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn render_str(image_str: &str) -> Result<Option<Header>, StreamError<String>> {
+        let mut seen = None;
+
+        render_from_slice(image_str.as_bytes(), 72.0, 1.0, |header| {
+            seen = Some(*header);
+            let surface = cairo::ImageSurface::create(cairo::Format::ARgb32, 10, 10)
+                .map_err(|err| err.to_string())?;
+            cairo::Context::new(&surface).map_err(|err| err.to_string())
+        })?;
+
+        Ok(seen)
+    }
+
+    const PENS: &str = r#"[{
+    "pattern": { "type": "monochrome", "color": [0, 0, 0] },
+    "width": 1,
+    "cap": "butt",
+    "join": "miter"
+  }]"#;
+
+    const SHAPES: &str = r#"[
+    { "type": "curve", "pen": 0, "data": [[0, 0], ["L", [10, 10]]] },
+    { "type": "region", "pen": 0, "data": [[[1, 1], ["L", [2, 1]], ["L", [2, 2]]]] }
+  ]"#;
+
+    #[test]
+    fn test_stream_resources_first() {
+        let image_str = format!(r#"{{
+  "width": 10,
+  "height": 20,
+  "unit-per-inch": 72,
+  "pens": {},
+  "brushes": [],
+  "shapes": {}
+}}"#, PENS, SHAPES);
+        let header = render_str(&image_str).unwrap().unwrap();
+        assert_eq!(10.0, header.width);
+        assert_eq!(20.0, header.height);
+        assert_eq!(72.0, header.unit_per_inch);
+    }
+
+    #[test]
+    fn test_stream_shapes_first() {
+        let image_str = format!(r#"{{
+  "shapes": {},
+  "editor": "T2SY95",
+  "pens": {},
+  "brushes": [],
+  "width": 30,
+  "height": 40,
+  "unit-per-inch": 96
+}}"#, SHAPES, PENS);
+        let header = render_str(&image_str).unwrap().unwrap();
+        assert_eq!(30.0, header.width);
+        assert_eq!(40.0, header.height);
+        assert_eq!(96.0, header.unit_per_inch);
+    }
+
+    #[test]
+    fn test_stream_errors() {
+        let missing_str = r#"{ "width": 10, "height": 10, "unit-per-inch": 72, "pens": [], "brushes": [] }"#;
+        assert!(matches!(render_str(missing_str), Err(StreamError::Parse(_))));
+
+        let unknown_str = r#"{ "width": 10, "height": 10, "unit-per-inch": 72, "pens": [], "brushes": [], "shapes": [], "x": 1 }"#;
+        assert!(matches!(render_str(unknown_str), Err(StreamError::Parse(_))));
+
+        let trailing_str = r#"{ "width": 10, "height": 10, "unit-per-inch": 72, "pens": [], "brushes": [], "shapes": [] } []"#;
+        assert!(matches!(render_str(trailing_str), Err(StreamError::Parse(_))));
+
+        let image_str = r#"{ "width": 10, "height": 10, "unit-per-inch": 72, "pens": [], "brushes": [], "shapes": [] }"#;
+        let result = render_from_slice(image_str.as_bytes(), 72.0, 1.0, |_| Err(String::from("no target")));
+        assert!(matches!(result, Err(StreamError::Target(message)) if message == "no target"));
+    }
+}
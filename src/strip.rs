@@ -0,0 +1,343 @@
+use serde::ser::{Serialize, SerializeSeq, SerializeStruct, Serializer};
+
+use crate::image::*;
+
+fn count_leaves(shapes: &[Shape]) -> usize {
+    shapes.iter()
+        .map(|shape| match shape {
+            Shape::Group(group) => count_leaves(&group.content),
+            _ => 1
+        })
+        .sum()
+}
+
+// Leaves are moved out of the consumed tree, so their curve data is never
+// copied.
+fn flatten_shape(shapes: &mut Vec<Shape>, shape: Shape) {
+    match shape {
+        Shape::Group(group) => {
+            for child in group.content {
+                flatten_shape(shapes, child);
+            }
+        },
+        _ => {
+            shapes.push(shape);
+        }
+    }
+}
+
+pub fn strip_image(image: &mut Image) {
+    image.editor = None;
+
+    let tree = std::mem::take(&mut image.shapes);
+    let mut shapes = Vec::with_capacity(count_leaves(&tree));
+
+    for shape in tree {
+        flatten_shape(&mut shapes, shape);
+    }
+
+    image.shapes = shapes;
+}
+
+// Serializes an image as strip_image would leave it, without modifying or
+// copying it. With a precision, coordinates are rounded to that many
+// decimals: curve points, gradient points and radii. Colors, pen widths,
+// the size and unit-per-inch are written exactly.
+pub struct StrippedImage<'a>(pub &'a Image, pub Option<u32>);
+
+// Above this magnitude an f64 no longer holds every integer exactly.
+const EXACT_LIMIT: f64 = 9007199254740992.0;
+
+// The f64 nearest to value rounded to precision decimals, which the
+// shortest round-trip form then writes with no more of them.
+fn round(value: f64, precision: u32) -> f64 {
+    let scale = 10f64.powi(precision as i32);
+    let mantissa = (value * scale).round();
+
+    if mantissa.abs() < EXACT_LIMIT {
+        mantissa / scale
+    } else if value.is_finite() {
+        format!("{:.*}", precision as usize, value).parse().unwrap_or(value)
+    } else {
+        value
+    }
+}
+
+fn round_point(point: Point, precision: u32) -> Point {
+    Point { x: round(point.x, precision), y: round(point.y, precision) }
+}
+
+fn round_pattern(pattern: Pattern, precision: u32) -> Pattern {
+    match pattern {
+        Pattern::Monochrome(_) => pattern,
+        Pattern::LinearGradient(pat) => Pattern::LinearGradient(LinearGradientPattern {
+            point_1: round_point(pat.point_1, precision),
+            point_2: round_point(pat.point_2, precision),
+            ..pat
+        }),
+        Pattern::RadialGradient(pat) => Pattern::RadialGradient(RadialGradientPattern {
+            center_1: round_point(pat.center_1, precision),
+            radius_1: round(pat.radius_1, precision),
+            center_2: round_point(pat.center_2, precision),
+            radius_2: round(pat.radius_2, precision),
+            ..pat
+        })
+    }
+}
+
+fn round_segment(seg: Segment, precision: u32) -> Segment {
+    match seg {
+        Segment::Line(s) => Segment::Line(LineSegment {
+            point_2: round_point(s.point_2, precision)
+        }),
+        Segment::QuadraticBezier(s) => Segment::QuadraticBezier(QuadraticBezierSegment {
+            point_2: round_point(s.point_2, precision),
+            point_3: round_point(s.point_3, precision)
+        }),
+        Segment::CubicBezier(s) => Segment::CubicBezier(CubicBezierSegment {
+            point_2: round_point(s.point_2, precision),
+            point_3: round_point(s.point_3, precision),
+            point_4: round_point(s.point_4, precision)
+        })
+    }
+}
+
+struct RoundedPens<'a>(&'a [Pen], u32);
+
+impl Serialize for RoundedPens<'_> {
+    fn serialize<S: Serializer>(&self, serializer: S) -> Result<S::Ok, S::Error> {
+        let mut seq = serializer.serialize_seq(Some(self.0.len()))?;
+
+        for pen in self.0.iter() {
+            seq.serialize_element(&Pen { pattern: round_pattern(pen.pattern, self.1), ..*pen })?;
+        }
+
+        seq.end()
+    }
+}
+
+struct RoundedBrushes<'a>(&'a [Brush], u32);
+
+impl Serialize for RoundedBrushes<'_> {
+    fn serialize<S: Serializer>(&self, serializer: S) -> Result<S::Ok, S::Error> {
+        let mut seq = serializer.serialize_seq(Some(self.0.len()))?;
+
+        for brush in self.0.iter() {
+            seq.serialize_element(&Brush { pattern: round_pattern(brush.pattern, self.1) })?;
+        }
+
+        seq.end()
+    }
+}
+
+struct RoundedCurve<'a>(&'a CurveData, u32);
+
+impl Serialize for RoundedCurve<'_> {
+    fn serialize<S: Serializer>(&self, serializer: S) -> Result<S::Ok, S::Error> {
+        let mut seq = serializer.serialize_seq(None)?;
+        seq.serialize_element(&round_point(self.0.start(), self.1))?;
+
+        for seg in self.0.segments() {
+            seq.serialize_element(&round_segment(seg, self.1))?;
+        }
+
+        seq.end()
+    }
+}
+
+struct RoundedRegion<'a>(&'a [CurveData], u32);
+
+impl Serialize for RoundedRegion<'_> {
+    fn serialize<S: Serializer>(&self, serializer: S) -> Result<S::Ok, S::Error> {
+        let mut seq = serializer.serialize_seq(Some(self.0.len()))?;
+
+        for data in self.0.iter() {
+            seq.serialize_element(&RoundedCurve(data, self.1))?;
+        }
+
+        seq.end()
+    }
+}
+
+// A leaf written as the derived Shape would write it.
+struct RoundedShape<'a>(&'a Shape, u32);
+
+impl Serialize for RoundedShape<'_> {
+    fn serialize<S: Serializer>(&self, serializer: S) -> Result<S::Ok, S::Error> {
+        match self.0 {
+            Shape::Group(_) => self.0.serialize(serializer),
+            Shape::Curve(curve) => {
+                let mut st = serializer.serialize_struct("CurveShape", 3)?;
+                st.serialize_field("type", "curve")?;
+                st.serialize_field("pen", &curve.pen)?;
+                st.serialize_field("data", &RoundedCurve(&curve.data, self.1))?;
+                st.end()
+            },
+            Shape::Region(region) => {
+                let mut st = serializer.serialize_struct("RegionShape", 4)?;
+                st.serialize_field("type", "region")?;
+
+                if let Some(pen) = region.pen {
+                    st.serialize_field("pen", &pen)?;
+                }
+
+                if let Some(brush) = region.brush {
+                    st.serialize_field("brush", &brush)?;
+                }
+
+                st.serialize_field("data", &RoundedRegion(&region.data, self.1))?;
+                st.end()
+            }
+        }
+    }
+}
+
+struct FlattenedShapes<'a>(&'a [Shape], Option<u32>);
+
+fn serialize_leaves<S: SerializeSeq>(seq: &mut S, shapes: &[Shape], precision: Option<u32>) -> Result<(), S::Error> {
+    for shape in shapes.iter() {
+        match (shape, precision) {
+            (Shape::Group(group), _) => serialize_leaves(seq, &group.content, precision)?,
+            (_, Some(precision)) => seq.serialize_element(&RoundedShape(shape, precision))?,
+            (_, None) => seq.serialize_element(shape)?
+        }
+    }
+
+    Ok(())
+}
+
+impl Serialize for FlattenedShapes<'_> {
+    fn serialize<S: Serializer>(&self, serializer: S) -> Result<S::Ok, S::Error> {
+        let mut seq = serializer.serialize_seq(Some(count_leaves(self.0)))?;
+        serialize_leaves(&mut seq, self.0, self.1)?;
+        seq.end()
+    }
+}
+
+impl Serialize for StrippedImage<'_> {
+    fn serialize<S: Serializer>(&self, serializer: S) -> Result<S::Ok, S::Error> {
+        let image = self.0;
+        let mut st = serializer.serialize_struct("Image", 6)?;
+        st.serialize_field("width", &image.width)?;
+        st.serialize_field("height", &image.height)?;
+        st.serialize_field("unit-per-inch", &image.unit_per_inch)?;
+
+        match self.1 {
+            Some(precision) => {
+                st.serialize_field("pens", &RoundedPens(&image.pens, precision))?;
+                st.serialize_field("brushes", &RoundedBrushes(&image.brushes, precision))?;
+            },
+            None => {
+                st.serialize_field("pens", &image.pens)?;
+                st.serialize_field("brushes", &image.brushes)?;
+            }
+        }
+
+        st.serialize_field("shapes", &FlattenedShapes(&image.shapes, self.1))?;
+        st.end()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn nested_image() -> Image {
+        serde_json::from_str(r#"{
+  "width": 100,
+  "height": 100,
+  "unit-per-inch": 72,
+  "editor": "test",
+  "pens": [],
+  "brushes": [],
+  "shapes": [{
+    "type": "group",
+    "content": [{
+      "type": "region",
+      "data": []
+    }, {
+      "type": "group",
+      "content": [{ "type": "region", "data": [] }, { "type": "group", "content": [] }],
+      "edit-annot": { "name": "layer" }
+    }]
+  }, {
+    "type": "region",
+    "data": []
+  }]
+}"#).unwrap()
+    }
+
+    #[test]
+    fn test_strip_image() {
+        let mut image = nested_image();
+        strip_image(&mut image);
+        assert_eq!(None, image.editor);
+        assert_eq!(3, image.shapes.len());
+        assert!(image.shapes.iter().all(|shape| matches!(shape, Shape::Region(_))));
+    }
+
+    #[test]
+    fn test_stripped_image() {
+        let image = nested_image();
+        let streamed = serde_json::to_string(&StrippedImage(&image, None)).unwrap();
+
+        let mut stripped = image.clone();
+        strip_image(&mut stripped);
+        assert_eq!(serde_json::to_string(&stripped).unwrap(), streamed);
+
+        // Rounding what has nothing to round keeps the same form.
+        assert_eq!(streamed, serde_json::to_string(&StrippedImage(&image, Some(2))).unwrap());
+    }
+
+    #[test]
+    fn test_stripped_image_precision() {
+        let image: Image = serde_json::from_str(r#"{
+  "width": 10.25,
+  "height": 20,
+  "unit-per-inch": 72.5,
+  "pens": [{ "pattern": { "type": "radial-gradient", "center-1": [0.4, 1.6], "radius-1": 2.5, "color-1": [0.1, 0.2, 0.3], "center-2": [2.5, 3.5], "radius-2": 7.25, "color-2": [0.9, 0.8, 0.7, 0.6] }, "width": 1.5, "cap": "butt", "join": "miter" }],
+  "brushes": [{ "pattern": { "type": "linear-gradient", "point-1": [0.4, 1.6], "color-1": [0.1, 0.2, 0.3], "point-2": [2.5, 3.5], "color-2": [0.9, 0.8, 0.7, 0.6] } }],
+  "shapes": [{ "type": "group", "content": [
+    { "type": "region", "brush": 0, "data": [[[1.4, 2.6], ["L", [3.5, 4.49]], ["C", [5.1, 6.9], [7.2, 8.8], [9.5, 9.4]]]] },
+    { "type": "curve", "pen": 0, "data": [[1e17, -2.5], ["Q", [0.25, 0.75], [1.05, 2.0]]] }
+  ] }]
+}"#).unwrap();
+
+        let written = serde_json::to_string(&StrippedImage(&image, Some(0))).unwrap();
+        let written: serde_json::Value = serde_json::from_str(&written).unwrap();
+
+        assert_eq!(10.25, written["width"]);
+        assert_eq!(72.5, written["unit-per-inch"]);
+        assert_eq!(1.5, written["pens"][0]["width"]);
+
+        let pen = &written["pens"][0]["pattern"];
+        assert_eq!(serde_json::json!([0.0, 2.0]), pen["center-1"]);
+        assert_eq!(serde_json::json!(3.0), pen["radius-1"]);
+        assert_eq!(serde_json::json!(7.0), pen["radius-2"]);
+        assert_eq!(serde_json::json!([0.1, 0.2, 0.3]), pen["color-1"]);
+        assert_eq!(serde_json::json!([0.9, 0.8, 0.7, 0.6]), pen["color-2"]);
+
+        let brush = &written["brushes"][0]["pattern"];
+        assert_eq!(serde_json::json!([0.0, 2.0]), brush["point-1"]);
+        assert_eq!(serde_json::json!([3.0, 4.0]), brush["point-2"]);
+        assert_eq!(serde_json::json!([0.1, 0.2, 0.3]), brush["color-1"]);
+
+        assert_eq!(serde_json::json!([
+            { "type": "region", "brush": 0, "data": [[[1.0, 3.0], ["L", [4.0, 4.0]], ["C", [5.0, 7.0], [7.0, 9.0], [10.0, 9.0]]]] },
+            { "type": "curve", "pen": 0, "data": [[1e17, -3.0], ["Q", [0.0, 1.0], [1.0, 2.0]]] }
+        ]), written["shapes"]);
+
+        // Through the formatter lison-strip writes with, and above the range
+        // where scaling to the decimals is exact.
+        let mut buf = Vec::new();
+        crate::format::to_writer(&mut buf, &StrippedImage(&image, Some(1)), Some(1)).unwrap();
+        let written = String::from_utf8(buf).unwrap();
+        assert!(written.contains(r#""data":[[[1.4,2.6],["L",[3.5,4.5]]"#), "{}", written);
+        assert!(written.contains(r#""color-1":[0.1,0.2,0.3]"#), "{}", written);
+        assert!(written.contains(r#"["Q",[0.3,0.8],[1.1,2]]"#), "{}", written);
+
+        let curve = CurveData::new(Point { x: 1234567890123.4567, y: 0.0 });
+        let rounded = serde_json::to_string(&RoundedCurve(&curve, 4)).unwrap();
+        assert_eq!("[[1234567890123.4568,0.0]]", rounded);
+    }
+}
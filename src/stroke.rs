@@ -0,0 +1,412 @@
+use std::collections::HashMap;
+use std::f64::consts::PI;
+
+use crate::bounds::MITER_LIMIT;
+use crate::image::*;
+
+pub type Vector = (f64, f64);
+
+// Closed contours, contour i being points[ends[i - 1]..ends[i]].
+#[derive(Clone, Default)]
+pub struct Polygon {
+    points: Vec<Vector>,
+    ends: Vec<usize>
+}
+
+impl Polygon {
+    pub fn new() -> Polygon {
+        Polygon::default()
+    }
+
+    pub fn len(&self) -> usize {
+        self.points.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.points.is_empty()
+    }
+
+    fn close(&mut self) {
+        if self.ends.last().copied().unwrap_or(0) < self.points.len() {
+            self.ends.push(self.points.len());
+        }
+    }
+
+    pub fn contours(&self) -> impl Iterator<Item = &[Vector]> {
+        self.ends.iter()
+            .scan(0, |start, &end| {
+                let contour = &self.points[*start..end];
+                *start = end;
+                Some(contour)
+            })
+    }
+
+    // Adds a convex contour wound the same way as every other one added
+    // here, so overlapping pieces add up under the nonzero rule.
+    fn push_convex(&mut self, contour: &[Vector]) {
+        let area: f64 = (0..contour.len())
+            .map(|i| {
+                let (p, q) = (contour[i], contour[(i + 1) % contour.len()]);
+                p.0 * q.1 - q.0 * p.1
+            })
+            .sum();
+
+        if area > 0.0 {
+            self.points.extend(contour.iter());
+        } else if area < 0.0 {
+            self.points.extend(contour.iter().rev());
+        }
+
+        self.close();
+    }
+}
+
+fn normal(p: Vector, q: Vector, half: f64) -> Option<Vector> {
+    let (dx, dy) = (q.0 - p.0, q.1 - p.1);
+    let length = (dx * dx + dy * dy).sqrt();
+
+    (length > 0.0).then(|| (-dy / length * half, dx / length * half))
+}
+
+// Turns polylines in output pixels into the area a pen covers along them,
+// as convex pieces to be filled with the nonzero rule.
+pub struct Stroker {
+    half: f64,
+    cap: LineCap,
+    join: LineJoin,
+    circle: Vec<Vector>
+}
+
+impl Stroker {
+    pub fn new(pen: &Pen, factor: f64, tolerance: f64) -> Stroker {
+        let half = pen.width.abs() * factor / 2.0;
+
+        // Enough sides that the chords stay within tolerance of the circle,
+        // in fours so that it reaches out as far as the circle along the axes.
+        let sides = if half > tolerance {
+            ((PI / (1.0 - tolerance / half).acos() / 4.0).ceil().clamp(1.0, 256.0) as usize) * 4
+        } else {
+            4
+        };
+
+        let circle = (0..sides)
+            .map(|i| {
+                let angle = 2.0 * PI * i as f64 / sides as f64;
+                (angle.cos() * half, angle.sin() * half)
+            })
+            .collect();
+
+        Stroker { half, cap: pen.cap, join: pen.join, circle }
+    }
+
+    pub fn stroke<'a>(&self, subpaths: impl Iterator<Item = &'a [Vector]>, closed: bool, polygon: &mut Polygon) {
+        let mut points = Vec::new();
+
+        for subpath in subpaths {
+            points.clear();
+            points.extend(subpath.iter().copied());
+            points.dedup();
+
+            if closed && points.len() > 1 && points.first() == points.last() {
+                points.pop();
+            }
+
+            self.stroke_subpath(&points, closed && points.len() > 1, subpath.len() > 1, polygon);
+        }
+    }
+
+    fn stroke_subpath(&self, points: &[Vector], closed: bool, drawn: bool, polygon: &mut Polygon) {
+        if self.half == 0.0 || points.is_empty() {
+            return;
+        }
+
+        // Like Cairo, a segment of zero length still gets its caps, a dot or
+        // an axis aligned square.
+        if points.len() == 1 {
+            if drawn {
+                let (x, y) = points[0];
+                let half = self.half;
+
+                match self.cap {
+                    LineCap::Butt => {},
+                    LineCap::Round => self.disk(polygon, points[0]),
+                    LineCap::Square => polygon.push_convex(&[(x - half, y - half), (x + half, y - half), (x + half, y + half), (x - half, y + half)])
+                }
+            }
+
+            return;
+        }
+
+        let count = points.len();
+        let segments = if closed { count } else { count - 1 };
+
+        for i in 0..segments {
+            let (p, q) = (points[i], points[(i + 1) % count]);
+
+            if let Some(n) = normal(p, q, self.half) {
+                polygon.push_convex(&[(p.0 + n.0, p.1 + n.1), (q.0 + n.0, q.1 + n.1), (q.0 - n.0, q.1 - n.1), (p.0 - n.0, p.1 - n.1)]);
+            }
+        }
+
+        let joints = if closed { 0..count } else { 1..count - 1 };
+
+        for i in joints {
+            let previous = points[(i + count - 1) % count];
+            let next = points[(i + 1) % count];
+            self.join(polygon, previous, points[i], next);
+        }
+
+        if !closed {
+            if let Some(n) = normal(points[1], points[0], self.half) {
+                self.cap(polygon, points[0], n);
+            }
+
+            if let Some(n) = normal(points[count - 2], points[count - 1], self.half) {
+                self.cap(polygon, points[count - 1], n);
+            }
+        }
+    }
+
+    fn disk(&self, polygon: &mut Polygon, center: Vector) {
+        let disk: Vec<Vector> = self.circle.iter()
+            .map(|p| (center.0 + p.0, center.1 + p.1))
+            .collect();
+
+        polygon.push_convex(&disk);
+    }
+
+    // n is the normal of the segment ending at point, of half the width.
+    fn cap(&self, polygon: &mut Polygon, point: Vector, n: Vector) {
+        match self.cap {
+            LineCap::Butt => {},
+            LineCap::Round => self.disk(polygon, point),
+            LineCap::Square => {
+                let d = (n.1, -n.0);
+                polygon.push_convex(&[
+                    (point.0 + n.0, point.1 + n.1),
+                    (point.0 + n.0 + d.0, point.1 + n.1 + d.1),
+                    (point.0 - n.0 + d.0, point.1 - n.1 + d.1),
+                    (point.0 - n.0, point.1 - n.1)
+                ]);
+            }
+        }
+    }
+
+    fn join(&self, polygon: &mut Polygon, previous: Vector, point: Vector, next: Vector) {
+        let (Some(n0), Some(n1)) = (normal(previous, point, self.half), normal(point, next, self.half)) else {
+            return;
+        };
+
+        let cross = n0.0 * n1.1 - n0.1 * n1.0;
+        let dot = (n0.0 * n1.0 + n0.1 * n1.1) / (self.half * self.half);
+
+        if cross == 0.0 && dot > 0.0 {
+            return;
+        }
+
+        if self.join == LineJoin::Round {
+            self.disk(polygon, point);
+            return;
+        }
+
+        // The outer side of the turn.
+        let side = if cross > 0.0 { -1.0 } else { 1.0 };
+        let a = (point.0 + side * n0.0, point.1 + side * n0.1);
+        let b = (point.0 + side * n1.0, point.1 + side * n1.1);
+
+        // The miter reaches 1 / cos(turn / 2) half widths out.
+        let cosine = ((1.0 + dot) / 2.0).sqrt();
+
+        if self.join == LineJoin::Miter && cosine * MITER_LIMIT >= 1.0 {
+            let (mx, my) = (n0.0 + n1.0, n0.1 + n1.1);
+            let length = (mx * mx + my * my).sqrt();
+            let reach = self.half / cosine / length;
+            let tip = (point.0 + side * mx * reach, point.1 + side * my * reach);
+            polygon.push_convex(&[point, a, tip, b]);
+        } else {
+            polygon.push_convex(&[point, a, b]);
+        }
+    }
+}
+
+#[derive(Clone, Copy, PartialEq, Eq, Hash)]
+pub(crate) struct StrokeKey {
+    pub(crate) curve: u64,
+    pub(crate) pen: u64,
+    pub(crate) factor: u64,
+    pub(crate) tolerance: u64
+}
+
+// Stroked outlines by curve, pen and scale, so rendering the same document
+// again at the same scale skips the stroking. Each entry keeps what it was
+// stroked from, and a hit is only taken when that matches. The budget
+// counts points; when it is exceeded the cache starts over.
+pub struct StrokeCache {
+    budget: usize,
+    size: usize,
+    hits: usize,
+    entries: HashMap<StrokeKey, StrokeEntry>
+}
+
+struct StrokeEntry {
+    data: Vec<CurveData>,
+    closed: bool,
+    pen: Pen,
+    polygon: Polygon
+}
+
+fn same_data(a: &CurveData, b: &CurveData) -> bool {
+    a.verbs() == b.verbs() && a.points().eq(b.points())
+}
+
+impl StrokeEntry {
+    fn size(&self) -> usize {
+        self.polygon.len() + self.data.iter().map(|data| data.len() + 1).sum::<usize>()
+    }
+
+    fn matches(&self, data: &[CurveData], closed: bool, pen: &Pen) -> bool {
+        self.closed == closed && self.pen == *pen && self.data.len() == data.len()
+            && self.data.iter().zip(data.iter()).all(|(a, b)| same_data(a, b))
+    }
+}
+
+impl StrokeCache {
+    pub fn new(budget: usize) -> StrokeCache {
+        StrokeCache { budget, size: 0, hits: 0, entries: HashMap::new() }
+    }
+
+    pub fn size(&self) -> usize {
+        self.size
+    }
+
+    pub fn hits(&self) -> usize {
+        self.hits
+    }
+
+    pub fn clear(&mut self) {
+        self.size = 0;
+        self.entries.clear();
+    }
+
+    pub(crate) fn get_or_insert(&mut self, key: StrokeKey, data: &[CurveData], closed: bool, pen: &Pen,
+                                build: impl FnOnce(&mut Polygon)) -> &Polygon {
+        if self.entries.get(&key).is_some_and(|entry| entry.matches(data, closed, pen)) {
+            self.hits += 1;
+        } else {
+            let mut polygon = Polygon::new();
+            build(&mut polygon);
+
+            let entry = StrokeEntry { data: data.to_vec(), closed, pen: *pen, polygon };
+
+            if let Some(old) = self.entries.remove(&key) {
+                self.size -= old.size();
+            }
+
+            if self.size + entry.size() > self.budget {
+                self.clear();
+            }
+
+            self.size += entry.size();
+            self.entries.insert(key, entry);
+        }
+
+        &self.entries[&key].polygon
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn pen(cap: LineCap, join: LineJoin) -> Pen {
+        Pen {
+            pattern: Pattern::Monochrome(MonochromePattern { color: Color { red: 0.0, green: 0.0, blue: 0.0, alpha: 1.0 } }),
+            width: 2.0,
+            cap,
+            join
+        }
+    }
+
+    fn bounds(polygon: &Polygon) -> (f64, f64, f64, f64) {
+        polygon.contours()
+            .flatten()
+            .fold((f64::INFINITY, f64::INFINITY, f64::NEG_INFINITY, f64::NEG_INFINITY), |(x0, y0, x1, y1), p| {
+                (x0.min(p.0), y0.min(p.1), x1.max(p.0), y1.max(p.1))
+            })
+    }
+
+    fn stroke(cap: LineCap, join: LineJoin, points: &[Vector], closed: bool) -> Polygon {
+        let mut polygon = Polygon::new();
+        Stroker::new(&pen(cap, join), 1.0, 0.1).stroke(std::iter::once(points), closed, &mut polygon);
+        polygon
+    }
+
+    fn assert_close(expected: (f64, f64, f64, f64), actual: (f64, f64, f64, f64)) {
+        let close = |a: f64, b: f64| (a - b).abs() < 1e-9;
+        assert!(close(expected.0, actual.0) && close(expected.1, actual.1) && close(expected.2, actual.2) && close(expected.3, actual.3),
+            "{:?} != {:?}", expected, actual);
+    }
+
+    #[test]
+    fn test_stroke_caps() {
+        let line = [(0.0, 0.0), (10.0, 0.0)];
+
+        assert_close((0.0, -1.0, 10.0, 1.0), bounds(&stroke(LineCap::Butt, LineJoin::Miter, &line, false)));
+        assert_close((-1.0, -1.0, 11.0, 1.0), bounds(&stroke(LineCap::Square, LineJoin::Miter, &line, false)));
+        assert_close((-1.0, -1.0, 11.0, 1.0), bounds(&stroke(LineCap::Round, LineJoin::Miter, &line, false)));
+
+        assert!(stroke(LineCap::Butt, LineJoin::Miter, &[(0.0, 0.0), (0.0, 0.0)], false).is_empty());
+        assert_close((-1.0, -1.0, 1.0, 1.0), bounds(&stroke(LineCap::Square, LineJoin::Miter, &[(0.0, 0.0), (0.0, 0.0)], false)));
+    }
+
+    #[test]
+    fn test_stroke_joins() {
+        let corner = [(0.0, 0.0), (10.0, 0.0), (10.0, 10.0)];
+
+        assert_close((0.0, -1.0, 11.0, 10.0), bounds(&stroke(LineCap::Butt, LineJoin::Miter, &corner, false)));
+        assert_close((0.0, -1.0, 11.0, 10.0), bounds(&stroke(LineCap::Butt, LineJoin::Bevel, &corner, false)));
+
+        // A sharp turn goes past the miter limit and falls back to a bevel.
+        let spike = [(0.0, 0.0), (10.0, 0.0), (0.0, 0.1)];
+        let (_, _, miter, _) = bounds(&stroke(LineCap::Butt, LineJoin::Miter, &spike, false));
+        assert!(miter < 11.0);
+
+        let square = [(0.0, 0.0), (10.0, 0.0), (10.0, 10.0), (0.0, 10.0)];
+        assert_close((-1.0, -1.0, 11.0, 11.0), bounds(&stroke(LineCap::Butt, LineJoin::Miter, &square, true)));
+        assert_eq!(4 * 4 + 4 * 4, stroke(LineCap::Butt, LineJoin::Miter, &square, true).len());
+    }
+
+    #[test]
+    fn test_stroke_cache() {
+        let pen = pen(LineCap::Butt, LineJoin::Miter);
+        let data = [CurveData::new(Point { x: 0.0, y: 0.0 })];
+        let triangle = |polygon: &mut Polygon| polygon.push_convex(&[(0.0, 0.0), (1.0, 0.0), (0.0, 1.0)]);
+
+        let mut cache = StrokeCache::new(100);
+        let key = StrokeKey { curve: 1, pen: 2, factor: 3, tolerance: 4 };
+
+        assert_eq!(3, cache.get_or_insert(key, &data, false, &pen, triangle).len());
+        assert_eq!(3, cache.get_or_insert(key, &data, false, &pen, |_| unreachable!()).len());
+        assert_eq!(1, cache.hits());
+        assert_eq!(3 + 1, cache.size());
+
+        // A colliding key is stroked again.
+        let moved = [CurveData::new(Point { x: 1.0, y: 0.0 })];
+        assert_eq!(0, cache.get_or_insert(key, &moved, false, &pen, |_| ()).len());
+        assert_eq!(0, cache.get_or_insert(key, &moved, true, &pen, |_| ()).len());
+        let wide = Pen { width: 4.0, ..pen };
+        assert_eq!(0, cache.get_or_insert(key, &moved, true, &wide, |_| ()).len());
+        assert_eq!(1, cache.hits());
+        assert_eq!(1, cache.size());
+
+        let other = StrokeKey { curve: 5, ..key };
+        cache.get_or_insert(other, &data, false, &pen, triangle);
+        assert_eq!(1 + 3 + 1, cache.size());
+
+        let mut small = StrokeCache::new(4);
+        small.get_or_insert(key, &data, false, &pen, triangle);
+        assert_eq!(4, small.size());
+        small.get_or_insert(other, &data, false, &pen, triangle);
+        assert_eq!(4, small.size());
+    }
+}
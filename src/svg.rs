@@ -0,0 +1,216 @@
+use std::io::{self, Write};
+
+use crate::hash::RepeatedGroups;
+use crate::image::*;
+
+fn hex(color: &Color) -> String {
+    let channel = |value: f64| (value.clamp(0.0, 1.0) * 255.0).round() as u8;
+    format!("#{:02x}{:02x}{:02x}", channel(color.red), channel(color.green), channel(color.blue))
+}
+
+fn write_stop<W: Write>(writer: &mut W, offset: u8, color: &Color) -> io::Result<()> {
+    write!(writer, r#"<stop offset="{}" stop-color="{}""#, offset, hex(color))?;
+
+    if color.alpha < 1.0 {
+        write!(writer, r#" stop-opacity="{}""#, color.alpha.max(0.0))?;
+    }
+
+    writeln!(writer, "/>")
+}
+
+// Gradients are fixed in user space, like cairo's.
+fn write_gradient<W: Write>(writer: &mut W, id: &str, pattern: &Pattern) -> io::Result<()> {
+    match pattern {
+        Pattern::Monochrome(_) => return Ok(()),
+        Pattern::LinearGradient(pat) => {
+            writeln!(writer, r#"<linearGradient id="{}" gradientUnits="userSpaceOnUse" x1="{}" y1="{}" x2="{}" y2="{}">"#,
+                id, pat.point_1.x, pat.point_1.y, pat.point_2.x, pat.point_2.y)?;
+            write_stop(writer, 0, &pat.color_1)?;
+            write_stop(writer, 1, &pat.color_2)?;
+            writeln!(writer, "</linearGradient>")
+        },
+        Pattern::RadialGradient(pat) => {
+            writeln!(writer, r#"<radialGradient id="{}" gradientUnits="userSpaceOnUse" fx="{}" fy="{}" fr="{}" cx="{}" cy="{}" r="{}">"#,
+                id, pat.center_1.x, pat.center_1.y, pat.radius_1, pat.center_2.x, pat.center_2.y, pat.radius_2)?;
+            write_stop(writer, 0, &pat.color_1)?;
+            write_stop(writer, 1, &pat.color_2)?;
+            writeln!(writer, "</radialGradient>")
+        }
+    }
+}
+
+// The paint of a pattern for the property, with its opacity if it has one.
+fn paint(property: &str, id: &str, pattern: &Pattern) -> String {
+    match pattern {
+        Pattern::Monochrome(pat) if pat.color.alpha < 1.0 =>
+            format!("{}: {}; {}-opacity: {};", property, hex(&pat.color), property, pat.color.alpha.max(0.0)),
+        Pattern::Monochrome(pat) => format!("{}: {};", property, hex(&pat.color)),
+        _ => format!("{}: url(#{});", property, id)
+    }
+}
+
+fn line_cap(cap: LineCap) -> &'static str {
+    match cap {
+        LineCap::Butt => "butt",
+        LineCap::Round => "round",
+        LineCap::Square => "square"
+    }
+}
+
+fn line_join(join: LineJoin) -> &'static str {
+    match join {
+        LineJoin::Miter => "miter",
+        LineJoin::Round => "round",
+        LineJoin::Bevel => "bevel"
+    }
+}
+
+fn write_path_data<W: Write>(writer: &mut W, data: &CurveData, closed: bool) -> io::Result<()> {
+    let start = data.start();
+    write!(writer, "M{} {}", start.x, start.y)?;
+
+    for seg in data.segments() {
+        match seg {
+            Segment::Line(line) => write!(writer, "L{} {}", line.point_2.x, line.point_2.y)?,
+            Segment::QuadraticBezier(bezier) => write!(writer, "Q{} {} {} {}",
+                bezier.point_2.x, bezier.point_2.y, bezier.point_3.x, bezier.point_3.y)?,
+            Segment::CubicBezier(bezier) => write!(writer, "C{} {} {} {} {} {}",
+                bezier.point_2.x, bezier.point_2.y, bezier.point_3.x, bezier.point_3.y, bezier.point_4.x, bezier.point_4.y)?
+        }
+    }
+
+    if closed {
+        write!(writer, "Z")?;
+    }
+
+    Ok(())
+}
+
+fn write_shapes<W: Write>(writer: &mut W, shapes: &[Shape], repeats: &RepeatedGroups<'_>) -> io::Result<()> {
+    for shape in shapes {
+        match shape {
+            Shape::Group(group) => match repeats.find(shape) {
+                Some((id, offset)) if offset.x == 0.0 && offset.y == 0.0 => writeln!(writer, r##"<use href="#g{}"/>"##, id)?,
+                Some((id, offset)) => writeln!(writer, r##"<use href="#g{}" x="{}" y="{}"/>"##, id, offset.x, offset.y)?,
+                // Groups carry no drawing state, so their content stands in
+                // for them.
+                None => write_shapes(writer, &group.content, repeats)?
+            },
+            Shape::Curve(curve) => {
+                write!(writer, r#"<path class="p{}" d=""#, curve.pen)?;
+                write_path_data(writer, &curve.data, false)?;
+                writeln!(writer, r#""/>"#)?;
+            },
+            Shape::Region(region) => {
+                let class = match (region.brush, region.pen) {
+                    (Some(brush), Some(pen)) => format!("b{} p{}", brush, pen),
+                    (Some(brush), None) => format!("b{}", brush),
+                    (None, Some(pen)) => format!("p{}", pen),
+                    (None, None) => continue
+                };
+
+                write!(writer, r#"<path class="{}" d=""#, class)?;
+
+                for data in &region.data {
+                    write_path_data(writer, data, true)?;
+                }
+
+                writeln!(writer, r#""/>"#)?;
+            }
+        }
+    }
+
+    Ok(())
+}
+
+// Writes image as SVG, width and height in pixels at ppi and scale. Every
+// pen and brush becomes one class, gradients are defined once, and each
+// group repeated as a translated copy is one symbol placed with use.
+pub fn write_svg<W: Write>(writer: &mut W, image: &Image, ppi: f64, scale: f64) -> io::Result<()> {
+    let factor = ppi / image.unit_per_inch * scale;
+    let repeats = RepeatedGroups::new(image);
+
+    writeln!(writer, r#"<svg xmlns="http://www.w3.org/2000/svg" width="{}" height="{}" viewBox="0 0 {} {}">"#,
+        image.width * factor, image.height * factor, image.width, image.height)?;
+    writeln!(writer, "<defs>")?;
+    writeln!(writer, "<style>")?;
+
+    for (index, pen) in image.pens.iter().enumerate() {
+        writeln!(writer, ".p{} {{ {} stroke-width: {}; stroke-linecap: {}; stroke-linejoin: {}; }}",
+            index, paint("stroke", &format!("pen{}", index), &pen.pattern), pen.width, line_cap(pen.cap), line_join(pen.join))?;
+    }
+
+    for (index, brush) in image.brushes.iter().enumerate() {
+        writeln!(writer, ".b{} {{ {} }}", index, paint("fill", &format!("brush{}", index), &brush.pattern))?;
+    }
+
+    writeln!(writer, "</style>")?;
+
+    for (index, pen) in image.pens.iter().enumerate() {
+        write_gradient(writer, &format!("pen{}", index), &pen.pattern)?;
+    }
+
+    for (index, brush) in image.brushes.iter().enumerate() {
+        write_gradient(writer, &format!("brush{}", index), &brush.pattern)?;
+    }
+
+    for (id, (group, _)) in repeats.groups().iter().enumerate() {
+        writeln!(writer, r#"<symbol id="g{}" overflow="visible">"#, id)?;
+        write_shapes(writer, &group.content, &repeats)?;
+        writeln!(writer, "</symbol>")?;
+    }
+
+    writeln!(writer, "</defs>")?;
+
+    // Cairo's defaults where SVG's differ.
+    writeln!(writer, r#"<g fill="none" fill-rule="evenodd" stroke-miterlimit="10">"#)?;
+    write_shapes(writer, &image.shapes, &repeats)?;
+    writeln!(writer, "</g>")?;
+    writeln!(writer, "</svg>")
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn svg(image: &Image) -> String {
+        let mut output = Vec::new();
+        write_svg(&mut output, image, 72.0, 2.0).unwrap();
+        String::from_utf8(output).unwrap()
+    }
+
+    #[test]
+    fn test_write_svg() {
+        let image: Image = serde_json::from_str(r#"{
+  "width": 100,
+  "height": 50,
+  "unit-per-inch": 72,
+  "pens": [{
+    "pattern": { "type": "monochrome", "color": [1, 0, 0, 0.5] },
+    "width": 2,
+    "cap": "round",
+    "join": "bevel"
+  }],
+  "brushes": [{
+    "pattern": { "type": "linear-gradient", "point-1": [0, 0], "color-1": [0, 0, 0], "point-2": [100, 0], "color-2": [1, 1, 1] }
+  }],
+  "shapes": [
+    { "type": "region", "brush": 0, "pen": 0, "data": [[[0, 0], ["L", [10, 0]], ["Q", [10, 10], [0, 10]]]] },
+    { "type": "group", "content": [{ "type": "curve", "pen": 0, "data": [[20, 20], ["C", [21, 20], [22, 21], [22, 22]]] }] },
+    { "type": "group", "content": [{ "type": "curve", "pen": 0, "data": [[30, 25], ["C", [31, 25], [32, 26], [32, 27]]] }] }
+  ]
+}"#).unwrap();
+
+        let text = svg(&image);
+        assert!(text.starts_with(r#"<svg xmlns="http://www.w3.org/2000/svg" width="200" height="100" viewBox="0 0 100 50">"#));
+        assert!(text.contains(".p0 { stroke: #ff0000; stroke-opacity: 0.5; stroke-width: 2; stroke-linecap: round; stroke-linejoin: bevel; }"));
+        assert!(text.contains(".b0 { fill: url(#brush0); }"));
+        assert_eq!(1, text.matches("<linearGradient").count());
+        assert!(text.contains(r#"<path class="b0 p0" d="M0 0L10 0Q10 10 0 10Z"/>"#));
+        assert_eq!(1, text.matches("<symbol").count());
+        assert!(text.contains(r#"<path class="p0" d="M20 20C21 20 22 21 22 22"/>"#));
+        assert!(text.contains(r##"<use href="#g0"/>"##));
+        assert!(text.contains(r##"<use href="#g0" x="10" y="5"/>"##));
+        assert!(text.ends_with("</svg>\n"));
+    }
+}
@@ -0,0 +1,198 @@
+use std::fmt;
+use std::sync::atomic::{AtomicBool, AtomicUsize, Ordering};
+use std::sync::mpsc;
+use std::thread;
+
+use cairo::{Context, Format, ImageSurface};
+
+use crate::bounds::*;
+use crate::image::*;
+use crate::index::*;
+use crate::render::*;
+
+#[derive(Clone, Copy, PartialEq, Debug)]
+pub struct Tile {
+    pub x: i32,
+    pub y: i32,
+    pub width: i32,
+    pub height: i32
+}
+
+impl Tile {
+    pub(crate) fn rect(&self) -> Rect {
+        Rect::new(self.x.into(), self.y.into(), self.width.into(), self.height.into())
+    }
+}
+
+pub fn split_tiles(width: i32, height: i32, tile_size: i32) -> Vec<Tile> {
+    let mut tiles = Vec::new();
+
+    if width <= 0 || height <= 0 || tile_size <= 0 {
+        return tiles;
+    }
+
+    for y in (0..height).step_by(tile_size as usize) {
+        for x in (0..width).step_by(tile_size as usize) {
+            tiles.push(Tile {
+                x,
+                y,
+                width: tile_size.min(width - x),
+                height: tile_size.min(height - y)
+            });
+        }
+    }
+
+    tiles
+}
+
+#[derive(Debug)]
+pub enum TileError {
+    Cairo(cairo::Error),
+    Borrow(cairo::BorrowError)
+}
+
+impl fmt::Display for TileError {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        match self {
+            TileError::Cairo(err) => write!(f, "{}", err),
+            TileError::Borrow(err) => write!(f, "{}", err)
+        }
+    }
+}
+
+impl std::error::Error for TileError {}
+
+pub(crate) fn render_tile(tile: &Tile, image: &Image, index: &SpatialIndex, resources: &Resources, ppi: f64, scale: f64) -> Result<Vec<u8>, TileError> {
+    let mut surface = ImageSurface::create(Format::ARgb32, tile.width, tile.height)
+        .map_err(TileError::Cairo)?;
+
+    {
+        let context = Context::new(&surface).map_err(TileError::Cairo)?;
+
+        // An integral translation keeps every sample at the same subpixel
+        // position as in the untiled surface.
+        context.translate((-tile.x).into(), (-tile.y).into());
+
+        render_region_of_interest_with_index(&context, image, index, resources, &tile.rect(), ppi, scale)
+            .map_err(TileError::Cairo)?;
+    }
+
+    surface.flush();
+
+    let stride = surface.stride() as usize;
+    let row = tile.width as usize * 4;
+    let data = surface.data().map_err(TileError::Borrow)?;
+
+    let mut pixels = Vec::with_capacity(row * tile.height as usize);
+
+    for y in 0..tile.height as usize {
+        pixels.extend_from_slice(&data[y * stride..y * stride + row]);
+    }
+
+    Ok(pixels)
+}
+
+pub fn render_tiled(image: &Image, width: i32, height: i32, ppi: f64, scale: f64, tile_size: i32, threads: usize) -> Result<ImageSurface, TileError> {
+    let mut surface = ImageSurface::create(Format::ARgb32, width, height)
+        .map_err(TileError::Cairo)?;
+
+    let index = SpatialIndex::new(image);
+
+    let tiles = split_tiles(width, height, tile_size);
+    let threads = threads.clamp(1, tiles.len().max(1));
+
+    let stride = surface.stride() as usize;
+    let mut data = surface.data().map_err(TileError::Borrow)?;
+
+    let next = AtomicUsize::new(0);
+    let failed = AtomicBool::new(false);
+
+    thread::scope(|scope| {
+        // Bounding the channel bounds the number of finished tiles waiting
+        // to be copied.
+        let (sender, receiver) = mpsc::sync_channel(threads);
+
+        for _ in 0..threads {
+            let sender = sender.clone();
+            let (tiles, index, next, failed) = (&tiles, &index, &next, &failed);
+
+            scope.spawn(move || {
+                // Cairo objects are not Send, so each thread prepares its own.
+                let resources = Resources::new(image);
+
+                while !failed.load(Ordering::Relaxed) {
+                    let number = next.fetch_add(1, Ordering::Relaxed);
+
+                    if number >= tiles.len() {
+                        break;
+                    }
+
+                    let result = render_tile(&tiles[number], image, index, &resources, ppi, scale);
+
+                    if result.is_err() {
+                        failed.store(true, Ordering::Relaxed);
+                    }
+
+                    if sender.send((number, result)).is_err() {
+                        break;
+                    }
+                }
+            });
+        }
+
+        drop(sender);
+
+        for (number, result) in receiver {
+            let tile = &tiles[number];
+            let pixels = result.inspect_err(|_| failed.store(true, Ordering::Relaxed))?;
+            let row = tile.width as usize * 4;
+
+            for y in 0..tile.height as usize {
+                let offset = (tile.y as usize + y) * stride + tile.x as usize * 4;
+                data[offset..offset + row].copy_from_slice(&pixels[y * row..(y + 1) * row]);
+            }
+        }
+
+        Ok(())
+    })?;
+
+    drop(data);
+    Ok(surface)
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn test_split_tiles() {
+        let tiles = split_tiles(250, 100, 128);
+        assert_eq!(vec![
+            Tile { x: 0, y: 0, width: 128, height: 100 },
+            Tile { x: 128, y: 0, width: 122, height: 100 }
+        ], tiles);
+
+        assert_eq!(9, split_tiles(300, 257, 128).len());
+        assert!(split_tiles(0, 100, 128).is_empty());
+    }
+
+    #[test]
+    fn test_render_tiled() {
+        let path = format!("{}/samples/pattern.lison", env!("CARGO_MANIFEST_DIR"));
+        let image = crate::load::load_image(path).unwrap();
+
+        let mut expected = ImageSurface::create(Format::ARgb32, 100, 100).unwrap();
+        {
+            let context = Context::new(&expected).unwrap();
+            render(&context, &image, 72.0, 1.0).unwrap();
+        }
+        expected.flush();
+
+        for threads in [1, 3] {
+            let mut surface = render_tiled(&image, 100, 100, 72.0, 1.0, 32, threads).unwrap();
+            assert_eq!(100, surface.width());
+            assert_eq!(100, surface.height());
+            assert_eq!(&*expected.data().unwrap(), &*surface.data().unwrap());
+        }
+    }
+}
@@ -0,0 +1,292 @@
+use std::fmt;
+use std::ops::Deref;
+
+use crate::image::*;
+
+#[derive(Debug, Clone, Copy, PartialEq, Eq)]
+pub enum Resource {
+    Pen(usize),
+    Brush(usize)
+}
+
+impl fmt::Display for Resource {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        match self {
+            Resource::Pen(index) => write!(f, "pen {}", index),
+            Resource::Brush(index) => write!(f, "brush {}", index)
+        }
+    }
+}
+
+// A shape is named by its index path from the top level, as in 2.0.5 for
+// the sixth child of the first child of the third shape.
+#[derive(Debug, Clone, PartialEq, Eq)]
+pub struct ShapePath(pub Vec<usize>);
+
+impl fmt::Display for ShapePath {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        for (i, index) in self.0.iter().enumerate() {
+            if i > 0 {
+                write!(f, ".")?;
+            }
+
+            write!(f, "{}", index)?;
+        }
+
+        Ok(())
+    }
+}
+
+#[derive(Debug, Clone, PartialEq)]
+pub enum ValidationError {
+    UnitPerInch(f64),
+    Size { width: f64, height: f64 },
+    PenWidth(usize),
+    NonFinitePattern(Resource),
+    NegativeRadius(Resource),
+    InvalidPen { shape: ShapePath, index: usize, count: usize },
+    InvalidBrush { shape: ShapePath, index: usize, count: usize },
+    NonFinite(ShapePath)
+}
+
+impl fmt::Display for ValidationError {
+    fn fmt(&self, f: &mut fmt::Formatter<'_>) -> fmt::Result {
+        match self {
+            ValidationError::UnitPerInch(value) =>
+                write!(f, "invalid unit-per-inch {}, must be positive.", value),
+            ValidationError::Size { width, height } =>
+                write!(f, "invalid image size {} x {}.", width, height),
+            ValidationError::PenWidth(index) =>
+                write!(f, "pen {} has an invalid width.", index),
+            ValidationError::NonFinitePattern(resource) =>
+                write!(f, "{} has a non-finite pattern.", resource),
+            ValidationError::NegativeRadius(resource) =>
+                write!(f, "{} has a negative gradient radius.", resource),
+            ValidationError::InvalidPen { shape, index, count } =>
+                write!(f, "shape {}: invalid pen index {}, must be less than {}.", shape, index, count),
+            ValidationError::InvalidBrush { shape, index, count } =>
+                write!(f, "shape {}: invalid brush index {}, must be less than {}.", shape, index, count),
+            ValidationError::NonFinite(shape) =>
+                write!(f, "shape {}: non-finite coordinate.", shape)
+        }
+    }
+}
+
+impl std::error::Error for ValidationError {}
+
+fn finite_point(point: Point) -> bool {
+    point.x.is_finite() && point.y.is_finite()
+}
+
+fn finite_color(color: &Color) -> bool {
+    color.red.is_finite() && color.green.is_finite() && color.blue.is_finite() && color.alpha.is_finite()
+}
+
+// Degenerate gradients are valid; every renderer draws them in their last
+// color.
+fn check_pattern(pattern: &Pattern, resource: Resource) -> Result<(), ValidationError> {
+    let (finite, negative) = match pattern {
+        Pattern::Monochrome(pat) => (finite_color(&pat.color), false),
+        Pattern::LinearGradient(pat) => (
+            finite_point(pat.point_1) && finite_point(pat.point_2)
+                && finite_color(&pat.color_1) && finite_color(&pat.color_2),
+            false
+        ),
+        Pattern::RadialGradient(pat) => (
+            finite_point(pat.center_1) && finite_point(pat.center_2)
+                && pat.radius_1.is_finite() && pat.radius_2.is_finite()
+                && finite_color(&pat.color_1) && finite_color(&pat.color_2),
+            pat.radius_1 < 0.0 || pat.radius_2 < 0.0
+        )
+    };
+
+    if !finite {
+        Err(ValidationError::NonFinitePattern(resource))
+    } else if negative {
+        Err(ValidationError::NegativeRadius(resource))
+    } else {
+        Ok(())
+    }
+}
+
+struct Validator<'a> {
+    image: &'a Image,
+    path: Vec<usize>
+}
+
+impl Validator<'_> {
+    fn shape_path(&self) -> ShapePath {
+        ShapePath(self.path.clone())
+    }
+
+    fn check_pen(&self, index: usize) -> Result<(), ValidationError> {
+        if index < self.image.pens.len() {
+            Ok(())
+        } else {
+            Err(ValidationError::InvalidPen { shape: self.shape_path(), index, count: self.image.pens.len() })
+        }
+    }
+
+    fn check_brush(&self, index: usize) -> Result<(), ValidationError> {
+        if index < self.image.brushes.len() {
+            Ok(())
+        } else {
+            Err(ValidationError::InvalidBrush { shape: self.shape_path(), index, count: self.image.brushes.len() })
+        }
+    }
+
+    fn check_data(&self, data: &CurveData) -> Result<(), ValidationError> {
+        if data.points().all(finite_point) {
+            Ok(())
+        } else {
+            Err(ValidationError::NonFinite(self.shape_path()))
+        }
+    }
+
+    fn check_shapes(&mut self, shapes: &[Shape]) -> Result<(), ValidationError> {
+        for (index, shape) in shapes.iter().enumerate() {
+            self.path.push(index);
+
+            match shape {
+                Shape::Group(group) => self.check_shapes(&group.content)?,
+                Shape::Curve(curve) => {
+                    self.check_pen(curve.pen)?;
+                    self.check_data(&curve.data)?;
+                },
+                Shape::Region(region) => {
+                    if let Some(pen) = region.pen {
+                        self.check_pen(pen)?;
+                    }
+
+                    if let Some(brush) = region.brush {
+                        self.check_brush(brush)?;
+                    }
+
+                    for data in &region.data {
+                        self.check_data(data)?;
+                    }
+                }
+            }
+
+            self.path.pop();
+        }
+
+        Ok(())
+    }
+}
+
+impl Image {
+    // Everything the renderer would otherwise trip over halfway through a
+    // surface, checked in one walk over the image. A valid image renders
+    // without errors from its contents.
+    pub fn validate(&self) -> Result<(), ValidationError> {
+        if !(self.unit_per_inch.is_finite() && self.unit_per_inch > 0.0) {
+            return Err(ValidationError::UnitPerInch(self.unit_per_inch));
+        }
+
+        if !(self.width.is_finite() && self.width >= 0.0 && self.height.is_finite() && self.height >= 0.0) {
+            return Err(ValidationError::Size { width: self.width, height: self.height });
+        }
+
+        for (index, pen) in self.pens.iter().enumerate() {
+            if !(pen.width.is_finite() && pen.width >= 0.0) {
+                return Err(ValidationError::PenWidth(index));
+            }
+
+            check_pattern(&pen.pattern, Resource::Pen(index))?;
+        }
+
+        for (index, brush) in self.brushes.iter().enumerate() {
+            check_pattern(&brush.pattern, Resource::Brush(index))?;
+        }
+
+        Validator { image: self, path: Vec::new() }.check_shapes(&self.shapes)
+    }
+}
+
+// An image known to pass validate. It can only be read, so it stays valid,
+// and render_valid draws it without checking its pen and brush indices.
+pub struct ValidImage(Image);
+
+impl ValidImage {
+    pub fn new(image: Image) -> Result<ValidImage, ValidationError> {
+        image.validate()?;
+        Ok(ValidImage(image))
+    }
+
+    pub fn into_inner(self) -> Image {
+        self.0
+    }
+}
+
+impl Deref for ValidImage {
+    type Target = Image;
+
+    fn deref(&self) -> &Image {
+        &self.0
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn parse(json: &str) -> Image {
+        serde_json::from_str(json).unwrap()
+    }
+
+    fn image(unit_per_inch: &str, pens: &str, brushes: &str, shapes: &str) -> Image {
+        parse(&format!(r#"{{
+  "width": 100,
+  "height": 100,
+  "unit-per-inch": {},
+  "pens": [{}],
+  "brushes": [{}],
+  "shapes": [{}]
+}}"#, unit_per_inch, pens, brushes, shapes))
+    }
+
+    const PEN: &str = r#"{ "pattern": { "type": "monochrome", "color": [0, 0, 0] }, "width": 1, "cap": "round", "join": "round" }"#;
+    const BRUSH: &str = r#"{ "pattern": { "type": "monochrome", "color": [1, 0, 0] } }"#;
+
+    #[test]
+    fn test_validate() {
+        for name in ["curve", "pattern", "region"] {
+            let path = format!("{}/samples/{}.lison", env!("CARGO_MANIFEST_DIR"), name);
+            assert_eq!(Ok(()), crate::load::load_image(path).unwrap().validate());
+        }
+
+        let shapes = r#"{ "type": "group", "content": [
+  { "type": "curve", "pen": 0, "data": [[0, 0], ["L", [10, 10]]] },
+  { "type": "region", "pen": 0, "brush": 3, "data": [[[0, 0], ["L", [10, 0]], ["L", [0, 10]]]] }
+] }"#;
+        assert_eq!(Err(ValidationError::InvalidBrush { shape: ShapePath(vec![0, 1]), index: 3, count: 1 }),
+            image("72", PEN, BRUSH, shapes).validate());
+        assert_eq!(Err(ValidationError::InvalidPen { shape: ShapePath(vec![0, 0]), index: 0, count: 0 }),
+            image("72", "", BRUSH, shapes).validate());
+        assert_eq!(Err(ValidationError::UnitPerInch(0.0)), image("0", PEN, BRUSH, "").validate());
+
+        let degenerate = r#"{ "pattern": { "type": "linear-gradient", "point-1": [5, 5], "point-2": [5, 5], "color-1": [0, 0, 0], "color-2": [1, 1, 1] } }"#;
+        assert_eq!(Ok(()), image("72", PEN, &format!("{}, {}", BRUSH, degenerate), "").validate());
+
+        let negative = r#"{ "pattern": { "type": "radial-gradient", "center-1": [5, 5], "radius-1": -1, "center-2": [5, 5], "radius-2": 2, "color-1": [0, 0, 0], "color-2": [1, 1, 1] } }"#;
+        assert_eq!(Err(ValidationError::NegativeRadius(Resource::Brush(1))),
+            image("72", PEN, &format!("{}, {}", BRUSH, negative), "").validate());
+
+        let mut image = image("72", PEN, BRUSH, shapes);
+        if let Shape::Group(group) = &mut image.shapes[0] {
+            group.content[0] = Shape::Curve(CurveShape { pen: 0, data: CurveData::new(Point { x: f64::NAN, y: 0.0 }) });
+        }
+        assert_eq!(Err(ValidationError::NonFinite(ShapePath(vec![0, 0]))), image.validate());
+        assert_eq!("shape 0.0: non-finite coordinate.", image.validate().unwrap_err().to_string());
+        assert!(ValidImage::new(image).is_err());
+    }
+
+    #[test]
+    fn test_valid_image() {
+        let shapes = r#"{ "type": "region", "pen": 0, "brush": 0, "data": [[[0, 0], ["L", [10, 0]], ["L", [0, 10]]]] }"#;
+        let valid = ValidImage::new(image("72", PEN, BRUSH, shapes)).unwrap();
+        assert_eq!(1, valid.shapes.len());
+        assert_eq!(1, valid.into_inner().pens.len());
+    }
+}